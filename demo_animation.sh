@@ -18,7 +18,11 @@ else
 fi
 cd "demo_animation/"
 
-parallel -j $1 ../../generate-image.sh '{}' ::: $(seq 0 359)
+# The scene is parsed once, and the frames are rendered in parallel; a fixed
+# luminosity keeps the same exposure in all the frames
+time ../raytracer render-animation -w 640 -h 360 --alg pathtracing --num-of-rays 3 --max-depth 4 \
+        --init-state 42 --init-seq 54 --samples-per-pixel 16 --threads $1 \
+        --luminosity 0.5 --outf image -i ../../examples/demo.txt --animate angle:0:359:1
 
 # -r 25: Number of frames per second
 ffmpeg -r 25 -f image2 -s 640x360 -i image%03d.png \
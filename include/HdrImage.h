@@ -22,10 +22,13 @@
 
 #include "colors.h"
 #include "gd.h"
+#include "mapped_file.h"
 #include <cmath>
 #include <cstdint>
 #include <cstring>
 #include <fstream>
+#include <functional>
+#include <future>
 #include <iomanip>
 #include <iostream>
 #include <ostream>
@@ -63,6 +66,57 @@ vector<int> parse_img_size(string);
  */
 inline float clamp(float x) { return x / (1 + x); }
 
+/** GammaLUT class
+ * @brief Convert linear values to 8-bit values as `255 * pow(x, 1 / gamma)`,
+ * truncated and clamped to [0, 255], without calling pow. `thresholds[k]` is
+ * the smallest value which is converted to `k` or more; `coarse` gives the
+ * result at the start of small ranges of values (indexed by the highest bits
+ * of the float), which is then refined by comparing it with the thresholds.
+ * The result is exactly the same as with the formula
+ *
+ * @param gamma
+ * @param thresholds
+ * @param coarse
+ */
+struct GammaLUT {
+  /**
+   * @brief Number of low bits of a float ignored by the index of `coarse`
+   *
+   */
+  static constexpr int coarse_shift = 16;
+
+  float gamma;
+  float thresholds[257]; // thresholds[256] is +∞
+  uint8_t coarse[0x3F800000 >> coarse_shift]; // every float in [0, 1)
+
+  /**
+   * @brief Construct a new GammaLUT object, computing the tables
+   *
+   * @param _gamma
+   */
+  GammaLUT(float _gamma);
+
+  /**
+   * @brief Convert a value (NaN and negative values give 0)
+   *
+   * @param x
+   * @return int
+   */
+  inline int operator()(float x) const {
+    if (!(x > 0.f))
+      return 0;
+    if (x >= 1.f)
+      return 255;
+
+    uint32_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int k = coarse[bits >> coarse_shift];
+    while (x >= thresholds[k + 1])
+      k++;
+    return k;
+  }
+};
+
 /**
  * @brief Derived class for error management
  *
@@ -71,6 +125,104 @@ class InvalidPfmFileFormat : public runtime_error {
   using runtime_error::runtime_error;
 };
 
+/**
+ * @brief The header of a PFM file
+ *
+ * @param width
+ * @param height
+ * @param endianness
+ * @param length number of bytes of the header, i.e. offset of the pixels
+ */
+struct PfmHeader {
+  int width = 0;
+  int height = 0;
+  Endianness endianness = Endianness::little_endian;
+  size_t length = 0;
+};
+
+/**
+ * @brief Parse the header of a PFM file held in memory, checking that the
+ * buffer is large enough for all the pixels
+ *
+ * @param data the content of the file
+ * @param size the size of `data` in bytes
+ * @return PfmHeader
+ */
+PfmHeader parse_pfm_header(const char *data, size_t size);
+
+/** MappedPfm class
+ * @brief A PFM file mapped in memory. The pixels are stored bottom-to-top
+ * as in the file; if the file has the same endianness as the machine they can
+ * be read in place (see is_native), otherwise every access swaps the bytes
+ *
+ * @param header the header of the file
+ * @param width
+ * @param height
+ */
+struct MappedPfm {
+  PfmHeader header;
+  int width = 0;
+  int height = 0;
+
+  /**
+   * @brief Map a PFM file in memory and parse its header
+   *
+   * @param file_name
+   */
+  MappedPfm(const string &file_name);
+  MappedPfm(const MappedPfm &) = delete;
+  MappedPfm &operator=(const MappedPfm &) = delete;
+
+  /**
+   * @brief Return the first byte of the pixels
+   *
+   * @return const char*
+   */
+  inline const char *payload() const { return file.data() + header.length; }
+
+  /**
+   * @brief Check if the floats in the file can be used without swapping their
+   * bytes
+   *
+   * @return true
+   * @return false
+   */
+  inline bool is_native() const {
+    return header.endianness == Endianness::little_endian &&
+           __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__;
+  }
+
+  /**
+   * @brief Get the pixel at column `x` and row `y`, counting rows from the
+   * top as HdrImage does
+   *
+   * @param x
+   * @param y
+   * @return Color
+   */
+  inline Color get_pixel(int x, int y) const {
+    Color color;
+    memcpy(&color, payload() + 12 * (size_t(height - 1 - y) * width + x), 12);
+    if (!is_native()) {
+      color.r = _swap(color.r);
+      color.g = _swap(color.g);
+      color.b = _swap(color.b);
+    }
+    return color;
+  }
+
+private:
+  MappedFile file;
+
+  static inline float _swap(float value) {
+    uint32_t word;
+    memcpy(&word, &value, 4);
+    word = __builtin_bswap32(word);
+    memcpy(&value, &word, 4);
+    return value;
+  }
+};
+
 /** HdrImage class
  * @brief This class represents a HDR (High-Dynamic Range) image
  *
@@ -85,6 +237,13 @@ private:
    *
    */
   void read_pfm(istream &);
+  /**
+   * @brief Copy the pixels of a PFM file, whose header is `header`, from
+   * `payload` into `pixels`, flipping the rows and swapping the bytes if
+   * needed
+   *
+   */
+  void read_pfm_payload(const PfmHeader &header, const char *payload);
   /**
    * @brief Allocate an image in memory, initializing width, height and
     pixels.size
@@ -115,10 +274,17 @@ public:
    */
   HdrImage(int, int);
   /**
-   * @brief Construct a new Hdr Image object using an input file
+   * @brief Construct a new Hdr Image object using an input file, which is
+   * mapped in memory and converted in bulk
    *
    */
   HdrImage(const string &);
+  /**
+   * @brief Construct a new Hdr Image object copying the pixels of a mapped
+   * PFM file
+   *
+   */
+  HdrImage(const MappedPfm &);
   /**
    * @brief Construct a new Hdr Image object from a input stream
    *
@@ -137,7 +303,7 @@ public:
    * @param y
    * @return int
    */
-  inline int pixel_offset(int x, int y) { return y * width + x; }
+  inline int pixel_offset(int x, int y) const { return y * width + x; }
   /**
    * @brief Get the pixel object
    *
@@ -145,7 +311,9 @@ public:
    * @param y
    * @return Color
    */
-  inline Color get_pixel(int x, int y) { return pixels[pixel_offset(x, y)]; }
+  inline Color get_pixel(int x, int y) const {
+    return pixels[pixel_offset(x, y)];
+  }
 
   /**
    * @brief Assign color to target pixel
@@ -168,11 +336,24 @@ public:
   void write_float(ostream &, float, Endianness);
 
   /**
-   * @brief Methods to write to file on disk or to file on memory
+   * @brief Methods to write to file on disk or to file on memory. Each
+   * scanline is converted in a buffer and written with a single call
    *
    */
   void write_pfm(ostream &, Endianness);
 
+  /**
+   * @brief Write the image to a pfm file on a separate thread. The image must
+   * not be changed nor destroyed until the returned future is ready; errors
+   * are rethrown by `future::get`, which otherwise returns the seconds spent
+   * writing
+   *
+   * @param file_name
+   * @param e
+   * @return future<double>
+   */
+  future<double> write_pfm_async(const string &file_name, Endianness e);
+
   /**
    * @brief Read a float number as its 4 bytes
    *
@@ -181,11 +362,13 @@ public:
   float read_float(istream &, Endianness);
 
   /**
-   * @brief Calculates the average luminosity of the image
+   * @brief Calculates the average luminosity of the image, summing the
+   * logarithms in double precision on `num_of_threads` threads (0 means one
+   * per core)
    *
    * @return float
    */
-  float average_luminosity(float);
+  float average_luminosity(float, int num_of_threads = 0);
   /**
    * @brief Overload, calls `average_luminosity` with fixed delta = 1e-10
    *
@@ -220,9 +403,105 @@ public:
   void clamp_image();
 
   /**
-   * @brief Convert PFM to a LDR format
+   * @brief Normalize the image by `factor` and clamp it in a single parallel
+   * pass: the result is the same as normalize_image followed by clamp_image
+   *
+   * @param factor
+   * @param luminosity the average luminosity to use, or 0 to calculate it
+   * @param num_of_threads 0 means one per core
+   */
+  void tone_map(float factor, float luminosity = 0, int num_of_threads = 0);
+
+  /**
+   * @brief Return an image with half the width and height (rounded up), each
+   * pixel of which is the average of the four pixels it covers; on odd sizes
+   * the last row and column are repeated. The rows are computed by
+   * `num_of_threads` threads (0 means one per core)
+   *
+   * @return HdrImage
+   */
+  HdrImage half_size(int num_of_threads = 0) const;
+
+  /**
+   * @brief Convert PFM to a LDR format. The rows are converted in parallel
+   * by `num_of_threads` threads (0 means one per core)
+   *
+   */
+  void write_ldr_image(const char *, float, int num_of_threads = 0);
+};
+
+/** TiledImage class
+ * @brief The pixels of an image stored in square tiles of `tile_side` x
+ * `tile_side` pixels, one tile after the other. Pixels which are close along
+ * either axis usually share a tile, so reading them from a large texture
+ * touches fewer cache lines than with rows; finding a pixel only takes a few
+ * shifts and masks. The size is padded to a whole number of tiles
+ *
+ * @param width
+ * @param height
+ * @param tiles_per_row number of tiles along the horizontal axis
+ * @param pixels the tiles, each stored row by row
+ */
+struct TiledImage {
+  static constexpr int log_tile_side = 3;
+  static constexpr int tile_side = 1 << log_tile_side;
+
+  int width = 0;
+  int height = 0;
+  int tiles_per_row = 0;
+  vector<Color> pixels;
+
+  /**
+   * @brief Copy the pixels of an image, using `num_of_threads` threads (0
+   * means one per core)
+   *
+   */
+  TiledImage(const HdrImage &, int num_of_threads = 0);
+  /**
+   * @brief Copy the pixels of a mapped PFM file, using `num_of_threads`
+   * threads (0 means one per core)
+   *
+   */
+  TiledImage(const MappedPfm &, int num_of_threads = 0);
+
+  /**
+   * @brief Position of pixel (x, y) in `pixels`
+   *
+   * @param x
+   * @param y
+   * @return int
+   */
+  inline int pixel_offset(int x, int y) const {
+    const int mask = tile_side - 1;
+    int tile = (y >> log_tile_side) * tiles_per_row + (x >> log_tile_side);
+    return (tile << (2 * log_tile_side)) | ((y & mask) << log_tile_side) |
+           (x & mask);
+  }
+
+  /**
+   * @brief Get the pixel object
+   *
+   * @param x
+   * @param y
+   * @return Color
+   */
+  inline Color get_pixel(int x, int y) const {
+    return pixels[pixel_offset(x, y)];
+  }
+
+  /**
+   * @brief Copy the pixels back in an image stored row by row
+   *
+   * @return HdrImage
+   */
+  HdrImage to_image() const;
+
+private:
+  /**
+   * @brief Allocate the tiles and fill them with func(x, y)
    *
    */
-  void write_ldr_image(const char *, float);
+  void _fill(int _width, int _height, const function<Color(int, int)> &func,
+             int num_of_threads);
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ACCUMULATION_H
+#define ACCUMULATION_H
+
+#include "HdrImage.h"
+#include "colors.h"
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief Version of the format of the partial accumulation files: files
+ * written with a different version cannot be merged
+ *
+ */
+const uint32_t ACCUMULATION_FILE_VERSION = 2;
+
+/**
+ * @brief Derived class for error management
+ *
+ */
+class InvalidAccumulationFile : public runtime_error {
+  using runtime_error::runtime_error;
+};
+
+/**
+ * @brief The pixels covered by tile number `tile` of an image split in
+ * square tiles of side `tile_size`, numbered row by row from the top left
+ * corner: columns from `first_col` to `last_col - 1` and rows from
+ * `first_row` to `last_row - 1`. The tiles on the right and bottom borders
+ * can be smaller
+ *
+ */
+struct TileBounds {
+  int first_col, first_row, last_col, last_row;
+
+  /**
+   * @brief Construct a new Tile Bounds object
+   *
+   * @param tile
+   * @param tile_size
+   * @param width the width of the image
+   * @param height the height of the image
+   */
+  TileBounds(int tile, int tile_size, int width, int height) {
+    int tiles_per_row = (width + tile_size - 1) / tile_size;
+    first_col = (tile % tiles_per_row) * tile_size;
+    first_row = (tile / tiles_per_row) * tile_size;
+    last_col = first_col + tile_size < width ? first_col + tile_size : width;
+    last_row = first_row + tile_size < height ? first_row + tile_size : height;
+  }
+
+  /**
+   * @brief Return the number of tiles of side `tile_size` covering an image
+   *
+   * @param tile_size
+   * @param width
+   * @param height
+   * @return int
+   */
+  static inline int num_of_tiles(int tile_size, int width, int height) {
+    return ((width + tile_size - 1) / tile_size) *
+           ((height + tile_size - 1) / tile_size);
+  }
+};
+
+/** AccumulationBuffer class
+ * @brief Sum of the samples taken so far on each pixel, and their number.
+ * Unlike an :class:`.HdrImage`, the buffer can keep being refined by further
+ * rendering passes, and its mean is the current estimate of the image. The
+ * sums of the luminosities of the samples and of their squares are kept as
+ * well, to estimate how noisy each pixel still is. The luminosity is not
+ * linear, so the former cannot be computed from `sums`
+ *
+ * @param width The number of pixel on the horizontal axis
+ * @param height The number of pixel on the vertical axis
+ * @param sums the sum of the samples of each pixel
+ * @param sums_lum the sum of the luminosities of the samples of each pixel
+ * @param sums_sq the sum of the squared luminosities of the samples of each
+ * pixel
+ * @param counts the number of samples of each pixel
+ *
+ * @see HdrImage
+ */
+struct AccumulationBuffer {
+  int width;
+  int height;
+  vector<Color> sums;
+  vector<double> sums_lum;
+  vector<double> sums_sq;
+  vector<int> counts;
+
+  /**
+   * @brief Construct a new, empty Accumulation Buffer object
+   *
+   * @param _width
+   * @param _height
+   */
+  AccumulationBuffer(int _width = 0, int _height = 0)
+      : width{_width}, height{_height}, sums(_width * _height),
+        sums_lum(_width * _height, 0.), sums_sq(_width * _height, 0.),
+        counts(_width * _height, 0) {}
+
+  /**
+   * @brief Converts (col, row) into the position in `sums` and `counts`
+   *
+   * @param col
+   * @param row
+   * @return int
+   */
+  inline int pixel_offset(int col, int row) const { return row * width + col; }
+
+  /**
+   * @brief Add `num_of_samples` samples, whose sum is `sum` and whose
+   * luminosities sum to `sum_lum` (and their squares to `sum_sq`), to pixel
+   * (col, row). Different pixels can be updated by different threads
+   *
+   * @param col
+   * @param row
+   * @param sum
+   * @param sum_lum
+   * @param sum_sq
+   * @param num_of_samples
+   */
+  inline void add(int col, int row, Color sum, double sum_lum, double sum_sq,
+                  int num_of_samples) {
+    int offset = pixel_offset(col, row);
+    sums[offset] = sums[offset] + sum;
+    sums_lum[offset] += sum_lum;
+    sums_sq[offset] += sum_sq;
+    counts[offset] += num_of_samples;
+  }
+
+  /**
+   * @brief Add a single sample to pixel (col, row)
+   *
+   * @param col
+   * @param row
+   * @param sample
+   */
+  inline void add_sample(int col, int row, Color sample) {
+    double lum = sample.luminosity();
+    add(col, row, sample, lum, lum * lum, 1);
+  }
+
+  /**
+   * @brief Return the average of the samples of pixel (col, row), or black if
+   * it has no sample yet
+   *
+   * @param col
+   * @param row
+   * @return Color
+   */
+  Color get_mean(int col, int row) const;
+
+  /**
+   * @brief Return the number of samples taken on pixel (col, row)
+   *
+   * @param col
+   * @param row
+   * @return int
+   */
+  inline int get_count(int col, int row) const {
+    return counts[pixel_offset(col, row)];
+  }
+
+  /**
+   * @brief Return the average luminosity of the samples of pixel (col, row),
+   * or zero if it has no sample yet
+   *
+   * @param col
+   * @param row
+   * @return double
+   */
+  double get_mean_luminosity(int col, int row) const;
+
+  /**
+   * @brief Return the unbiased variance of the luminosity of the samples of
+   * pixel (col, row), or zero if it has less than two samples
+   *
+   * @param col
+   * @param row
+   * @return float
+   */
+  float get_variance(int col, int row) const;
+
+  /**
+   * @brief Return the standard error of the mean luminosity of pixel
+   * (col, row), relative to the mean itself. Means darker than `min_mean` are
+   * treated as `min_mean`, so that the error of black pixels stays finite.
+   * Pixels with less than two samples have an infinite error
+   *
+   * @param col
+   * @param row
+   * @param min_mean
+   * @return float
+   */
+  float get_relative_error(int col, int row, float min_mean = 1e-3) const;
+
+  /**
+   * @brief Return the smallest number of samples taken on a pixel
+   *
+   * @return int
+   */
+  int min_count() const;
+
+  /**
+   * @brief Return an image whose pixels are the averages of the samples
+   *
+   * @return HdrImage
+   */
+  HdrImage to_image() const;
+
+  /**
+   * @brief Return an image showing the number of samples taken on each
+   * pixel, ranging from blue (the fewest) to red (the most). Its colors are
+   * already in [0, 1], so it can be written as is with
+   * HdrImage::write_ldr_image
+   *
+   * @return HdrImage
+   */
+  HdrImage count_heatmap() const;
+
+  /**
+   * @brief Forget all the samples taken so far
+   *
+   */
+  void clear();
+
+  /**
+   * @brief Write the samples of some tiles of the buffer to a partial
+   * accumulation file, which merge_tile_files combines with the files
+   * holding the other tiles of the image
+   *
+   * @param file_name
+   * @param tiles the tiles to write, see TileBounds
+   * @param tile_size
+   * @param frame a description of how the image was rendered: only files
+   * with the same description can be merged
+   */
+  void write_tiles(const string &file_name, const vector<int> &tiles,
+                   int tile_size, const string &frame) const;
+};
+
+/**
+ * @brief Combine the partial accumulation files written by
+ * AccumulationBuffer::write_tiles into a buffer for the whole image. Every
+ * tile of the image must be stored in exactly one file, so the result does
+ * not depend on the order of the files. Throw InvalidAccumulationFile if the
+ * files cannot be merged, and ios_base::failure if they cannot be read
+ *
+ * @param file_names
+ * @param frame if not null, set to the description of the frame shared by
+ * the files
+ * @return AccumulationBuffer
+ */
+AccumulationBuffer merge_tile_files(const vector<string> &file_names,
+                                    string *frame = nullptr);
+
+#endif
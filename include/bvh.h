@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef BVH_H
+#define BVH_H
+
+#include "geometry.h"
+#include "packet.h"
+#include "ray.h"
+#include <limits>
+#include <vector>
+
+using namespace std;
+
+/** AABB class
+ * @brief An axis-aligned bounding box, defined by its two opposite corners
+ *
+ * @param min corner with the smallest coordinates
+ * @param max corner with the largest coordinates
+ *
+ * @see Point
+ */
+struct AABB {
+  Point min, max;
+
+  /**
+   * @brief Construct a new AABB object. The default box is empty, so that
+   * expanding it with any point returns a box containing only that point
+   *
+   * @param _min
+   * @param _max
+   */
+  AABB(Point _min = Point(numeric_limits<float>::infinity(),
+                          numeric_limits<float>::infinity(),
+                          numeric_limits<float>::infinity()),
+       Point _max = Point(-numeric_limits<float>::infinity(),
+                          -numeric_limits<float>::infinity(),
+                          -numeric_limits<float>::infinity()))
+      : min{_min}, max{_max} {}
+
+  /**
+   * @brief Check if the box contains no point at all
+   *
+   * @return true
+   * @return false
+   */
+  inline bool is_empty() const {
+    return min.x > max.x || min.y > max.y || min.z > max.z;
+  }
+
+  /**
+   * @brief Enlarge the box so that it contains `p`
+   *
+   * @param p
+   */
+  inline void expand(const Point &p) {
+    min = Point{fmin(min.x, p.x), fmin(min.y, p.y), fmin(min.z, p.z)};
+    max = Point{fmax(max.x, p.x), fmax(max.y, p.y), fmax(max.z, p.z)};
+  }
+
+  /**
+   * @brief Enlarge the box so that it contains `box`
+   *
+   * @param box
+   */
+  inline void expand(const AABB &box) {
+    if (box.is_empty())
+      return;
+    expand(box.min);
+    expand(box.max);
+  }
+
+  /**
+   * @brief Return the center of the box
+   *
+   * @return Point
+   */
+  inline Point centroid() const {
+    return Point{0.5f * (min.x + max.x), 0.5f * (min.y + max.y),
+                 0.5f * (min.z + max.z)};
+  }
+
+  /**
+   * @brief Return half of the surface area of the box, which is what the
+   * surface area heuristic needs
+   *
+   * @return float
+   */
+  inline float half_area() const {
+    if (is_empty())
+      return 0.f;
+    float dx = max.x - min.x, dy = max.y - min.y, dz = max.z - min.z;
+    return dx * dy + dy * dz + dz * dx;
+  }
+
+  /**
+   * @brief Slab test: check whether the ray enters the box for some t in
+   * [tmin, tmax]
+   *
+   * @param origin origin of the ray
+   * @param inv_dir component-wise inverse of the direction of the ray
+   * @param tmin
+   * @param tmax
+   * @return true
+   * @return false
+   */
+  inline bool intersect(const Point &origin, const Vec &inv_dir, float tmin,
+                        float tmax) const {
+    float tx1 = (min.x - origin.x) * inv_dir.x;
+    float tx2 = (max.x - origin.x) * inv_dir.x;
+    tmin = _max(tmin, _min(tx1, tx2));
+    tmax = _min(tmax, _max(tx1, tx2));
+
+    float ty1 = (min.y - origin.y) * inv_dir.y;
+    float ty2 = (max.y - origin.y) * inv_dir.y;
+    tmin = _max(tmin, _min(ty1, ty2));
+    tmax = _min(tmax, _max(ty1, ty2));
+
+    float tz1 = (min.z - origin.z) * inv_dir.z;
+    float tz2 = (max.z - origin.z) * inv_dir.z;
+    tmin = _max(tmin, _min(tz1, tz2));
+    tmax = _min(tmax, _max(tz1, tz2));
+
+    return tmin <= tmax;
+  }
+
+private:
+  // Same results as fmin and fmax (a NaN argument is ignored), but these are
+  // inlined, while fmin and fmax are calls to the C library
+  static inline float _min(float a, float b) {
+    return (b < a || a != a) ? b : a;
+  }
+  static inline float _max(float a, float b) {
+    return (b > a || a != a) ? b : a;
+  }
+};
+
+/**
+ * @brief A node of a BVH. If `count` is zero the node is an inner node and
+ * its children are stored at `first` and `first + 1`; otherwise it is a leaf
+ * holding the primitives `indices[first]`, ..., `indices[first + count - 1]`
+ *
+ */
+struct BVHNode {
+  AABB bounds;
+  int first = 0;
+  int count = 0;
+};
+
+/** BVH class
+ * @brief A bounding volume hierarchy built over a list of bounding boxes.
+ * The tree only knows about boxes and their position in the input list, so it
+ * can be used for any kind of primitive
+ *
+ * @param nodes the nodes of the tree, the root is `nodes[0]`
+ * @param indices the indices of the primitives, sorted so that each leaf
+ * refers to a contiguous range
+ */
+struct BVH {
+  vector<BVHNode> nodes;
+  vector<int> indices;
+
+  /**
+   * @brief Default maximum number of primitives allowed in a leaf
+   *
+   */
+  static const int max_leaf_size = 4;
+  /**
+   * @brief Maximum depth of the tree: deeper nodes are turned into leaves, so
+   * that the traversal stack never overflows
+   *
+   */
+  static const int max_depth = 60;
+
+  /**
+   * @brief Build the tree using the surface area heuristic
+   *
+   * @param boxes the bounding box of each primitive
+   * @param leaf_size maximum number of primitives in a leaf
+   */
+  void build(const vector<AABB> &boxes, int leaf_size = max_leaf_size);
+
+  /**
+   * @brief Compute the bounds of the nodes again, after the primitives moved,
+   * keeping the structure of the tree. This is much faster than building it
+   * again, but the tree gets slower to traverse as the primitives move away
+   * from where they were when it was built
+   *
+   * @param boxes the new bounding box of each primitive, indexed as
+   * `indices`
+   */
+  void refit(const vector<AABB> &boxes);
+
+  /**
+   * @brief Remove all the nodes of the tree
+   *
+   */
+  inline void clear() {
+    nodes.clear();
+    indices.clear();
+  }
+
+  /**
+   * @brief Check whether the tree contains no node
+   *
+   * @return true
+   * @return false
+   */
+  inline bool is_empty() const { return nodes.empty(); }
+
+  /**
+   * @brief Visit the leaves hit by a ray, nearest first. `func` is called
+   * with the index of each primitive in the leaf and must return the
+   * distance of the closest hit found so far (or `ray.tmax`), which is used to
+   * skip the nodes that are farther away
+   *
+   * @tparam Func
+   * @param ray
+   * @param func
+   */
+  template <typename Func> void traverse(const Ray &ray, Func &&func) const {
+    traverse_leaves(ray, [&](const BVHNode &leaf) {
+      float closest = ray.tmax;
+      for (int i{}; i < leaf.count; i++)
+        closest = func(indices[leaf.first + i]);
+      return closest;
+    });
+  }
+
+  /**
+   * @brief Like traverse, but `func` is called once for each leaf hit by the
+   * ray, with the leaf itself: this allows to check all its primitives at
+   * once. `func` must return the distance of the closest hit found so far
+   * (or `ray.tmax`)
+   *
+   * @tparam Func
+   * @param ray
+   * @param func
+   */
+  template <typename Func>
+  void traverse_leaves(const Ray &ray, Func &&func) const {
+    if (nodes.empty())
+      return;
+
+    Point origin = ray.origin;
+    Vec inv_dir{1.f / ray.dir.x, 1.f / ray.dir.y, 1.f / ray.dir.z};
+    float closest = ray.tmax;
+
+    int stack[max_depth + 2];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+      const BVHNode &node = nodes[stack[--stack_size]];
+      if (!node.bounds.intersect(origin, inv_dir, ray.tmin, closest))
+        continue;
+
+      if (node.count > 0) {
+        closest = func(node);
+        continue;
+      }
+
+      // Push the farthest child first, so that the nearest is visited first
+      int left = node.first, right = node.first + 1;
+      if (_is_nearer(nodes[right], nodes[left], origin, ray.dir))
+        swap(left, right);
+      stack[stack_size++] = right;
+      stack[stack_size++] = left;
+    }
+  }
+
+  /**
+   * @brief Visit the leaves hit by at least one ray of a packet. `func` is
+   * called with the index of each primitive in the leaf; it must keep
+   * `closest` (the distance of the closest hit found so far by each ray)
+   * up to date, so that the nodes which are farther away for all the rays
+   * can be skipped. Children are ordered using the first ray of the packet
+   *
+   * @tparam Func
+   * @param packet
+   * @param closest
+   * @param func
+   */
+  template <typename Func>
+  void traverse_packet(const RayPacket &packet, const float *closest,
+                       Func &&func) const {
+    if (nodes.empty())
+      return;
+
+    const Ray &first_ray = packet.rays[0];
+    int stack[max_depth + 2];
+    int stack_size = 0;
+    stack[stack_size++] = 0;
+
+    while (stack_size > 0) {
+      const BVHNode &node = nodes[stack[--stack_size]];
+      if (!packet_intersect_box(node.bounds.min, node.bounds.max, packet,
+                                closest))
+        continue;
+
+      if (node.count > 0) {
+        for (int i{}; i < node.count; i++)
+          func(indices[node.first + i]);
+        continue;
+      }
+
+      int left = node.first, right = node.first + 1;
+      if (_is_nearer(nodes[right], nodes[left], first_ray.origin,
+                     first_ray.dir))
+        swap(left, right);
+      stack[stack_size++] = right;
+      stack[stack_size++] = left;
+    }
+  }
+
+private:
+  /**
+   * @brief Recursively split the node `node_index`
+   *
+   */
+  void _subdivide(int node_index, int depth, int leaf_size,
+                  const vector<AABB> &boxes, const vector<Point> &centroids);
+
+  /**
+   * @brief Order two sibling nodes along the direction of the ray
+   *
+   * @return true if `a` is met before `b`
+   */
+  static inline bool _is_nearer(const BVHNode &a, const BVHNode &b,
+                                const Point &origin, Vec dir) {
+    return (a.bounds.centroid() - origin).dot(dir) <
+           (b.bounds.centroid() - origin).dot(dir);
+  }
+};
+
+#endif
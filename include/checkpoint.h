@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "accumulation.h"
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/** Checkpointer class
+ * @brief Periodically save the samples accumulated by a rendering to a
+ * checkpoint file, from which the rendering can be resumed. The file is
+ * written by a background thread; the tiles are copied one at a time, each
+ * while holding its mutex in `tile_mutexes`, which the tracer holds while it
+ * renders the tile (see ImageTracer::tile_mutexes). The render threads are
+ * thus never kept waiting by the file, and every tile is saved as it was
+ * between two renders.
+ *
+ * The random numbers of each pixel only depend on the seed and on the
+ * number of samples already taken (see ImageTracer::pixel_pcg), so the
+ * samples and their count are all that is needed to resume the rendering
+ * where it was interrupted.
+ *
+ * @see AccumulationBuffer::write_tiles
+ */
+struct Checkpointer {
+  /**
+   * @brief The mutex of each tile of the image
+   *
+   */
+  vector<mutex> tile_mutexes;
+
+  /**
+   * @brief Construct a new Checkpointer object, starting the thread which
+   * writes a checkpoint every `interval` seconds
+   *
+   * @param _buffer the samples of the rendering, which must outlive the
+   * object
+   * @param _tile_size the side of the tiles rendered by the tracer
+   * @param _file_name
+   * @param _frame a description of how the image is rendered, which must
+   * match when the rendering is resumed
+   * @param interval seconds between two checkpoints; if it is not positive,
+   * checkpoints are only written by calling write
+   */
+  Checkpointer(const AccumulationBuffer &_buffer, int _tile_size,
+               const string &_file_name, const string &_frame,
+               double interval);
+
+  /**
+   * @brief Stop the background thread, waiting for the checkpoint being
+   * written
+   *
+   */
+  ~Checkpointer();
+
+  Checkpointer(const Checkpointer &) = delete;
+  Checkpointer &operator=(const Checkpointer &) = delete;
+
+  /**
+   * @brief Write a checkpoint now. The previous checkpoint is replaced only
+   * when the new one is complete, so that an interrupted write does not lose
+   * it. Throw ios_base::failure if the file cannot be written
+   *
+   */
+  void write();
+
+  /**
+   * @brief Stop writing checkpoints in the background
+   *
+   */
+  void stop();
+
+private:
+  const AccumulationBuffer &buffer;
+  int tile_size;
+  string file_name, frame;
+  // The copy of the buffer which is written to the file
+  AccumulationBuffer snapshot;
+  mutex write_mutex;
+
+  thread writer;
+  mutex stop_mutex;
+  condition_variable stop_requested;
+  bool stopping = false;
+
+  void _run(double interval);
+};
+
+/**
+ * @brief Read the samples saved by a Checkpointer, throwing
+ * InvalidAccumulationFile if the file does not hold an image of size
+ * `width` x `height` rendered as described by `frame`, and ios_base::failure
+ * if it cannot be read
+ *
+ * @param file_name
+ * @param width
+ * @param height
+ * @param frame
+ * @return AccumulationBuffer
+ */
+AccumulationBuffer read_checkpoint(const string &file_name, int width,
+                                   int height, const string &frame);
+
+#endif
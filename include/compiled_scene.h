@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef COMPILED_SCENE_H
+#define COMPILED_SCENE_H
+
+#include "bvh.h"
+#include "hitrecord.h"
+#include "ray.h"
+#include "shapes.h"
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+/** CompiledScene class
+ * @brief A read-only copy of the geometry of a list of shapes, laid out for
+ * fast intersection. Spheres and planes are stored as structures of arrays,
+ * so that a ray is intersected with eight of them at once (see simd.h) without
+ * touching the :class:`.Shape` objects, nor their materials: only the shape
+ * which is hit first is asked for the full :class:`.HitRecord`, which is the
+ * same that Shape::ray_intersection would return.
+ *
+ * The spheres are sorted by a BVH whose leaves hold up to `leaf_size`
+ * spheres, so that each leaf is a contiguous range of the arrays. Other kinds
+ * of shapes are checked one by one.
+ *
+ * @param bvh the tree over the spheres
+ * @param shapes the shapes the scene was compiled from (not owned)
+ */
+struct CompiledScene {
+  /**
+   * @brief Number of spheres in a leaf of the BVH, i.e. the width of an AVX2
+   * register
+   *
+   */
+  static constexpr int leaf_size = 8;
+
+  BVH bvh;
+  vector<Shape *> shapes;
+
+  // Spheres, in the order of `bvh.indices`, plus `leaf_size` padding entries
+  vector<float> sphere_center_x, sphere_center_y, sphere_center_z;
+  vector<float> sphere_inv_radius;
+  vector<float> sphere_matrix[12]; // world_to_object, row by row
+  vector<int> sphere_is_simple;    // -1 (all bits set) or 0, to mask lanes
+  vector<int> sphere_shape;        // index of the sphere in `shapes`
+
+  // Planes, plus `leaf_size` padding entries; only the third row of
+  // world_to_object is needed
+  vector<float> plane_row[4];
+  vector<int> plane_shape;
+  int num_of_planes = 0;
+
+  // Every other shape
+  vector<int> other_shapes;
+
+  /**
+   * @brief Compile the geometry of `_shapes`. The shapes must not be changed
+   * nor destroyed while the scene is in use
+   *
+   * @param _shapes
+   * @param sphere_bvh if not null, the tree over the spheres built by a
+   * previous call (see `bvh`), which is used instead of building it again
+   */
+  void build(const vector<shared_ptr<Shape>> &_shapes,
+             const BVH *sphere_bvh = nullptr);
+
+  /**
+   * @brief Forget the compiled geometry
+   *
+   */
+  void clear();
+
+  /**
+   * @brief Check if nothing has been compiled
+   *
+   * @return true
+   * @return false
+   */
+  inline bool is_empty() const { return shapes.empty(); }
+
+  /**
+   * @brief Determine the first intersection of a ray with the shapes
+   *
+   * @param ray
+   * @return HitRecord
+   */
+  HitRecord ray_intersection(const Ray &ray) const;
+
+private:
+  /**
+   * @brief Intersect the ray with `count` (at most `leaf_size`) spheres
+   * starting from position `first` of the arrays, updating `closest` and
+   * `closest_shape`
+   *
+   */
+  void _intersect_spheres(const Ray &ray, int first, int count,
+                          float &closest, int &closest_shape) const;
+
+  /**
+   * @brief Intersect the ray with `count` (at most `leaf_size`) planes
+   * starting from position `first` of the arrays, updating `closest` and
+   * `closest_shape`
+   *
+   */
+  void _intersect_planes(const Ray &ray, int first, int count, float &closest,
+                         int &closest_shape) const;
+};
+
+#endif
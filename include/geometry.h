@@ -458,7 +458,7 @@ struct Transformation {
    * @param vec
    * @return Vec
    */
-  inline Vec operator*(Vec vec) {
+  inline Vec operator*(Vec vec) const {
     return Vec{vec.x * m[0][0] + vec.y * m[0][1] + vec.z * m[0][2],
                vec.x * m[1][0] + vec.y * m[1][1] + vec.z * m[1][2],
                vec.x * m[2][0] + vec.y * m[2][1] + vec.z * m[2][2]};
@@ -469,14 +469,14 @@ struct Transformation {
    * @param vec
    * @return Vec
    */
-  Point operator*(Point);
+  Point operator*(Point) const;
   /**
    * @brief Transformation of a Normal object
    *
    * @param n
    * @return Normal
    */
-  inline Normal operator*(Normal n) {
+  inline Normal operator*(Normal n) const {
     return Normal{n.x * invm[0][0] + n.y * invm[1][0] + n.z * invm[2][0],
                   n.x * invm[0][1] + n.y * invm[1][1] + n.z * invm[2][1],
                   n.x * invm[0][2] + n.y * invm[1][2] + n.z * invm[2][2]};
@@ -489,6 +489,65 @@ struct Transformation {
   Transformation operator*(Transformation);
 };
 
+/** AffineMatrix class
+ * @brief The upper 3x4 block of a 4x4 matrix whose last row is (0, 0, 0, 1),
+ * i.e., of an affine transformation (any composition of translations,
+ * rotations and scalings).
+ * Transforming a point needs neither the fourth row nor the `w` divide, so
+ * this is what shapes keep to transform rays in the inner loop.
+ *
+ * @param m A 3x4 matrix
+ */
+struct AffineMatrix {
+  float m[3][4];
+
+  /**
+   * @brief Construct a new Affine Matrix object from the first three rows of a
+   * 4x4 matrix, whose last row is assumed to be (0, 0, 0, 1)
+   *
+   * @param _m
+   */
+  AffineMatrix(const float _m[4][4] = IDENTITY_MATR4x4);
+
+  /**
+   * @brief Transformation of a Point object
+   *
+   * @param p
+   * @return Point
+   */
+  inline Point operator*(const Point &p) const {
+    return Point{m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3],
+                 m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3],
+                 m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3]};
+  }
+
+  /**
+   * @brief Transformation of a Vec object
+   *
+   * @param v
+   * @return Vec
+   */
+  inline Vec operator*(const Vec &v) const {
+    return Vec{m[0][0] * v.x + m[0][1] * v.y + m[0][2] * v.z,
+               m[1][0] * v.x + m[1][1] * v.y + m[1][2] * v.z,
+               m[2][0] * v.x + m[2][1] * v.y + m[2][2] * v.z};
+  }
+
+  /**
+   * @brief Multiply a Normal by the transpose of the 3x3 linear part. If the
+   * matrix is the inverse of a transformation, this is how that
+   * transformation acts on normals
+   *
+   * @param n
+   * @return Normal
+   */
+  inline Normal transpose_mul(const Normal &n) const {
+    return Normal{n.x * m[0][0] + n.y * m[1][0] + n.z * m[2][0],
+                  n.x * m[0][1] + n.y * m[1][1] + n.z * m[2][1],
+                  n.x * m[0][2] + n.y * m[1][2] + n.z * m[2][2]};
+  }
+};
+
 /**
  * @brief Compare two 4x4 matrices
  *
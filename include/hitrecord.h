@@ -27,7 +27,7 @@
  * @brief "Redefining" class Shape in order to avoid circular references
  * This works because we only use a pointer to Shape
  */
-class Shape;
+struct Shape;
 
 /**
  * @brief A class representing an intersection between a ray and a shape
@@ -42,7 +42,11 @@ class Shape;
  the ray where the hit happened
  * @param ray the ray that hit the surface
  * @param hit a bool which says whether the ray hit the surface
- * @param shape pointer to the shape hit by the ray
+ * @param footprint size of the area covered by the ray around the hit point
+ along u and v, or (0, 0) if unknown: it tells textures how much detail can be
+ seen
+ * @param shape pointer to the shape hit by the ray. It does not own the shape,
+ which must outlive the HitRecord (shapes are owned by the :class:`.World`)
  *
  * @see Point
  * @see Normal
@@ -56,9 +60,10 @@ struct HitRecord {
   Normal normal;
   Vec2d surface_point;
   Ray ray;
-  shared_ptr<Shape> shape;
+  Shape *shape;
   float t;
   bool hit;
+  Vec2d footprint = Vec2d(0.f, 0.f);
   /**
    * @brief Construct a new Hit Record object
    *
@@ -70,7 +75,7 @@ struct HitRecord {
    * @param hit
    * @param shape
    */
-  HitRecord(shared_ptr<Shape> _shape, Point _world_point = Point(),
+  HitRecord(Shape *_shape = nullptr, Point _world_point = Point(),
             Normal _normal = Normal(), Vec2d _surface_point = Vec2d(),
             float _t = 0.f, Ray _ray = Ray(), bool _hit = false)
       : shape{_shape}, world_point{_world_point}, normal{_normal},
@@ -21,11 +21,15 @@
 #define IMAGETRACER_H
 
 #include "HdrImage.h"
+#include "accumulation.h"
 #include "camera.h"
 #include "colors.h"
 #include "pcg.h"
 #include "render.h"
+#include "thread_pool.h"
 #include <functional>
+#include <mutex>
+#include <thread>
 
 using namespace std;
 
@@ -42,10 +46,63 @@ using namespace std;
  * @see PerspectiveCamera
  */
 struct ImageTracer {
+  /**
+   * @brief A function computing the colors of `n` rays at once (e.g.,
+   * Renderer::render_packet). It must draw random numbers from the
+   * :class:`.PCG` as if the rays were processed one after the other
+   *
+   */
+  using PacketFunction = function<void(const Ray *, int, Color *, PCG &)>;
+
   HdrImage image;
   shared_ptr<Camera> camera;
   int samples_per_side;
   PCG pcg;
+  /**
+   * @brief Seed of the generators of the pixels, drawn from `pcg` when the
+   * tracer is built
+   *
+   * @see pixel_pcg
+   */
+  uint64_t seed_state = 0, seed_seq = 0;
+  /**
+   * @brief Footprint and spread given to the rays fired through the image:
+   * they describe a beam as wide as a sample, i.e. a pixel divided by
+   * `samples_per_side`
+   *
+   * @see Ray
+   */
+  float ray_footprint = 0.f, ray_spread = 0.f;
+  /**
+   * @brief If not null, the tiles are rendered by the threads of this pool,
+   * which can be shared with other tracers, and the number of threads passed
+   * to the methods firing the rays is ignored
+   *
+   */
+  ThreadPool *pool = nullptr;
+  /**
+   * @brief If not empty, the methods firing the rays only render these tiles
+   * (see TileBounds) and leave the other pixels untouched, so that several
+   * processes can render disjoint parts of the same image
+   *
+   */
+  vector<int> tiles;
+  /**
+   * @brief If not null, each tile is rendered while holding its mutex in
+   * this list (one per tile), so that another thread can read the pixels of
+   * the tiles which are not being rendered
+   *
+   * @see Checkpointer
+   */
+  vector<mutex> *tile_mutexes = nullptr;
+
+  /**
+   * @brief Size (in pixels) of the side of the square tiles used by the
+   * parallel version of fire_all_rays. It must not depend on the number of
+   * threads, otherwise the image would change with it.
+   *
+   */
+  static const int tile_size = 32;
 
   /**
    * @brief Construct a new Image Tracer object
@@ -61,6 +118,30 @@ struct ImageTracer {
               int _samples_per_side = 0, PCG _pcg = PCG())
       : image{_image}, camera{_camera}, pcg{_pcg} {
     samples_per_side = _samples_per_side;
+    seed_state = (static_cast<uint64_t>(pcg.random()) << 32) | pcg.random();
+    seed_seq = (static_cast<uint64_t>(pcg.random()) << 32) | pcg.random();
+    _init_footprint();
+  }
+
+  /**
+   * @brief Return the generator used for round `round` of the samples of
+   pixel (col, row), both for stratified sampling and by the function
+   computing the colors; a round is made of samples_per_pixel() samples.
+   *
+   * It only depends on the seed, on the position of the pixel and on
+   `round`: any pixel can be rendered alone, and the image does not depend on
+   the number of threads nor on the order in which tiles are rendered.
+   *
+   * @param col
+   * @param row
+   * @param round
+   * @return PCG
+   *
+   * @see PCG::stream
+   */
+  inline PCG pixel_pcg(int col, int row, uint64_t round = 0) const {
+    return PCG::stream(seed_state, seed_seq,
+                       static_cast<uint64_t>(row) * image.width + col, round);
   }
 
   /**
@@ -83,7 +164,10 @@ struct ImageTracer {
     float u = (col + u_pixel) / image.width;
     float v = 1.0 - (row + v_pixel) / image.height;
 
-    return camera->fire_ray(u, v);
+    Ray ray = camera->fire_ray(u, v);
+    ray.footprint = ray_footprint;
+    ray.spread = ray_spread;
+    return ray;
   }
 
   /**
@@ -97,5 +181,180 @@ struct ImageTracer {
    assign to that pixel in the image.
    */
   void fire_all_rays(function<Color(const Ray &)>);
+
+  /**
+   * @brief Shoot several light rays crossing each of the pixels in the image,
+   * using `num_of_threads` threads
+   *
+   * The image is split in square tiles of side `tile_size`, which are handed
+   to a pool of threads. Every pixel gets its own random number generator
+   (see pixel_pcg), so that the result does not depend on the number of
+   threads.
+   *
+   * @param func It must accept a :class:`.Ray` and the :class:`.PCG` of the
+   pixel, and return a :class:`.Color`. It is called concurrently, so it must
+   not modify any shared state.
+   * @param num_of_threads Number of threads to use; if it is not positive,
+   all the available cores are used.
+   */
+  void fire_all_rays(function<Color(const Ray &, PCG &)>, int num_of_threads);
+
+  /**
+   * @brief Like the previous one, but the rays of each pixel are passed to
+   * `func` in packets of up to RayPacket::max_size rays, which can be
+   * intersected all at once. The image is the same, provided that `func`
+   * computes the same colors
+   *
+   * @param func
+   * @param num_of_threads
+   */
+  void fire_all_rays(PacketFunction func, int num_of_threads);
+
+  /**
+   * @brief Run one rendering pass, adding `samples_per_side`² new samples to
+   * each pixel of `buffer`, and update `image` with the new averages
+   *
+   * Like fire_all_rays, the work is split in tiles rendered by
+   `num_of_threads` threads. The round of samples of each pixel is given by
+   the samples already in `buffer` (see pixel_pcg), so that consecutive
+   passes take different samples, and the result of a sequence of passes
+   does not depend on the number of threads.
+   *
+   * @param func It must accept a :class:`.Ray` and a :class:`.PCG`, and
+   return a :class:`.Color`. It is called concurrently.
+   * @param buffer It must have the same size as `image`
+   * @param num_of_threads Number of threads to use; if it is not positive,
+   all the available cores are used.
+   */
+  void fire_pass(function<Color(const Ray &, PCG &)> func,
+                 AccumulationBuffer &buffer, int num_of_threads);
+
+  /**
+   * @brief Like the previous one, passing the rays to `func` in packets
+   *
+   * @param func
+   * @param buffer
+   * @param num_of_threads
+   */
+  void fire_pass(PacketFunction func, AccumulationBuffer &buffer,
+                 int num_of_threads);
+
+  /**
+   * @brief Sample each pixel until the relative error of its mean luminosity
+   * drops below `max_error`, adding the samples to `buffer`, and update
+   * `image` with the averages
+   *
+   * Samples are taken in rounds of samples_per_pixel() stratified samples;
+   every pixel receives at least `min_samples` and at most `max_samples`
+   samples (both rounded up to a whole number of rounds). Like fire_pass,
+   the result does not depend on the number of threads.
+   *
+   * @param func It must accept a :class:`.Ray` and a :class:`.PCG`, and
+   return a :class:`.Color`. It is called concurrently.
+   * @param buffer It must have the same size as `image`
+   * @param max_error
+   * @param min_samples
+   * @param max_samples
+   * @param num_of_threads Number of threads to use; if it is not positive,
+   all the available cores are used.
+   *
+   * @see AccumulationBuffer::get_relative_error
+   */
+  void fire_adaptive(function<Color(const Ray &, PCG &)> func,
+                     AccumulationBuffer &buffer, float max_error,
+                     int min_samples, int max_samples, int num_of_threads);
+
+  /**
+   * @brief Like the previous one, passing the rays to `func` in packets
+   *
+   */
+  void fire_adaptive(PacketFunction func, AccumulationBuffer &buffer,
+                     float max_error, int min_samples, int max_samples,
+                     int num_of_threads);
+
+  /**
+   * @brief Number of samples taken on each pixel by fire_all_rays and
+   * fire_pass
+   *
+   * @return int
+   */
+  inline int samples_per_pixel() const {
+    return samples_per_side > 0 ? samples_per_side * samples_per_side : 1;
+  }
+
+  /**
+   * @brief Return the number of tiles covering the image
+   *
+   * @return int
+   */
+  inline int num_of_tiles() const {
+    return TileBounds::num_of_tiles(tile_size, image.width, image.height);
+  }
+
+private:
+  /**
+   * @brief Set `ray_footprint` and `ray_spread` by comparing the rays fired
+   * through two neighbouring samples at the center of the image
+   *
+   */
+  void _init_footprint();
+
+  /**
+   * @brief Compute the color of pixel (col, row) by averaging the samples
+   * inside it
+   *
+   * @param col
+   * @param row
+   * @param func
+   * @param _pcg generator used for stratified sampling, and passed to `func`
+   * @return Color
+   */
+  Color _sample_pixel(int col, int row, const PacketFunction &func, PCG &_pcg);
+
+  /**
+   * @brief Return the sum of the samples_per_pixel() samples taken inside
+   * pixel (col, row). The offsets of the samples in a packet are drawn
+   * before tracing it
+   *
+   * @param col
+   * @param row
+   * @param func
+   * @param _pcg generator used for stratified sampling, and passed to `func`
+   * @param sum_lum if not null, the luminosities of the samples are added to
+   * it
+   * @param sum_sq if not null, the squared luminosities of the samples are
+   * added to it
+   * @return Color
+   */
+  Color _sum_samples(int col, int row, const PacketFunction &func, PCG &_pcg,
+                     double *sum_lum = nullptr, double *sum_sq = nullptr);
+
+  /**
+   * @brief Wrap a function computing the color of one ray at a time. The
+   * result refers to `func`, which must outlive it
+   *
+   * @param func
+   * @return PacketFunction
+   */
+  static PacketFunction
+  _to_packet(const function<Color(const Ray &, PCG &)> &func);
+
+  /**
+   * @brief Split the image in tiles and call `func(col, row)` on each pixel,
+   * using `num_of_threads` threads (or the threads of `pool`)
+   *
+   * @param func
+   * @param num_of_threads
+   */
+  void _for_each_tile(const function<void(int, int)> &func,
+                      int num_of_threads);
+
+  /**
+   * @brief Call `func` on all the pixels of tile number `tile`
+   *
+   * @param tile
+   * @param func
+   */
+  void _fire_tile(int tile, const function<void(int, int)> &func);
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef JSON_H
+#define JSON_H
+
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief Derived class for error management
+ *
+ */
+class JsonError : public runtime_error {
+  using runtime_error::runtime_error;
+};
+
+/**
+ * @brief Enumeration of all the possible types of a JSON value
+ *
+ */
+enum class JsonType { null, boolean, number, string, array, object };
+
+/** JsonValue struct
+ * @brief A JSON value. Only the member matching `type` is meaningful
+ *
+ */
+struct JsonValue {
+  JsonType type = JsonType::null;
+  bool boolean = false;
+  double number = 0.;
+  string str;
+  vector<JsonValue> array;
+  map<string, JsonValue> object;
+
+  /**
+   * @brief Return the member `key` of an object, or null if the value is not
+   * an object or has no such member
+   *
+   * @param key
+   * @return const JsonValue*
+   */
+  const JsonValue *find(const string &key) const;
+};
+
+/**
+ * @brief Parse a JSON document, throwing JsonError if it is not valid
+ *
+ * @param text
+ * @return JsonValue
+ */
+JsonValue parse_json(string_view text);
+
+/**
+ * @brief Return `text` as a JSON string, quoted and with the special
+ * characters escaped
+ *
+ * @param text
+ * @return string
+ */
+string json_quote(string_view text);
+
+#endif
@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef MAPPED_FILE_H
+#define MAPPED_FILE_H
+
+#include <cstddef>
+#include <string>
+
+using namespace std;
+
+/** MappedFile class
+ * @brief A whole file mapped in memory, unmapped when the object is
+ * destroyed. The mapping is private: it is not affected by later writes to
+ * the file, but the process is killed by SIGBUS if the file is truncated
+ * while it is read. An empty file is not mapped, and has no data
+ *
+ */
+struct MappedFile {
+  /**
+   * @brief Map the file `file_name`, throwing ios_base::failure if it cannot
+   * be read
+   *
+   * @param file_name
+   * @param writable whether the mapping can be written (the file never is)
+   * @param sequential whether the file will be read from the beginning to
+   * the end, so that the kernel can read ahead
+   */
+  MappedFile(const string &file_name, bool writable = false,
+             bool sequential = false);
+  MappedFile(const MappedFile &) = delete;
+  MappedFile &operator=(const MappedFile &) = delete;
+  /**
+   * @brief Unmap the file
+   *
+   */
+  ~MappedFile();
+
+  /**
+   * @brief Return the first byte of the file, or nullptr if it is empty
+   *
+   * @return char*
+   */
+  inline char *data() const { return _data; }
+
+  /**
+   * @brief Return the size of the file, in bytes
+   *
+   * @return size_t
+   */
+  inline size_t size() const { return _size; }
+
+private:
+  char *_data = nullptr;
+  size_t _size = 0;
+};
+
+/**
+ * @brief Copy the whole file `file_name` in memory, throwing ios_base::failure
+ * if it cannot be read. Unlike a mapping, the copy is safe from a file which
+ * is truncated meanwhile: it then holds what could be read
+ *
+ * @param file_name
+ * @return string
+ */
+string read_file(const string &file_name);
+
+#endif
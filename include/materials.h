@@ -41,6 +41,18 @@ struct Pigment {
    * @return Color
    */
   virtual Color operator()(Vec2d) = 0;
+
+  /**
+   * @brief Get the color seen by a ray which covers `footprint.u` and
+   * `footprint.v` units around the specified coordinates. Only textures need
+   * to average their details over the footprint, so by default this is the
+   * same as operator()
+   *
+   * @param uv
+   * @param footprint
+   * @return Color
+   */
+  virtual Color filtered(Vec2d uv, Vec2d footprint) { return (*this)(uv); }
 };
 
 /**
@@ -73,13 +85,127 @@ struct CheckeredPigment : public Pigment {
 };
 
 /**
- * @brief A pigment which texture is given by a PFM image file.
+ * @brief The pixels of a PFM image file, held in just one of `image` (copied
+ * row by row), `tiled` (copied in tiles) or `mapped` (read directly from the
+ * file mapped in memory), and optionally its mip pyramid (`mipmaps`): level
+ * `i` has half the width and height of level `i - 1`, down to a single
+ * pixel, level 0 being the file itself. All of them are immutable, so a
+ * texture can be shared by any number of pigments
+ *
+ */
+struct Texture {
+  shared_ptr<const HdrImage> image;
+  shared_ptr<const MappedPfm> mapped;
+  shared_ptr<const vector<HdrImage>> mipmaps; // levels 1, 2, ...
+  shared_ptr<const TiledImage> tiled;
+  // The file the texture was read from (empty if it was built in memory)
+  string file_name;
+
+  inline int width() const {
+    return tiled ? tiled->width : (mapped ? mapped->width : image->width);
+  }
+  inline int height() const {
+    return tiled ? tiled->height : (mapped ? mapped->height : image->height);
+  }
+
+  /**
+   * @brief Return the number of levels of the mip pyramid (1 if it was not
+   * built)
+   *
+   * @return int
+   */
+  inline int num_of_levels() const {
+    return 1 + (mipmaps ? mipmaps->size() : 0);
+  }
+
+  /**
+   * @brief Return the image of a level of the mip pyramid, or nullptr for
+   * level 0 (use get_pixel to read it, as it may be mapped)
+   *
+   * @param level
+   * @return const HdrImage*
+   */
+  inline const HdrImage *level_image(int level) const {
+    return level == 0 ? nullptr : &(*mipmaps)[level - 1];
+  }
+
+  /**
+   * @brief Get a pixel of level 0
+   *
+   * @param x
+   * @param y
+   * @return Color
+   */
+  inline Color get_pixel(int x, int y) const {
+    if (tiled)
+      return tiled->get_pixel(x, y);
+    return mapped ? mapped->get_pixel(x, y) : image->get_pixel(x, y);
+  }
+
+  /**
+   * @brief Store level 0 in tiles, using `num_of_threads` threads (0 means
+   * one per core); the copy (or the mapping) row by row is released
+   *
+   * @param num_of_threads
+   */
+  void make_tiled(int num_of_threads = 0);
+
+  /**
+   * @brief Build the mip pyramid, using `num_of_threads` threads (0 means
+   * one per core) to compute each level
+   *
+   * @param num_of_threads
+   */
+  void build_mipmaps(int num_of_threads = 0);
+
+  /**
+   * @brief Return the number of bytes used by the pixels, including the mip
+   * pyramid
+   *
+   * @return size_t
+   */
+  size_t memory_usage() const;
+};
+
+/**
+ * @brief How an ImagePigment reads its texture: `nearest` returns the pixel
+ * containing the (u, v) point, `bilinear` interpolates the four nearest
+ * pixels of the level of the mip pyramid matching the footprint of the ray,
+ * and `trilinear` also interpolates between the two nearest levels
+ *
+ */
+enum class TextureFilter { nearest, bilinear, trilinear };
+
+/**
+ * @brief A pigment which texture is given by a PFM image file. Unless the
+ * filter is `nearest`, the texture should have its mip pyramid built,
+ * otherwise only level 0 is interpolated
  *
+ * @see Texture
+ * @see TextureFilter
  */
 struct ImagePigment : public Pigment {
-  HdrImage image;
-  ImagePigment(HdrImage _image) : image{_image} {};
+  Texture texture;
+  TextureFilter filter;
+  ImagePigment(HdrImage _image, TextureFilter _filter = TextureFilter::nearest)
+      : texture{make_shared<const HdrImage>(move(_image)), nullptr},
+        filter{_filter} {};
+  ImagePigment(shared_ptr<const MappedPfm> _mapped,
+               TextureFilter _filter = TextureFilter::nearest)
+      : texture{nullptr, _mapped}, filter{_filter} {};
+  ImagePigment(Texture _texture,
+               TextureFilter _filter = TextureFilter::nearest)
+      : texture{_texture}, filter{_filter} {};
   Color operator()(Vec2d uv);
+  Color filtered(Vec2d uv, Vec2d footprint);
+
+private:
+  /**
+   * @brief Interpolate the four pixels of `level` nearest to `uv`. The
+   * texture wraps around along u and is clamped along v, as on a sphere
+   *
+   */
+  Color _bilinear(int level, Vec2d uv);
 };
 
 /**
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef PACKET_H
+#define PACKET_H
+
+#include "geometry.h"
+#include "ray.h"
+
+using namespace std;
+
+/** RayPacket class
+ * @brief A group of up to `max_size` rays, stored as a structure of arrays so
+ * that they can be intersected all at once with SIMD instructions (see
+ * simd.h). The lanes beyond `size` hold a ray which can never hit anything
+ *
+ * @param rays the rays of the packet
+ * @param size the number of rays in the packet
+ *
+ * @see Ray
+ */
+struct RayPacket {
+  static constexpr int max_size = 8;
+
+  const Ray *rays;
+  int size;
+  alignas(32) float origin_x[max_size];
+  alignas(32) float origin_y[max_size];
+  alignas(32) float origin_z[max_size];
+  alignas(32) float dir_x[max_size];
+  alignas(32) float dir_y[max_size];
+  alignas(32) float dir_z[max_size];
+  alignas(32) float inv_dir_x[max_size];
+  alignas(32) float inv_dir_y[max_size];
+  alignas(32) float inv_dir_z[max_size];
+  alignas(32) float tmin[max_size];
+  alignas(32) float tmax[max_size];
+
+  /**
+   * @brief Construct a new Ray Packet object from the first `_size` rays of
+   * `_rays`
+   *
+   * @param _rays
+   * @param _size it must be between 1 and `max_size`
+   */
+  RayPacket(const Ray *_rays, int _size);
+};
+
+/**
+ * @brief Intersect the packet with a sphere described by its center and the
+ * inverse of its radius. The results are bit-identical to
+ * Sphere::ray_intersection
+ *
+ * @param center
+ * @param inv_radius
+ * @param packet
+ * @param t for each ray, the distance of the first hit or +∞ if there is none
+ */
+void packet_intersect_simple_sphere(const Point &center, float inv_radius,
+                                    const RayPacket &packet, float *t);
+
+/**
+ * @brief Intersect the packet with the unit sphere, after moving it with
+ * `world_to_object`. The results are bit-identical to Sphere::ray_intersection
+ *
+ * @param world_to_object
+ * @param packet
+ * @param t for each ray, the distance of the first hit or +∞ if there is none
+ */
+void packet_intersect_sphere(const AffineMatrix &world_to_object,
+                             const RayPacket &packet, float *t);
+
+/**
+ * @brief Intersect the packet with the x-y plane, after moving it with
+ * `world_to_object`. The results are bit-identical to Plane::ray_intersection
+ *
+ * @param world_to_object
+ * @param packet
+ * @param t for each ray, the distance of the hit or +∞ if there is none
+ */
+void packet_intersect_plane(const AffineMatrix &world_to_object,
+                            const RayPacket &packet, float *t);
+
+/**
+ * @brief Check whether at least one ray of the packet enters the box
+ * [min, max] before reaching the distance `closest` (one for each ray)
+ *
+ * @param min
+ * @param max
+ * @param packet
+ * @param closest
+ * @return true
+ * @return false
+ */
+bool packet_intersect_box(const Point &min, const Point &max,
+                          const RayPacket &packet, const float *closest);
+
+#endif
@@ -51,6 +51,38 @@ struct PCG {
    * @return A random `float` number in [0,1]
    */
   float random_float() { return random() / static_cast<float>(0xffffffff); }
+
+  /**
+   * @brief Skip `delta` random numbers, as if `random` were called `delta`
+   * times, in O(log delta) steps
+   *
+   * @param delta
+   */
+  void advance(uint64_t delta);
+
+  /**
+   * @brief Number of random numbers reserved to each sample of a stream:
+   * samples drawing fewer numbers never overlap
+   *
+   */
+  static const uint64_t sample_stride = uint64_t(1) << 32;
+
+  /**
+   * @brief Return the generator of sample `sample` of pixel `pixel` in an
+   * image seeded with (`init_state`, `init_seq`). Each pixel has its own
+   * sequence, selected by a hash of `pixel`, and each of its samples starts
+   * `sample_stride` numbers after the previous one (using `advance`): the
+   * generator only depends on its four arguments, so any sample can be
+   * reproduced alone
+   *
+   * @param init_state The seed of the image
+   * @param init_seq The sequence ID of the image
+   * @param pixel the index of the pixel
+   * @param sample the index of the sample in the pixel
+   * @return PCG
+   */
+  static PCG stream(uint64_t init_state, uint64_t init_seq, uint64_t pixel,
+                    uint64_t sample = 0);
 };
 
 #endif
\ No newline at end of file
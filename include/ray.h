@@ -34,6 +34,9 @@ using namespace std;
  * @param depth number of times this ray was reflected/refracted
  * @param tmin The minimum distance travelled by the ray is this float number
  * @param tmax The maximum distance travelled by the ray is this float number
+ * @param footprint width of the beam of light represented by the ray at its
+ * origin (e.g., the size of a pixel for a camera ray), or 0 if unknown
+ * @param spread how much the width of the beam grows for each unit of `t`
  *
  * @see Point
  * @see Vec
@@ -44,6 +47,8 @@ struct Ray {
   float tmin;
   float tmax;
   int depth;
+  float footprint = 0.f;
+  float spread = 0.f;
 
   /**
    * @brief Construct a new Ray object
@@ -87,14 +92,21 @@ struct Ray {
   /**
    * @brief Transform a ray
    * This method returns a new ray whose origin and direction are the
-   transformation of the original ray
+   transformation of the original ray. The footprint is scaled as the
+   direction, so that it keeps covering the same surface
    *
    * @param transformation
    * @return The ray transformed
    */
-  inline Ray transform(Transformation transformation) {
-    return Ray(transformation * origin, transformation * dir, depth, tmin,
+  inline Ray transform(const Transformation &transformation) {
+    Ray result(transformation * origin, transformation * dir, depth, tmin,
                tmax);
+    if (footprint > 0.f || spread > 0.f) {
+      float scale = sqrt(result.dir.squared_norm() / dir.squared_norm());
+      result.footprint = footprint * scale;
+      result.spread = spread * scale;
+    }
+    return result;
   }
 };
 #endif
\ No newline at end of file
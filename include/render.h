@@ -52,6 +52,45 @@ struct Renderer {
    * @return Color
    */
   virtual Color operator()(Ray) = 0;
+
+  /**
+   * @brief Estimate a radiance along a Ray, drawing random numbers from `pcg`
+   * instead of any generator owned by the renderer. This is what allows
+   * several threads to share the same renderer. Renderers that do not need
+   * random numbers simply ignore `pcg`.
+   *
+   * @param ray
+   * @param pcg
+   * @return Color
+   */
+  virtual Color operator()(Ray ray, PCG &pcg) { return (*this)(ray); }
+
+  /**
+   * @brief Estimate a radiance along a Ray, whose intersection with the world
+   * has already been computed. Renderers should override it, so that
+   * render_packet does not need to intersect the ray again
+   *
+   * @param ray
+   * @param intersection the result of `world.ray_intersection(ray)`
+   * @param pcg
+   * @return Color
+   */
+  virtual Color shade(Ray ray, const HitRecord &intersection, PCG &pcg) {
+    return (*this)(ray, pcg);
+  }
+
+  /**
+   * @brief Estimate the radiance along `n` rays. The rays are first
+   * intersected with the world in packets, then shaded one after the other:
+   * the random numbers are drawn in the same order as by `n` calls to
+   * operator(), so the colors are the same
+   *
+   * @param rays
+   * @param n
+   * @param colors an array of at least `n` elements
+   * @param pcg
+   */
+  void render_packet(const Ray *rays, int n, Color *colors, PCG &pcg);
 };
 
 /**
@@ -81,6 +120,18 @@ struct OnOffRenderer : public Renderer {
   Color operator()(Ray ray) {
     return world.ray_intersection(ray).hit ? color : background_color;
   }
+
+  /**
+   * @brief Return color if the ray hit something, background_color otherwise
+   *
+   * @param ray
+   * @param intersection
+   * @param pcg
+   * @return Color
+   */
+  Color shade(Ray ray, const HitRecord &intersection, PCG &pcg) {
+    return intersection.hit ? color : background_color;
+  }
 };
 
 /**
@@ -106,6 +157,25 @@ struct FlatRenderer : public Renderer {
    * @return Color
    */
   Color operator()(Ray ray);
+
+  /**
+   * @brief Determine the radiance based on the pigment of the surface hit
+   *
+   * @param ray
+   * @param intersection
+   * @param pcg
+   * @return Color
+   */
+  Color shade(Ray ray, const HitRecord &intersection, PCG &pcg);
+
+private:
+  /**
+   * @brief Return the color of the surface hit, or background_color
+   *
+   * @param intersection
+   * @return Color
+   */
+  Color _surface_color(const HitRecord &intersection);
 };
 
 /**
@@ -145,6 +215,88 @@ struct PathTracer : public Renderer {
    * @param ray
    * @return Color
    */
-  Color operator()(Ray ray);
+  Color operator()(Ray ray) { return (*this)(ray, pcg); }
+
+  /**
+   * @brief Calculate the final radiance using the Russian Roulette, drawing
+   * random numbers from `_pcg`
+   *
+   * @param ray
+   * @param _pcg
+   * @return Color
+   */
+  Color operator()(Ray ray, PCG &_pcg);
+
+  /**
+   * @brief Estimate the radiance along a ray whose first intersection is
+   * already known, drawing random numbers from `_pcg`
+   *
+   * @param ray
+   * @param intersection
+   * @param _pcg
+   * @return Color
+   */
+  Color shade(Ray ray, const HitRecord &intersection, PCG &_pcg);
+};
+
+/**
+ * @brief An iterative path-tracing renderer
+ *
+ * Unlike PathTracer, at each surface this renderer scatters one ray only and
+ * follows a single path, weighting the radiance it collects by the product of
+ * the colors met so far (the «throughput»). The cost of a sample is therefore
+ * linear in the depth of the path, and no recursion is needed: to reduce the
+ * noise, increase the number of samples per pixel. Russian roulette is used
+ * like in PathTracer.
+ */
+struct IterativePathTracer : public Renderer {
+  PCG pcg;
+  int max_depth, russian_roulette_limit;
+
+  /**
+   * @brief Construct a new Iterative Path Tracer object
+   *
+   * @param world
+   * @param background_color
+   * @param pcg
+   * @param max_depth
+   * @param russian_roulette_limit
+   */
+  IterativePathTracer(World world, Color background_color = BLACK,
+                      PCG _pcg = PCG(), int _max_depth = 2,
+                      int _russian_roulette_limit = 3)
+      : Renderer(world, background_color), pcg{_pcg} {
+    max_depth = _max_depth;
+    russian_roulette_limit = _russian_roulette_limit;
+  }
+
+  /**
+   * @brief Estimate the radiance along a ray by following a single path
+   *
+   * @param ray
+   * @return Color
+   */
+  Color operator()(Ray ray) { return (*this)(ray, pcg); }
+
+  /**
+   * @brief Estimate the radiance along a ray by following a single path,
+   * drawing random numbers from `_pcg`
+   *
+   * @param ray
+   * @param _pcg
+   * @return Color
+   */
+  Color operator()(Ray ray, PCG &_pcg);
+
+  /**
+   * @brief Estimate the radiance along a ray whose first intersection is
+   * already known, drawing random numbers from `_pcg`
+   *
+   * @param ray
+   * @param intersection
+   * @param _pcg
+   * @return Color
+   */
+  Color shade(Ray ray, const HitRecord &intersection, PCG &_pcg);
 };
 #endif
\ No newline at end of file
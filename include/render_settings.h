@@ -0,0 +1,233 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef RENDER_SETTINGS_H
+#define RENDER_SETTINGS_H
+
+#include "HdrImage.h"
+#include "render.h"
+#include "scene_file.h"
+#include "texture_cache.h"
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief Split a string (using boost would be better, but for only one
+ * function it would have been overkill). Method found here:
+ * https://stackoverflow.com/questions/289347/using-strtok-with-a-stdstring
+ *
+ * @param str
+ * @param delim
+ * @param parts
+ */
+void split(const string &str, const string &delim, vector<string> &parts);
+
+/**
+ * @brief Parse the list of `-d` switches and return a map associating
+ * variable names with their values
+ *
+ * @param definitions
+ * @return map<string,float>
+ */
+map<string, float> build_vars_table(vector<string> &definitions);
+
+/**
+ * @brief Options of the `render` command
+ *
+ */
+struct RenderSettings {
+  int width = 0, height = 0;
+  string algorithm;
+  int init_state = 0, init_seq = 0;
+  int num_of_rays = 0, max_depth = 0;
+  int samples_per_pixel = 0;
+  int num_of_threads = 0;
+  string output_file, input_scene;
+
+  // Progressive rendering: each pass adds `samples_per_pixel` samples
+  int passes = 1;                // 0 means no limit
+  double time_budget = 0.;       // seconds, 0 means no limit
+  int snapshot_every = 0;        // passes between snapshots, 0 means never
+  double snapshot_interval = 0.; // seconds between snapshots, 0 means never
+
+  // Adaptive sampling: pixels are sampled until their relative error drops
+  // below `max_error`
+  float max_error = 0.; // 0 means no adaptive sampling
+  int min_samples = 16, max_samples = 1024;
+  string heatmap_file; // where to write the number of samples of each pixel
+
+  bool map_textures = false;         // read textures from the mapped files
+  bool tiled_textures = false;       // store textures in tiles
+  string texture_filter = "nearest"; // see TextureFilter
+
+  // Distributed rendering: a worker only renders some tiles of the image,
+  // and writes their samples to a file which merge combines with the others
+  string tile_range; // FIRST:LAST, the tiles from FIRST to LAST - 1
+  string worker;     // INDEX:COUNT, one tile every COUNT starting at INDEX
+
+  // Checkpoints: the samples are saved to <outf>.checkpoint, from which an
+  // interrupted rendering can be resumed
+  double checkpoint_interval = 0.; // seconds, 0 means never
+  bool resume = false;
+
+  // Statistics about the rendering, see stats.h
+  bool stats = false;     // print them at the end
+  string stats_json_file; // where to write them as JSON
+
+  /**
+   * @brief Check whether statistics must be kept
+   *
+   * @return true
+   * @return false
+   */
+  bool keeps_stats() const { return stats || stats_json_file != ""; }
+
+  /**
+   * @brief Check whether the image must be rendered in several passes
+   *
+   * @return true
+   * @return false
+   */
+  bool is_progressive() const { return passes != 1 || time_budget > 0.; }
+
+  /**
+   * @brief Check whether the number of samples must be adapted to the noise
+   * of each pixel
+   *
+   * @return true
+   * @return false
+   */
+  bool is_adaptive() const { return max_error > 0.; }
+
+  /**
+   * @brief Check whether only a part of the tiles must be rendered
+   *
+   * @return true
+   * @return false
+   */
+  bool is_worker() const { return tile_range != "" || worker != ""; }
+
+  /**
+   * @brief Check whether the samples must be saved to or read from a
+   * checkpoint
+   *
+   * @return true
+   * @return false
+   */
+  bool uses_checkpoints() const { return checkpoint_interval > 0. || resume; }
+
+  /**
+   * @brief Check whether the samples of each pixel are kept in an
+   * AccumulationBuffer, instead of only their average in the image
+   *
+   * @return true
+   * @return false
+   */
+  bool accumulates_samples() const {
+    return is_adaptive() || is_progressive() || is_worker() ||
+           uses_checkpoints();
+  }
+};
+
+/**
+ * @brief Write `image` as a pfm file and, after tone mapping, as a png (or
+ * jpeg) file. The pfm file is written in the background while the tone
+ * mapping runs
+ *
+ * @param image
+ * @param pfm_output
+ * @param png_output
+ * @param luminosity average luminosity used by the tone mapping; 0 means
+ * that it is computed from the image
+ */
+void save_image(HdrImage &image, const string &pfm_output,
+                const string &png_output, float luminosity = 0.);
+
+/**
+ * @brief Check the sampling options, returning a description of the first
+ * error found (or the empty string if they are valid)
+ *
+ * @param settings
+ * @return string
+ */
+string settings_error(const RenderSettings &settings);
+
+/**
+ * @brief Remove the extension from the output file name chosen by the user,
+ * and return the extension of the ldr image (".png" or ".jpg")
+ *
+ * @param output_file
+ * @return string
+ */
+string split_output_file(string &output_file);
+
+/**
+ * @brief Convert the name of a texture filter, exiting if it is unknown
+ *
+ * @param name
+ * @return TextureFilter
+ */
+TextureFilter parse_texture_filter(const string &name);
+
+/**
+ * @brief Return how the textures must be loaded
+ *
+ * @param settings
+ * @return TextureOptions
+ */
+TextureOptions texture_options(const RenderSettings &settings);
+
+/**
+ * @brief Parse the input file defining the scene, throwing ios_base::failure
+ * if it cannot be opened and GrammarError if it is not valid
+ *
+ * @param settings
+ * @param vars the variables defined on the command line
+ * @param animated_variables the variables which change from a frame to the
+ * next, see InputStream::animated_variables
+ * @param textures where the textures are loaded
+ * @param map_file whether the file can be mapped in memory instead of copied,
+ * see InputStream
+ * @param fix_animated_variables whether the animated variables can be used
+ * outside the transformations, see InputStream::fix_animated_variables
+ * @return Scene
+ */
+Scene read_scene_file(const RenderSettings &settings,
+                      const map<string, float> &vars,
+                      const vector<string> &animated_variables,
+                      shared_ptr<TextureCache> textures,
+                      bool map_file = true,
+                      bool fix_animated_variables = false);
+
+/**
+ * @brief Allocate the user-chosen renderer, exiting if it is unknown
+ *
+ * @param settings
+ * @param world
+ * @param verbose whether to print which renderer is used
+ * @return shared_ptr<Renderer>
+ */
+shared_ptr<Renderer> make_renderer(const RenderSettings &settings,
+                                   World &world, bool verbose = true);
+
+#endif
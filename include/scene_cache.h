@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCENE_CACHE_H
+#define SCENE_CACHE_H
+
+#include "scene_file.h"
+#include "texture_cache.h"
+#include <map>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief Version of the scene cache format: files written with a different
+ * version are rejected, and must be compiled again
+ *
+ */
+const uint32_t SCENE_CACHE_VERSION = 1;
+
+/**
+ * @brief Derived class for error management
+ *
+ */
+class InvalidSceneCache : public runtime_error {
+  using runtime_error::runtime_error;
+};
+
+/**
+ * @brief Write `scene` to a scene cache: a binary file holding the shapes
+ * with their final transformations, the tables of materials, BRDFs and
+ * pigments, the paths of the textures, the camera, the variables and the
+ * acceleration structures of the world, so that it can be loaded without
+ * parsing the scene file nor building the trees again.
+ * The animated shapes are written with their current transformation
+ *
+ * @param scene a scene whose world is compiled (see World::compile)
+ * @param file_name
+ */
+void write_scene_cache(const Scene &scene, const string &file_name);
+
+/**
+ * @brief Read a scene written by write_scene_cache. The file is mapped in
+ * memory, and the trees are copied from it as they are
+ *
+ * @param file_name
+ * @param textures where the textures are loaded
+ * @param options how the textures are loaded
+ * @param filter how the pigments read the textures
+ * @return Scene
+ */
+Scene read_scene_cache(const string &file_name, TextureCache &textures,
+                       const TextureOptions &options = TextureOptions(),
+                       TextureFilter filter = TextureFilter::nearest);
+
+/**
+ * @brief Check whether `file_name` begins like a scene cache (of any version)
+ *
+ * @param file_name
+ * @return true
+ * @return false
+ */
+bool is_scene_cache(const string &file_name);
+
+/**
+ * @brief Return the variables overridden when the scene cache `file_name` was
+ * written (see Scene::overridden_variables), with their values. The scene
+ * read from the cache is the same that would be parsed from its source with
+ * these variables
+ *
+ * @param file_name
+ * @return map<string, float>
+ */
+map<string, float> scene_cache_variables(const string &file_name);
+
+#endif
@@ -24,13 +24,16 @@
 #include "camera.h"
 #include "colors.h"
 #include "geometry.h"
+#include "mapped_file.h"
 #include "materials.h"
 #include "shapes.h"
+#include "texture_cache.h"
 #include "world.h"
 #include <cassert>
 #include <fstream>
 #include <iostream>
 #include <map>
+#include <string_view>
 
 using namespace std;
 
@@ -47,7 +50,7 @@ using namespace std;
  */
 struct SourceLocation {
 
-  string file_name;
+  string_view file_name;
   int line_num;
   int col_num;
 
@@ -57,11 +60,13 @@ struct SourceLocation {
    *
    * @param file_name: the name of the file, or the empty string if there is no
    * file associated with this location (e.g., because the source code was
-   * provided as a memory stream, or through a network connection)
+   * provided as a memory stream, or through a network connection). It is not
+   * copied, so it must outlive the location
    * @param line_num: number of the line (starting from 1)
    * @param col_num: number of the column (starting from 1)
    */
-  SourceLocation(string _file_name = "", int _line_num = 0, int _col_num = 0)
+  SourceLocation(string_view _file_name = "", int _line_num = 0,
+                 int _col_num = 0)
       : file_name{_file_name} {
     line_num = _line_num;
     col_num = _col_num;
@@ -129,20 +134,20 @@ enum class TokenType {
 };
 
 /**
- * @brief Union representing the values of each TokenType
+ * @brief Union representing the values of each TokenType. Strings and
+ * identifiers point inside the buffer of the InputStream which read them, so
+ * copying a token never allocates
  *
  */
 union TokenValue {
   float number;
-  string str;
+  string_view str;
   KeywordEnum keyword;
   char symbol;
 
-  // The default constructor and destructor are *mandatory* for unions to
-  // be used in structs/classes
-  TokenValue() : str{""} {}
-  TokenValue(const TokenValue &t) : str{t.str} {}
-  ~TokenValue() {}
+  // The default constructor is *mandatory* for unions to be used in
+  // structs/classes
+  TokenValue() : str{} {}
 };
 
 /**
@@ -162,49 +167,6 @@ struct Token {
   Token(SourceLocation _location = SourceLocation())
       : type(TokenType::LITERAL_NUMBER), location{_location} {}
 
-  Token(const Token &t) : type{t.type}, location{t.location} {
-    switch (t.type) {
-    case TokenType::IDENTIFIER:
-      value.str = t.value.str;
-      break;
-    case TokenType::KEYWORD:
-      value.keyword = t.value.keyword;
-      break;
-    case TokenType::LITERAL_NUMBER:
-      value.number = t.value.number;
-      break;
-    case TokenType::LITERAL_STRING:
-      value.str = t.value.str;
-      break;
-    case TokenType::SYMBOL:
-      value.symbol = t.value.symbol;
-      break;
-    }
-  }
-
-  Token &operator=(const Token &t) {
-    type = t.type;
-    location = t.location;
-    switch (type) {
-    case TokenType::IDENTIFIER:
-      value.str = t.value.str;
-      break;
-    case TokenType::KEYWORD:
-      value.keyword = t.value.keyword;
-      break;
-    case TokenType::LITERAL_NUMBER:
-      value.number = t.value.number;
-      break;
-    case TokenType::LITERAL_STRING:
-      value.str = t.value.str;
-      break;
-    case TokenType::SYMBOL:
-      value.symbol = t.value.symbol;
-      break;
-    }
-    return *this;
-  }
-
   /**
    * @brief Define the Token as a number and assign its value
    *
@@ -220,7 +182,7 @@ struct Token {
    *
    * @param s
    */
-  void assign_string(const string &s) {
+  void assign_string(string_view s) {
     type = TokenType::LITERAL_STRING;
     value.str = s;
   }
@@ -250,7 +212,7 @@ struct Token {
    *
    * @param id
    */
-  void assign_identifier(const string &id) {
+  void assign_identifier(string_view id) {
     type = TokenType::IDENTIFIER;
     value.str = id;
   }
@@ -258,9 +220,58 @@ struct Token {
   void assign_stop() { type = TokenType::STOP; }
 };
 
+/**
+ * @brief A transformation read from a scene file, which remembers the
+ * variables its parameters were taken from, so that it can be evaluated again
+ * when their values change
+ *
+ */
+struct TransformationExpression {
+  /**
+   * @brief One of the transformations composed by the expression: a
+   * translation or a scaling (three parameters), a rotation (one parameter),
+   * or the identity (none)
+   *
+   * @param variables the name of the variable each parameter was read from,
+   * or the empty string for literal numbers
+   */
+  struct Factor {
+    KeywordEnum keyword;
+    float values[3] = {0.f, 0.f, 0.f};
+    string variables[3];
+  };
+
+  vector<Factor> factors;
+
+  /**
+   * @brief Compose the transformations, taking the parameters read from a
+   * variable from `variables` (when listed there)
+   *
+   * @param variables
+   * @return Transformation
+   */
+  Transformation evaluate(const map<string, float> &variables) const;
+
+  /**
+   * @brief Check whether any parameter was read from one of `variables`
+   *
+   * @param variables
+   * @return true
+   * @return false
+   */
+  bool depends_on(const vector<string> &variables) const;
+};
+
 /**
  * @brief A scene read from a scene file
  *
+ * @param animated_shapes the index (in `world.shapes`) of the shapes whose
+ * transformation depends on the animated variables, see
+ * InputStream::animated_variables
+ * @param camera_transformation the transformation of the camera
+ * @param fixed_variables the animated variables used outside the
+ * transformations, whose values are fixed in the scene, see
+ * InputStream::fix_animated_variables
  */
 struct Scene {
   map<string, Material> materials;
@@ -268,41 +279,126 @@ struct Scene {
   shared_ptr<Camera> camera;
   map<string, float> float_variables;
   vector<string> overridden_variables;
+  vector<pair<int, TransformationExpression>> animated_shapes;
+  TransformationExpression camera_transformation;
+  vector<string> fixed_variables;
+
+  /**
+   * @brief Return a copy of the camera, placed where it is when the
+   * variables take the values in `values`
+   *
+   * @param values
+   * @return shared_ptr<Camera>
+   */
+  shared_ptr<Camera> camera_at(const map<string, float> &values) const;
+
+  /**
+   * @brief Return a compiled world where the animated shapes are copied and
+   * placed where they are when the variables take the values in `values`.
+   * The other shapes, as well as all the materials and textures, are shared
+   * with `world`. The acceleration structures of `world` are not built
+   * again: the boxes of their nodes are refitted around the moved shapes
+   *
+   * @param values
+   * @return World
+   */
+  World world_at(const map<string, float> &values) const;
+
+private:
+  /**
+   * @brief Return the variables of the scene, overridden by `values`
+   *
+   */
+  map<string, float> _variables_at(const map<string, float> &values) const;
 };
 
+/** InputStream class
+ * @brief The lexer and parser of scene files. The whole source is kept in
+ * memory (a file is mapped, a stream is read at once), so that characters
+ * are read without going through the stream and the tokens can point to
+ * their text instead of copying it
+ *
+ */
 struct InputStream {
 public:
-  istream &stream;
+  string file_name;
   SourceLocation location;
   SourceLocation saved_location;
   int tabulations;
-  char saved_char = '\0'; // '\0' is the null char
   Token saved_token;
+  // Read the pixels of the images straight from the mapped files, when their
+  // endianness allows it, instead of copying them
+  bool map_textures = false;
+  // Copy the pixels of the images in tiles, see TiledImage
+  bool tile_textures = false;
+  // How the pigments read the images: unless it is `nearest`, their mip
+  // pyramids are built as they are loaded
+  TextureFilter texture_filter = TextureFilter::nearest;
+  // Where the images are loaded: each file is only read once
+  shared_ptr<TextureCache> textures = make_shared<TextureCache>();
+  // Variables changing from a frame to the next of an animation: they can
+  // only be used in the transformations of the shapes and the camera, which
+  // are recorded in Scene so that they can be evaluated again
+  vector<string> animated_variables;
+  // Accept the animated variables outside the transformations too, instead of
+  // throwing a GrammarError: their values are then fixed in the scene, and
+  // they are listed in Scene::fixed_variables
+  bool fix_animated_variables = false;
 
   /**
-   * @brief Construct a new Input Stream object
+   * @brief Construct a new Input Stream object, reading the whole `stream`
    *
    * @param stream
-   * @param location
+   * @param filename the name used in the error messages
    * @param tabulations
    */
-  InputStream(istream &_stream, string filename = "", int _tabulations = 4)
-      : stream{_stream}, location{filename, 1, 1}, saved_token{} {
-    tabulations = _tabulations;
-  }
+  InputStream(istream &_stream, string filename = "", int _tabulations = 4);
+  /**
+   * @brief Construct a new Input Stream object, mapping the file `filename`
+   * in memory. A mapped file must not be truncated while it is parsed (the
+   * process would be killed by SIGBUS): files which can be modified meanwhile,
+   * like the scenes reloaded by `serve`, must be read with `map_file` false,
+   * which copies them instead
+   *
+   * @param filename
+   * @param tabulations
+   * @param map_file
+   */
+  InputStream(const string &filename, int _tabulations = 4,
+              bool map_file = true);
+  // Tokens and locations point inside the object, which cannot be copied
+  InputStream(const InputStream &) = delete;
+  InputStream &operator=(const InputStream &) = delete;
 
   /**
    * @brief Read a new character from the stream
    *
    * @return char
    */
-  char read_char();
+  inline char read_char() {
+    char ch = pos < size ? data[pos] : '\0';
+    // A null character ends the input, and is read again and again
+    if (ch != '\0')
+      pos++;
+
+    saved_location = location;
+    _update_pos(ch);
+    return ch;
+  }
   /**
    * @brief Push a character back to the stream
    *
    * @param ch `Char` to push back
    */
-  void unread_char(const char &ch);
+  inline void unread_char(const char &ch) {
+    if (ch != '\0') {
+      pos--;
+      // Like istream::putback, a different character can be pushed back
+      if (data[pos] != ch)
+        data[pos] = ch;
+    }
+    location = saved_location;
+  }
 
   /**
    * @brief Keep reading characters until a non-whitespace character is found
@@ -326,12 +422,37 @@ public:
   Scene parse_scene(const map<string, float> &);
 
 private:
+  // The source: `data` points either to `buffer` or to the mapped file
+  string buffer;
+  unique_ptr<MappedFile> file;
+  char *data = nullptr;
+  size_t size = 0;
+  size_t pos = 0;
+  // The animated variables used outside the transformations so far
+  vector<string> fixed_variables;
+
   /**
    * @brief Update `location` after having read `ch` from the stream
    *
    * @param ch `char`
    */
-  void _update_pos(const char &ch);
+  inline void _update_pos(const char &ch) {
+    if (ch == '\0') {
+      // Nothing to do
+    } else if (ch == '\n') {
+      location.line_num += 1;
+      location.col_num = 1;
+    } else if (ch == '\t')
+      location.col_num += tabulations;
+    else
+      location.col_num += 1;
+  }
+  /**
+   * @brief Skip the characters accepted by `accept`, which must never be
+   * tabulations or newlines, and return how many they were
+   *
+   */
+  size_t _skip_word(bool (*accept)(char));
   Token _parse_string_token(SourceLocation);
   Token _parse_float_token(const char &, SourceLocation);
   Token _parse_keyword_or_identifier_token(const char &, SourceLocation);
@@ -358,9 +479,13 @@ private:
    * number or a variable in `scene` and return the number as a `float`
    *
    * @param scene
+   * @param variable_name if not null, it is set to the name of the variable
+   * the number was read from (or to the empty string); otherwise the number
+   * cannot be read from an animated variable, unless fix_animated_variables
+   * is set
    * @return float
    */
-  float expect_number(const Scene &scene);
+  float expect_number(const Scene &scene, string *variable_name = nullptr);
 
   /**
    * @brief Read a token from `stream` and check that it is a literal
@@ -376,15 +501,15 @@ private:
    * @return Return the name of the identifier.
    */
   string expect_identifier();
-  Vec _parse_vector(const Scene &);
+  Vec _parse_vector(const Scene &, string *variable_names = nullptr);
   Color _parse_color(const Scene &);
   shared_ptr<Pigment> _parse_pigment(const Scene &);
   shared_ptr<BRDF> _parse_brdf(const Scene &);
   tuple<string, Material> _parse_material(const Scene &);
-  Transformation _parse_transformation(const Scene &);
-  Sphere _parse_sphere(const Scene &);
-  Plane _parse_plane(const Scene &);
-  shared_ptr<Camera> _parse_camera(const Scene &);
+  TransformationExpression _parse_transformation(const Scene &);
+  Sphere _parse_sphere(const Scene &, TransformationExpression &);
+  Plane _parse_plane(const Scene &, TransformationExpression &);
+  shared_ptr<Camera> _parse_camera(const Scene &, TransformationExpression &);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "render_settings.h"
+#include "thread_pool.h"
+#include <condition_variable>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <future>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief A scene loaded by `serve`
+ *
+ * @param animated whether the variables of the job were parsed as animated
+ * variables (see InputStream::animated_variables): if so, the job must
+ * place the camera and the shapes depending on them, otherwise the scene was
+ * parsed with the values of the job
+ */
+struct ServedScene {
+  shared_ptr<Scene> scene;
+  bool animated = false;
+};
+
+/**
+ * @brief The scenes loaded by `serve`, which are kept in memory between the
+ * jobs and read again when their file, or one of their textures, changes.
+ * The variables overridden by
+ * the jobs are parsed as animated variables, so that jobs with different
+ * values share the materials, the textures and all the shapes which do not
+ * depend on them; the variables used outside the transformations are fixed,
+ * and other values of them need a scene of their own. All the scenes share
+ * the same textures. Scene files are copied instead of mapped in memory,
+ * since they can be rewritten while they are parsed. At most `max_scenes`
+ * scenes are kept: the least recently used is dropped to make room for a new
+ * one, and the scenes read from an older version of a file are dropped when
+ * it is read again. The textures are dropped with the last scene using them
+ *
+ */
+struct SceneStore {
+  RenderSettings settings; // how the textures are loaded
+  shared_ptr<TextureCache> textures = make_shared<TextureCache>();
+  size_t max_scenes;
+
+  SceneStore(const RenderSettings &_settings, size_t _max_scenes = 16)
+      : settings{_settings}, max_scenes{_max_scenes} {}
+
+  /**
+   * @brief Return the scene read from `file_name` (a scene file or a scene
+   * cache) with the variables `vars`, loading it if needed. Scenes which
+   * cannot be loaded throw an exception, which is thrown again for the jobs
+   * requesting them until the file changes
+   *
+   * @param file_name
+   * @param vars
+   * @return ServedScene
+   */
+  ServedScene get(const string &file_name, const map<string, float> &vars);
+
+  /**
+   * @brief Return the number of scenes kept in memory
+   *
+   * @return size_t
+   */
+  size_t size();
+
+private:
+  struct Entry {
+    string file_name;
+    filesystem::file_time_type time; // of the file when it was read
+    shared_future<shared_ptr<Scene>> scene;
+    unsigned long last_use; // the value of `uses` when it was last requested
+    unsigned long load;     // the value of `uses` when it was loaded
+    // The textures of the scene, with the time of their file when they were
+    // read; empty until the scene is loaded
+    vector<pair<string, filesystem::file_time_type>> textures;
+  };
+  mutex entries_mutex;
+  map<string, Entry> entries;
+  unsigned long uses = 0;
+
+  /**
+   * @brief Return the scene stored with `key`, calling `load` if there is
+   * none or if it was read from an older version of `file_name` or of its
+   * textures. Jobs requesting a scene which is being loaded wait for it
+   *
+   */
+  shared_ptr<Scene> _get(const string &key, const string &file_name,
+                         filesystem::file_time_type time,
+                         const function<Scene()> &load);
+};
+
+/**
+ * @brief A job received by `serve`
+ *
+ * @param id the identifier chosen by the client, as JSON text: it is copied
+ * in the reply
+ * @param settings the options of the daemon, overridden by those of the job
+ * @param vars the variables defined on the command line of the daemon,
+ * overridden by those of the job
+ */
+struct RenderJob {
+  string id = "null";
+  RenderSettings settings;
+  map<string, float> vars;
+};
+
+/**
+ * @brief Read a job of `serve` from a line holding a JSON object, throwing
+ * JsonError or invalid_argument if it is not valid. `job` must hold the
+ * defaults; its identifier is read first, so that it is known even if the
+ * rest of the job is not valid
+ *
+ * @param line
+ * @param job
+ */
+void parse_render_job(const string &line, RenderJob &job);
+
+/**
+ * @brief Render a job of `serve` on the threads of `pool`, returning the
+ * members of the reply which describe the result
+ *
+ * @param job
+ * @param scenes
+ * @param pool
+ * @return string
+ */
+string run_render_job(RenderJob &job, SceneStore &scenes, ThreadPool &pool);
+
+/**
+ * @brief A client of `serve`, sending jobs through `input` and receiving the
+ * replies through `output`
+ *
+ */
+struct ServeClient {
+  int input, output;
+
+  /**
+   * @brief Construct a new Serve Client object. The file descriptors are
+   * closed with it
+   *
+   * @param _input
+   * @param _output
+   */
+  ServeClient(int _input, int _output) : input{_input}, output{_output} {}
+
+  ~ServeClient();
+
+  ServeClient(const ServeClient &) = delete;
+  ServeClient &operator=(const ServeClient &) = delete;
+
+  /**
+   * @brief Send a line to the client, ignoring errors: the client may have
+   * gone away
+   *
+   * @param line
+   */
+  void reply(const string &line);
+
+private:
+  mutex output_mutex;
+};
+
+/**
+ * @brief The jobs received by `serve` and not started yet
+ *
+ */
+struct JobQueue {
+  /**
+   * @brief Add a job sent by `client`
+   *
+   */
+  void push(shared_ptr<ServeClient> client, string line);
+
+  /**
+   * @brief Wait for a job and remove it from the queue, returning false if
+   * the queue is closed and empty
+   *
+   */
+  bool pop(shared_ptr<ServeClient> &client, string &line);
+
+  /**
+   * @brief Tell the workers that no other job will be added
+   *
+   */
+  void close();
+
+private:
+  mutex jobs_mutex;
+  condition_variable job_available;
+  deque<pair<shared_ptr<ServeClient>, string>> jobs;
+  bool closed = false;
+};
+
+/**
+ * @brief Read the jobs sent by `client`, one per line, until it closes its
+ * end of the connection
+ *
+ * @param client
+ * @param queue
+ */
+void read_jobs(shared_ptr<ServeClient> client, JobQueue &queue);
+
+/**
+ * @brief Keep the scenes in memory and render the jobs received from the
+ * standard input, or from the clients connecting to a UNIX socket. The jobs
+ * are JSON objects on a line, and each of them gets a reply on a line
+ *
+ * @param settings the default options of the jobs
+ * @param cli_vars the default values of the variables
+ * @param socket_path the socket to listen on, or the empty string to read
+ * the standard input
+ * @param num_of_jobs the number of jobs rendered at the same time
+ * @param max_scenes the number of scenes kept in memory
+ */
+void serve(RenderSettings settings, vector<string> &cli_vars,
+           const string &socket_path, int num_of_jobs, int max_scenes);
+
+#endif
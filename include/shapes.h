@@ -20,6 +20,7 @@
 #ifndef SHAPES_H
 #define SHAPES_H
 
+#include "bvh.h"
 #include "hitrecord.h"
 #include "materials.h"
 #include "ray.h"
@@ -36,14 +37,64 @@ struct Shape {
   Transformation transformation;
   Material material;
 
+  /**
+   * @brief Affine form of `transformation.invm` and `transformation.m`,
+   * computed once so that rays can be moved to and from the shape reference
+   * frame without copying or inverting the transformation. Use
+   * set_transformation to keep them up to date.
+   *
+   */
+  AffineMatrix world_to_object, object_to_world;
+
   Shape(Transformation _transformation, Material _material)
-      : transformation{_transformation}, material{_material} {}
+      : transformation{_transformation}, material{_material},
+        world_to_object{_transformation.invm},
+        object_to_world{_transformation.m} {}
+
+  /**
+   * @brief Change the transformation of the shape, updating all the data
+   * derived from it
+   *
+   * @param _transformation
+   */
+  virtual void set_transformation(const Transformation &_transformation) {
+    transformation = _transformation;
+    world_to_object = AffineMatrix(transformation.invm);
+    object_to_world = AffineMatrix(transformation.m);
+  }
   /**
    * @brief Compute the intersection between a ray and this shape
    *
    * @return HitRecord
    */
   virtual HitRecord ray_intersection(Ray) = 0;
+
+  /**
+   * @brief Compute the distance at which each ray of a packet hits the shape
+   * (+∞ if it does not). The default implementation calls ray_intersection
+   * on each ray; shapes can override it to intersect all of them at once
+   *
+   * @param packet
+   * @param t an array of RayPacket::max_size elements
+   */
+  virtual void packet_intersection(const RayPacket &packet, float *t);
+
+  /**
+   * @brief Check whether the shape fits in a finite box. Unbounded shapes
+   * cannot be stored in a BVH, and must always be checked for intersections
+   *
+   * @return true
+   * @return false
+   */
+  virtual bool is_bounded() { return true; }
+
+  /**
+   * @brief Compute the axis-aligned box enclosing the shape, in world
+   * coordinates
+   *
+   * @return AABB
+   */
+  virtual AABB bounding_box() = 0;
 };
 
 /**
@@ -53,9 +104,32 @@ struct Shape {
  */
 struct Sphere : public Shape {
 
+  /**
+   * @brief If the transformation is a translation combined with a uniform
+   * scaling, the sphere is fully described by its center and radius: in this
+   * case the intersection skips the matrix products altogether
+   *
+   */
+  bool is_simple;
+  Point center;
+  float radius, inv_radius;
+
   Sphere(Transformation transformation = Transformation(),
          Material material = Material())
-      : Shape{transformation, material} {}
+      : Shape{transformation, material} {
+    _update_simple_form();
+  }
+
+  /**
+   * @brief Change the transformation of the sphere, updating all the data
+   * derived from it
+   *
+   * @param _transformation
+   */
+  void set_transformation(const Transformation &_transformation) {
+    Shape::set_transformation(_transformation);
+    _update_simple_form();
+  }
 
   /**
    * @brief Checks if a ray intersects the sphere
@@ -68,7 +142,31 @@ struct Sphere : public Shape {
    */
   HitRecord ray_intersection(Ray);
 
+  /**
+   * @brief Intersect a packet of rays with the sphere using SIMD
+   * instructions, with the same results as ray_intersection
+   *
+   * @param packet
+   * @param t
+   */
+  void packet_intersection(const RayPacket &packet, float *t);
+
+  /**
+   * @brief Compute the world-space box enclosing the sphere, by transforming
+   * the corners of the box [-1, 1]^3 enclosing the unit sphere
+   *
+   * @return AABB
+   */
+  AABB bounding_box();
+
 private:
+  /**
+   * @brief Check whether the transformation is a translation combined with a
+   * uniform scaling, and compute `center` and `radius` if it is
+   *
+   */
+  void _update_simple_form();
+
   /**
  * @brief Convert a 3D point on the surface of the unit sphere into a (u, "
               "v) 2D point"
@@ -127,6 +225,29 @@ struct Plane : public Shape {
    */
   HitRecord ray_intersection(Ray);
 
+  /**
+   * @brief Intersect a packet of rays with the plane using SIMD instructions,
+   * with the same results as ray_intersection
+   *
+   * @param packet
+   * @param t
+   */
+  void packet_intersection(const RayPacket &packet, float *t);
+
+  /**
+   * @brief A plane is infinite, so it has no bounding box
+   *
+   * @return false
+   */
+  bool is_bounded() { return false; }
+
+  /**
+   * @brief Return a box as large as the whole space
+   *
+   * @return AABB
+   */
+  AABB bounding_box();
+
 private:
   /**
    * @brief Convert a 3D point on the surface of the plane into a (u, v) 2D
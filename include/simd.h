@@ -0,0 +1,222 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef SIMD_H
+#define SIMD_H
+
+#include "colors.h"
+#include <cmath>
+#include <cstddef>
+#include <limits>
+
+using namespace std;
+
+/*
+ * Building blocks shared by the SIMD routines. The AVX2
+ * functions are compiled for AVX2 on their own (the rest of the program
+ * keeps running on any x86-64 CPU) and must only be called when
+ * simd_enabled() is true.
+ *
+ * Every routine does the same operations, in the same order, as
+ * Sphere::ray_intersection and Plane::ray_intersection: the AVX2 ones use
+ * neither FMA nor approximated divisions and square roots, so all the
+ * versions give bit-identical results.
+ */
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAS_AVX2_KERNELS
+#define AVX2_FUNCTION __attribute__((target("avx2")))
+#include <immintrin.h>
+#endif
+
+/**
+ * @brief Check whether the SIMD routines run on AVX2 instructions: if the
+ * CPU does not support them, the same computations are done one lane at a
+ * time
+ *
+ * @return true
+ * @return false
+ */
+bool simd_enabled();
+
+/**
+ * @brief Enable or disable the AVX2 code paths (they are enabled by default
+ * when the CPU supports them). Disabling them is mostly useful to compare
+ * the two implementations
+ *
+ * @param enabled
+ */
+void set_simd_enabled(bool enabled);
+
+/**
+ * @brief Copy `count` 32-bit words from `src` to `dst`, reversing the order
+ * of the bytes of each of them. The buffers need not be aligned, and may be
+ * the same
+ *
+ * @param src
+ * @param dst
+ * @param count
+ */
+void byte_swap_32(const void *src, void *dst, size_t count);
+
+/**
+ * @brief Replace each of the `count` values `x` with `x * scale`, then apply
+ * the clamp `x / (1 + x)`: the tone mapping of HdrImage
+ *
+ * @param values
+ * @param count
+ * @param scale
+ */
+void scale_and_clamp(float *values, size_t count, float scale);
+
+/**
+ * @brief Return the sum of the base-10 logarithms of `count` values, in
+ * double precision. The AVX2 version evaluates the logarithms with a
+ * polynomial, which is accurate to a few units in the last place of a float
+ *
+ * @param values
+ * @param count
+ * @return double
+ */
+double sum_log10(const float *values, size_t count);
+
+/**
+ * @brief Return the distance of the first hit between the unit sphere and
+ * the ray (ox, oy, oz) + t (dx, dy, dz), or +∞ if there is none in (tmin,
+ * tmax)
+ *
+ */
+inline float unit_sphere_t(float ox, float oy, float oz, float dx, float dy,
+                           float dz, float tmin, float tmax) {
+  float a = dx * dx + dy * dy + dz * dz;
+  float b = 2.f * (dx * ox + dy * oy + dz * oz);
+  float c = (ox * ox + oy * oy + oz * oz) - 1.f;
+
+  float delta = b * b - 4.f * a * c;
+  if (delta <= 0.f)
+    return numeric_limits<float>::infinity();
+
+  float sqrt_delta = sqrt(delta);
+  float t1 = (-b - sqrt_delta) / (2.f * a);
+  float t2 = (-b + sqrt_delta) / (2.f * a);
+  if (t1 > tmin && t1 < tmax)
+    return t1;
+  if (t2 > tmin && t2 < tmax)
+    return t2;
+  return numeric_limits<float>::infinity();
+}
+
+/**
+ * @brief Return the distance at which a ray whose origin and direction have
+ * z components `oz` and `dz` hits the x-y plane, or +∞ if it does not in
+ * (tmin, tmax)
+ *
+ */
+inline float plane_t(float oz, float dz, float tmin, float tmax) {
+  if (are_close(dz, 0.0))
+    return numeric_limits<float>::infinity();
+  float t = -oz / dz;
+  if (t <= tmin || t >= tmax)
+    return numeric_limits<float>::infinity();
+  return t;
+}
+
+#ifdef HAS_AVX2_KERNELS
+
+/**
+ * @brief Eight-lane version of unit_sphere_t
+ *
+ */
+AVX2_FUNCTION inline __m256 unit_sphere_t_avx2(__m256 ox, __m256 oy,
+                                               __m256 oz, __m256 dx,
+                                               __m256 dy, __m256 dz,
+                                               __m256 tmin, __m256 tmax) {
+  __m256 a = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+      _mm256_mul_ps(dz, dz));
+  __m256 b = _mm256_mul_ps(
+      _mm256_set1_ps(2.f),
+      _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(dx, ox), _mm256_mul_ps(dy, oy)),
+          _mm256_mul_ps(dz, oz)));
+  __m256 c = _mm256_sub_ps(
+      _mm256_add_ps(
+          _mm256_add_ps(_mm256_mul_ps(ox, ox), _mm256_mul_ps(oy, oy)),
+          _mm256_mul_ps(oz, oz)),
+      _mm256_set1_ps(1.f));
+
+  __m256 delta = _mm256_sub_ps(
+      _mm256_mul_ps(b, b),
+      _mm256_mul_ps(_mm256_mul_ps(_mm256_set1_ps(4.f), a), c));
+  // !(delta <= 0), exactly like the scalar test
+  __m256 hit = _mm256_cmp_ps(delta, _mm256_setzero_ps(), _CMP_NLE_UQ);
+
+  // Lanes with a negative delta produce NaNs here, which are masked away
+  __m256 sqrt_delta = _mm256_sqrt_ps(delta);
+  __m256 minus_b = _mm256_xor_ps(b, _mm256_set1_ps(-0.f));
+  __m256 two_a = _mm256_mul_ps(_mm256_set1_ps(2.f), a);
+  __m256 t1 = _mm256_div_ps(_mm256_sub_ps(minus_b, sqrt_delta), two_a);
+  __m256 t2 = _mm256_div_ps(_mm256_add_ps(minus_b, sqrt_delta), two_a);
+
+  __m256 t1_valid = _mm256_and_ps(_mm256_cmp_ps(t1, tmin, _CMP_GT_OQ),
+                                  _mm256_cmp_ps(t1, tmax, _CMP_LT_OQ));
+  __m256 t2_valid = _mm256_and_ps(_mm256_cmp_ps(t2, tmin, _CMP_GT_OQ),
+                                  _mm256_cmp_ps(t2, tmax, _CMP_LT_OQ));
+
+  __m256 inf = _mm256_set1_ps(numeric_limits<float>::infinity());
+  __m256 result = _mm256_blendv_ps(inf, t2, t2_valid);
+  result = _mm256_blendv_ps(result, t1, t1_valid);
+  return _mm256_blendv_ps(inf, result, hit);
+}
+
+/**
+ * @brief Eight-lane version of plane_t
+ *
+ */
+AVX2_FUNCTION inline __m256 plane_t_avx2(__m256 oz, __m256 dz, __m256 tmin,
+                                         __m256 tmax) {
+  // !are_close(dz, 0)
+  __m256 abs_dz = _mm256_andnot_ps(_mm256_set1_ps(-0.f), dz);
+  __m256 hit = _mm256_cmp_ps(abs_dz, _mm256_set1_ps(1e-5f), _CMP_NLT_UQ);
+
+  __m256 t = _mm256_div_ps(_mm256_xor_ps(oz, _mm256_set1_ps(-0.f)), dz);
+  // !(t <= tmin || t >= tmax)
+  hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, tmin, _CMP_NLE_UQ));
+  hit = _mm256_and_ps(hit, _mm256_cmp_ps(t, tmax, _CMP_NGE_UQ));
+  return _mm256_blendv_ps(_mm256_set1_ps(numeric_limits<float>::infinity()),
+                          t, hit);
+}
+
+/**
+ * @brief Compute m0 * x + m1 * y + m2 * z (+ m3 if `m3` is not null), i.e.
+ * one row of an affine transformation, on eight lanes
+ *
+ */
+AVX2_FUNCTION inline __m256 affine_row_avx2(__m256 m0, __m256 m1, __m256 m2,
+                                            const __m256 *m3, __m256 x,
+                                            __m256 y, __m256 z) {
+  __m256 result = _mm256_add_ps(
+      _mm256_add_ps(_mm256_mul_ps(m0, x), _mm256_mul_ps(m1, y)),
+      _mm256_mul_ps(m2, z));
+  return m3 ? _mm256_add_ps(result, *m3) : result;
+}
+
+#endif
+
+#endif
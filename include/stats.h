@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <chrono>
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief Timer class to easily time code execution
+ * Highly inspired (if not entirely copied) from
+ * https://www.learncpp.com/cpp-tutorial/timing-your-code/
+ *
+ */
+struct Timer {
+private:
+  // Type aliases to make accessing nested type easier
+  using clock_t = chrono::high_resolution_clock;
+  using second_t = chrono::duration<double, ratio<1>>;
+
+  chrono::time_point<clock_t> m_beg;
+
+public:
+  /**
+   * @brief Construct a new Timer object with the time of calling
+   *
+   */
+  Timer() : m_beg{clock_t::now()} {}
+  /**
+   * @brief Resets the timer
+   *
+   */
+  void reset() { m_beg = clock_t::now(); }
+
+  /**
+   * @brief Returns the elapsed time in proper units
+   *
+   * @return double
+   */
+  double elapsed() const {
+    return chrono::duration_cast<second_t>(clock_t::now() - m_beg).count();
+  }
+};
+
+/** RenderStats class
+ * @brief What a render has done, and how long each stage took. Every thread
+ * updates its own copy (see thread_stats), so counting needs no
+ * synchronization; the copies are summed by collect_stats
+ *
+ * @param camera_rays number of rays fired by the ImageTracer
+ * @param rays_per_depth number of rays intersected with the world, by
+ * Ray::depth (the perspective camera fires rays of depth 1, the orthogonal one
+ * of depth 0); deeper rays are counted in the last element
+ * @param intersection_tests number of ray-shape tests
+ * @param hits number of rays which hit a shape
+ * @param shadow_rays number of rays tested for occlusion only (none of the
+ * current renderers traces them)
+ * @param russian_roulette_terminations paths ended by the Russian roulette
+ * @param textures number of texture files loaded
+ * @param texture_bytes memory used by the pixels of the textures
+ */
+struct RenderStats {
+  static constexpr int max_depth = 15;
+
+  long camera_rays = 0;
+  long rays_per_depth[max_depth + 1] = {};
+  long intersection_tests = 0;
+  long hits = 0;
+  long shadow_rays = 0;
+  long russian_roulette_terminations = 0;
+  long textures = 0;
+  long texture_bytes = 0;
+
+  // Seconds spent in each stage; texture loading is part of the parsing
+  double parse_seconds = 0.;
+  double texture_seconds = 0.;
+  double tracing_seconds = 0.;
+  double pfm_write_seconds = 0.;
+  double tone_mapping_seconds = 0.;
+  double ldr_encode_seconds = 0.;
+
+  /**
+   * @brief Return the number of rays intersected with the world
+   *
+   * @return long
+   */
+  long rays() const;
+
+  /**
+   * @brief Return the number of rays scattered by the surfaces
+   *
+   * @return long
+   */
+  inline long secondary_rays() const { return rays() - camera_rays; }
+
+  /**
+   * @brief Return the average number of rays traced for each camera ray
+   *
+   * @return double
+   */
+  double average_path_length() const;
+
+  /**
+   * @brief Add the counters and times of `other` to these
+   *
+   * @param other
+   */
+  void merge(const RenderStats &other);
+
+  /**
+   * @brief Print a human-readable report
+   *
+   */
+  void print() const;
+
+  /**
+   * @brief Return the statistics as a JSON document
+   *
+   * @return string
+   */
+  string to_json() const;
+};
+
+// Whether the counters must be updated, see stats_enabled
+extern bool _stats_enabled;
+
+/**
+ * @brief Check whether the renderer must keep statistics (by default it does
+ * not, so that the hot paths only pay for this check)
+ *
+ * @return true
+ * @return false
+ */
+inline bool stats_enabled() { return _stats_enabled; }
+
+/**
+ * @brief Start or stop keeping statistics
+ *
+ * @param enabled
+ */
+void set_stats_enabled(bool enabled);
+
+/**
+ * @brief Return the statistics of the calling thread. When a thread ends,
+ * they are added to the ones returned by collect_stats
+ *
+ * @return RenderStats&
+ */
+RenderStats &thread_stats();
+
+/**
+ * @brief Return the sum of the statistics of the threads which have ended and
+ * of the calling thread
+ *
+ * @return RenderStats
+ */
+RenderStats collect_stats();
+
+/**
+ * @brief Set all the statistics to zero
+ *
+ */
+void reset_stats();
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef TEXTURE_CACHE_H
+#define TEXTURE_CACHE_H
+
+#include "materials.h"
+#include <filesystem>
+#include <map>
+#include <mutex>
+#include <string>
+
+using namespace std;
+
+/**
+ * @brief How the textures are loaded
+ *
+ * @param map read the pixels from the file mapped in memory, when its
+ * endianness allows it, instead of copying them
+ * @param tiled copy the pixels in tiles (see TiledImage); this takes
+ * precedence over `map`
+ * @param mipmaps build the mip pyramid
+ */
+struct TextureOptions {
+  bool map = false;
+  bool tiled = false;
+  bool mipmaps = false;
+};
+
+/** TextureCache class
+ * @brief The textures loaded so far, by canonical path: a file used by
+ * several pigments (e.g. as both the color and the emitted radiance of a
+ * material) is only read once, and all the pigments share its pixels. A file
+ * whose modification time changed is read again. The cache can be shared by
+ * several threads
+ *
+ */
+struct TextureCache {
+  /**
+   * @brief Return the texture stored in `file_name`, loading it if it was not
+   * requested before
+   *
+   * @param file_name
+   * @param options how a newly loaded texture is stored. The tiles and the
+   * mip pyramid are also built the first time they are requested for a
+   * texture already loaded, and kept with it
+   * @return Texture
+   */
+  Texture get(const string &file_name,
+              const TextureOptions &options = TextureOptions());
+
+  /**
+   * @brief Return the modification time of the file `file_name` when its
+   * texture was loaded, or the minimum time if it is not in the cache
+   *
+   * @param file_name a canonical path, as in Texture::file_name
+   * @return filesystem::file_time_type
+   */
+  filesystem::file_time_type file_time(const string &file_name);
+
+  /**
+   * @brief Return the number of textures loaded
+   *
+   * @return int
+   */
+  int num_of_textures();
+
+  /**
+   * @brief Return the number of bytes used by the pixels of all the textures,
+   * including their mip pyramids
+   *
+   * @return size_t
+   */
+  size_t memory_usage();
+
+  /**
+   * @brief Forget all the textures (the pigments using them keep them alive)
+   *
+   */
+  void clear();
+
+  /**
+   * @brief Forget the textures which are not used by any pigment any more,
+   * so that their pixels are released
+   *
+   */
+  void prune();
+
+private:
+  struct Entry {
+    filesystem::file_time_type time; // of the file when it was read
+    Texture texture;
+  };
+  mutex textures_mutex;
+  map<string, Entry> textures;
+};
+
+#endif
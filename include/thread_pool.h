@@ -0,0 +1,115 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+/** ThreadPool class
+ * @brief A fixed set of threads running batches of tasks. Several threads can
+ * submit batches at the same time: the workers take one task from each batch
+ * in turn, so that the batches progress together instead of one after the
+ * other
+ *
+ */
+struct ThreadPool {
+  /**
+   * @brief Construct a new Thread Pool object and start its threads
+   *
+   * @param num_of_threads Number of threads; if it is not positive, one for
+   * each of the available cores
+   */
+  ThreadPool(int num_of_threads = 0);
+
+  /**
+   * @brief Wait for the tasks being run and stop the threads
+   *
+   */
+  ~ThreadPool();
+
+  ThreadPool(const ThreadPool &) = delete;
+  ThreadPool &operator=(const ThreadPool &) = delete;
+
+  /**
+   * @brief Call `task(0)`, ..., `task(num_of_tasks - 1)` on the threads of
+   * the pool, returning when they have all been completed. The calling thread
+   * runs tasks of its batch as well while it waits
+   *
+   * @param num_of_tasks
+   * @param task It is called concurrently, so it must be thread-safe
+   */
+  void run(int num_of_tasks, const function<void(int)> &task);
+
+  /**
+   * @brief Return the number of threads of the pool
+   *
+   * @return int
+   */
+  inline int size() const { return static_cast<int>(workers.size()); }
+
+private:
+  /**
+   * @brief The tasks submitted by a call to run
+   *
+   */
+  struct Batch {
+    const function<void(int)> *task;
+    int num_of_tasks;
+    int next = 0; // the first task which has not been started
+    int done = 0; // the number of tasks completed
+  };
+
+  mutex batches_mutex;
+  condition_variable work_available, batch_done;
+  // The batches with tasks which have not been started yet
+  deque<shared_ptr<Batch>> batches;
+  vector<thread> workers;
+  bool stopping = false;
+
+  /**
+   * @brief Take the next task of `batch` (or of the first batch waiting, if
+   * it is null), returning false if there is none. The caller must hold
+   * `batches_mutex`
+   *
+   */
+  bool _take_task(shared_ptr<Batch> &batch, int &index);
+
+  /**
+   * @brief Run a task taken with _take_task, and record its completion
+   *
+   */
+  void _run_task(unique_lock<mutex> &lock, Batch &batch, int index);
+
+  /**
+   * @brief The loop run by each thread of the pool
+   *
+   */
+  void _work();
+};
+
+#endif
@@ -20,6 +20,8 @@
 #ifndef WORLD_H
 #define WORLD_H
 
+#include "bvh.h"
+#include "compiled_scene.h"
 #include "shapes.h"
 #include <iostream>
 #include <memory>
@@ -32,23 +34,123 @@ using namespace std;
     ray_intersection to check whether a light ray intersects any
     of the shapes in the world.
  *
+ * Once all the shapes have been added, call build_bvh to speed up
+ ray_intersection: until then (or if `use_bvh` is false) every shape is checked
+ for every ray.
+ *
+ * @param shapes the list of shapes
+ * @param bvh a bounding volume hierarchy built over the bounded shapes
+ * @param unbounded_shapes indices of the shapes that cannot be stored in `bvh`
+ * @param use_bvh whether ray_intersection should use `bvh` (when built):
+ * if false, every shape is checked even when the scene is compiled
+ * @param compiled the compiled copy of the shapes
+ * @param use_compiled whether ray_intersection should use `compiled` (when
+ * built) instead of `bvh`
  */
 struct World {
   vector<shared_ptr<Shape>> shapes;
+  BVH bvh;
+  vector<int> unbounded_shapes;
+  bool use_bvh = true;
+  CompiledScene compiled;
+  bool use_compiled = true;
 
   /**
-   * @brief Add a new shape to the world
+   * @brief Add a new shape to the world. This invalidates the BVH and the
+   * compiled scene, which must be built again
    *
    * @param newShape
    */
-  inline void add(shared_ptr<Shape> newShape) { shapes.push_back(newShape); }
+  inline void add(shared_ptr<Shape> newShape) {
+    shapes.push_back(newShape);
+    clear_bvh();
+    compiled.clear();
+  }
+
+  /**
+   * @brief Build the BVH over the shapes currently in the world
+   *
+   */
+  void build_bvh();
+
+  /**
+   * @brief Remove the BVH, so that ray_intersection falls back to brute force
+   *
+   */
+  void clear_bvh();
+
+  /**
+   * @brief Check if the BVH has been built over the current list of shapes
+   *
+   * @return true
+   * @return false
+   */
+  inline bool has_bvh() const { return bvh_built; }
+
+  /**
+   * @brief Build both the BVH and the CompiledScene over the shapes currently
+   * in the world. Call it once the world is complete
+   *
+   */
+  void compile();
+
+  /**
+   * @brief Like compile, but using trees which were already built over these
+   * shapes (e.g. read from a file, see scene_cache.h) instead of building them
+   * again
+   *
+   * @param shape_bvh the tree over the bounded shapes, like `bvh`
+   * @param sphere_bvh the tree over the spheres, like `compiled.bvh`
+   */
+  void compile(BVH shape_bvh, BVH sphere_bvh);
+
+  /**
+   * @brief Check if the compiled scene has been built over the current list
+   * of shapes
+   *
+   * @return true
+   * @return false
+   */
+  inline bool has_compiled() const { return !compiled.is_empty(); }
+
   /**
    * @brief Determine if a ray intersect an object of the current world.
+   * When statistics are enabled (see stats.h) the ray is counted
    *
    * @param ray
    * @return HitRecord
    */
   HitRecord ray_intersection(Ray ray);
+
+  /**
+   * @brief Determine if a ray intersect an object of the current world by
+   * checking every shape. This is the reference implementation used when no
+   * BVH is available.
+   *
+   * @param ray
+   * @return HitRecord
+   */
+  HitRecord ray_intersection_brute_force(Ray ray);
+
+  /**
+   * @brief Intersect `n` rays with the world, intersecting them in packets
+   * of RayPacket::max_size rays. `hits[i]` is the same HitRecord that
+   * ray_intersection(rays[i]) would return
+   *
+   * @param rays
+   * @param n
+   * @param hits an array of at least `n` elements
+   */
+  void ray_intersection_packet(const Ray *rays, int n, HitRecord *hits);
+
+private:
+  bool bvh_built = false;
+
+  /**
+   * @brief Find the closest intersection with the fastest available method
+   *
+   */
+  HitRecord _closest_intersection(const Ray &ray);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,40 @@
+#!/bin/bash
+
+if [ "$2" == "" ]; then
+    echo "Usage: $(basename $0) NUM_OF_WORKERS OUTPUT_FILE [RENDER OPTIONS]"
+    exit 1
+fi
+
+readonly num_of_workers="$1"
+readonly output_file="$2"
+shift 2
+
+# The path of the program can be changed, e.g. RAYTRACER=build/raytracer
+readonly raytracer="${RAYTRACER:-./raytracer}"
+
+readonly parts_dir=$(mktemp -d)
+trap 'rm -rf "$parts_dir"' EXIT
+
+# Every worker renders its tiles on its share of the cores
+threads=$(( $(nproc) / num_of_workers ))
+if [ $threads -lt 1 ]; then
+    threads=1
+fi
+
+pids=()
+for ((i = 0; i < num_of_workers; i++)); do
+    "$raytracer" render --worker $i:$num_of_workers --threads $threads \
+        --outf "$parts_dir/part$i" "$@" < /dev/null > "$parts_dir/part$i.log" &
+    pids+=($!)
+done
+
+for ((i = 0; i < num_of_workers; i++)); do
+    if ! wait ${pids[$i]}; then
+        echo "Worker $i has failed:"
+        cat "$parts_dir/part$i.log"
+        exit 1
+    fi
+done
+
+# The tiles can be merged in any order
+"$raytracer" merge --outf "$output_file" "$parts_dir"/part*.acc
@@ -18,6 +18,74 @@
  */
 
 #include "HdrImage.h"
+#include "simd.h"
+#include "stats.h"
+#include <functional>
+#include <limits>
+#include <numeric>
+#include <thread>
+
+// The pixels are copied in bulk, as arrays of floats
+static_assert(sizeof(Color) == 3 * sizeof(float), "Color must be 3 floats");
+
+// Number of threads to use when the user asks for `num_of_threads` (0 means
+// one per core)
+static int _num_of_workers(int num_of_threads) {
+  if (num_of_threads <= 0)
+    num_of_threads = max(1u, thread::hardware_concurrency());
+  return num_of_threads;
+}
+
+// Split [0, size) in `num_of_workers` contiguous chunks and call
+// func(first, last, worker) on each of them, in parallel
+static void _parallel_for(size_t size, int num_of_workers,
+                          const function<void(size_t, size_t, int)> &func) {
+  vector<thread> workers;
+  for (int worker{1}; worker < num_of_workers; worker++)
+    workers.push_back(thread(func, size * worker / num_of_workers,
+                             size * (worker + 1) / num_of_workers, worker));
+  func(0, size / num_of_workers, 0);
+  for (auto &worker : workers)
+    worker.join();
+}
+
+// Same as getline: read up to the next newline, which is skipped
+static string _read_line(const char *data, size_t size, size_t &pos) {
+  size_t first = pos;
+  while (pos < size && data[pos] != '\n')
+    pos++;
+  string line(data + first, pos - first);
+  if (pos < size)
+    pos++;
+  return line;
+}
+
+PfmHeader parse_pfm_header(const char *data, size_t size) {
+  PfmHeader header;
+  size_t pos = 0;
+
+  // check file format: is it a PFM file?
+  if (_read_line(data, size, pos) != "PF")
+    throw InvalidPfmFileFormat("Invalid magic in PFM file");
+
+  vector<int> img_size = parse_img_size(_read_line(data, size, pos));
+  header.width = img_size[0];
+  header.height = img_size[1];
+  header.endianness = parse_endianness(_read_line(data, size, pos));
+  header.length = pos;
+
+  // check if img pixels are >= width*height
+  if (size - header.length < size_t(header.width) * header.height * 3 * 4)
+    throw InvalidPfmFileFormat("Invalid file dimension");
+  return header;
+}
+
+MappedPfm::MappedPfm(const string &file_name) : file{file_name} {
+  // An empty file is not mapped, but its header is invalid anyway
+  header = parse_pfm_header(file.data(), file.size());
+  width = header.width;
+  height = header.height;
+}
 
 void HdrImage::read_pfm(istream &stream) {
   if (!stream)
@@ -30,46 +98,40 @@ void HdrImage::read_pfm(istream &stream) {
   if (file_len == -1)
     throw InvalidPfmFileFormat("The file is empty");
 
-  // check file format: is it a PFM file?
-  string magic;
-  getline(stream, magic);
-  if (magic != "PF")
-    throw InvalidPfmFileFormat("Invalid magic in PFM file");
+  // Read everything at once, then parse it from memory
+  string content(file_len, '\0');
+  stream.read(&content[0], file_len);
+  content.resize(stream.gcount());
 
-  // read img_size
-  string img_size;
-  getline(stream, img_size);
-  width = parse_img_size(img_size)[0];
-  height = parse_img_size(img_size)[1];
-
-  // read endianness
-  string e;
-  Endianness endianness;
-  getline(stream, e);
-  endianness = parse_endianness(e);
-
-  // check if img pixels are >= width*height
-  int header_len = stream.tellg();
-  if ((file_len - header_len) < (width * height * 3 * 4))
-    throw InvalidPfmFileFormat("Invalid file dimension");
+  PfmHeader header = parse_pfm_header(content.data(), content.size());
+  read_pfm_payload(header, content.data() + header.length);
+}
 
-  allocate_memory(width, height);
-  // Read the image
-  for (int y{height - 1}; y >= 0; y--) {
-    for (int x{}; x < width; x++) {
-      float r = read_float(stream, endianness);
-      float g = read_float(stream, endianness);
-      float b = read_float(stream, endianness);
-      set_pixel(x, y, Color(r, g, b));
-    }
+void HdrImage::read_pfm_payload(const PfmHeader &header,
+                                const char *payload) {
+  allocate_memory(header.width, header.height);
+
+  bool swap = (header.endianness == Endianness::big_endian) ==
+              (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+  size_t row_floats = 3 * size_t(width);
+  // The file stores the rows from the bottom to the top
+  for (int y{}; y < height; y++) {
+    const char *source = payload + 4 * row_floats * (height - 1 - y);
+    float *destination = &pixels[pixel_offset(0, y)].r;
+    if (swap)
+      byte_swap_32(source, destination, row_floats);
+    else
+      memcpy(destination, source, 4 * row_floats);
   }
 }
 
 HdrImage::HdrImage(int w, int h) { allocate_memory(w, h); }
 
-HdrImage::HdrImage(const string &file_name) {
-  ifstream stream{file_name};
-  read_pfm(stream);
+HdrImage::HdrImage(const string &file_name)
+    : HdrImage(MappedPfm(file_name)) {}
+
+HdrImage::HdrImage(const MappedPfm &file) {
+  read_pfm_payload(file.header, file.payload());
 }
 
 HdrImage::HdrImage(istream &stream) { read_pfm(stream); };
@@ -134,16 +196,35 @@ void HdrImage::write_pfm(ostream &stream, Endianness e) {
   string result{sstr.str()};
 
   stream << result << endl;
+
+  // Build each scanline in memory and write it at once
+  bool swap = (e == Endianness::big_endian) ==
+              (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__);
+  size_t row_floats = 3 * size_t(width);
+  vector<char> row(4 * row_floats);
   for (int y = height - 1; y >= 0; y--) {
-    for (int x = 0; x < width; x++) {
-      Color color = get_pixel(x, y);
-      write_float(stream, color.r, e);
-      write_float(stream, color.g, e);
-      write_float(stream, color.b, e);
-    }
+    const Color *source = pixels.data() + pixel_offset(0, y);
+    if (swap)
+      byte_swap_32(source, row.data(), row_floats);
+    else
+      memcpy(row.data(), source, row.size());
+    stream.write(row.data(), row.size());
   }
 }
 
+future<double> HdrImage::write_pfm_async(const string &file_name,
+                                         Endianness e) {
+  return async(launch::async, [this, file_name, e]() {
+    Timer t;
+    ofstream stream(file_name, ios::binary);
+    if (!stream)
+      throw ios_base::failure("Failed to open output file.");
+    write_pfm(stream, e);
+    stream.close();
+    return t.elapsed();
+  });
+}
+
 float HdrImage::read_float(istream &stream, Endianness e) {
   unsigned char bytes[4];
 
@@ -209,14 +290,105 @@ vector<int> parse_img_size(string str) {
   return dim;
 }
 
-float HdrImage::average_luminosity(float delta) {
-  float cumsum = 0.f;
-  for (int i{}; i < pixels.size(); i++)
-    cumsum += log10(delta + pixels[i].luminosity());
-
+float HdrImage::average_luminosity(float delta, int num_of_threads) {
+  // Every thread sums its own chunk in double precision, so that no term is
+  // lost even on large images. The logarithms are taken in batches, so that
+  // they can be vectorized
+  vector<double> partial_sums(_num_of_workers(num_of_threads));
+  _parallel_for(pixels.size(), partial_sums.size(),
+                [&](size_t first, size_t last, int worker) {
+                  const size_t batch_size = 256;
+                  float luminosity[batch_size];
+                  double cumsum = 0.;
+                  for (size_t i{first}; i < last; i += batch_size) {
+                    size_t n = min(batch_size, last - i);
+                    for (size_t j{}; j < n; j++)
+                      luminosity[j] = delta + pixels[i + j].luminosity();
+                    cumsum += sum_log10(luminosity, n);
+                  }
+                  partial_sums[worker] = cumsum;
+                });
+
+  double cumsum = accumulate(partial_sums.begin(), partial_sums.end(), 0.);
   return pow(10, cumsum / pixels.size());
 };
 
+void HdrImage::tone_map(float factor, float luminosity, int num_of_threads) {
+  if (factor <= 0)
+    throw invalid_argument("FACTOR must be a positive floating point");
+  if (luminosity <= 0)
+    luminosity = average_luminosity(1e-10, num_of_threads);
+
+  // Colors are plain arrays of floats: go through all of them at once
+  float scale = factor / luminosity;
+  float *values = &pixels.data()->r;
+  _parallel_for(3 * pixels.size(), _num_of_workers(num_of_threads),
+                [&](size_t first, size_t last, int) {
+                  scale_and_clamp(values + first, last - first, scale);
+                });
+}
+
+HdrImage HdrImage::half_size(int num_of_threads) const {
+  HdrImage result(max(1, (width + 1) / 2), max(1, (height + 1) / 2));
+  _parallel_for(result.height, _num_of_workers(num_of_threads),
+                [&](size_t first, size_t last, int) {
+                  for (int y = first; y < last; y++) {
+                    int y0 = min(2 * y, height - 1);
+                    int y1 = min(2 * y + 1, height - 1);
+                    for (int x{}; x < result.width; x++) {
+                      int x0 = min(2 * x, width - 1);
+                      int x1 = min(2 * x + 1, width - 1);
+                      Color sum = get_pixel(x0, y0) + get_pixel(x1, y0) +
+                                  get_pixel(x0, y1) + get_pixel(x1, y1);
+                      result.pixels[result.pixel_offset(x, y)] = sum * 0.25f;
+                    }
+                  }
+                });
+  return result;
+}
+
+TiledImage::TiledImage(const HdrImage &image, int num_of_threads) {
+  _fill(
+      image.width, image.height,
+      [&](int x, int y) { return image.get_pixel(x, y); }, num_of_threads);
+}
+
+TiledImage::TiledImage(const MappedPfm &file, int num_of_threads) {
+  _fill(
+      file.width, file.height,
+      [&](int x, int y) { return file.get_pixel(x, y); }, num_of_threads);
+}
+
+void TiledImage::_fill(int _width, int _height,
+                       const function<Color(int, int)> &func,
+                       int num_of_threads) {
+  width = _width;
+  height = _height;
+  tiles_per_row = (width + tile_side - 1) / tile_side;
+  int tiles_per_column = (height + tile_side - 1) / tile_side;
+  pixels.resize(size_t(tiles_per_row) * tiles_per_column * tile_side *
+                tile_side);
+
+  // Every worker fills whole rows of tiles
+  _parallel_for(tiles_per_column, _num_of_workers(num_of_threads),
+                [&](size_t first, size_t last, int) {
+                  int y_end = min<int>(last * tile_side, height);
+                  for (int y = first * tile_side; y < y_end; y++) {
+                    for (int x{}; x < width; x++)
+                      pixels[pixel_offset(x, y)] = func(x, y);
+                  }
+                });
+}
+
+HdrImage TiledImage::to_image() const {
+  HdrImage image(width, height);
+  for (int y{}; y < height; y++) {
+    for (int x{}; x < width; x++)
+      image.pixels[image.pixel_offset(x, y)] = get_pixel(x, y);
+  }
+  return image;
+}
+
 void HdrImage::clamp_image() {
   for (int i{}; i < pixels.size(); i++) {
     pixels[i].r = clamp(pixels[i].r);
@@ -234,25 +406,60 @@ void HdrImage::normalize_pixels(float factor, float luminosity) {
   }
 }
 
+GammaLUT::GammaLUT(float _gamma) : gamma{_gamma} {
+  float inv_gamma = 1 / gamma;
+  auto to_ldr = [&](float x) {
+    return static_cast<int>(255 * pow(x, inv_gamma));
+  };
+
+  thresholds[0] = -numeric_limits<float>::infinity();
+  for (int k{1}; k < 256; k++) {
+    // Start from the exact inverse, then fix the last few bits
+    float x = pow(k / 255.f, gamma);
+    while (to_ldr(x) < k)
+      x = nextafter(x, numeric_limits<float>::infinity());
+    while (x > 0.f && to_ldr(nextafter(x, 0.f)) >= k)
+      x = nextafter(x, 0.f);
+    thresholds[k] = x;
+  }
+  thresholds[256] = numeric_limits<float>::infinity();
+
+  for (uint32_t i{}; i < sizeof(coarse); i++) {
+    float x;
+    uint32_t bits = i << coarse_shift;
+    memcpy(&x, &bits, sizeof(x));
+    int k = 0;
+    for (int step{128}; step > 0; step /= 2)
+      k += (x >= thresholds[k + step]) ? step : 0;
+    coarse[i] = k;
+  }
+}
+
 // Write LDR image
-void HdrImage::write_ldr_image(const char *output_filename, float gamma) {
+void HdrImage::write_ldr_image(const char *output_filename, float gamma,
+                               int num_of_threads) {
   gdImagePtr img;
   FILE *output_file;
 
-  img = gdImageCreateTrueColor(width, height);
   if (gamma <= 0)
     throw invalid_argument("GAMMA must be a positive floating point");
+  GammaLUT to_ldr{gamma};
+  img = gdImageCreateTrueColor(width, height);
 
-  for (int row{}; row < height; ++row) {
-    for (int col{}; col < width; ++col) {
-      Color cur_color = get_pixel(col, row);
-      int red, green, blue;
-      red = static_cast<int>(255 * pow(cur_color.r, 1 / gamma));
-      green = static_cast<int>(255 * pow(cur_color.g, 1 / gamma));
-      blue = static_cast<int>(255 * pow(cur_color.b, 1 / gamma));
-      gdImageSetPixel(img, col, row, gdImageColorExact(img, red, green, blue));
-    }
-  }
+  // Rows are converted in parallel, straight into the pixels of the true
+  // color image
+  _parallel_for(height, _num_of_workers(num_of_threads),
+                [&](size_t first_row, size_t last_row, int) {
+                  for (size_t row{first_row}; row < last_row; row++) {
+                    const Color *source =
+                        pixels.data() + pixel_offset(0, row);
+                    int *destination = img->tpixels[row];
+                    for (int col{}; col < width; ++col)
+                      destination[col] = gdTrueColor(to_ldr(source[col].r),
+                                                     to_ldr(source[col].g),
+                                                     to_ldr(source[col].b));
+                  }
+                });
 
   output_file = fopen(output_filename, "wb");
   if (!output_file) {
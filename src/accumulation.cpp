@@ -0,0 +1,276 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "accumulation.h"
+#include "fmtlib.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <limits>
+
+// The first bytes of every partial accumulation file
+static const char MAGIC[8] = {'R', 'T', 'T', 'I', 'L', 'E', 'S', '\0'};
+// Written as a number: a file written by a machine with the other byte order
+// reads it swapped
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+// The records of a partial accumulation file, written as they are. The header
+// is followed by the description of the frame, the indices of the tiles and
+// the pixels of each tile, row by row
+struct TileFileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  int32_t width, height, tile_size, num_of_tiles;
+  uint32_t frame_length;
+  uint32_t reserved;
+};
+
+struct PixelRecord {
+  float r, g, b;
+  int32_t count;
+  double sum_lum;
+  double sum_sq;
+};
+static_assert(sizeof(TileFileHeader) == 40 && sizeof(PixelRecord) == 32,
+              "the records must not have padding");
+
+Color AccumulationBuffer::get_mean(int col, int row) const {
+  int offset = pixel_offset(col, row);
+  if (counts[offset] == 0)
+    return Color();
+  Color sum = sums[offset];
+  return sum * (1.f / counts[offset]);
+}
+
+double AccumulationBuffer::get_mean_luminosity(int col, int row) const {
+  int offset = pixel_offset(col, row);
+  if (counts[offset] == 0)
+    return 0.;
+  return sums_lum[offset] / counts[offset];
+}
+
+float AccumulationBuffer::get_variance(int col, int row) const {
+  int offset = pixel_offset(col, row);
+  int n = counts[offset];
+  if (n < 2)
+    return 0.f;
+  double mean = sums_lum[offset] / n;
+  // Rounding errors can make the difference slightly negative
+  return static_cast<float>(
+      max(0., (sums_sq[offset] - n * mean * mean) / (n - 1)));
+}
+
+float AccumulationBuffer::get_relative_error(int col, int row,
+                                             float min_mean) const {
+  int n = get_count(col, row);
+  if (n < 2)
+    return numeric_limits<float>::infinity();
+  float mean =
+      max(static_cast<float>(get_mean_luminosity(col, row)), min_mean);
+  return sqrt(get_variance(col, row) / n) / mean;
+}
+
+int AccumulationBuffer::min_count() const {
+  if (counts.empty())
+    return 0;
+  return *min_element(counts.begin(), counts.end());
+}
+
+HdrImage AccumulationBuffer::to_image() const {
+  HdrImage image(width, height);
+  for (int row{}; row < height; row++) {
+    for (int col{}; col < width; col++)
+      image.set_pixel(col, row, get_mean(col, row));
+  }
+  return image;
+}
+
+HdrImage AccumulationBuffer::count_heatmap() const {
+  HdrImage image(width, height);
+  if (counts.empty())
+    return image;
+
+  auto range = minmax_element(counts.begin(), counts.end());
+  int lowest = *range.first, highest = *range.second;
+  for (int row{}; row < height; row++) {
+    for (int col{}; col < width; col++) {
+      float t = highest == lowest ? 0.f
+                                  : static_cast<float>(get_count(col, row) -
+                                                       lowest) /
+                                        (highest - lowest);
+      image.set_pixel(col, row, Color(t, 0.f, 1.f - t));
+    }
+  }
+  return image;
+}
+
+void AccumulationBuffer::clear() {
+  fill(sums.begin(), sums.end(), Color());
+  fill(sums_lum.begin(), sums_lum.end(), 0.);
+  fill(sums_sq.begin(), sums_sq.end(), 0.);
+  fill(counts.begin(), counts.end(), 0);
+}
+
+void AccumulationBuffer::write_tiles(const string &file_name,
+                                     const vector<int> &tiles, int tile_size,
+                                     const string &frame) const {
+  int num_of_tiles = TileBounds::num_of_tiles(tile_size, width, height);
+  vector<PixelRecord> pixels;
+  for (int tile : tiles) {
+    if (tile < 0 || tile >= num_of_tiles)
+      throw invalid_argument(fmt::format("the image has no tile {}", tile));
+    TileBounds bounds(tile, tile_size, width, height);
+    for (int row{bounds.first_row}; row < bounds.last_row; row++) {
+      for (int col{bounds.first_col}; col < bounds.last_col; col++) {
+        int offset = pixel_offset(col, row);
+        pixels.push_back(PixelRecord{sums[offset].r, sums[offset].g,
+                                     sums[offset].b, counts[offset],
+                                     sums_lum[offset], sums_sq[offset]});
+      }
+    }
+  }
+
+  TileFileHeader header{};
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = ACCUMULATION_FILE_VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  header.width = width;
+  header.height = height;
+  header.tile_size = tile_size;
+  header.num_of_tiles = tiles.size();
+  header.frame_length = frame.size();
+
+  ofstream stream(file_name, ios::binary);
+  stream.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  stream.write(frame.data(), frame.size());
+  stream.write(reinterpret_cast<const char *>(tiles.data()),
+               tiles.size() * sizeof(int));
+  stream.write(reinterpret_cast<const char *>(pixels.data()),
+               pixels.size() * sizeof(PixelRecord));
+  stream.close();
+  if (!stream)
+    throw ios_base::failure("Unable to write " + file_name);
+}
+
+// Read `size` bytes, throwing InvalidAccumulationFile if the file ends first
+static void _read_bytes(istream &stream, void *data, size_t size,
+                        const string &file_name) {
+  stream.read(static_cast<char *>(data), size);
+  if (static_cast<size_t>(stream.gcount()) != size)
+    throw InvalidAccumulationFile(file_name + " is truncated");
+}
+
+AccumulationBuffer merge_tile_files(const vector<string> &file_names,
+                                    string *frame) {
+  if (file_names.empty())
+    throw InvalidAccumulationFile("there are no files to merge");
+
+  AccumulationBuffer result;
+  int tile_size = 0;
+  string first_frame;
+  vector<int> owner; // the file holding each tile, or -1
+  for (int i{}; i < file_names.size(); i++) {
+    const string &file_name = file_names[i];
+    ifstream stream(file_name, ios::binary);
+    if (!stream)
+      throw ios_base::failure("Unable to open " + file_name);
+
+    TileFileHeader header;
+    _read_bytes(stream, &header, sizeof(header), file_name);
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+      throw InvalidAccumulationFile(file_name +
+                                    " is not a partial accumulation file");
+    if (header.byte_order != BYTE_ORDER_MARK)
+      throw InvalidAccumulationFile(file_name +
+                                    " was written with another byte order");
+    if (header.version != ACCUMULATION_FILE_VERSION)
+      throw InvalidAccumulationFile(
+          fmt::format("{} has version {} instead of {}", file_name,
+                      header.version, ACCUMULATION_FILE_VERSION));
+    if (header.width <= 0 || header.height <= 0 || header.tile_size <= 0 ||
+        header.num_of_tiles < 0 || header.frame_length > (1u << 20))
+      throw InvalidAccumulationFile(file_name + " has an invalid header");
+
+    string file_frame(header.frame_length, '\0');
+    _read_bytes(stream, file_frame.data(), file_frame.size(), file_name);
+
+    if (i == 0) {
+      result = AccumulationBuffer(header.width, header.height);
+      tile_size = header.tile_size;
+      first_frame = file_frame;
+      owner.assign(
+          TileBounds::num_of_tiles(tile_size, header.width, header.height),
+          -1);
+    } else if (header.width != result.width ||
+               header.height != result.height ||
+               header.tile_size != tile_size || file_frame != first_frame)
+      throw InvalidAccumulationFile(
+          fmt::format("{} and {} belong to different frames", file_names[0],
+                      file_name));
+
+    if (header.num_of_tiles > static_cast<int>(owner.size()))
+      throw InvalidAccumulationFile(file_name + " has an invalid header");
+    vector<int> tiles(header.num_of_tiles);
+    _read_bytes(stream, tiles.data(), tiles.size() * sizeof(int), file_name);
+    for (int tile : tiles) {
+      if (tile < 0 || tile >= static_cast<int>(owner.size()))
+        throw InvalidAccumulationFile(
+            fmt::format("{} holds tile {}, which is not part of the image",
+                        file_name, tile));
+      if (owner[tile] >= 0)
+        throw InvalidAccumulationFile(
+            fmt::format("tile {} is held both by {} and by {}", tile,
+                        file_names[owner[tile]], file_name));
+      owner[tile] = i;
+    }
+
+    for (int tile : tiles) {
+      TileBounds bounds(tile, tile_size, result.width, result.height);
+      for (int row{bounds.first_row}; row < bounds.last_row; row++) {
+        int num_of_cols = bounds.last_col - bounds.first_col;
+        vector<PixelRecord> pixels(num_of_cols);
+        _read_bytes(stream, pixels.data(), num_of_cols * sizeof(PixelRecord),
+                    file_name);
+        for (int col{}; col < num_of_cols; col++) {
+          const PixelRecord &pixel = pixels[col];
+          if (pixel.count < 0)
+            throw InvalidAccumulationFile(file_name +
+                                          " has a negative sample count");
+          int offset = result.pixel_offset(bounds.first_col + col, row);
+          result.sums[offset] = Color(pixel.r, pixel.g, pixel.b);
+          result.sums_lum[offset] = pixel.sum_lum;
+          result.sums_sq[offset] = pixel.sum_sq;
+          result.counts[offset] = pixel.count;
+        }
+      }
+    }
+    if (stream.peek() != char_traits<char>::eof())
+      throw InvalidAccumulationFile(file_name + " is too long");
+  }
+
+  int missing = count(owner.begin(), owner.end(), -1);
+  if (missing > 0)
+    throw InvalidAccumulationFile(
+        fmt::format("{} tiles out of {} are missing", missing, owner.size()));
+  if (frame)
+    *frame = first_frame;
+  return result;
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "bvh.h"
+#include <algorithm>
+
+// Number of bins used to evaluate the surface area heuristic
+static const int NUM_OF_BINS = 16;
+
+// Return the coordinate of `p` along `axis` (0 = x, 1 = y, 2 = z)
+static inline float _axis_coord(const Point &p, int axis) {
+  return axis == 0 ? p.x : (axis == 1 ? p.y : p.z);
+}
+
+void BVH::build(const vector<AABB> &boxes, int leaf_size) {
+  clear();
+  if (boxes.empty())
+    return;
+
+  vector<Point> centroids(boxes.size());
+  indices.resize(boxes.size());
+  for (int i{}; i < boxes.size(); i++) {
+    centroids[i] = boxes[i].centroid();
+    indices[i] = i;
+  }
+
+  // A binary tree with N leaves has 2N - 1 nodes
+  nodes.reserve(2 * boxes.size() - 1);
+  BVHNode root;
+  root.first = 0;
+  root.count = boxes.size();
+  nodes.push_back(root);
+
+  _subdivide(0, 0, leaf_size, boxes, centroids);
+  nodes.shrink_to_fit();
+}
+
+void BVH::refit(const vector<AABB> &boxes) {
+  // Children are always stored after their parent
+  for (int i = nodes.size() - 1; i >= 0; i--) {
+    BVHNode &node = nodes[i];
+    node.bounds = AABB();
+    if (node.count > 0) {
+      for (int j{node.first}; j < node.first + node.count; j++)
+        node.bounds.expand(boxes[indices[j]]);
+    } else {
+      node.bounds.expand(nodes[node.first].bounds);
+      node.bounds.expand(nodes[node.first + 1].bounds);
+    }
+  }
+}
+
+void BVH::_subdivide(int node_index, int depth, int leaf_size,
+                     const vector<AABB> &boxes,
+                     const vector<Point> &centroids) {
+  int first = nodes[node_index].first, count = nodes[node_index].count;
+
+  AABB bounds, centroid_bounds;
+  for (int i{first}; i < first + count; i++) {
+    bounds.expand(boxes[indices[i]]);
+    centroid_bounds.expand(centroids[indices[i]]);
+  }
+  nodes[node_index].bounds = bounds;
+
+  if (count <= leaf_size || depth >= max_depth)
+    return;
+
+  // Look for the cheapest split among the bin boundaries of every axis
+  float best_cost = numeric_limits<float>::infinity();
+  int best_axis = -1, best_split = 0;
+  for (int axis{}; axis < 3; axis++) {
+    float lower = _axis_coord(centroid_bounds.min, axis);
+    float upper = _axis_coord(centroid_bounds.max, axis);
+    if (lower == upper)
+      continue; // All the centroids are aligned along this axis
+
+    AABB bin_bounds[NUM_OF_BINS];
+    int bin_count[NUM_OF_BINS] = {};
+    float scale = NUM_OF_BINS / (upper - lower);
+    for (int i{first}; i < first + count; i++) {
+      int bin = static_cast<int>(
+          (_axis_coord(centroids[indices[i]], axis) - lower) * scale);
+      bin = min(bin, NUM_OF_BINS - 1);
+      bin_count[bin]++;
+      bin_bounds[bin].expand(boxes[indices[i]]);
+    }
+
+    // Sweep from the right to know the cost of each right partition
+    float right_area[NUM_OF_BINS - 1];
+    int right_count[NUM_OF_BINS - 1];
+    AABB right_box;
+    int right_sum = 0;
+    for (int i{NUM_OF_BINS - 1}; i > 0; i--) {
+      right_box.expand(bin_bounds[i]);
+      right_sum += bin_count[i];
+      right_area[i - 1] = right_box.half_area();
+      right_count[i - 1] = right_sum;
+    }
+
+    AABB left_box;
+    int left_sum = 0;
+    for (int i{}; i < NUM_OF_BINS - 1; i++) {
+      left_box.expand(bin_bounds[i]);
+      left_sum += bin_count[i];
+      if (left_sum == 0 || right_count[i] == 0)
+        continue;
+
+      float cost = left_sum * left_box.half_area() +
+                   right_count[i] * right_area[i];
+      if (cost < best_cost) {
+        best_cost = cost;
+        best_axis = axis;
+        best_split = i;
+      }
+    }
+  }
+
+  // If all the centroids coincide there is no way to split the node
+  if (best_axis < 0)
+    return;
+
+  float lower = _axis_coord(centroid_bounds.min, best_axis);
+  float upper = _axis_coord(centroid_bounds.max, best_axis);
+  float scale = NUM_OF_BINS / (upper - lower);
+  auto middle = partition(
+      indices.begin() + first, indices.begin() + first + count, [&](int i) {
+        int bin = static_cast<int>(
+            (_axis_coord(centroids[i], best_axis) - lower) * scale);
+        return min(bin, NUM_OF_BINS - 1) <= best_split;
+      });
+  int left_count = static_cast<int>(middle - indices.begin()) - first;
+
+  // Children are always allocated in pairs, see BVHNode
+  int left_index = nodes.size();
+  BVHNode left, right;
+  left.first = first;
+  left.count = left_count;
+  right.first = first + left_count;
+  right.count = count - left_count;
+  nodes.push_back(left);
+  nodes.push_back(right);
+
+  nodes[node_index].first = left_index;
+  nodes[node_index].count = 0;
+
+  _subdivide(left_index, depth + 1, leaf_size, boxes, centroids);
+  _subdivide(left_index + 1, depth + 1, leaf_size, boxes, centroids);
+}
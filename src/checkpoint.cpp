@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "checkpoint.h"
+#include "fmtlib.h"
+#include "stats.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+
+Checkpointer::Checkpointer(const AccumulationBuffer &_buffer, int _tile_size,
+                           const string &_file_name, const string &_frame,
+                           double interval)
+    : tile_mutexes(TileBounds::num_of_tiles(_tile_size, _buffer.width,
+                                            _buffer.height)),
+      buffer{_buffer}, tile_size{_tile_size}, file_name{_file_name},
+      frame{_frame}, snapshot(_buffer.width, _buffer.height) {
+  if (interval > 0.)
+    writer = thread([this, interval]() { _run(interval); });
+}
+
+Checkpointer::~Checkpointer() { stop(); }
+
+void Checkpointer::stop() {
+  {
+    lock_guard<mutex> lock(stop_mutex);
+    stopping = true;
+  }
+  stop_requested.notify_all();
+  if (writer.joinable())
+    writer.join();
+}
+
+void Checkpointer::write() {
+  lock_guard<mutex> lock(write_mutex);
+  vector<int> tiles(tile_mutexes.size());
+  for (int tile{}; tile < tiles.size(); tile++) {
+    tiles[tile] = tile;
+    TileBounds bounds(tile, tile_size, buffer.width, buffer.height);
+    lock_guard<mutex> tile_lock(tile_mutexes[tile]);
+    for (int row{bounds.first_row}; row < bounds.last_row; row++) {
+      int first = buffer.pixel_offset(bounds.first_col, row);
+      int last = buffer.pixel_offset(bounds.last_col, row);
+      copy(buffer.sums.begin() + first, buffer.sums.begin() + last,
+           snapshot.sums.begin() + first);
+      copy(buffer.sums_lum.begin() + first, buffer.sums_lum.begin() + last,
+           snapshot.sums_lum.begin() + first);
+      copy(buffer.sums_sq.begin() + first, buffer.sums_sq.begin() + last,
+           snapshot.sums_sq.begin() + first);
+      copy(buffer.counts.begin() + first, buffer.counts.begin() + last,
+           snapshot.counts.begin() + first);
+    }
+  }
+
+  string temporary_file = file_name + ".tmp";
+  snapshot.write_tiles(temporary_file, tiles, tile_size, frame);
+  if (rename(temporary_file.c_str(), file_name.c_str()) != 0)
+    throw ios_base::failure("Unable to replace " + file_name);
+}
+
+void Checkpointer::_run(double interval) {
+  unique_lock<mutex> lock(stop_mutex);
+  while (!stop_requested.wait_for(lock, chrono::duration<double>(interval),
+                                  [&]() { return stopping; })) {
+    lock.unlock();
+    try {
+      Timer t;
+      write();
+      fmt::print("Checkpoint {} written in {:.2f} s\n", file_name,
+                 t.elapsed());
+    } catch (exception &e) {
+      // The rendering goes on: the next checkpoint may succeed
+      fmt::print("WARNING: unable to write the checkpoint {}: {}\n",
+                 file_name, e.what());
+    }
+    lock.lock();
+  }
+}
+
+AccumulationBuffer read_checkpoint(const string &file_name, int width,
+                                   int height, const string &frame) {
+  string file_frame;
+  AccumulationBuffer buffer = merge_tile_files({file_name}, &file_frame);
+  if (buffer.width != width || buffer.height != height)
+    throw InvalidAccumulationFile(
+        fmt::format("{} holds an image of {}x{} pixels", file_name,
+                    buffer.width, buffer.height));
+  if (file_frame != frame)
+    throw InvalidAccumulationFile(file_name +
+                                  " was rendered with other options");
+  return buffer;
+}
@@ -0,0 +1,287 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "compiled_scene.h"
+#include "simd.h"
+#include "stats.h"
+
+static const float INF = numeric_limits<float>::infinity();
+
+void CompiledScene::build(const vector<shared_ptr<Shape>> &_shapes,
+                          const BVH *sphere_bvh) {
+  clear();
+
+  vector<int> spheres, planes;
+  vector<AABB> boxes;
+  for (int i{}; i < _shapes.size(); i++) {
+    Shape *shape = _shapes[i].get();
+    shapes.push_back(shape);
+    if (dynamic_cast<Sphere *>(shape)) {
+      spheres.push_back(i);
+      if (!sphere_bvh)
+        boxes.push_back(shape->bounding_box());
+    } else if (dynamic_cast<Plane *>(shape))
+      planes.push_back(i);
+    else
+      other_shapes.push_back(i);
+  }
+
+  if (sphere_bvh)
+    bvh = *sphere_bvh;
+  else
+    bvh.build(boxes, leaf_size);
+
+  // Store the spheres in the order of the leaves of the tree. The padding
+  // allows to always load `leaf_size` entries
+  int size = spheres.size() + leaf_size;
+  sphere_center_x.assign(size, 0.f);
+  sphere_center_y.assign(size, 0.f);
+  sphere_center_z.assign(size, 0.f);
+  sphere_inv_radius.assign(size, 0.f);
+  for (auto &entries : sphere_matrix)
+    entries.assign(size, 0.f);
+  sphere_is_simple.assign(size, 0);
+  sphere_shape.assign(size, -1);
+  for (int i{}; i < bvh.indices.size(); i++) {
+    int index = spheres[bvh.indices[i]];
+    const Sphere &sphere = *static_cast<Sphere *>(shapes[index]);
+    sphere_center_x[i] = sphere.center.x;
+    sphere_center_y[i] = sphere.center.y;
+    sphere_center_z[i] = sphere.center.z;
+    sphere_inv_radius[i] = sphere.inv_radius;
+    for (int row{}; row < 3; row++) {
+      for (int col{}; col < 4; col++)
+        sphere_matrix[4 * row + col][i] = sphere.world_to_object.m[row][col];
+    }
+    sphere_is_simple[i] = sphere.is_simple ? -1 : 0;
+    sphere_shape[i] = index;
+  }
+
+  num_of_planes = planes.size();
+  for (int col{}; col < 4; col++)
+    plane_row[col].assign(num_of_planes + leaf_size, 0.f);
+  plane_shape.assign(num_of_planes + leaf_size, -1);
+  for (int i{}; i < num_of_planes; i++) {
+    const AffineMatrix &m = shapes[planes[i]]->world_to_object;
+    for (int col{}; col < 4; col++)
+      plane_row[col][i] = m.m[2][col];
+    plane_shape[i] = planes[i];
+  }
+}
+
+void CompiledScene::clear() {
+  bvh.clear();
+  shapes.clear();
+  sphere_center_x.clear();
+  sphere_center_y.clear();
+  sphere_center_z.clear();
+  sphere_inv_radius.clear();
+  for (auto &entries : sphere_matrix)
+    entries.clear();
+  sphere_is_simple.clear();
+  sphere_shape.clear();
+  for (auto &entries : plane_row)
+    entries.clear();
+  plane_shape.clear();
+  num_of_planes = 0;
+  other_shapes.clear();
+}
+
+HitRecord CompiledScene::ray_intersection(const Ray &ray) const {
+  float closest = INF;
+  int closest_shape = -1;
+
+  for (int first{}; first < num_of_planes; first += leaf_size)
+    _intersect_planes(ray, first, min(leaf_size, num_of_planes - first),
+                      closest, closest_shape);
+
+  for (int i : other_shapes) {
+    HitRecord intersection = shapes[i]->ray_intersection(ray);
+    if (intersection.hit && intersection.t < closest) {
+      closest = intersection.t;
+      closest_shape = i;
+    }
+  }
+
+  long num_of_tests = num_of_planes + other_shapes.size();
+  bvh.traverse_leaves(ray, [&](const BVHNode &leaf) {
+    num_of_tests += leaf.count;
+    // Leaves can only be larger than leaf_size if the tree is too deep
+    int last = leaf.first + leaf.count;
+    for (int first{leaf.first}; first < last; first += leaf_size)
+      _intersect_spheres(ray, first, min(leaf_size, last - first), closest,
+                         closest_shape);
+    return closest_shape < 0 ? ray.tmax : closest;
+  });
+
+  if (stats_enabled())
+    thread_stats().intersection_tests += num_of_tests;
+
+  // The full record is computed by the winning shape alone
+  if (closest_shape < 0)
+    return HitRecord();
+  return shapes[closest_shape]->ray_intersection(ray);
+}
+
+#ifdef HAS_AVX2_KERNELS
+
+AVX2_FUNCTION static void _spheres_avx2(const CompiledScene &scene,
+                                        const Ray &ray, int first, float *t) {
+  __m256 x = _mm256_set1_ps(ray.origin.x);
+  __m256 y = _mm256_set1_ps(ray.origin.y);
+  __m256 z = _mm256_set1_ps(ray.origin.z);
+  __m256 dx = _mm256_set1_ps(ray.dir.x);
+  __m256 dy = _mm256_set1_ps(ray.dir.y);
+  __m256 dz = _mm256_set1_ps(ray.dir.z);
+
+  // Translation and uniform scaling, see Sphere::is_simple
+  __m256 inv_radius = _mm256_loadu_ps(&scene.sphere_inv_radius[first]);
+  __m256 simple_ox = _mm256_mul_ps(
+      _mm256_sub_ps(x, _mm256_loadu_ps(&scene.sphere_center_x[first])),
+      inv_radius);
+  __m256 simple_oy = _mm256_mul_ps(
+      _mm256_sub_ps(y, _mm256_loadu_ps(&scene.sphere_center_y[first])),
+      inv_radius);
+  __m256 simple_oz = _mm256_mul_ps(
+      _mm256_sub_ps(z, _mm256_loadu_ps(&scene.sphere_center_z[first])),
+      inv_radius);
+  __m256 simple_dx = _mm256_mul_ps(inv_radius, dx);
+  __m256 simple_dy = _mm256_mul_ps(inv_radius, dy);
+  __m256 simple_dz = _mm256_mul_ps(inv_radius, dz);
+
+  // Generic transformation
+  __m256 m[12];
+  for (int k{}; k < 12; k++)
+    m[k] = _mm256_loadu_ps(&scene.sphere_matrix[k][first]);
+  __m256 ox = affine_row_avx2(m[0], m[1], m[2], &m[3], x, y, z);
+  __m256 oy = affine_row_avx2(m[4], m[5], m[6], &m[7], x, y, z);
+  __m256 oz = affine_row_avx2(m[8], m[9], m[10], &m[11], x, y, z);
+  __m256 odx = affine_row_avx2(m[0], m[1], m[2], nullptr, dx, dy, dz);
+  __m256 ody = affine_row_avx2(m[4], m[5], m[6], nullptr, dx, dy, dz);
+  __m256 odz = affine_row_avx2(m[8], m[9], m[10], nullptr, dx, dy, dz);
+
+  __m256 is_simple = _mm256_castsi256_ps(_mm256_loadu_si256(
+      reinterpret_cast<const __m256i *>(&scene.sphere_is_simple[first])));
+  ox = _mm256_blendv_ps(ox, simple_ox, is_simple);
+  oy = _mm256_blendv_ps(oy, simple_oy, is_simple);
+  oz = _mm256_blendv_ps(oz, simple_oz, is_simple);
+  odx = _mm256_blendv_ps(odx, simple_dx, is_simple);
+  ody = _mm256_blendv_ps(ody, simple_dy, is_simple);
+  odz = _mm256_blendv_ps(odz, simple_dz, is_simple);
+
+  _mm256_storeu_ps(t, unit_sphere_t_avx2(ox, oy, oz, odx, ody, odz,
+                                         _mm256_set1_ps(ray.tmin),
+                                         _mm256_set1_ps(ray.tmax)));
+}
+
+AVX2_FUNCTION static void _planes_avx2(const CompiledScene &scene,
+                                       const Ray &ray, int first, float *t) {
+  __m256 m0 = _mm256_loadu_ps(&scene.plane_row[0][first]);
+  __m256 m1 = _mm256_loadu_ps(&scene.plane_row[1][first]);
+  __m256 m2 = _mm256_loadu_ps(&scene.plane_row[2][first]);
+  __m256 m3 = _mm256_loadu_ps(&scene.plane_row[3][first]);
+  __m256 oz = affine_row_avx2(m0, m1, m2, &m3, _mm256_set1_ps(ray.origin.x),
+                              _mm256_set1_ps(ray.origin.y),
+                              _mm256_set1_ps(ray.origin.z));
+  __m256 dz = affine_row_avx2(m0, m1, m2, nullptr, _mm256_set1_ps(ray.dir.x),
+                              _mm256_set1_ps(ray.dir.y),
+                              _mm256_set1_ps(ray.dir.z));
+  _mm256_storeu_ps(t, plane_t_avx2(oz, dz, _mm256_set1_ps(ray.tmin),
+                                   _mm256_set1_ps(ray.tmax)));
+}
+
+#endif
+
+static void _spheres_scalar(const CompiledScene &scene, const Ray &ray,
+                            int first, int count, float *t) {
+  for (int lane{}; lane < count; lane++) {
+    int i = first + lane;
+    if (scene.sphere_is_simple[i]) {
+      float inv_radius = scene.sphere_inv_radius[i];
+      t[lane] = unit_sphere_t((ray.origin.x - scene.sphere_center_x[i]) *
+                                  inv_radius,
+                              (ray.origin.y - scene.sphere_center_y[i]) *
+                                  inv_radius,
+                              (ray.origin.z - scene.sphere_center_z[i]) *
+                                  inv_radius,
+                              inv_radius * ray.dir.x, inv_radius * ray.dir.y,
+                              inv_radius * ray.dir.z, ray.tmin, ray.tmax);
+    } else {
+      float m[12];
+      for (int k{}; k < 12; k++)
+        m[k] = scene.sphere_matrix[k][i];
+      const Point &o = ray.origin;
+      const Vec &d = ray.dir;
+      t[lane] = unit_sphere_t(
+          m[0] * o.x + m[1] * o.y + m[2] * o.z + m[3],
+          m[4] * o.x + m[5] * o.y + m[6] * o.z + m[7],
+          m[8] * o.x + m[9] * o.y + m[10] * o.z + m[11],
+          m[0] * d.x + m[1] * d.y + m[2] * d.z,
+          m[4] * d.x + m[5] * d.y + m[6] * d.z,
+          m[8] * d.x + m[9] * d.y + m[10] * d.z, ray.tmin, ray.tmax);
+    }
+  }
+}
+
+void CompiledScene::_intersect_spheres(const Ray &ray, int first, int count,
+                                       float &closest,
+                                       int &closest_shape) const {
+  float t[leaf_size];
+#ifdef HAS_AVX2_KERNELS
+  if (simd_enabled())
+    _spheres_avx2(*this, ray, first, t);
+  else
+#endif
+    _spheres_scalar(*this, ray, first, count, t);
+
+  // Lanes are checked in order, so that ties are broken like in World
+  for (int lane{}; lane < count; lane++) {
+    if (t[lane] < closest) {
+      closest = t[lane];
+      closest_shape = sphere_shape[first + lane];
+    }
+  }
+}
+
+void CompiledScene::_intersect_planes(const Ray &ray, int first, int count,
+                                      float &closest,
+                                      int &closest_shape) const {
+  float t[leaf_size];
+#ifdef HAS_AVX2_KERNELS
+  if (simd_enabled())
+    _planes_avx2(*this, ray, first, t);
+  else
+#endif
+    for (int lane{}; lane < count; lane++) {
+      int i = first + lane;
+      float oz = plane_row[0][i] * ray.origin.x +
+                 plane_row[1][i] * ray.origin.y +
+                 plane_row[2][i] * ray.origin.z + plane_row[3][i];
+      float dz = plane_row[0][i] * ray.dir.x + plane_row[1][i] * ray.dir.y +
+                 plane_row[2][i] * ray.dir.z;
+      t[lane] = plane_t(oz, dz, ray.tmin, ray.tmax);
+    }
+
+  for (int lane{}; lane < count; lane++) {
+    if (t[lane] < closest) {
+      closest = t[lane];
+      closest_shape = plane_shape[first + lane];
+    }
+  }
+}
@@ -113,7 +113,7 @@ string Transformation::to_str() {
 
 Transformation Transformation::inverse() { return Transformation{invm, m}; }
 
-Point Transformation::operator*(Point p) {
+Point Transformation::operator*(Point p) const {
   float x = m[0][0] * p.x + m[0][1] * p.y + m[0][2] * p.z + m[0][3];
   float y = m[1][0] * p.x + m[1][1] * p.y + m[1][2] * p.z + m[1][3];
   float z = m[2][0] * p.x + m[2][1] * p.y + m[2][2] * p.z + m[2][3];
@@ -137,6 +137,13 @@ Transformation Transformation::operator*(Transformation t) {
   return Transformation{result_m, result_invm};
 }
 
+AffineMatrix::AffineMatrix(const float _m[4][4]) {
+  for (int i{}; i < 3; i++) {
+    for (int j{}; j < 4; j++)
+      m[i][j] = _m[i][j];
+  }
+}
+
 // Translation transformation
 Transformation translation(Vec vec) {
   float _m[4][4] = {{1.0, 0.0, 0.0, vec.x},
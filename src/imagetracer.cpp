@@ -18,30 +18,201 @@
  */
 
 #include "imagetracer.h"
+#include "stats.h"
+#include <atomic>
+
+void ImageTracer::_init_footprint() {
+  if (!camera || image.width <= 0)
+    return;
+  float step = 1.f / (image.width * max(samples_per_side, 1));
+  Ray center = camera->fire_ray(0.5f, 0.5f);
+  Ray next = camera->fire_ray(0.5f + step, 0.5f);
+  ray_footprint = (next.origin - center.origin).norm();
+  ray_spread = (next.dir - center.dir).norm();
+}
 
 void ImageTracer::fire_all_rays(function<Color(const Ray &)> func) {
+  function<Color(const Ray &, PCG &)> ray_func =
+      [&func](const Ray &ray, PCG &) { return func(ray); };
+  PacketFunction wrapper = _to_packet(ray_func);
   for (int row{}; row < image.height; row++) {
     for (int col{}; col < image.width; col++) {
-      Color cum_color;
-
-      if (samples_per_side > 0) {
-        for (int inter_pixel_row{}; inter_pixel_row < samples_per_side;
-             ++inter_pixel_row) {
-          for (int inter_pixel_col{}; inter_pixel_col < samples_per_side;
-               ++inter_pixel_col) {
-            float u_pixel =
-                (inter_pixel_col + pcg.random_float()) / samples_per_side;
-            float v_pixel =
-                (inter_pixel_row + pcg.random_float()) / samples_per_side;
-            Ray ray = fire_ray(col, row, u_pixel, v_pixel);
-            cum_color = cum_color + func(ray);
-          }
+      PCG generator = pixel_pcg(col, row);
+      image.set_pixel(col, row, _sample_pixel(col, row, wrapper, generator));
+    }
+  }
+}
+
+void ImageTracer::fire_all_rays(function<Color(const Ray &, PCG &)> func,
+                                int num_of_threads) {
+  fire_all_rays(_to_packet(func), num_of_threads);
+}
+
+void ImageTracer::fire_all_rays(PacketFunction func, int num_of_threads) {
+  _for_each_tile(
+      [&](int col, int row) {
+        PCG generator = pixel_pcg(col, row);
+        image.set_pixel(col, row, _sample_pixel(col, row, func, generator));
+      },
+      num_of_threads);
+}
+
+void ImageTracer::fire_pass(function<Color(const Ray &, PCG &)> func,
+                            AccumulationBuffer &buffer, int num_of_threads) {
+  fire_pass(_to_packet(func), buffer, num_of_threads);
+}
+
+void ImageTracer::fire_pass(PacketFunction func, AccumulationBuffer &buffer,
+                            int num_of_threads) {
+  int num_of_samples = samples_per_pixel();
+  _for_each_tile(
+      [&](int col, int row) {
+        PCG generator =
+            pixel_pcg(col, row, buffer.get_count(col, row) / num_of_samples);
+        double sum_lum = 0., sum_sq = 0.;
+        Color sum = _sum_samples(col, row, func, generator, &sum_lum, &sum_sq);
+        buffer.add(col, row, sum, sum_lum, sum_sq, num_of_samples);
+        image.set_pixel(col, row, buffer.get_mean(col, row));
+      },
+      num_of_threads);
+}
+
+void ImageTracer::fire_adaptive(function<Color(const Ray &, PCG &)> func,
+                                AccumulationBuffer &buffer, float max_error,
+                                int min_samples, int max_samples,
+                                int num_of_threads) {
+  fire_adaptive(_to_packet(func), buffer, max_error, min_samples, max_samples,
+                num_of_threads);
+}
+
+void ImageTracer::fire_adaptive(PacketFunction func, AccumulationBuffer &buffer,
+                                float max_error, int min_samples,
+                                int max_samples, int num_of_threads) {
+  int num_of_samples = samples_per_pixel();
+  // The variance cannot be estimated with less than two samples
+  min_samples = max(min_samples, 2);
+  _for_each_tile(
+      [&](int col, int row) {
+        while (buffer.get_count(col, row) < min_samples ||
+               (buffer.get_count(col, row) < max_samples &&
+                buffer.get_relative_error(col, row) > max_error)) {
+          PCG generator =
+              pixel_pcg(col, row, buffer.get_count(col, row) / num_of_samples);
+          double sum_lum = 0., sum_sq = 0.;
+          Color sum =
+              _sum_samples(col, row, func, generator, &sum_lum, &sum_sq);
+          buffer.add(col, row, sum, sum_lum, sum_sq, num_of_samples);
         }
-        image.set_pixel(col, row, cum_color * (1. / pow(samples_per_side, 2)));
-      } else {
-        Ray ray = fire_ray(col, row);
-        image.set_pixel(col, row, func(ray));
-      }
+        image.set_pixel(col, row, buffer.get_mean(col, row));
+      },
+      num_of_threads);
+}
+
+void ImageTracer::_for_each_tile(const function<void(int, int)> &func,
+                                 int num_of_threads) {
+  int num_to_render = tiles.empty() ? num_of_tiles() : tiles.size();
+  // Render the i-th tile of the list
+  auto fire = [&](int i) { _fire_tile(tiles.empty() ? i : tiles[i], func); };
+
+  if (pool) {
+    pool->run(num_to_render, fire);
+    return;
+  }
+
+  if (num_of_threads <= 0)
+    num_of_threads = max(1u, thread::hardware_concurrency());
+  num_of_threads = max(1, min(num_of_threads, num_to_render));
+
+  // Every worker keeps taking the next tile which has not been rendered yet
+  atomic<int> next_tile{0};
+  auto worker = [&]() {
+    for (int i = next_tile++; i < num_to_render; i = next_tile++)
+      fire(i);
+  };
+
+  vector<thread> pool;
+  for (int i{1}; i < num_of_threads; i++)
+    pool.emplace_back(worker);
+  worker(); // The calling thread works as well
+  for (auto &t : pool)
+    t.join();
+}
+
+Color ImageTracer::_sample_pixel(int col, int row,
+                                 const PacketFunction &func, PCG &_pcg) {
+  Color sum = _sum_samples(col, row, func, _pcg);
+  if (samples_per_side <= 0)
+    return sum;
+  return sum * (1. / pow(samples_per_side, 2));
+}
+
+// Add the luminosity of `color` to `sum_lum` and its square to `sum_sq`,
+// unless they are null
+static inline void _add_luminosity(Color color, double *sum_lum,
+                                   double *sum_sq) {
+  double lum = color.luminosity();
+  if (sum_lum)
+    *sum_lum += lum;
+  if (sum_sq)
+    *sum_sq += lum * lum;
+}
+
+Color ImageTracer::_sum_samples(int col, int row, const PacketFunction &func,
+                                PCG &_pcg, double *sum_lum,
+                                double *sum_sq) {
+  Ray rays[RayPacket::max_size];
+  Color colors[RayPacket::max_size];
+
+  if (samples_per_side <= 0) {
+    rays[0] = fire_ray(col, row);
+    if (stats_enabled())
+      thread_stats().camera_rays++;
+    func(rays, 1, colors, _pcg);
+    _add_luminosity(colors[0], sum_lum, sum_sq);
+    return colors[0];
+  }
+
+  Color cum_color;
+  int num_of_samples = samples_per_side * samples_per_side;
+  for (int first{}; first < num_of_samples; first += RayPacket::max_size) {
+    int size = min(num_of_samples - first, RayPacket::max_size);
+    for (int i{}; i < size; i++) {
+      int inter_pixel_row = (first + i) / samples_per_side;
+      int inter_pixel_col = (first + i) % samples_per_side;
+      float u_pixel =
+          (inter_pixel_col + _pcg.random_float()) / samples_per_side;
+      float v_pixel =
+          (inter_pixel_row + _pcg.random_float()) / samples_per_side;
+      rays[i] = fire_ray(col, row, u_pixel, v_pixel);
+    }
+
+    if (stats_enabled())
+      thread_stats().camera_rays += size;
+    func(rays, size, colors, _pcg);
+    for (int i{}; i < size; i++) {
+      cum_color = cum_color + colors[i];
+      _add_luminosity(colors[i], sum_lum, sum_sq);
     }
   }
-}
\ No newline at end of file
+  return cum_color;
+}
+
+ImageTracer::PacketFunction
+ImageTracer::_to_packet(const function<Color(const Ray &, PCG &)> &func) {
+  // Only a reference is captured, so that no memory is allocated
+  return [&func](const Ray *rays, int n, Color *colors, PCG &_pcg) {
+    for (int i{}; i < n; i++)
+      colors[i] = func(rays[i], _pcg);
+  };
+}
+
+void ImageTracer::_fire_tile(int tile, const function<void(int, int)> &func) {
+  TileBounds bounds(tile, tile_size, image.width, image.height);
+  unique_lock<mutex> lock;
+  if (tile_mutexes)
+    lock = unique_lock<mutex>((*tile_mutexes)[tile]);
+  for (int row{bounds.first_row}; row < bounds.last_row; row++) {
+    for (int col{bounds.first_col}; col < bounds.last_col; col++)
+      func(col, row);
+  }
+}
@@ -0,0 +1,293 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "json.h"
+#include <cstdlib>
+
+// Nesting level beyond which a document is rejected, so that a malicious
+// input cannot overflow the stack of the recursive parser
+static const int MAX_DEPTH = 64;
+
+const JsonValue *JsonValue::find(const string &key) const {
+  if (type != JsonType::object)
+    return nullptr;
+  auto it = object.find(key);
+  return it == object.end() ? nullptr : &it->second;
+}
+
+// Unlike isdigit, safe with any char
+static inline bool _is_digit(char c) { return c >= '0' && c <= '9'; }
+
+namespace {
+// A recursive descent parser over the whole text
+struct JsonParser {
+  string_view text;
+  size_t pos = 0;
+
+  [[noreturn]] void fail(const string &message) {
+    throw JsonError(message + " at offset " + to_string(pos));
+  }
+
+  void skip_spaces() {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t' ||
+                                 text[pos] == '\n' || text[pos] == '\r'))
+      pos++;
+  }
+
+  void expect(char c) {
+    skip_spaces();
+    if (pos >= text.size() || text[pos] != c)
+      fail(string("expected '") + c + "'");
+    pos++;
+  }
+
+  // Skip the comma separating two elements, if there is one
+  bool skip_comma() {
+    skip_spaces();
+    if (pos >= text.size() || text[pos] != ',')
+      return false;
+    pos++;
+    return true;
+  }
+
+  void expect_word(string_view word) {
+    if (text.substr(pos, word.size()) != word)
+      fail("invalid value");
+    pos += word.size();
+  }
+
+  JsonValue parse_value(int depth) {
+    if (depth > MAX_DEPTH)
+      fail("too many nested values");
+    skip_spaces();
+    if (pos >= text.size())
+      fail("unexpected end of the document");
+
+    JsonValue value;
+    char c = text[pos];
+    if (c == '{') {
+      value.type = JsonType::object;
+      pos++;
+      skip_spaces();
+      if (pos < text.size() && text[pos] == '}') {
+        pos++;
+        return value;
+      }
+      while (true) {
+        skip_spaces();
+        if (pos >= text.size() || text[pos] != '"')
+          fail("expected a string");
+        string key = parse_string();
+        expect(':');
+        value.object[key] = parse_value(depth + 1);
+        if (!skip_comma())
+          break;
+      }
+      expect('}');
+    } else if (c == '[') {
+      value.type = JsonType::array;
+      pos++;
+      skip_spaces();
+      if (pos < text.size() && text[pos] == ']') {
+        pos++;
+        return value;
+      }
+      while (true) {
+        value.array.push_back(parse_value(depth + 1));
+        if (!skip_comma())
+          break;
+      }
+      expect(']');
+    } else if (c == '"') {
+      value.type = JsonType::string;
+      value.str = parse_string();
+    } else if (c == 't' || c == 'f') {
+      value.type = JsonType::boolean;
+      value.boolean = c == 't';
+      expect_word(value.boolean ? "true" : "false");
+    } else if (c == 'n') {
+      expect_word("null");
+    } else if (c == '-' || _is_digit(c)) {
+      value.type = JsonType::number;
+      value.number = parse_number();
+    } else
+      fail("invalid value");
+    return value;
+  }
+
+  double parse_number() {
+    size_t start = pos;
+    auto skip_digits = [&]() {
+      size_t first = pos;
+      while (pos < text.size() && _is_digit(text[pos]))
+        pos++;
+      if (pos == first)
+        fail("invalid number");
+    };
+    if (text[pos] == '-')
+      pos++;
+    skip_digits();
+    if (pos < text.size() && text[pos] == '.') {
+      pos++;
+      skip_digits();
+    }
+    if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+      pos++;
+      if (pos < text.size() && (text[pos] == '+' || text[pos] == '-'))
+        pos++;
+      skip_digits();
+    }
+    // strtod needs a terminated string
+    return strtod(string(text.substr(start, pos - start)).c_str(), nullptr);
+  }
+
+  unsigned parse_hex4() {
+    if (pos + 4 > text.size())
+      fail("invalid escape sequence");
+    unsigned code = 0;
+    for (int i{}; i < 4; i++) {
+      char c = text[pos++];
+      code <<= 4;
+      if (c >= '0' && c <= '9')
+        code |= c - '0';
+      else if (c >= 'a' && c <= 'f')
+        code |= c - 'a' + 10;
+      else if (c >= 'A' && c <= 'F')
+        code |= c - 'A' + 10;
+      else
+        fail("invalid escape sequence");
+    }
+    return code;
+  }
+
+  // Append the UTF-8 encoding of `code` to `str`
+  static void append_utf8(string &str, unsigned code) {
+    if (code < 0x80)
+      str += static_cast<char>(code);
+    else if (code < 0x800) {
+      str += static_cast<char>(0xc0 | (code >> 6));
+      str += static_cast<char>(0x80 | (code & 0x3f));
+    } else if (code < 0x10000) {
+      str += static_cast<char>(0xe0 | (code >> 12));
+      str += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      str += static_cast<char>(0x80 | (code & 0x3f));
+    } else {
+      str += static_cast<char>(0xf0 | (code >> 18));
+      str += static_cast<char>(0x80 | ((code >> 12) & 0x3f));
+      str += static_cast<char>(0x80 | ((code >> 6) & 0x3f));
+      str += static_cast<char>(0x80 | (code & 0x3f));
+    }
+  }
+
+  string parse_string() {
+    pos++; // Opening quote
+    string result;
+    while (true) {
+      if (pos >= text.size())
+        fail("unterminated string");
+      char c = text[pos++];
+      if (c == '"')
+        return result;
+      if (static_cast<unsigned char>(c) < 0x20)
+        fail("control character in string");
+      if (c != '\\') {
+        result += c;
+        continue;
+      }
+
+      if (pos >= text.size())
+        fail("unterminated string");
+      switch (text[pos++]) {
+      case '"':
+        result += '"';
+        break;
+      case '\\':
+        result += '\\';
+        break;
+      case '/':
+        result += '/';
+        break;
+      case 'b':
+        result += '\b';
+        break;
+      case 'f':
+        result += '\f';
+        break;
+      case 'n':
+        result += '\n';
+        break;
+      case 'r':
+        result += '\r';
+        break;
+      case 't':
+        result += '\t';
+        break;
+      case 'u': {
+        unsigned code = parse_hex4();
+        // Characters outside the basic plane are written as surrogate pairs
+        if (code >= 0xd800 && code < 0xdc00 &&
+            text.substr(pos, 2) == "\\u") {
+          pos += 2;
+          unsigned low = parse_hex4();
+          if (low < 0xdc00 || low >= 0xe000)
+            fail("invalid surrogate pair");
+          code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+        }
+        append_utf8(result, code);
+        break;
+      }
+      default:
+        fail("invalid escape sequence");
+      }
+    }
+  }
+};
+} // namespace
+
+JsonValue parse_json(string_view text) {
+  JsonParser parser{text};
+  JsonValue value = parser.parse_value(0);
+  parser.skip_spaces();
+  if (parser.pos != text.size())
+    parser.fail("unexpected text after the value");
+  return value;
+}
+
+string json_quote(string_view text) {
+  static const char hex_digits[] = "0123456789abcdef";
+  string result = "\"";
+  for (char c : text) {
+    if (c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if (c == '\n')
+      result += "\\n";
+    else if (c == '\t')
+      result += "\\t";
+    else if (c == '\r')
+      result += "\\r";
+    else if (static_cast<unsigned char>(c) < 0x20) {
+      result += "\\u00";
+      result += hex_digits[c >> 4];
+      result += hex_digits[c & 0xf];
+    } else
+      result += c;
+  }
+  return result + "\"";
+}
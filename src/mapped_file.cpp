@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "mapped_file.h"
+#include <cerrno>
+#include <fcntl.h>
+#include <ios>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Open `file_name` for reading and store its size in `size`
+static int _open_file(const string &file_name, size_t &size) {
+  int fd = open(file_name.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw ios_base::failure("File does not exist");
+
+  struct stat info;
+  if (fstat(fd, &info) < 0) {
+    close(fd);
+    throw ios_base::failure("Unable to read the file");
+  }
+  size = info.st_size;
+  return fd;
+}
+
+MappedFile::MappedFile(const string &file_name, bool writable,
+                       bool sequential) {
+  int fd = _open_file(file_name, _size);
+
+  // An empty file cannot be mapped
+  if (_size > 0) {
+    int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+    void *address = mmap(nullptr, _size, protection, MAP_PRIVATE, fd, 0);
+    if (address == MAP_FAILED) {
+      close(fd);
+      throw ios_base::failure("Unable to map the file");
+    }
+    if (sequential)
+      madvise(address, _size, MADV_SEQUENTIAL);
+    _data = static_cast<char *>(address);
+  }
+  // The mapping stays valid after the file is closed
+  close(fd);
+}
+
+MappedFile::~MappedFile() {
+  if (_data)
+    munmap(_data, _size);
+}
+
+string read_file(const string &file_name) {
+  size_t size;
+  int fd = _open_file(file_name, size);
+
+  string buffer(size, '\0');
+  size_t num_of_bytes = 0;
+  while (num_of_bytes < buffer.size()) {
+    ssize_t result =
+        ::read(fd, &buffer[num_of_bytes], buffer.size() - num_of_bytes);
+    if (result < 0 && errno == EINTR)
+      continue;
+    if (result < 0) {
+      close(fd);
+      throw ios_base::failure("Unable to read the file");
+    }
+    if (result == 0)
+      break; // The file was truncated meanwhile
+    num_of_bytes += result;
+  }
+  close(fd);
+  buffer.resize(num_of_bytes);
+  return buffer;
+}
@@ -26,17 +26,105 @@ Color CheckeredPigment::operator()(Vec2d uv) {
   return ((int_u % 2) == (int_v % 2)) ? color1 : color2;
 }
 
+void Texture::build_mipmaps(int num_of_threads) {
+  auto levels = make_shared<vector<HdrImage>>();
+  // The first level needs the pixels of the file in an HdrImage
+  if (image)
+    levels->push_back(image->half_size(num_of_threads));
+  else if (tiled)
+    levels->push_back(tiled->to_image().half_size(num_of_threads));
+  else
+    levels->push_back(HdrImage(*mapped).half_size(num_of_threads));
+  while (levels->back().width > 1 || levels->back().height > 1)
+    levels->push_back(levels->back().half_size(num_of_threads));
+  mipmaps = levels;
+}
+
+void Texture::make_tiled(int num_of_threads) {
+  if (tiled)
+    return;
+  if (image)
+    tiled = make_shared<const TiledImage>(*image, num_of_threads);
+  else
+    tiled = make_shared<const TiledImage>(*mapped, num_of_threads);
+  image = nullptr;
+  mapped = nullptr;
+}
+
+size_t Texture::memory_usage() const {
+  size_t bytes = 0;
+  if (tiled)
+    bytes = tiled->pixels.size() * sizeof(Color);
+  else if (mapped)
+    bytes = 12 * size_t(mapped->width) * mapped->height;
+  else if (image)
+    bytes = image->pixels.size() * sizeof(Color);
+  if (mipmaps) {
+    for (const auto &level : *mipmaps)
+      bytes += level.pixels.size() * sizeof(Color);
+  }
+  return bytes;
+}
+
 Color ImagePigment::operator()(Vec2d uv) {
-  int col = static_cast<int>(uv.u * image.width);
-  int row = static_cast<int>(uv.v * image.height);
+  int width = texture.width(), height = texture.height();
+  int col = static_cast<int>(uv.u * width);
+  int row = static_cast<int>(uv.v * height);
+
+  if (col >= width)
+    col = width - 1;
+
+  if (row >= height)
+    row = height - 1;
+
+  return texture.get_pixel(col, row);
+}
+
+Color ImagePigment::filtered(Vec2d uv, Vec2d footprint) {
+  if (filter == TextureFilter::nearest)
+    return (*this)(uv);
+
+  // The level where the longest side of the footprint is as large as a pixel
+  int max_level = texture.num_of_levels() - 1;
+  float texels = max(footprint.u * texture.width(),
+                     footprint.v * texture.height());
+  float level = texels > 1.f ? log2(texels) : 0.f;
+  if (level >= max_level)
+    return _bilinear(max_level, uv);
+
+  if (filter == TextureFilter::bilinear)
+    return _bilinear(static_cast<int>(level + 0.5f), uv);
+
+  int lower = static_cast<int>(level);
+  float weight = level - lower;
+  if (weight == 0.f)
+    return _bilinear(lower, uv);
+  return _bilinear(lower, uv) * (1.f - weight) +
+         _bilinear(lower + 1, uv) * weight;
+}
+
+Color ImagePigment::_bilinear(int level, Vec2d uv) {
+  const HdrImage *image = texture.level_image(level);
+  int width = image ? image->width : texture.width();
+  int height = image ? image->height : texture.height();
 
-  if (col >= image.width)
-    col = image.width - 1;
+  // Pixel centers are at half-integer coordinates
+  float x = uv.u * width - 0.5f, y = uv.v * height - 0.5f;
+  float floor_x = floor(x), floor_y = floor(y);
+  float dx = x - floor_x, dy = y - floor_y;
 
-  if (row >= image.height)
-    row = image.height - 1;
+  int x0 = static_cast<int>(floor_x) % width;
+  if (x0 < 0)
+    x0 += width;
+  int x1 = x0 + 1 < width ? x0 + 1 : 0;
+  int y0 = max(0, min(static_cast<int>(floor_y), height - 1));
+  int y1 = max(0, min(static_cast<int>(floor_y) + 1, height - 1));
 
-  return image.get_pixel(col, row);
+  auto fetch = [&](int px, int py) {
+    return image ? image->get_pixel(px, py) : texture.get_pixel(px, py);
+  };
+  return (fetch(x0, y0) * (1.f - dx) + fetch(x1, y0) * dx) * (1.f - dy) +
+         (fetch(x0, y1) * (1.f - dx) + fetch(x1, y1) * dx) * dy;
 }
 
 Ray DiffusiveBRDF::scatter_ray(PCG &pcg, Vec inc_dir, Point interaction_point,
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "packet.h"
+#include "simd.h"
+
+static const float INF = numeric_limits<float>::infinity();
+
+RayPacket::RayPacket(const Ray *_rays, int _size) : rays{_rays}, size{_size} {
+  for (int i{}; i < max_size; i++) {
+    // Unused lanes copy the first ray, but accept no distance at all
+    const Ray &ray = rays[i < size ? i : 0];
+    origin_x[i] = ray.origin.x;
+    origin_y[i] = ray.origin.y;
+    origin_z[i] = ray.origin.z;
+    dir_x[i] = ray.dir.x;
+    dir_y[i] = ray.dir.y;
+    dir_z[i] = ray.dir.z;
+    inv_dir_x[i] = 1.f / ray.dir.x;
+    inv_dir_y[i] = 1.f / ray.dir.y;
+    inv_dir_z[i] = 1.f / ray.dir.z;
+    tmin[i] = i < size ? ray.tmin : INF;
+    tmax[i] = i < size ? ray.tmax : -INF;
+  }
+}
+
+#ifdef HAS_AVX2_KERNELS
+
+AVX2_FUNCTION static void _simple_sphere_avx2(const Point &center,
+                                              float inv_radius,
+                                              const RayPacket &packet,
+                                              float *t) {
+  __m256 scale = _mm256_set1_ps(inv_radius);
+  __m256 ox = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(packet.origin_x),
+                                          _mm256_set1_ps(center.x)),
+                            scale);
+  __m256 oy = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(packet.origin_y),
+                                          _mm256_set1_ps(center.y)),
+                            scale);
+  __m256 oz = _mm256_mul_ps(_mm256_sub_ps(_mm256_loadu_ps(packet.origin_z),
+                                          _mm256_set1_ps(center.z)),
+                            scale);
+  __m256 dx = _mm256_mul_ps(scale, _mm256_loadu_ps(packet.dir_x));
+  __m256 dy = _mm256_mul_ps(scale, _mm256_loadu_ps(packet.dir_y));
+  __m256 dz = _mm256_mul_ps(scale, _mm256_loadu_ps(packet.dir_z));
+  _mm256_storeu_ps(t, unit_sphere_t_avx2(ox, oy, oz, dx, dy, dz,
+                                         _mm256_loadu_ps(packet.tmin),
+                                         _mm256_loadu_ps(packet.tmax)));
+}
+
+// Apply row `row` of `m` to the points (or vectors, if `is_point` is false)
+// of the packet
+AVX2_FUNCTION static inline __m256 _transform_avx2(const float (&row)[4],
+                                                   __m256 x, __m256 y,
+                                                   __m256 z, bool is_point) {
+  __m256 m3 = _mm256_set1_ps(row[3]);
+  return affine_row_avx2(_mm256_set1_ps(row[0]), _mm256_set1_ps(row[1]),
+                         _mm256_set1_ps(row[2]), is_point ? &m3 : nullptr, x,
+                         y, z);
+}
+
+AVX2_FUNCTION static void _sphere_avx2(const AffineMatrix &m,
+                                       const RayPacket &packet, float *t) {
+  __m256 x = _mm256_loadu_ps(packet.origin_x);
+  __m256 y = _mm256_loadu_ps(packet.origin_y);
+  __m256 z = _mm256_loadu_ps(packet.origin_z);
+  __m256 ox = _transform_avx2(m.m[0], x, y, z, true);
+  __m256 oy = _transform_avx2(m.m[1], x, y, z, true);
+  __m256 oz = _transform_avx2(m.m[2], x, y, z, true);
+
+  x = _mm256_loadu_ps(packet.dir_x);
+  y = _mm256_loadu_ps(packet.dir_y);
+  z = _mm256_loadu_ps(packet.dir_z);
+  __m256 dx = _transform_avx2(m.m[0], x, y, z, false);
+  __m256 dy = _transform_avx2(m.m[1], x, y, z, false);
+  __m256 dz = _transform_avx2(m.m[2], x, y, z, false);
+  _mm256_storeu_ps(t, unit_sphere_t_avx2(ox, oy, oz, dx, dy, dz,
+                                         _mm256_loadu_ps(packet.tmin),
+                                         _mm256_loadu_ps(packet.tmax)));
+}
+
+AVX2_FUNCTION static void _plane_avx2(const AffineMatrix &m,
+                                      const RayPacket &packet, float *t) {
+  __m256 oz = _transform_avx2(m.m[2], _mm256_loadu_ps(packet.origin_x),
+                              _mm256_loadu_ps(packet.origin_y),
+                              _mm256_loadu_ps(packet.origin_z), true);
+  __m256 dz = _transform_avx2(m.m[2], _mm256_loadu_ps(packet.dir_x),
+                              _mm256_loadu_ps(packet.dir_y),
+                              _mm256_loadu_ps(packet.dir_z), false);
+  _mm256_storeu_ps(t, plane_t_avx2(oz, dz, _mm256_loadu_ps(packet.tmin),
+                                   _mm256_loadu_ps(packet.tmax)));
+}
+
+AVX2_FUNCTION static void _slab_avx2(float min, float max,
+                                     const float *origin,
+                                     const float *inv_dir, __m256 &tmin,
+                                     __m256 &tmax) {
+  __m256 o = _mm256_loadu_ps(origin);
+  __m256 inv = _mm256_loadu_ps(inv_dir);
+  __m256 t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(min), o), inv);
+  __m256 t2 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(max), o), inv);
+  // The order of the operands makes NaNs (0 * ∞) ignored, like fmin/fmax do
+  tmin = _mm256_max_ps(_mm256_min_ps(t1, t2), tmin);
+  tmax = _mm256_min_ps(_mm256_max_ps(t1, t2), tmax);
+}
+
+AVX2_FUNCTION static bool _box_avx2(const Point &min, const Point &max,
+                                    const RayPacket &packet,
+                                    const float *closest) {
+  __m256 tmin = _mm256_loadu_ps(packet.tmin);
+  __m256 tmax = _mm256_loadu_ps(closest);
+  _slab_avx2(min.x, max.x, packet.origin_x, packet.inv_dir_x, tmin, tmax);
+  _slab_avx2(min.y, max.y, packet.origin_y, packet.inv_dir_y, tmin, tmax);
+  _slab_avx2(min.z, max.z, packet.origin_z, packet.inv_dir_z, tmin, tmax);
+  int mask = _mm256_movemask_ps(_mm256_cmp_ps(tmin, tmax, _CMP_LE_OQ));
+  return (mask & ((1 << packet.size) - 1)) != 0;
+}
+
+#endif
+
+void packet_intersect_simple_sphere(const Point &center, float inv_radius,
+                                    const RayPacket &packet, float *t) {
+#ifdef HAS_AVX2_KERNELS
+  if (simd_enabled())
+    return _simple_sphere_avx2(center, inv_radius, packet, t);
+#endif
+  for (int i{}; i < RayPacket::max_size; i++) {
+    t[i] = unit_sphere_t((packet.origin_x[i] - center.x) * inv_radius,
+                         (packet.origin_y[i] - center.y) * inv_radius,
+                         (packet.origin_z[i] - center.z) * inv_radius,
+                         inv_radius * packet.dir_x[i],
+                         inv_radius * packet.dir_y[i],
+                         inv_radius * packet.dir_z[i], packet.tmin[i],
+                         packet.tmax[i]);
+  }
+}
+
+void packet_intersect_sphere(const AffineMatrix &world_to_object,
+                             const RayPacket &packet, float *t) {
+#ifdef HAS_AVX2_KERNELS
+  if (simd_enabled())
+    return _sphere_avx2(world_to_object, packet, t);
+#endif
+  for (int i{}; i < RayPacket::max_size; i++) {
+    Point origin = world_to_object * Point{packet.origin_x[i],
+                                           packet.origin_y[i],
+                                           packet.origin_z[i]};
+    Vec dir = world_to_object *
+              Vec{packet.dir_x[i], packet.dir_y[i], packet.dir_z[i]};
+    t[i] = unit_sphere_t(origin.x, origin.y, origin.z, dir.x, dir.y, dir.z,
+                         packet.tmin[i], packet.tmax[i]);
+  }
+}
+
+void packet_intersect_plane(const AffineMatrix &world_to_object,
+                            const RayPacket &packet, float *t) {
+#ifdef HAS_AVX2_KERNELS
+  if (simd_enabled())
+    return _plane_avx2(world_to_object, packet, t);
+#endif
+  const float(&m)[4] = world_to_object.m[2];
+  for (int i{}; i < RayPacket::max_size; i++) {
+    float oz = m[0] * packet.origin_x[i] + m[1] * packet.origin_y[i] +
+               m[2] * packet.origin_z[i] + m[3];
+    float dz = m[0] * packet.dir_x[i] + m[1] * packet.dir_y[i] +
+               m[2] * packet.dir_z[i];
+    t[i] = plane_t(oz, dz, packet.tmin[i], packet.tmax[i]);
+  }
+}
+
+bool packet_intersect_box(const Point &min, const Point &max,
+                          const RayPacket &packet, const float *closest) {
+#ifdef HAS_AVX2_KERNELS
+  if (simd_enabled())
+    return _box_avx2(min, max, packet, closest);
+#endif
+  for (int i{}; i < packet.size; i++) {
+    float tmin = packet.tmin[i], tmax = closest[i];
+    float t1 = (min.x - packet.origin_x[i]) * packet.inv_dir_x[i];
+    float t2 = (max.x - packet.origin_x[i]) * packet.inv_dir_x[i];
+    tmin = fmax(tmin, fmin(t1, t2));
+    tmax = fmin(tmax, fmax(t1, t2));
+    t1 = (min.y - packet.origin_y[i]) * packet.inv_dir_y[i];
+    t2 = (max.y - packet.origin_y[i]) * packet.inv_dir_y[i];
+    tmin = fmax(tmin, fmin(t1, t2));
+    tmax = fmin(tmax, fmax(t1, t2));
+    t1 = (min.z - packet.origin_z[i]) * packet.inv_dir_z[i];
+    t2 = (max.z - packet.origin_z[i]) * packet.inv_dir_z[i];
+    tmin = fmax(tmin, fmin(t1, t2));
+    tmax = fmin(tmax, fmax(t1, t2));
+    if (tmin <= tmax)
+      return true;
+  }
+  return false;
+}
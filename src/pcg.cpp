@@ -19,6 +19,18 @@
 
 #include "pcg.h"
 
+// The multiplier of the underlying linear congruential generator
+static const uint64_t MULTIPLIER = 6364136223846793005u;
+
+// A bijective hash of 64-bit integers (the finalizer of SplitMix64): close
+// pixel indices are turned into unrelated sequences
+static uint64_t _mix(uint64_t x) {
+  x += 0x9e3779b97f4a7c15u;
+  x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9u;
+  x = (x ^ (x >> 27)) * 0x94d049bb133111ebu;
+  return x ^ (x >> 31);
+}
+
 PCG::PCG(uint64_t init_state, uint64_t init_seq) {
   inc = (init_seq << 1) | 1;
   random(); // Throw a random number and discard it
@@ -28,10 +40,35 @@ PCG::PCG(uint64_t init_state, uint64_t init_seq) {
 
 uint32_t PCG::random() {
   uint64_t old_state = state;
-  state = old_state * 6364136223846793005 + inc;
+  state = old_state * MULTIPLIER + inc;
 
   uint32_t xorshifted = ((old_state >> 18) ^ old_state) >> 27;
   uint32_t rot = old_state >> 59;
 
   return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
-}
\ No newline at end of file
+}
+
+void PCG::advance(uint64_t delta) {
+  // Compose the affine maps state -> a * state + c of the steps, squaring
+  // them at each bit of delta (Brown, "Random number generation with
+  // arbitrary strides", 1994)
+  uint64_t step_mult = MULTIPLIER, step_plus = inc;
+  uint64_t total_mult = 1, total_plus = 0;
+  while (delta > 0) {
+    if (delta & 1) {
+      total_mult *= step_mult;
+      total_plus = total_plus * step_mult + step_plus;
+    }
+    step_plus = (step_mult + 1) * step_plus;
+    step_mult *= step_mult;
+    delta >>= 1;
+  }
+  state = total_mult * state + total_plus;
+}
+
+PCG PCG::stream(uint64_t init_state, uint64_t init_seq, uint64_t pixel,
+                uint64_t sample) {
+  PCG pcg(init_state, init_seq ^ _mix(pixel));
+  pcg.advance(sample * sample_stride);
+  return pcg;
+}
@@ -20,161 +20,169 @@
 #include "HdrImage.h"
 #include "args.hxx"
 #include "camera.h"
+#include "checkpoint.h"
 #include "imagetracer.h"
+#include "json.h"
 #include "materials.h"
 #include "render.h"
+#include "render_settings.h"
+#include "scene_cache.h"
 #include "scene_file.h"
+#include "serve.h"
+#include "simd.h"
+#include "stats.h"
 #include "world.h"
-#include <chrono>
+#include <atomic>
+#include <filesystem>
 #include <memory>
+#include <numeric>
 
 using namespace std;
 
 /**
- * @brief Timer class to easily time code execution
- * Highly inspired (if not entirely copied) from
- * https://www.learncpp.com/cpp-tutorial/timing-your-code/
+ * @brief Check the options shared by `render` and `render-animation`,
+ * exiting on errors, and return the number of samples per side of each pixel
  *
+ * @param settings
+ * @return int
  */
-struct Timer {
-private:
-  // Type aliases to make accessing nested type easier
-  using clock_t = chrono::high_resolution_clock;
-  using second_t = chrono::duration<double, ratio<1>>;
-
-  chrono::time_point<clock_t> m_beg;
+int check_settings(const RenderSettings &settings) {
+  string error = settings_error(settings);
+  if (error != "") {
+    fmt::print("ERROR: {}.\nExiting.\n", error);
+    exit(1);
+  }
 
-public:
-  /**
-   * @brief Construct a new Timer object with the time of calling
-   *
-   */
-  Timer() : m_beg{clock_t::now()} {}
-  /**
-   * @brief Resets the timer
-   *
-   */
-  void reset() { m_beg = clock_t::now(); }
+  // Checking if user defined an output file
+  if (settings.output_file == "")
+    throw invalid_argument("You must specify the output filename");
+  return static_cast<int>(sqrt(settings.samples_per_pixel));
+}
 
-  /**
-   * @brief Returns the elapsed time in proper units
-   *
-   * @return double
-   */
-  double elapsed() const {
-    return chrono::duration_cast<second_t>(clock_t::now() - m_beg).count();
+/**
+ * @brief Parse the input file defining the scene, exiting on errors
+ *
+ * @see read_scene_file
+ */
+Scene parse_scene_file(const RenderSettings &settings,
+                       const map<string, float> &vars,
+                       const vector<string> &animated_variables,
+                       shared_ptr<TextureCache> textures) {
+  try {
+    return read_scene_file(settings, vars, animated_variables, textures);
+  } catch (ios_base::failure &) {
+    fmt::print("ERROR: unable to open {} file\n", settings.input_scene);
+    exit(1);
+  } catch (GrammarError &e) {
+    fmt::print(e.what());
+    exit(1);
   }
-};
+}
 
 /**
- * @brief Split a string (using boost would be better, but for only one
- * function it would have been overkill). Method found here:
- * https://stackoverflow.com/questions/289347/using-strtok-with-a-stdstring
+ * @brief Return the scene cache written by compile-scene for `scene_file`
+ * when no output file is given, which render uses in its place when it can
  *
- * @param str
- * @param delim
- * @param parts
+ * @param scene_file
+ * @return string
  */
-void split(const string &str, const string &delim, vector<string> &parts) {
-  size_t start, end = 0;
-  while (end < str.size()) {
-    start = end;
-    while (start < str.size() && (delim.find(str[start]) != string::npos)) {
-      start++; // skip initial whitespace
-    }
-    end = start;
-    while (end < str.size() && (delim.find(str[end]) == string::npos)) {
-      end++; // skip to end of word
-    }
-    if (end - start != 0) { // just ignore zero-length strings.
-      parts.push_back(string(str, start, end - start));
-    }
+string default_scene_cache(const string &scene_file) {
+  return scene_file + ".bin";
+}
+
+/**
+ * @brief Check whether `cache_file` can be read in place of `scene_file`: it
+ * must be a scene cache of the current version, newer than the scene file and
+ * compiled with the variables `vars`
+ *
+ * @param cache_file
+ * @param scene_file
+ * @param vars
+ * @return true
+ * @return false
+ */
+bool is_scene_cache_usable(const string &cache_file, const string &scene_file,
+                           const map<string, float> &vars) {
+  error_code error;
+  auto cache_time = filesystem::last_write_time(cache_file, error);
+  if (error)
+    return false;
+  auto scene_time = filesystem::last_write_time(scene_file, error);
+  if (error || cache_time < scene_time)
+    return false;
+  try {
+    return scene_cache_variables(cache_file) == vars;
+  } catch (exception &) {
+    return false;
   }
 }
 
 /**
- * @brief Parse the list of `-d` switches and return a map associating
- * variable names with their values
+ * @brief Load the scene, exiting on errors. The input file is either a scene
+ * file or a scene cache (see compile-scene); a scene file is replaced by its
+ * cache when it is usable (see is_scene_cache_usable), unless some variables
+ * are animated
  *
- * @param definitions
- * @return map<string,float>
+ * @param settings
+ * @param vars the variables defined on the command line
+ * @param animated_variables the variables which change from a frame to the
+ * next, see InputStream::animated_variables
+ * @return Scene
  */
-map<string, float> build_vars_table(vector<string> &definitions) {
-  map<string, float> vars;
-  for (const auto &el : definitions) {
-    vector<string> parts;
-    split(el, ":", parts);
-    if (parts.size() != 2) {
-      fmt::print(
-          "ERROR: the definition {} does not follow the pattern NAME:VALUE\n",
-          el);
+Scene load_scene(const RenderSettings &settings, const map<string, float> &vars,
+                 const vector<string> &animated_variables = {}) {
+  Timer parse_timer;
+  string cache_file;
+  if (is_scene_cache(settings.input_scene)) {
+    if (!animated_variables.empty()) {
+      fmt::print("ERROR: animations must be rendered from the scene file, not "
+                 "from {}.\nExiting.\n",
+                 settings.input_scene);
       exit(1);
     }
-    string name = parts.at(0), value = parts.at(1);
-    float f_value = 0.;
+    cache_file = settings.input_scene;
+  } else if (animated_variables.empty() &&
+             is_scene_cache_usable(default_scene_cache(settings.input_scene),
+                                   settings.input_scene, vars))
+    cache_file = default_scene_cache(settings.input_scene);
+
+  auto textures = make_shared<TextureCache>();
+  Scene scene;
+  if (cache_file != "") {
+    fmt::print("Reading the compiled scene {}\n", cache_file);
+    TextureFilter filter = parse_texture_filter(settings.texture_filter);
     try {
-      f_value = stof(value);
-    } catch (invalid_argument &e) {
-      fmt::print("invalid floating point value {} in definition {}\n", value,
-                 el);
+      if (!vars.empty() && scene_cache_variables(cache_file) != vars) {
+        fmt::print("ERROR: {} was compiled with other values of the "
+                   "variables.\nExiting.\n",
+                   cache_file);
+        exit(1);
+      }
+      scene = read_scene_cache(cache_file, *textures,
+                               texture_options(settings), filter);
+    } catch (InvalidSceneCache &e) {
+      fmt::print("ERROR: {}: {}.\nExiting.\n", cache_file, e.what());
+      exit(1);
     }
-    vars[name] = f_value;
-  }
+  } else
+    scene = parse_scene_file(settings, vars, animated_variables, textures);
+  if (stats_enabled())
+    thread_stats().parse_seconds += parse_timer.elapsed();
 
-  return vars;
-}
-
-void imagerender(int width, int height, string algorithm, int init_state,
-                 int init_seq, int num_of_rays, int max_depth,
-                 int samples_per_pixel, string output_file, string input_scene,
-                 vector<string> &cli_vars) {
-
-  // Checking if antialiasing feature is on, and properly set
-  int samples_per_side = static_cast<int>(sqrt(samples_per_pixel));
-  if (pow(samples_per_side, 2) != samples_per_pixel) {
-    fmt::print("ERROR: the number of samples per pixel ({}) must be a perfect "
-               "square.\nExiting.\n",
-               samples_per_pixel);
-    exit(1);
-  }
-
-  // Checking if user defined an output file
-  if (output_file == "")
-    throw invalid_argument("You must specify the output filename");
-
-  string format = static_cast<string>(output_file)
-                      .erase(0, static_cast<string>(output_file).find(".") + 1);
-  string name = static_cast<string>(output_file)
-                    .substr(0, static_cast<string>(output_file).find("."));
-  if (format != output_file) // if user have specified a format
-    output_file = name;
-
-  string pfm_output = output_file + ".pfm";
-  string png_output;
-  if (format == "jpeg" || format == "jpg" || format == "JPEG")
-    png_output = output_file + ".jpg";
-  else
-    png_output = output_file + ".png";
-
-  // Parsing the input file defining the scene
-  ifstream scene_file(input_scene);
-  if (scene_file.fail()) {
-    fmt::print("ERROR: unable to open {} file\n", input_scene);
-    exit(1);
-  }
-  InputStream stream(scene_file, input_scene);
-  map<string, float> vars = build_vars_table(cli_vars);
-  Scene scene;
-  try {
-    scene = stream.parse_scene(vars);
-  } catch (GrammarError &e) {
-    fmt::print(e.what());
-    exit(1);
+  int num_of_textures = textures->num_of_textures();
+  size_t texture_bytes = textures->memory_usage();
+  if (num_of_textures > 0)
+    fmt::print("Loaded {} textures ({:.1f} MB)\n", num_of_textures,
+               texture_bytes / (1024. * 1024.));
+  if (stats_enabled()) {
+    thread_stats().textures += num_of_textures;
+    thread_stats().texture_bytes += texture_bytes;
   }
 
   /* Warn the user if the aspect_ratio specified by CLI or in input file is
    * different from width/height */
-  float _expected_aspect_ratio = static_cast<float>(width) / height;
+  float _expected_aspect_ratio =
+      static_cast<float>(settings.width) / settings.height;
   if (!are_close(scene.camera->aspect_ratio, _expected_aspect_ratio, 1e-3)) {
     fmt::print(
         "The aspect ratio you defined ({}) is not the ideal one ({}) for this "
@@ -197,46 +205,508 @@ void imagerender(int width, int height, string algorithm, int init_state,
       exit(1);
     }
   }
-  // Allocating the image
-  HdrImage image(width, height);
+  return scene;
+}
 
-  // Allocating the tracer
-  ImageTracer tracer(image, scene.camera, samples_per_side);
+/**
+ * @brief Print the statistics collected during the rendering and write them
+ * to a JSON file, as requested by the user
+ *
+ * @param settings
+ */
+void report_stats(const RenderSettings &settings) {
+  // The worker threads have ended, so their counters are included
+  RenderStats stats = collect_stats();
+  if (settings.stats)
+    stats.print();
+  if (settings.stats_json_file != "") {
+    ofstream json(settings.stats_json_file);
+    json << stats.to_json();
+    fmt::print("File {} has been written to disk. \n",
+               settings.stats_json_file);
+  }
+}
 
-  // Allocating the user-chosen renderer
-  shared_ptr<Renderer> renderer;
-  if (algorithm == "onoff") {
-    fmt::print("Using on/off renderer\n");
-    renderer = make_shared<OnOffRenderer>(scene.world);
-  } else if (algorithm == "flat") {
-    fmt::print("Using flat renderer\n");
-    renderer = make_shared<FlatRenderer>(scene.world);
-  } else if (algorithm == "pathtracing") {
-    fmt::print("Using a path tracer\n");
-    renderer = make_shared<PathTracer>(
-        scene.world, BLACK, PCG(init_state, init_seq), num_of_rays, max_depth);
+/**
+ * @brief Return the tiles rendered by a worker (see --tile-range and
+ * --worker), exiting on errors
+ *
+ * @param settings
+ * @return vector<int>
+ */
+vector<int> worker_tiles(const RenderSettings &settings) {
+  int num_of_tiles = TileBounds::num_of_tiles(
+      ImageTracer::tile_size, settings.width, settings.height);
+  string definition =
+      settings.tile_range != "" ? settings.tile_range : settings.worker;
+  vector<string> parts;
+  split(definition, ":", parts);
+  int first = 0, second = 0;
+  try {
+    if (parts.size() != 2)
+      throw invalid_argument(definition);
+    first = stoi(parts.at(0));
+    second = stoi(parts.at(1));
+  } catch (exception &) {
+    fmt::print("ERROR: {} does not follow the pattern {}.\nExiting.\n",
+               definition,
+               settings.tile_range != "" ? "FIRST:LAST" : "INDEX:COUNT");
+    exit(1);
+  }
+
+  vector<int> tiles;
+  if (settings.tile_range != "") {
+    if (first < 0 || first >= second || second > num_of_tiles) {
+      fmt::print("ERROR: the tile range {} is not within the {} tiles of "
+                 "the image.\nExiting.\n",
+                 definition, num_of_tiles);
+      exit(1);
+    }
+    for (int tile{first}; tile < second; tile++)
+      tiles.push_back(tile);
   } else {
-    fmt::print("Unknown renderer type.\nExiting.\n");
+    if (second <= 0 || first < 0 || first >= second) {
+      fmt::print("ERROR: invalid worker {}: the index must be between 0 and "
+                 "the number of workers minus one.\nExiting.\n",
+                 definition);
+      exit(1);
+    }
+    // Neighbouring tiles go to different workers, which balances the time
+    // they spend on the expensive parts of the image
+    for (int tile{first}; tile < num_of_tiles; tile += second)
+      tiles.push_back(tile);
+  }
+  return tiles;
+}
+
+/**
+ * @brief Describe the options which determine the samples of each pixel, so
+ * that merge only combines the tiles of the same frame
+ *
+ * @param settings
+ * @param vars
+ * @return string
+ */
+string frame_description(const RenderSettings &settings,
+                         const map<string, float> &vars) {
+  string description = fmt::format(
+      "scene={} algorithm={} samples-per-pixel={} num-of-rays={} "
+      "max-depth={} init-state={} init-seq={} texture-filter={}",
+      settings.input_scene, settings.algorithm, settings.samples_per_pixel,
+      settings.num_of_rays, settings.max_depth, settings.init_state,
+      settings.init_seq, settings.texture_filter);
+  if (settings.is_adaptive())
+    description +=
+        fmt::format(" max-error={} min-samples={} max-samples={}",
+                    settings.max_error, settings.min_samples,
+                    settings.max_samples);
+  for (const auto &var : vars)
+    description += fmt::format(" {}={}", var.first, var.second);
+  return description;
+}
+
+/**
+ * @brief Return the tiles among `tiles` whose pixels have less than
+ * `num_of_samples` samples. The passes give the same number of samples to
+ * all the pixels of a tile, so its first pixel is enough
+ *
+ * @param buffer
+ * @param tiles
+ * @param num_of_samples
+ * @return vector<int>
+ */
+vector<int> tiles_behind(const AccumulationBuffer &buffer,
+                         const vector<int> &tiles, int num_of_samples) {
+  vector<int> result;
+  for (int tile : tiles) {
+    TileBounds bounds(tile, ImageTracer::tile_size, buffer.width,
+                      buffer.height);
+    if (buffer.get_count(bounds.first_col, bounds.first_row) < num_of_samples)
+      result.push_back(tile);
+  }
+  return result;
+}
+
+void imagerender(RenderSettings settings, vector<string> &cli_vars) {
+  int samples_per_side = check_settings(settings);
+  string ldr_extension = split_output_file(settings.output_file);
+  string pfm_output = settings.output_file + ".pfm";
+  string png_output = settings.output_file + ldr_extension;
+
+  // Workers write the samples of their tiles to a partial accumulation file
+  // instead of the images
+  map<string, float> vars = build_vars_table(cli_vars);
+  vector<int> tiles;
+  string partial_output = settings.output_file + ".acc";
+  string frame = frame_description(settings, vars);
+  if (settings.is_worker()) {
+    if (settings.tile_range != "" && settings.worker != "") {
+      fmt::print("ERROR: --tile-range and --worker cannot be used "
+                 "together.\nExiting.\n");
+      exit(1);
+    }
+    if (settings.heatmap_file != "") {
+      fmt::print("ERROR: the heatmap of a distributed rendering is written by "
+                 "merge.\nExiting.\n");
+      exit(1);
+    }
+    tiles = worker_tiles(settings);
+    if (tiles.empty()) {
+      // More workers than tiles: this one has nothing to do
+      AccumulationBuffer(settings.width, settings.height)
+          .write_tiles(partial_output, tiles, ImageTracer::tile_size, frame);
+      fmt::print("File {} has been written to disk. \n", partial_output);
+      return;
+    }
+    fmt::print("Rendering {} tiles out of {}\n", tiles.size(),
+               TileBounds::num_of_tiles(ImageTracer::tile_size,
+                                        settings.width, settings.height));
+  }
+  if (settings.heatmap_file != "" && !settings.accumulates_samples()) {
+    fmt::print("ERROR: a single pass gives the same number of samples to all "
+               "the pixels: --heatmap needs adaptive sampling (or progressive "
+               "rendering).\nExiting.\n");
     exit(1);
   }
 
+  // Parsing the input file defining the scene
+  set_stats_enabled(settings.keeps_stats());
+  Scene scene = load_scene(settings, vars);
+
+  // Allocating the image
+  HdrImage image(settings.width, settings.height);
+
+  // Allocating the tracer: its generator seeds the one used by each tile
+  ImageTracer tracer(image, scene.camera, samples_per_side,
+                     PCG(settings.init_state, settings.init_seq));
+  tracer.tiles = tiles;
+
+  // Allocating the user-chosen renderer
+  shared_ptr<Renderer> renderer = make_renderer(settings, scene.world);
+
+  // Camera rays are intersected in packets, using AVX2 when available
+  fmt::print("Intersecting camera rays in packets of {}{}\n",
+             RayPacket::max_size, simd_enabled() ? " (AVX2)" : "");
+  auto render_ray = [&](const Ray *rays, int n, Color *colors, PCG &pcg) {
+    renderer->render_packet(rays, n, colors, pcg);
+  };
+
+  // Resuming from a checkpoint: the samples already taken are loaded, and
+  // only the missing ones are rendered
+  AccumulationBuffer buffer(settings.width, settings.height);
+  string checkpoint_file = settings.output_file + ".checkpoint";
+  if (settings.resume) {
+    try {
+      buffer = read_checkpoint(checkpoint_file, settings.width,
+                               settings.height, frame);
+    } catch (exception &e) {
+      fmt::print("ERROR: unable to resume the rendering: {}.\nExiting.\n",
+                 e.what());
+      exit(1);
+    }
+    tracer.image = buffer.to_image();
+    fmt::print("Resuming from {}\n", checkpoint_file);
+  }
+  unique_ptr<Checkpointer> checkpointer;
+  if (settings.checkpoint_interval > 0.) {
+    checkpointer.reset(new Checkpointer(buffer, ImageTracer::tile_size,
+                                        checkpoint_file, frame,
+                                        settings.checkpoint_interval));
+    tracer.tile_mutexes = &checkpointer->tile_mutexes;
+  }
+
   Timer t;
   // Rendering the image (time-consuming process, where the "magic" happens)
-  tracer.fire_all_rays([&](const Ray &ray) { return (*renderer)(ray); });
+  auto save = [&]() {
+    if (settings.is_worker()) {
+      buffer.write_tiles(partial_output, tiles, ImageTracer::tile_size, frame);
+      fmt::print("File {} has been written to disk. \n", partial_output);
+    } else
+      save_image(tracer.image, pfm_output, png_output);
+  };
+  if (settings.is_adaptive()) {
+    tracer.fire_adaptive(render_ray, buffer, settings.max_error,
+                         settings.min_samples, settings.max_samples,
+                         settings.num_of_threads);
+    // Only the pixels of the tiles of a worker have samples
+    fmt::print("Average number of samples per pixel: {}\n",
+               accumulate(buffer.counts.begin(), buffer.counts.end(), 0.) /
+                   (buffer.counts.size() -
+                    count(buffer.counts.begin(), buffer.counts.end(), 0)));
+  } else if (!settings.accumulates_samples()) {
+    tracer.fire_all_rays(render_ray, settings.num_of_threads);
+  } else {
+    vector<int> all_tiles = tiles;
+    for (int tile{}; tiles.empty() && tile < tracer.num_of_tiles(); tile++)
+      all_tiles.push_back(tile);
+    // A resumed rendering starts from the first pass which some tiles did
+    // not complete, and only renders those tiles in it
+    int first_pass = 1;
+    while (tiles_behind(buffer, all_tiles,
+                        first_pass * tracer.samples_per_pixel())
+               .empty())
+      first_pass++;
+
+    // Every pass refines the same buffer; a pass is never interrupted, so the
+    // time budget can be exceeded by the duration of the last one
+    Timer since_snapshot;
+    for (int pass{first_pass}; settings.passes <= 0 || pass <= settings.passes;
+         pass++) {
+      tracer.tiles = tiles_behind(buffer, all_tiles,
+                                  pass * tracer.samples_per_pixel());
+      tracer.fire_pass(render_ray, buffer, settings.num_of_threads);
+      // The pixels outside the tiles of a worker have no sample
+      if (settings.is_progressive())
+        fmt::print("Pass {} completed in {} s ({} samples per pixel)\n", pass,
+                   t.elapsed(),
+                   settings.is_worker() ? pass * tracer.samples_per_pixel()
+                                        : buffer.min_count());
+
+      if (pass == settings.passes ||
+          (settings.time_budget > 0. && t.elapsed() >= settings.time_budget))
+        break;
+
+      if ((settings.snapshot_every > 0 &&
+           pass % settings.snapshot_every == 0) ||
+          (settings.snapshot_interval > 0. &&
+           since_snapshot.elapsed() >= settings.snapshot_interval)) {
+        save();
+        since_snapshot.reset();
+      }
+    }
+  }
   fmt::print("Rendering completed in {} s\n", t.elapsed());
+  if (stats_enabled())
+    thread_stats().tracing_seconds += t.elapsed();
+
+  // The last checkpoint allows to add passes to the rendering later
+  if (checkpointer) {
+    checkpointer->stop();
+    try {
+      checkpointer->write();
+      fmt::print("File {} has been written to disk. \n", checkpoint_file);
+    } catch (exception &e) {
+      fmt::print("WARNING: unable to write the checkpoint {}: {}\n",
+                 checkpoint_file, e.what());
+    }
+  }
+
+  save();
+
+  if (settings.heatmap_file != "") {
+    buffer.count_heatmap().write_ldr_image(settings.heatmap_file.c_str(), 1.0);
+    fmt::print("File {} has been written to disk. \n", settings.heatmap_file);
+  }
+
+  report_stats(settings);
+}
+
+/**
+ * @brief The values taken by a variable in an animation: `first`,
+ * `first + step`, ... up to `last`
+ *
+ */
+struct AnimationRange {
+  string variable;
+  float first = 0., last = 0., step = 1.;
+
+  /**
+   * @brief Construct a new AnimationRange object from a definition following
+   * the pattern NAME:FIRST:LAST[:STEP], exiting on errors
+   *
+   * @param definition
+   */
+  AnimationRange(const string &definition) {
+    vector<string> parts;
+    split(definition, ":", parts);
+    if (parts.size() != 3 && parts.size() != 4) {
+      fmt::print("ERROR: the animation {} does not follow the pattern "
+                 "NAME:FIRST:LAST[:STEP]\n",
+                 definition);
+      exit(1);
+    }
+    variable = parts.at(0);
+    try {
+      first = stof(parts.at(1));
+      last = stof(parts.at(2));
+      if (parts.size() == 4)
+        step = stof(parts.at(3));
+    } catch (invalid_argument &e) {
+      fmt::print("ERROR: invalid floating point value in animation {}\n",
+                 definition);
+      exit(1);
+    }
+    if (step == 0. || (last - first) * step < 0.) {
+      fmt::print("ERROR: the animation {} never reaches its last value\n",
+                 definition);
+      exit(1);
+    }
+  }
+
+  /**
+   * @brief Return the number of frames of the animation
+   *
+   * @return int
+   */
+  int num_of_frames() const {
+    // The tolerance keeps `last` when rounding errors fall short of it
+    return static_cast<int>(floor((last - first) / step + 1e-4)) + 1;
+  }
+
+  /**
+   * @brief Return the value of the variable in the frame `frame`
+   *
+   * @param frame
+   * @return float
+   */
+  float value(int frame) const { return first + frame * step; }
+};
+
+void render_animation(RenderSettings settings, vector<string> &cli_vars,
+                      const string &animation, float luminosity) {
+  int samples_per_side = check_settings(settings);
+  if (settings.is_progressive() || settings.is_adaptive()) {
+    fmt::print("ERROR: animations cannot be rendered progressively nor with "
+               "adaptive sampling.\nExiting.\n");
+    exit(1);
+  }
+  if (settings.is_worker()) {
+    fmt::print("ERROR: only render can split an image among "
+               "workers.\nExiting.\n");
+    exit(1);
+  }
+  if (settings.uses_checkpoints()) {
+    fmt::print("ERROR: only render can write and resume from "
+               "checkpoints.\nExiting.\n");
+    exit(1);
+  }
+  string ldr_extension = split_output_file(settings.output_file);
+  AnimationRange range(animation);
+  int num_of_frames = range.num_of_frames();
+  int num_of_digits =
+      max(3, static_cast<int>(to_string(num_of_frames - 1).size()));
+
+  // The scene is parsed once: each frame only evaluates again the
+  // transformations depending on the animated variable
+  set_stats_enabled(settings.keeps_stats());
+  map<string, float> vars = build_vars_table(cli_vars);
+  vars[range.variable] = range.value(0);
+  Scene scene = load_scene(settings, vars, {range.variable});
+  make_renderer(settings, scene.world); // Check the algorithm
+  fmt::print("Rendering {} frames, moving the camera{}\n", num_of_frames,
+             scene.animated_shapes.empty()
+                 ? ""
+                 : fmt::format(" and {} shapes", scene.animated_shapes.size()));
+
+  // Frames are rendered in parallel; each of them only gets several threads
+  // when they outnumber the frames
+  int num_of_threads = settings.num_of_threads;
+  if (num_of_threads <= 0)
+    num_of_threads = max(1u, thread::hardware_concurrency());
+  int num_of_workers = min(num_of_threads, num_of_frames);
+  int threads_per_frame = max(1, num_of_threads / num_of_workers);
+
+  Timer t;
+  atomic<int> next_frame{0};
+  auto worker = [&]() {
+    for (int frame = next_frame++; frame < num_of_frames;
+         frame = next_frame++) {
+      map<string, float> values{{range.variable, range.value(frame)}};
 
-  // Writing pfm file
-  ofstream pfm_stream(pfm_output);
-  tracer.image.write_pfm(pfm_stream, Endianness::little_endian);
-  fmt::print("File {} has been written to disk\n", pfm_output);
+      // Unless shapes move, all the frames share the same world
+      World frame_world;
+      if (!scene.animated_shapes.empty())
+        frame_world = scene.world_at(values);
+      World &world =
+          scene.animated_shapes.empty() ? scene.world : frame_world;
 
-  // Apply tone - mapping to the image
-  tracer.image.normalize_image(1.0);
-  tracer.image.clamp_image();
+      shared_ptr<Renderer> renderer = make_renderer(settings, world, false);
+      ImageTracer tracer(HdrImage(settings.width, settings.height),
+                         scene.camera_at(values), samples_per_side,
+                         PCG(settings.init_state, settings.init_seq));
+      tracer.fire_all_rays(
+          [&](const Ray *rays, int n, Color *colors, PCG &pcg) {
+            renderer->render_packet(rays, n, colors, pcg);
+          },
+          threads_per_frame);
+
+      string name = fmt::format("{}{:0{}}", settings.output_file, frame,
+                                num_of_digits);
+      save_image(tracer.image, name + ".pfm", name + ldr_extension,
+                 luminosity);
+    }
+  };
+
+  vector<thread> pool;
+  for (int i{1}; i < num_of_workers; i++)
+    pool.emplace_back(worker);
+  worker(); // The calling thread works as well
+  for (auto &thread : pool)
+    thread.join();
+
+  fmt::print("Animation completed in {} s\n", t.elapsed());
+  if (stats_enabled())
+    thread_stats().tracing_seconds += t.elapsed();
+  report_stats(settings);
+}
+
+void compile_scene(RenderSettings settings, vector<string> &cli_vars) {
+  if (is_scene_cache(settings.input_scene)) {
+    fmt::print("ERROR: {} is already compiled.\nExiting.\n",
+               settings.input_scene);
+    exit(1);
+  }
+  string output_file = settings.output_file != ""
+                           ? settings.output_file
+                           : default_scene_cache(settings.input_scene);
 
-  // Writing image in ldr format (for now png)
-  tracer.image.write_ldr_image(png_output.c_str(), 1.0);
-  fmt::print("File {} has been written to disk. \n", png_output);
+  Timer t;
+  Scene scene = parse_scene_file(settings, build_vars_table(cli_vars), {},
+                                 make_shared<TextureCache>());
+  try {
+    write_scene_cache(scene, output_file);
+  } catch (exception &e) {
+    fmt::print("ERROR: unable to write {}: {}.\nExiting.\n", output_file,
+               e.what());
+    exit(1);
+  }
+  fmt::print("Scene with {} shapes compiled in {:.3f} s\n",
+             scene.world.shapes.size(), t.elapsed());
+  fmt::print("File {} has been written to disk. \n", output_file);
+}
+
+/**
+ * @brief Combine the partial accumulation files written by the workers of a
+ * distributed rendering into the images of the whole frame, exiting on
+ * errors
+ *
+ * @param file_names
+ * @param output_file
+ * @param heatmap_file where to write the number of samples of each pixel, or
+ * the empty string
+ */
+void merge(const vector<string> &file_names, string output_file,
+           const string &heatmap_file) {
+  if (output_file == "")
+    throw invalid_argument("You must specify the output filename");
+  string ldr_extension = split_output_file(output_file);
+
+  AccumulationBuffer buffer;
+  string frame;
+  try {
+    buffer = merge_tile_files(file_names, &frame);
+  } catch (exception &e) {
+    fmt::print("ERROR: {}.\nExiting.\n", e.what());
+    exit(1);
+  }
+  fmt::print("Merged {} files ({})\n", file_names.size(), frame);
+
+  HdrImage image = buffer.to_image();
+  save_image(image, output_file + ".pfm", output_file + ldr_extension);
+  if (heatmap_file != "") {
+    buffer.count_heatmap().write_ldr_image(heatmap_file.c_str(), 1.0);
+    fmt::print("File {} has been written to disk. \n", heatmap_file);
+  }
 }
 
 struct pfm2png {
@@ -259,13 +729,8 @@ pfm2png::pfm2png(string input_pfm_filename, string output_filename,
   luminosity = _luminosity;
   fmt::print("File {} has been read from disk. \n", input_pfm_filename);
 
-  // Run Tone-Mapping
-  if (luminosity == 0.) {
-    image.normalize_image(factor);
-  } else {
-    image.normalize_image(factor, luminosity);
-  }
-  image.clamp_image();
+  // Run Tone-Mapping (a luminosity of 0 is calculated from the image)
+  image.tone_map(factor, luminosity);
 
   // Open output file
   image.write_ldr_image(output_filename.c_str(), gamma);
@@ -279,6 +744,23 @@ int interface(int argc, char **argv) {
 
   args::Command render(commands, "render",
                        "Use this command to produce an image");
+  args::Command render_animation_command(
+      commands, "render-animation",
+      "Use this command to produce the frames of an animation, in which a "
+      "variable of the scene takes a range of values");
+  args::Command compile_scene_command(
+      commands, "compile-scene",
+      "Use this command to compile a scene file into a binary file, which "
+      "render reads much faster (by default <input-scene>.bin, which render "
+      "uses in place of the scene file while it is newer)");
+  args::Command serve_command(
+      commands, "serve",
+      "Use this command to keep scenes in memory and render the jobs sent "
+      "on the standard input (or --socket), one JSON object per line");
+  args::Command merge_command(
+      commands, "merge",
+      "Use this command to combine the files written by the workers of a "
+      "distributed rendering (see --worker and --tile-range) into the image");
   args::Command convertpfm2png(
       commands, "convertpfm2png",
       "Use this option to convert a HDR image to PNG format");
@@ -299,7 +781,7 @@ int interface(int argc, char **argv) {
   args::ValueFlag<string> algorithm(
       render_arguments, "",
       "Type of renderer to use to produce image, "
-      "can either be 'flat', 'onoff' or 'pathtracing'",
+      "can either be 'flat', 'onoff', 'pathtracing' or 'iterative'",
       {"alg", "algorithm"});
   args::ValueFlag<string> output_filename(
       render_arguments, "",
@@ -313,7 +795,8 @@ int interface(int argc, char **argv) {
       {"num-of-rays"});
   args::ValueFlag<int> max_depth(render_arguments, "",
                                  "Maximum allowed ray depth (only applicable "
-                                 "with --algorithm=pathtracing).",
+                                 "with --algorithm=pathtracing or "
+                                 "--algorithm=iterative).",
                                  {"max-depth"});
   args::ValueFlag<int> init_state(
       render_arguments, "",
@@ -327,14 +810,124 @@ int interface(int argc, char **argv) {
       render_arguments, "",
       "Number of samples per pixel (must be a perfect square, e.g., 16).",
       {"samples-per-pixel"});
+  args::ValueFlag<int> threads(
+      render_arguments, "",
+      "Number of threads used to render the image (default: all the "
+      "available cores). The image does not depend on it.",
+      {"threads"}, 0);
+  args::ValueFlag<int> passes(
+      render_arguments, "",
+      "Number of progressive passes, each adding --samples-per-pixel samples "
+      "to every pixel (default: 1, use 0 for no limit).",
+      {"passes"}, 1);
+  args::ValueFlag<double> time_budget(
+      render_arguments, "",
+      "Stop the progressive rendering after the pass exceeding this number "
+      "of seconds (default: no limit).",
+      {"time-budget"}, 0.);
+  args::ValueFlag<int> snapshot_every(
+      render_arguments, "",
+      "Write the output files every N progressive passes.",
+      {"snapshot-every"}, 0);
+  args::ValueFlag<double> snapshot_interval(
+      render_arguments, "",
+      "Write the output files every T seconds of progressive rendering.",
+      {"snapshot-interval"}, 0.);
+  args::ValueFlag<float> max_error(
+      render_arguments, "",
+      "Enable adaptive sampling: keep sampling each pixel until the relative "
+      "error of its luminosity drops below this value (e.g., 0.02).",
+      {"max-error"}, 0.);
+  args::ValueFlag<int> min_samples(
+      render_arguments, "",
+      "Minimum number of samples per pixel with adaptive sampling.",
+      {"min-samples"}, 16);
+  args::ValueFlag<int> max_samples(
+      render_arguments, "",
+      "Maximum number of samples per pixel with adaptive sampling.",
+      {"max-samples"}, 1024);
+  args::ValueFlag<string> heatmap(
+      render_arguments, "",
+      "Write an image showing the number of samples taken on each pixel "
+      "(png or jpeg), with adaptive sampling or progressive rendering.",
+      {"heatmap"});
+  args::Flag map_textures(
+      render_arguments, "",
+      "Read little-endian pfm textures from the files mapped in memory, "
+      "without copying them.",
+      {"map-textures"});
+  args::Flag tiled_textures(
+      render_arguments, "",
+      "Store the textures in square tiles of pixels instead of rows, which "
+      "is faster for large textures.",
+      {"tiled-textures"});
+  args::ValueFlag<string> texture_filter(
+      render_arguments, "",
+      "How textures are sampled: nearest, bilinear or trilinear. The last two "
+      "build mip pyramids, and average the texture over the area seen by "
+      "each camera ray.",
+      {"texture-filter"}, "nearest");
+  args::Flag stats(render_arguments, "",
+                   "Print statistics about the rays traced and the time "
+                   "spent in each stage.",
+                   {"stats"});
+  args::ValueFlag<string> stats_json(
+      render_arguments, "", "Write the statistics to a JSON file.",
+      {"stats-json"});
   args::ValueFlag<string> scene_file(render_arguments, "",
                                      "Input file defining the scene.",
                                      {'i', "input-scene"});
+  args::ValueFlag<string> animate(
+      render_arguments, "",
+      "Variable to animate and its values, with render-animation. The syntax "
+      "is «--animate=VAR:FIRST:LAST[:STEP]». Example: --animate=angle:0:359:1",
+      {"animate"});
   args::ValueFlagList<string> declare_float(
       render_arguments, "",
       "Declare a variable. The syntax is «--declare-float=VAR:VALUE». Example: "
       "--declare-float=clock:150",
       {'d', "declare-float"});
+  args::ValueFlag<string> tile_range(
+      render_arguments, "",
+      "Only render the tiles from FIRST to LAST - 1 (tiles are squares of "
+      "32x32 pixels, numbered row by row), and write their samples to "
+      "<outf>.acc for merge. The syntax is «--tile-range=FIRST:LAST».",
+      {"tile-range"});
+  args::ValueFlag<string> worker(
+      render_arguments, "",
+      "Render the tiles of worker INDEX out of COUNT (one tile every COUNT, "
+      "starting from INDEX), and write their samples to <outf>.acc for "
+      "merge. The syntax is «--worker=INDEX:COUNT».",
+      {"worker"});
+  args::ValueFlag<double> checkpoint_interval(
+      render_arguments, "",
+      "Save the samples taken so far to <outf>.checkpoint every T seconds, "
+      "and at the end of the rendering.",
+      {"checkpoint-interval"}, 0.);
+  args::Flag resume(
+      render_arguments, "",
+      "Resume the rendering from <outf>.checkpoint. The other options must "
+      "be the same; more passes can be added.",
+      {"resume"});
+  args::PositionalList<string> partial_files(
+      render_arguments, "files",
+      "With merge, the files written by the workers (in any order).");
+  args::ValueFlag<string> socket_path(
+      render_arguments, "",
+      "With serve, read the jobs from the clients connecting to this UNIX "
+      "socket instead of the standard input.",
+      {"socket"});
+  args::ValueFlag<int> jobs(
+      render_arguments, "",
+      "With serve, number of jobs rendered at the same time, sharing the "
+      "--threads threads (default: 4).",
+      {"jobs"}, 4);
+  args::ValueFlag<int> max_scenes(
+      render_arguments, "",
+      "With serve, number of scenes kept in memory: the least recently used "
+      "is dropped to load a new one (default: 16). Each set of values of "
+      "variables used outside the transformations counts as a scene.",
+      {"max-scenes"}, 16);
   args::ValueFlag<string> input_pfm(
       pfm2png_arguments, "", "Path to input pfm file", {"inpfm", "input_pfm"});
   args::ValueFlag<string> output_png(pfm2png_arguments, "",
@@ -344,8 +937,9 @@ int interface(int argc, char **argv) {
                                 {'f', "factor"});
   args::ValueFlag<float> luminosity(
       pfm2png_arguments, "",
-      "Luminosity. Use 0 and it will be calculated "
-      "internally.",
+      "Luminosity used by the tone mapping, with convertpfm2png and "
+      "render-animation (which needs it for the exposure to stay the same in "
+      "all the frames). Use 0 and it will be calculated internally.",
       {'l', "luminosity"});
   args::ValueFlag<float> gamma(pfm2png_arguments, "",
                                "Gamma factor of the screen to use",
@@ -366,19 +960,61 @@ int interface(int argc, char **argv) {
     return 1;
   }
 
-  if (render) {
+  if (render || render_animation_command || compile_scene_command ||
+      serve_command) {
     vector<string> cli_vars;
     if (declare_float) {
       for (const auto &str : args::get(declare_float)) {
         cli_vars.push_back(str);
       }
     }
-    imagerender(args::get(width), args::get(height), args::get(algorithm),
-                args::get(init_state), args::get(init_seq),
-                args::get(num_of_rays), args::get(max_depth),
-                args::get(samples_per_pixel), args::get(output_filename),
-                args::get(scene_file), cli_vars);
+    RenderSettings settings;
+    settings.width = args::get(width);
+    settings.height = args::get(height);
+    settings.algorithm = args::get(algorithm);
+    settings.init_state = args::get(init_state);
+    settings.init_seq = args::get(init_seq);
+    settings.num_of_rays = args::get(num_of_rays);
+    settings.max_depth = args::get(max_depth);
+    settings.samples_per_pixel = args::get(samples_per_pixel);
+    settings.num_of_threads = args::get(threads);
+    settings.output_file = args::get(output_filename);
+    settings.input_scene = args::get(scene_file);
+    settings.passes = args::get(passes);
+    settings.time_budget = args::get(time_budget);
+    settings.snapshot_every = args::get(snapshot_every);
+    settings.snapshot_interval = args::get(snapshot_interval);
+    settings.max_error = args::get(max_error);
+    settings.min_samples = args::get(min_samples);
+    settings.max_samples = args::get(max_samples);
+    settings.heatmap_file = args::get(heatmap);
+    settings.map_textures = args::get(map_textures);
+    settings.tiled_textures = args::get(tiled_textures);
+    settings.texture_filter = args::get(texture_filter);
+    settings.stats = args::get(stats);
+    settings.stats_json_file = args::get(stats_json);
+    settings.tile_range = args::get(tile_range);
+    settings.worker = args::get(worker);
+    settings.checkpoint_interval = args::get(checkpoint_interval);
+    settings.resume = args::get(resume);
+    if (compile_scene_command)
+      compile_scene(settings, cli_vars);
+    else if (serve_command)
+      serve(settings, cli_vars, args::get(socket_path), args::get(jobs),
+            args::get(max_scenes));
+    else if (render)
+      imagerender(settings, cli_vars);
+    else if (!animate) {
+      fmt::print("ERROR: you must specify the variable to animate with "
+                 "--animate.\nExiting.\n");
+      exit(1);
+    } else
+      render_animation(settings, cli_vars, args::get(animate),
+                       args::get(luminosity));
   }
+  if (merge_command)
+    merge(args::get(partial_files), args::get(output_filename),
+          args::get(heatmap));
   if (convertpfm2png) {
     pfm2png(args::get(input_pfm), args::get(output_png), args::get(factor),
             args::get(gamma), args::get(luminosity));
@@ -18,29 +18,54 @@
  */
 
 #include "render.h"
+#include "stats.h"
+
+void Renderer::render_packet(const Ray *rays, int n, Color *colors,
+                             PCG &pcg) {
+  HitRecord hits[RayPacket::max_size];
+  for (int first{}; first < n; first += RayPacket::max_size) {
+    int size = min(n - first, RayPacket::max_size);
+    world.ray_intersection_packet(rays + first, size, hits);
+    for (int i{}; i < size; i++)
+      colors[first + i] = shade(rays[first + i], hits[i], pcg);
+  }
+}
 
 Color FlatRenderer::operator()(Ray ray) {
-  HitRecord intersection = world.ray_intersection(ray);
+  return _surface_color(world.ray_intersection(ray));
+}
+
+Color FlatRenderer::shade(Ray ray, const HitRecord &intersection, PCG &pcg) {
+  return _surface_color(intersection);
+}
+
+Color FlatRenderer::_surface_color(const HitRecord &intersection) {
   if (!intersection.hit)
     return background_color;
 
-  Material material = intersection.shape->material;
-  return ((*(material.brdf->pigment))(intersection.surface_point) +
-          (*material.emitted_radiance)(intersection.surface_point));
+  const Material &material = intersection.shape->material;
+  Vec2d uv = intersection.surface_point;
+  return (material.brdf->pigment->filtered(uv, intersection.footprint) +
+          material.emitted_radiance->filtered(uv, intersection.footprint));
 }
 
-Color PathTracer::operator()(Ray ray) {
+Color PathTracer::operator()(Ray ray, PCG &_pcg) {
   if (ray.depth > max_depth)
     return BLACK;
+  return shade(ray, world.ray_intersection(ray), _pcg);
+}
 
-  HitRecord intersection = world.ray_intersection(ray);
+Color PathTracer::shade(Ray ray, const HitRecord &intersection, PCG &_pcg) {
+  if (ray.depth > max_depth)
+    return BLACK;
   if (!intersection.hit)
     return background_color;
 
-  Material hit_material = intersection.shape->material;
-  Color hit_color = (*(hit_material.brdf->pigment))(intersection.surface_point);
-  Color emitted_radiance =
-      (*hit_material.emitted_radiance)(intersection.surface_point);
+  const Material &hit_material = intersection.shape->material;
+  Color hit_color = hit_material.brdf->pigment->filtered(
+      intersection.surface_point, intersection.footprint);
+  Color emitted_radiance = hit_material.emitted_radiance->filtered(
+      intersection.surface_point, intersection.footprint);
 
   float hit_color_lum =
       max(max(hit_color.r, hit_color.g),
@@ -49,12 +74,14 @@ Color PathTracer::operator()(Ray ray) {
   // Russian Roulette
   if (ray.depth >= russian_roulette_limit) {
     float q = max(0.5f, 1 - hit_color_lum);
-    if (pcg.random_float() > q)
+    if (_pcg.random_float() > q)
       // Keep the recursion going, but compensate for other potentially
       // discarded rays
       hit_color = hit_color * (1.0 / (1.0 - q));
     else {
       // Terminate prematurely
+      if (stats_enabled())
+        thread_stats().russian_roulette_terminations++;
       return emitted_radiance;
     }
   }
@@ -63,13 +90,66 @@ Color PathTracer::operator()(Ray ray) {
   if (hit_color_lum > 0.0) { // Only do costly recursions if it's worth it
     for (int i{}; i < num_of_rays; i++) {
       Ray new_ray = hit_material.brdf->scatter_ray(
-          pcg, intersection.ray.dir, intersection.world_point,
+          _pcg, intersection.ray.dir, intersection.world_point,
           intersection.normal, ray.depth + 1);
 
       // Recursive call
-      Color new_radiance = (*this)(new_ray);
+      Color new_radiance = (*this)(new_ray, _pcg);
       cum_radiance = cum_radiance + (hit_color * new_radiance);
     }
   }
   return emitted_radiance + cum_radiance * (1.0 / num_of_rays);
+}
+
+Color IterativePathTracer::operator()(Ray ray, PCG &_pcg) {
+  if (ray.depth > max_depth)
+    return BLACK;
+  return shade(ray, world.ray_intersection(ray), _pcg);
+}
+
+Color IterativePathTracer::shade(Ray ray, const HitRecord &first_hit,
+                                 PCG &_pcg) {
+  Color radiance;
+  Color throughput = WHITE;
+
+  HitRecord intersection = first_hit;
+  while (ray.depth <= max_depth) {
+    if (!intersection.hit) {
+      radiance = radiance + throughput * background_color;
+      break;
+    }
+
+    const Material &hit_material = intersection.shape->material;
+    Color hit_color = hit_material.brdf->pigment->filtered(
+        intersection.surface_point, intersection.footprint);
+    radiance = radiance + throughput * hit_material.emitted_radiance->filtered(
+                                           intersection.surface_point,
+                                           intersection.footprint);
+
+    float hit_color_lum = max(max(hit_color.r, hit_color.g), hit_color.b);
+
+    // Russian Roulette
+    if (ray.depth >= russian_roulette_limit) {
+      float q = max(0.5f, 1 - hit_color_lum);
+      if (_pcg.random_float() > q)
+        // Keep the path going, but compensate for the discarded ones
+        hit_color = hit_color * (1.0 / (1.0 - q));
+      else {
+        if (stats_enabled())
+          thread_stats().russian_roulette_terminations++;
+        break;
+      }
+    }
+
+    if (hit_color_lum <= 0.0) // Nothing more can be collected
+      break;
+
+    throughput = throughput * hit_color;
+    ray = hit_material.brdf->scatter_ray(_pcg, intersection.ray.dir,
+                                         intersection.world_point,
+                                         intersection.normal, ray.depth + 1);
+    if (ray.depth <= max_depth)
+      intersection = world.ray_intersection(ray);
+  }
+  return radiance;
 }
\ No newline at end of file
@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "render_settings.h"
+#include "fmtlib.h"
+#include "stats.h"
+#include <cmath>
+#include <future>
+
+void split(const string &str, const string &delim, vector<string> &parts) {
+  size_t start, end = 0;
+  while (end < str.size()) {
+    start = end;
+    while (start < str.size() && (delim.find(str[start]) != string::npos)) {
+      start++; // skip initial whitespace
+    }
+    end = start;
+    while (end < str.size() && (delim.find(str[end]) == string::npos)) {
+      end++; // skip to end of word
+    }
+    if (end - start != 0) { // just ignore zero-length strings.
+      parts.push_back(string(str, start, end - start));
+    }
+  }
+}
+
+map<string, float> build_vars_table(vector<string> &definitions) {
+  map<string, float> vars;
+  for (const auto &el : definitions) {
+    vector<string> parts;
+    split(el, ":", parts);
+    if (parts.size() != 2) {
+      fmt::print(
+          "ERROR: the definition {} does not follow the pattern NAME:VALUE\n",
+          el);
+      exit(1);
+    }
+    string name = parts.at(0), value = parts.at(1);
+    float f_value = 0.;
+    try {
+      f_value = stof(value);
+    } catch (invalid_argument &e) {
+      fmt::print("invalid floating point value {} in definition {}\n", value,
+                 el);
+    }
+    vars[name] = f_value;
+  }
+
+  return vars;
+}
+
+void save_image(HdrImage &image, const string &pfm_output,
+                const string &png_output, float luminosity) {
+  // Writing pfm file
+  future<double> pfm_written =
+      image.write_pfm_async(pfm_output, Endianness::little_endian);
+
+  // Apply tone - mapping to a copy of the image
+  Timer t;
+  HdrImage ldr_image{image};
+  ldr_image.tone_map(1.0, luminosity);
+  double tone_mapping_seconds = t.elapsed();
+
+  // Writing image in ldr format (for now png)
+  t.reset();
+  ldr_image.write_ldr_image(png_output.c_str(), 1.0);
+  double ldr_encode_seconds = t.elapsed();
+
+  double pfm_write_seconds = pfm_written.get();
+  if (stats_enabled()) {
+    RenderStats &stats = thread_stats();
+    stats.tone_mapping_seconds += tone_mapping_seconds;
+    stats.ldr_encode_seconds += ldr_encode_seconds;
+    stats.pfm_write_seconds += pfm_write_seconds;
+  }
+  fmt::print("File {} has been written to disk\n", pfm_output);
+  fmt::print("File {} has been written to disk. \n", png_output);
+}
+
+string settings_error(const RenderSettings &settings) {
+  // Checking if antialiasing feature is on, and properly set
+  int samples_per_side = static_cast<int>(sqrt(settings.samples_per_pixel));
+  if (pow(samples_per_side, 2) != settings.samples_per_pixel)
+    return fmt::format("the number of samples per pixel ({}) must be a "
+                       "perfect square",
+                       settings.samples_per_pixel);
+  if (settings.passes <= 0 && settings.time_budget <= 0.)
+    return "with no limit on the number of passes, you must set a time "
+           "budget";
+  if (settings.is_adaptive() && settings.is_progressive())
+    return "adaptive sampling cannot be combined with progressive rendering";
+  if (settings.is_adaptive() && settings.min_samples > settings.max_samples)
+    return fmt::format("the minimum number of samples ({}) exceeds the "
+                       "maximum ({})",
+                       settings.min_samples, settings.max_samples);
+  return "";
+}
+
+string split_output_file(string &output_file) {
+  // Only the last component of the path has an extension
+  size_t dot = output_file.find('.', output_file.rfind('/') + 1);
+  if (dot == string::npos)
+    return ".png";
+  string format = output_file.substr(dot + 1);
+  output_file.erase(dot);
+
+  if (format == "jpeg" || format == "jpg" || format == "JPEG")
+    return ".jpg";
+  return ".png";
+}
+
+TextureFilter parse_texture_filter(const string &name) {
+  if (name == "nearest")
+    return TextureFilter::nearest;
+  if (name == "bilinear")
+    return TextureFilter::bilinear;
+  if (name == "trilinear")
+    return TextureFilter::trilinear;
+  fmt::print("ERROR: unknown texture filter \"{}\".\nExiting.\n", name);
+  exit(1);
+}
+
+TextureOptions texture_options(const RenderSettings &settings) {
+  TextureOptions options;
+  options.map = settings.map_textures;
+  options.tiled = settings.tiled_textures;
+  options.mipmaps =
+      parse_texture_filter(settings.texture_filter) != TextureFilter::nearest;
+  return options;
+}
+
+Scene read_scene_file(const RenderSettings &settings,
+                      const map<string, float> &vars,
+                      const vector<string> &animated_variables,
+                      shared_ptr<TextureCache> textures,
+                      bool map_file, bool fix_animated_variables) {
+  InputStream stream(settings.input_scene, 4, map_file);
+  stream.map_textures = settings.map_textures;
+  stream.tile_textures = settings.tiled_textures;
+  stream.texture_filter = parse_texture_filter(settings.texture_filter);
+  stream.textures = textures;
+  stream.animated_variables = animated_variables;
+  stream.fix_animated_variables = fix_animated_variables;
+  return stream.parse_scene(vars);
+}
+
+shared_ptr<Renderer> make_renderer(const RenderSettings &settings,
+                                   World &world, bool verbose) {
+  if (settings.algorithm == "onoff") {
+    if (verbose)
+      fmt::print("Using on/off renderer\n");
+    return make_shared<OnOffRenderer>(world);
+  } else if (settings.algorithm == "flat") {
+    if (verbose)
+      fmt::print("Using flat renderer\n");
+    return make_shared<FlatRenderer>(world);
+  } else if (settings.algorithm == "pathtracing") {
+    if (verbose)
+      fmt::print("Using a path tracer\n");
+    return make_shared<PathTracer>(
+        world, BLACK, PCG(settings.init_state, settings.init_seq),
+        settings.num_of_rays, settings.max_depth);
+  } else if (settings.algorithm == "iterative") {
+    if (verbose)
+      fmt::print("Using an iterative path tracer\n");
+    return make_shared<IterativePathTracer>(
+        world, BLACK, PCG(settings.init_state, settings.init_seq),
+        settings.max_depth);
+  }
+  fmt::print("Unknown renderer type.\nExiting.\n");
+  exit(1);
+}
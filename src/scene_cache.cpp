@@ -0,0 +1,562 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "scene_cache.h"
+#include <cstring>
+#include <type_traits>
+
+// The first bytes of every scene cache
+static const char MAGIC[8] = {'R', 'T', 'S', 'C', 'E', 'N', 'E', '\0'};
+// Written as a number: a file written by a machine with the other byte order
+// reads it swapped
+static const uint32_t BYTE_ORDER_MARK = 0x01020304;
+
+enum class PigmentType : uint32_t { uniform, checkered, image };
+enum class BrdfType : uint32_t { diffuse, specular };
+enum class ShapeType : uint32_t { sphere, plane };
+enum class CameraType : uint32_t { none, perspective, orthogonal };
+
+// The records of the file, copied as they are: apart from `file_size`, all
+// the fields are 4 bytes long, so that the records have no padding. The
+// strings follow their record, padded to a multiple of 4 bytes
+struct FileHeader {
+  char magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint64_t file_size;
+  uint32_t num_of_variables, num_of_material_names, num_of_textures;
+  uint32_t num_of_pigments, num_of_brdfs, num_of_materials, num_of_shapes;
+  uint32_t num_of_shape_nodes, num_of_shape_indices;
+  uint32_t num_of_sphere_nodes, num_of_sphere_indices;
+  uint32_t reserved;
+};
+
+struct CameraRecord {
+  CameraType type;
+  float aspect_ratio, screen_distance;
+  float m[4][4], invm[4][4];
+};
+
+struct VariableRecord {
+  uint32_t name_length;
+  float value;
+  uint32_t overridden;
+};
+
+struct MaterialNameRecord {
+  uint32_t name_length;
+  uint32_t material;
+};
+
+struct PigmentRecord {
+  PigmentType type;
+  uint32_t num_of_steps; // checkered
+  uint32_t texture;      // image
+  float color1[3], color2[3];
+};
+
+struct BrdfRecord {
+  BrdfType type;
+  uint32_t pigment;
+  float parameter; // reflectance or threshold angle
+};
+
+struct MaterialRecord {
+  uint32_t brdf, emitted_radiance;
+};
+
+struct ShapeRecord {
+  ShapeType type;
+  uint32_t material;
+  float m[4][4], invm[4][4];
+};
+
+static_assert(sizeof(FileHeader) == 72 && sizeof(BVHNode) == 32,
+              "the records of the scene cache must have no padding");
+static_assert(is_trivially_copyable<BVHNode>::value,
+              "the nodes of the BVH are copied as they are");
+
+/**
+ * @brief Append records and strings to the bytes of a scene cache
+ *
+ */
+struct CacheWriter {
+  string bytes;
+
+  template <typename T> void write(const T &record) {
+    bytes.append(reinterpret_cast<const char *>(&record), sizeof(T));
+  }
+
+  template <typename T> void write_array(const vector<T> &records) {
+    bytes.append(reinterpret_cast<const char *>(records.data()),
+                 records.size() * sizeof(T));
+  }
+
+  void write_string(const string &str) {
+    bytes.append(str);
+    bytes.append((4 - str.size() % 4) % 4, '\0');
+  }
+};
+
+/**
+ * @brief A scene cache mapped in memory, read from the beginning to the end.
+ * Every read is checked against the size of the file
+ *
+ */
+struct CacheReader {
+  FileHeader header;
+
+  /**
+   * @brief Map the file and check its header
+   *
+   * @param file_name
+   */
+  CacheReader(const string &file_name)
+      : file{file_name, false, true}, data{file.data()}, size{file.size()} {
+    header = read<FileHeader>();
+    if (memcmp(header.magic, MAGIC, sizeof(MAGIC)) != 0)
+      throw InvalidSceneCache("not a scene cache");
+    if (header.byte_order != BYTE_ORDER_MARK)
+      throw InvalidSceneCache("scene cache written with another byte order");
+    if (header.version != SCENE_CACHE_VERSION)
+      throw InvalidSceneCache(fmt::format("scene cache version {} instead of {}",
+                                          header.version, SCENE_CACHE_VERSION));
+    if (header.file_size != size)
+      throw InvalidSceneCache("truncated scene cache");
+  }
+  CacheReader(const CacheReader &) = delete;
+  CacheReader &operator=(const CacheReader &) = delete;
+
+  template <typename T> T read() {
+    _check(sizeof(T));
+    T record;
+    memcpy(&record, data + pos, sizeof(T));
+    pos += sizeof(T);
+    return record;
+  }
+
+  template <typename T> void read_array(vector<T> &records, size_t length) {
+    if (length > size)
+      throw InvalidSceneCache("truncated scene cache");
+    _check(length * sizeof(T));
+    records.resize(length);
+    memcpy(records.data(), data + pos, length * sizeof(T));
+    pos += length * sizeof(T);
+  }
+
+  string read_string(size_t length) {
+    size_t padded = length + (4 - length % 4) % 4;
+    if (length > size)
+      throw InvalidSceneCache("truncated scene cache");
+    _check(padded);
+    string result(data + pos, length);
+    pos += padded;
+    return result;
+  }
+
+private:
+  MappedFile file;
+  const char *data;
+  size_t size;
+  size_t pos = 0;
+
+  void _check(size_t length) {
+    if (length > size - pos)
+      throw InvalidSceneCache("truncated scene cache");
+  }
+};
+
+/**
+ * @brief Give each distinct object of a table its index, in order of
+ * appearance
+ *
+ */
+template <typename Key> struct Table {
+  map<Key, uint32_t> indices;
+  vector<Key> keys;
+
+  uint32_t index(const Key &key) {
+    auto it = indices.find(key);
+    if (it != indices.end())
+      return it->second;
+    indices[key] = keys.size();
+    keys.push_back(key);
+    return keys.size() - 1;
+  }
+};
+
+static void _copy_matrices(const Transformation &transformation,
+                           float m[4][4], float invm[4][4]) {
+  memcpy(m, transformation.m, sizeof(transformation.m));
+  memcpy(invm, transformation.invm, sizeof(transformation.invm));
+}
+
+void write_scene_cache(const Scene &scene, const string &file_name) {
+  // The trees are written too: build them if needed
+  const World *world = &scene.world;
+  World compiled_world;
+  if (!world->has_bvh() || !world->has_compiled()) {
+    compiled_world.shapes = scene.world.shapes;
+    compiled_world.compile();
+    world = &compiled_world;
+  }
+
+  Table<string> textures;
+  Table<const Pigment *> pigments;
+  Table<const BRDF *> brdfs;
+  Table<pair<const BRDF *, const Pigment *>> materials;
+
+  auto material_index = [&](const Material &material) {
+    pigments.index(material.brdf->pigment.get());
+    pigments.index(material.emitted_radiance.get());
+    brdfs.index(material.brdf.get());
+    return materials.index({material.brdf.get(),
+                            material.emitted_radiance.get()});
+  };
+
+  vector<MaterialNameRecord> material_names;
+  for (const auto &material : scene.materials) {
+    MaterialNameRecord record{};
+    record.name_length = material.first.size();
+    record.material = material_index(material.second);
+    material_names.push_back(record);
+  }
+
+  vector<ShapeRecord> shapes;
+  for (const auto &shape : world->shapes) {
+    ShapeRecord record{};
+    if (dynamic_cast<const Sphere *>(shape.get()))
+      record.type = ShapeType::sphere;
+    else if (dynamic_cast<const Plane *>(shape.get()))
+      record.type = ShapeType::plane;
+    else
+      throw InvalidSceneCache("unknown shape");
+    record.material = material_index(shape->material);
+    _copy_matrices(shape->transformation, record.m, record.invm);
+    shapes.push_back(record);
+  }
+
+  vector<PigmentRecord> pigment_records;
+  for (const Pigment *pigment : pigments.keys) {
+    PigmentRecord record{};
+    if (auto uniform = dynamic_cast<const UniformPigment *>(pigment)) {
+      record.type = PigmentType::uniform;
+      record.color1[0] = uniform->color.r;
+      record.color1[1] = uniform->color.g;
+      record.color1[2] = uniform->color.b;
+    } else if (auto checkered =
+                   dynamic_cast<const CheckeredPigment *>(pigment)) {
+      record.type = PigmentType::checkered;
+      record.num_of_steps = checkered->num_of_steps;
+      Color colors[2] = {checkered->color1, checkered->color2};
+      float *fields[2] = {record.color1, record.color2};
+      for (int i{}; i < 2; i++) {
+        fields[i][0] = colors[i].r;
+        fields[i][1] = colors[i].g;
+        fields[i][2] = colors[i].b;
+      }
+    } else if (auto image = dynamic_cast<const ImagePigment *>(pigment)) {
+      if (image->texture.file_name == "")
+        throw InvalidSceneCache("texture not read from a file");
+      record.type = PigmentType::image;
+      record.texture = textures.index(image->texture.file_name);
+    } else
+      throw InvalidSceneCache("unknown pigment");
+    pigment_records.push_back(record);
+  }
+
+  vector<BrdfRecord> brdf_records;
+  for (const BRDF *brdf : brdfs.keys) {
+    BrdfRecord record{};
+    if (auto diffuse = dynamic_cast<const DiffusiveBRDF *>(brdf)) {
+      record.type = BrdfType::diffuse;
+      record.parameter = diffuse->reflectance;
+    } else if (auto specular = dynamic_cast<const SpecularBRDF *>(brdf)) {
+      record.type = BrdfType::specular;
+      record.parameter = specular->threshold_angle_rad;
+    } else
+      throw InvalidSceneCache("unknown BRDF");
+    record.pigment = pigments.index(brdf->pigment.get());
+    brdf_records.push_back(record);
+  }
+
+  vector<MaterialRecord> material_records;
+  for (const auto &material : materials.keys) {
+    MaterialRecord record{};
+    record.brdf = brdfs.index(material.first);
+    record.emitted_radiance = pigments.index(material.second);
+    material_records.push_back(record);
+  }
+
+  CameraRecord camera{};
+  camera.type = CameraType::none;
+  if (auto perspective =
+          dynamic_pointer_cast<PerspectiveCamera>(scene.camera)) {
+    camera.type = CameraType::perspective;
+    camera.screen_distance = perspective->screen_distance;
+  } else if (scene.camera)
+    camera.type = CameraType::orthogonal;
+  if (scene.camera) {
+    camera.aspect_ratio = scene.camera->aspect_ratio;
+    _copy_matrices(scene.camera->transformation, camera.m, camera.invm);
+  }
+
+  FileHeader header{};
+  memcpy(header.magic, MAGIC, sizeof(MAGIC));
+  header.version = SCENE_CACHE_VERSION;
+  header.byte_order = BYTE_ORDER_MARK;
+  header.num_of_variables = scene.float_variables.size();
+  header.num_of_material_names = material_names.size();
+  header.num_of_textures = textures.keys.size();
+  header.num_of_pigments = pigment_records.size();
+  header.num_of_brdfs = brdf_records.size();
+  header.num_of_materials = material_records.size();
+  header.num_of_shapes = shapes.size();
+  header.num_of_shape_nodes = world->bvh.nodes.size();
+  header.num_of_shape_indices = world->bvh.indices.size();
+  header.num_of_sphere_nodes = world->compiled.bvh.nodes.size();
+  header.num_of_sphere_indices = world->compiled.bvh.indices.size();
+
+  CacheWriter writer;
+  writer.write(header);
+  writer.write(camera);
+  for (const auto &variable : scene.float_variables) {
+    VariableRecord record{};
+    record.name_length = variable.first.size();
+    record.value = variable.second;
+    record.overridden =
+        find(scene.overridden_variables.begin(),
+             scene.overridden_variables.end(),
+             variable.first) != scene.overridden_variables.end();
+    writer.write(record);
+    writer.write_string(variable.first);
+  }
+  int i = 0;
+  for (const auto &material : scene.materials) {
+    writer.write(material_names[i++]);
+    writer.write_string(material.first);
+  }
+  for (const auto &texture : textures.keys) {
+    writer.write(static_cast<uint32_t>(texture.size()));
+    writer.write_string(texture);
+  }
+  writer.write_array(pigment_records);
+  writer.write_array(brdf_records);
+  writer.write_array(material_records);
+  writer.write_array(shapes);
+  writer.write_array(world->bvh.nodes);
+  writer.write_array(world->bvh.indices);
+  writer.write_array(world->compiled.bvh.nodes);
+  writer.write_array(world->compiled.bvh.indices);
+
+  // Now the size is known
+  header.file_size = writer.bytes.size();
+  memcpy(&writer.bytes[0], &header, sizeof(header));
+
+  ofstream stream(file_name, ios::binary);
+  if (!stream)
+    throw ios_base::failure("Unable to write the file");
+  stream.write(writer.bytes.data(), writer.bytes.size());
+  if (!stream)
+    throw ios_base::failure("Unable to write the file");
+}
+
+/**
+ * @brief Check that the tree can be traversed safely: children come after
+ * their parent, leaves refer to existing indices, the tree is not deeper than
+ * BVH::max_depth (the size of the traversal stack) and the indices refer to
+ * one of `num_of_primitives` primitives
+ *
+ */
+static void _check_bvh(const BVH &bvh, size_t num_of_primitives) {
+  vector<int> depth(bvh.nodes.size(), 0);
+  for (size_t i{}; i < bvh.nodes.size(); i++) {
+    const BVHNode &node = bvh.nodes[i];
+    if (node.first < 0 || node.count < 0)
+      throw InvalidSceneCache("invalid BVH node");
+    size_t first = node.first;
+    if (node.count > 0) {
+      if (first + node.count > bvh.indices.size())
+        throw InvalidSceneCache("invalid BVH leaf");
+    } else {
+      if (first <= i || first + 1 >= bvh.nodes.size() ||
+          depth[i] >= BVH::max_depth)
+        throw InvalidSceneCache("invalid BVH node");
+      depth[first] = depth[first + 1] = depth[i] + 1;
+    }
+  }
+  for (int index : bvh.indices) {
+    if (index < 0 || static_cast<size_t>(index) >= num_of_primitives)
+      throw InvalidSceneCache("invalid BVH index");
+  }
+}
+
+/**
+ * @brief Read the variables, which follow the camera
+ *
+ */
+static void _read_variables(CacheReader &reader, Scene &scene) {
+  for (uint32_t i{}; i < reader.header.num_of_variables; i++) {
+    auto record = reader.read<VariableRecord>();
+    string name = reader.read_string(record.name_length);
+    scene.float_variables[name] = record.value;
+    if (record.overridden)
+      scene.overridden_variables.push_back(name);
+  }
+}
+
+Scene read_scene_cache(const string &file_name, TextureCache &textures,
+                       const TextureOptions &options, TextureFilter filter) {
+  CacheReader reader(file_name);
+  const FileHeader &header = reader.header;
+  Scene scene;
+
+  auto camera = reader.read<CameraRecord>();
+  Transformation camera_transformation =
+      Transformation(camera.m, camera.invm);
+  if (camera.type == CameraType::perspective)
+    scene.camera = make_shared<PerspectiveCamera>(
+        camera.screen_distance, camera.aspect_ratio, camera_transformation);
+  else if (camera.type == CameraType::orthogonal)
+    scene.camera = make_shared<OrthogonalCamera>(camera.aspect_ratio,
+                                                 camera_transformation);
+  else if (camera.type != CameraType::none)
+    throw InvalidSceneCache("unknown camera");
+
+  _read_variables(reader, scene);
+
+  vector<pair<string, uint32_t>> material_names;
+  for (uint32_t i{}; i < header.num_of_material_names; i++) {
+    auto record = reader.read<MaterialNameRecord>();
+    material_names.push_back(
+        {reader.read_string(record.name_length), record.material});
+  }
+
+  vector<string> texture_names;
+  for (uint32_t i{}; i < header.num_of_textures; i++)
+    texture_names.push_back(reader.read_string(reader.read<uint32_t>()));
+
+  vector<PigmentRecord> pigment_records;
+  vector<BrdfRecord> brdf_records;
+  vector<MaterialRecord> material_records;
+  vector<ShapeRecord> shape_records;
+  reader.read_array(pigment_records, header.num_of_pigments);
+  reader.read_array(brdf_records, header.num_of_brdfs);
+  reader.read_array(material_records, header.num_of_materials);
+  reader.read_array(shape_records, header.num_of_shapes);
+  BVH shape_bvh, sphere_bvh;
+  reader.read_array(shape_bvh.nodes, header.num_of_shape_nodes);
+  reader.read_array(shape_bvh.indices, header.num_of_shape_indices);
+  reader.read_array(sphere_bvh.nodes, header.num_of_sphere_nodes);
+  reader.read_array(sphere_bvh.indices, header.num_of_sphere_indices);
+
+  // Each texture is only loaded if a pigment uses it
+  vector<shared_ptr<Pigment>> pigments;
+  for (const auto &record : pigment_records) {
+    if (record.type == PigmentType::uniform)
+      pigments.push_back(make_shared<UniformPigment>(Color(
+          record.color1[0], record.color1[1], record.color1[2])));
+    else if (record.type == PigmentType::checkered)
+      pigments.push_back(make_shared<CheckeredPigment>(
+          Color(record.color1[0], record.color1[1], record.color1[2]),
+          Color(record.color2[0], record.color2[1], record.color2[2]),
+          record.num_of_steps));
+    else if (record.type == PigmentType::image &&
+             record.texture < texture_names.size())
+      pigments.push_back(make_shared<ImagePigment>(
+          textures.get(texture_names[record.texture], options), filter));
+    else
+      throw InvalidSceneCache("invalid pigment");
+  }
+
+  vector<shared_ptr<BRDF>> brdfs;
+  for (const auto &record : brdf_records) {
+    if (record.pigment >= pigments.size())
+      throw InvalidSceneCache("invalid BRDF");
+    if (record.type == BrdfType::diffuse)
+      brdfs.push_back(make_shared<DiffusiveBRDF>(pigments[record.pigment],
+                                                 record.parameter));
+    else if (record.type == BrdfType::specular)
+      brdfs.push_back(make_shared<SpecularBRDF>(pigments[record.pigment],
+                                                record.parameter));
+    else
+      throw InvalidSceneCache("invalid BRDF");
+  }
+
+  vector<Material> materials;
+  for (const auto &record : material_records) {
+    if (record.brdf >= brdfs.size() ||
+        record.emitted_radiance >= pigments.size())
+      throw InvalidSceneCache("invalid material");
+    materials.push_back(
+        Material(brdfs[record.brdf], pigments[record.emitted_radiance]));
+  }
+  for (const auto &name : material_names) {
+    if (name.second >= materials.size())
+      throw InvalidSceneCache("invalid material");
+    scene.materials[name.first] = materials[name.second];
+  }
+
+  size_t num_of_spheres = 0;
+  scene.world.shapes.reserve(shape_records.size());
+  for (auto &record : shape_records) {
+    if (record.material >= materials.size())
+      throw InvalidSceneCache("invalid shape");
+    Transformation transformation =
+        Transformation(record.m, record.invm);
+    if (record.type == ShapeType::sphere) {
+      scene.world.shapes.push_back(
+          make_shared<Sphere>(transformation, materials[record.material]));
+      num_of_spheres++;
+    } else if (record.type == ShapeType::plane)
+      scene.world.shapes.push_back(
+          make_shared<Plane>(transformation, materials[record.material]));
+    else
+      throw InvalidSceneCache("invalid shape");
+  }
+
+  // The spheres are the only bounded shapes
+  _check_bvh(shape_bvh, scene.world.shapes.size());
+  _check_bvh(sphere_bvh, num_of_spheres);
+  if (shape_bvh.indices.size() != num_of_spheres ||
+      sphere_bvh.indices.size() != num_of_spheres)
+    throw InvalidSceneCache("invalid BVH");
+  scene.world.compile(move(shape_bvh), move(sphere_bvh));
+  return scene;
+}
+
+bool is_scene_cache(const string &file_name) {
+  ifstream stream(file_name, ios::binary);
+  char magic[sizeof(MAGIC)];
+  if (!stream.read(magic, sizeof(magic)))
+    return false;
+  return memcmp(magic, MAGIC, sizeof(MAGIC)) == 0;
+}
+
+map<string, float> scene_cache_variables(const string &file_name) {
+  CacheReader reader(file_name);
+  reader.read<CameraRecord>();
+  Scene scene;
+  _read_variables(reader, scene);
+
+  map<string, float> result;
+  for (const auto &name : scene.overridden_variables)
+    result[name] = scene.float_variables[name];
+  return result;
+}
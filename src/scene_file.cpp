@@ -18,72 +18,190 @@
  */
 
 #include "scene_file.h"
+#include "stats.h"
 
-string WHITESPACE{" #\t\n\r"};
-string symbols{'(', ')', '<', '>', ',', '[', ']', '*'};
-map<string, KeywordEnum> KEYWORDS{
-    {"new", KeywordEnum::NEW},
-    {"material", KeywordEnum::MATERIAL},
-    {"plane", KeywordEnum::PLANE},
-    {"sphere", KeywordEnum::SPHERE},
-    {"diffuse", KeywordEnum::DIFFUSE},
-    {"specular", KeywordEnum::SPECULAR},
-    {"uniform", KeywordEnum::UNIFORM},
-    {"checkered", KeywordEnum::CHECKERED},
-    {"image", KeywordEnum::IMAGE},
-    {"identity", KeywordEnum::IDENTITY},
-    {"translation", KeywordEnum::TRANSLATION},
-    {"rotation_x", KeywordEnum::ROTATION_X},
-    {"rotation_y", KeywordEnum::ROTATION_Y},
-    {"rotation_z", KeywordEnum::ROTATION_Z},
-    {"scaling", KeywordEnum::SCALING},
-    {"camera", KeywordEnum::CAMERA},
-    {"orthogonal", KeywordEnum::ORTHOGONAL},
-    {"perspective", KeywordEnum::PERSPECTIVE},
-    {"float", KeywordEnum::FLOAT},
-};
-
-void InputStream::_update_pos(const char &ch) {
-  if (ch == '\0') {
-    // Nothing to do
-  } else if (ch == '\n') {
-    location.line_num += 1;
-    location.col_num = 1;
-  } else if (ch == '\t')
-    location.col_num += tabulations;
-  else
-    location.col_num += 1;
+// Characters skipped between the tokens; `#` begins a comment
+static inline bool _is_whitespace(char ch) {
+  return ch == ' ' || ch == '#' || ch == '\t' || ch == '\n' || ch == '\r';
 }
 
-char InputStream::read_char() {
-  char ch;
-  // Read a new character from the stream
-  if (saved_char != '\0') {
-    // Recover the «unread» character and return it
-    ch = saved_char;
-    saved_char = '\0';
-  } else {
-    // Read a new character from the stream
-    stream.get(ch);
-    if (stream.eof()) {
-      ch = '\0';
-    }
+// One-character tokens
+static inline bool _is_symbol(char ch) {
+  switch (ch) {
+  case '(':
+  case ')':
+  case '<':
+  case '>':
+  case ',':
+  case '[':
+  case ']':
+  case '*':
+    return true;
+  default:
+    return false;
   }
+}
 
-  saved_location = location;
-  _update_pos(ch);
+static inline bool _is_digit(char ch) { return ch >= '0' && ch <= '9'; }
+
+static inline bool _is_alpha(char ch) {
+  return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z');
+}
 
-  return ch;
+// Characters allowed in keywords and identifiers, after the first one
+static inline bool _is_word_char(char ch) {
+  return _is_alpha(ch) || _is_digit(ch) || ch == '_';
 }
 
-void InputStream::unread_char(const char &ch) {
-  stream.putback(ch);
-  location = saved_location;
+// The length, first and last character tell apart every keyword, so they are
+// a perfect hash for the switch in _find_keyword
+static constexpr int _keyword_hash(size_t length, char first, char last) {
+  return static_cast<int>(length) << 16 | first << 8 | last;
+}
+
+// The keywords, in the same order as KeywordEnum
+static const string_view KEYWORD_NAMES[]{
+    "new",         "material",   "plane",      "sphere",
+    "diffuse",     "specular",   "uniform",    "checkered",
+    "image",       "identity",   "translation", "rotation_x",
+    "rotation_y",  "rotation_z", "scaling",    "camera",
+    "orthogonal",  "perspective", "float"};
+
+/**
+ * @brief Check whether `word` is a keyword, and which one
+ *
+ */
+static bool _find_keyword(string_view word, KeywordEnum &keyword) {
+  if (word.size() < 3 || word.size() > 11)
+    return false;
+
+  switch (_keyword_hash(word.size(), word.front(), word.back())) {
+  case _keyword_hash(3, 'n', 'w'):
+    keyword = KeywordEnum::NEW;
+    break;
+  case _keyword_hash(8, 'm', 'l'):
+    keyword = KeywordEnum::MATERIAL;
+    break;
+  case _keyword_hash(5, 'p', 'e'):
+    keyword = KeywordEnum::PLANE;
+    break;
+  case _keyword_hash(6, 's', 'e'):
+    keyword = KeywordEnum::SPHERE;
+    break;
+  case _keyword_hash(7, 'd', 'e'):
+    keyword = KeywordEnum::DIFFUSE;
+    break;
+  case _keyword_hash(8, 's', 'r'):
+    keyword = KeywordEnum::SPECULAR;
+    break;
+  case _keyword_hash(7, 'u', 'm'):
+    keyword = KeywordEnum::UNIFORM;
+    break;
+  case _keyword_hash(9, 'c', 'd'):
+    keyword = KeywordEnum::CHECKERED;
+    break;
+  case _keyword_hash(5, 'i', 'e'):
+    keyword = KeywordEnum::IMAGE;
+    break;
+  case _keyword_hash(8, 'i', 'y'):
+    keyword = KeywordEnum::IDENTITY;
+    break;
+  case _keyword_hash(11, 't', 'n'):
+    keyword = KeywordEnum::TRANSLATION;
+    break;
+  case _keyword_hash(10, 'r', 'x'):
+    keyword = KeywordEnum::ROTATION_X;
+    break;
+  case _keyword_hash(10, 'r', 'y'):
+    keyword = KeywordEnum::ROTATION_Y;
+    break;
+  case _keyword_hash(10, 'r', 'z'):
+    keyword = KeywordEnum::ROTATION_Z;
+    break;
+  case _keyword_hash(7, 's', 'g'):
+    keyword = KeywordEnum::SCALING;
+    break;
+  case _keyword_hash(6, 'c', 'a'):
+    keyword = KeywordEnum::CAMERA;
+    break;
+  case _keyword_hash(10, 'o', 'l'):
+    keyword = KeywordEnum::ORTHOGONAL;
+    break;
+  case _keyword_hash(11, 'p', 'e'):
+    keyword = KeywordEnum::PERSPECTIVE;
+    break;
+  case _keyword_hash(5, 'f', 't'):
+    keyword = KeywordEnum::FLOAT;
+    break;
+  default:
+    return false;
+  }
+  return word == KEYWORD_NAMES[static_cast<int>(keyword)];
+}
+
+/**
+ * @brief Return the text of `token`, as it is shown in the error messages
+ *
+ */
+static string _token_text(const Token &token) {
+  switch (token.type) {
+  case TokenType::LITERAL_STRING:
+  case TokenType::IDENTIFIER:
+    return string(token.value.str);
+  case TokenType::KEYWORD:
+    return string(KEYWORD_NAMES[static_cast<int>(token.value.keyword)]);
+  case TokenType::LITERAL_NUMBER:
+    return fmt::format("{}", token.value.number);
+  case TokenType::SYMBOL:
+    return string(1, token.value.symbol);
+  default:
+    return "";
+  }
+}
+
+InputStream::InputStream(istream &_stream, string filename, int _tabulations)
+    : file_name{filename}, location{file_name, 1, 1}, saved_token{} {
+  tabulations = _tabulations;
+
+  // Read the whole stream at once, with a single copy when its size is known
+  streampos start = _stream.tellg();
+  if (start != streampos(-1) && _stream.seekg(0, ios::end)) {
+    streampos end = _stream.tellg();
+    _stream.seekg(start);
+    buffer.resize(static_cast<size_t>(end - start));
+    _stream.read(&buffer[0], buffer.size());
+    buffer.resize(_stream.gcount());
+  } else {
+    _stream.clear();
+    buffer.assign(istreambuf_iterator<char>(_stream),
+                  istreambuf_iterator<char>());
+  }
+  data = &buffer[0];
+  size = buffer.size();
+}
+
+InputStream::InputStream(const string &filename, int _tabulations,
+                         bool map_file)
+    : file_name{filename}, location{file_name, 1, 1}, saved_token{} {
+  tabulations = _tabulations;
+
+  if (!map_file) {
+    // The file can change while it is read: keep what could be read
+    buffer = read_file(filename);
+    data = &buffer[0];
+    size = buffer.size();
+  } else {
+    // An empty file is not mapped, but it is a valid (empty) scene. The
+    // mapping is writable, so that unread_char can change it
+    file.reset(new MappedFile(filename, true, true));
+    data = file->data();
+    size = file->size();
+  }
 }
 
 void InputStream::skip_whitespaces_and_comments() {
   char ch = read_char();
-  while (WHITESPACE.find(ch) != string::npos) {
+  while (_is_whitespace(ch)) {
     if (ch == '#') {
       // `#` is a comment! Keep reading until the end of the line (include the
       // case "", the end-of-file)
@@ -99,7 +217,8 @@ void InputStream::skip_whitespaces_and_comments() {
 }
 
 Token InputStream::_parse_string_token(SourceLocation _location) {
-  string string_token;
+  // The string goes from the character after `"` up to the closing one
+  size_t start = pos;
 
   while (true) {
     char ch = read_char();
@@ -109,28 +228,36 @@ Token InputStream::_parse_string_token(SourceLocation _location) {
     if (ch == '\0') {
       throw GrammarError(_location, "unterminated string");
     }
-    string_token.push_back(ch);
   }
 
   Token token(_location);
-  token.assign_string(string_token);
+  token.assign_string(string_view(data + start, pos - 1 - start));
 
   return token;
 }
 
+size_t InputStream::_skip_word(bool (*accept)(char)) {
+  // Words never contain tabulations or newlines, so this is the same as
+  // calling read_char until `accept` fails and pushing back the last char
+  size_t start = pos;
+  while (pos < size && accept(data[pos]))
+    pos++;
+  location.col_num += pos - start;
+  saved_location = location;
+  return pos - start;
+}
+
+static bool _is_float_char(char ch) {
+  return _is_digit(ch) || ch == '.' || ch == 'e' || ch == 'E';
+}
+
 Token InputStream::_parse_float_token(const char &first_ch,
                                       SourceLocation _location) {
-  string string_token;
-  string_token.push_back(first_ch);
+  // `first_ch` has just been read, so it is the character before `pos`
+  size_t start = pos - 1;
+  size_t length = 1 + _skip_word(_is_float_char);
+  string string_token(data + start, length);
   float value = 0.;
-  while (true) {
-    char ch = read_char();
-    if (!isdigit(ch) && ch != '.' && ch != 'e' && ch != 'E') {
-      unread_char(ch);
-      break;
-    }
-    string_token.push_back(ch);
-  }
 
   try {
     value = stof(string_token);
@@ -149,25 +276,16 @@ Token InputStream::_parse_float_token(const char &first_ch,
 
 Token InputStream::_parse_keyword_or_identifier_token(
     const char &first_ch, SourceLocation _location) {
-  string string_token;
-  string_token.push_back(first_ch);
-
-  while (true) {
-    char ch = read_char();
+  size_t start = pos - 1;
+  size_t length = 1 + _skip_word(_is_word_char);
+  string_view word(data + start, length);
 
-    if (!isalnum(ch) && ch != '_') {
-      unread_char(ch);
-      break;
-    }
-
-    string_token.push_back(ch);
-  }
   Token token(_location);
-  try {
-    token.assign_keyword(KEYWORDS.at(string_token));
-  } catch (out_of_range) {
-    token.assign_identifier(string_token);
-  }
+  KeywordEnum keyword;
+  if (_find_keyword(word, keyword))
+    token.assign_keyword(keyword);
+  else
+    token.assign_identifier(word);
   return token;
 }
 
@@ -202,16 +320,16 @@ Token InputStream::read_token() {
   // character (which has been put back in the stream with self.unread_char).
   // First, we save the position in the stream
   SourceLocation token_location = location;
-  if (symbols.find(ch) != string::npos) {
+  if (_is_symbol(ch)) {
     // One-character symbol, like '(' or ','
     return _parse_symbol_token(ch, token_location);
   } else if (ch == '"') {
     // A literal string (used for file names)
     return _parse_string_token(token_location);
-  } else if (isdigit(ch) || ch == '+' || ch == '-' || ch == '.') {
+  } else if (_is_digit(ch) || ch == '+' || ch == '-' || ch == '.') {
     // A floating-point number
     return _parse_float_token(ch, token_location);
-  } else if (isalpha(ch) || ch == '_') {
+  } else if (_is_alpha(ch) || ch == '_') {
     // Since it begins with an alphabetic character, it must either be a keyword
     // or a identifier
     return _parse_keyword_or_identifier_token(ch, token_location);
@@ -231,7 +349,7 @@ void InputStream::expect_symbol(const char &ch) {
   Token token = read_token();
   if (token.type != TokenType::SYMBOL || token.value.symbol != ch) {
     throw(GrammarError(token.location, fmt::format("got '{}' instead of '{}'",
-                                                   token.value.symbol, ch)));
+                                                   _token_text(token), ch)));
   }
 }
 
@@ -241,7 +359,7 @@ KeywordEnum InputStream::expect_keywords(const vector<KeywordEnum> &keywords) {
   if (token.type != TokenType::KEYWORD) {
     throw(GrammarError(
         token.location,
-        fmt::format("expected a keyword instead of '{}'", token.value.symbol)));
+        fmt::format("expected a keyword instead of '{}'", _token_text(token))));
   }
 
   if (find(keywords.begin(), keywords.end(), token.value.keyword) ==
@@ -251,21 +369,34 @@ KeywordEnum InputStream::expect_keywords(const vector<KeywordEnum> &keywords) {
   return token.value.keyword;
 }
 
-float InputStream::expect_number(const Scene &_scene) {
+float InputStream::expect_number(const Scene &_scene, string *variable_name) {
   Token token = read_token();
+  if (variable_name)
+    *variable_name = "";
+
   if (token.type == TokenType::LITERAL_NUMBER) {
     return token.value.number;
   } else if (token.type == TokenType::IDENTIFIER) {
-    string variable_name = token.value.str;
-    if (_scene.float_variables.find(variable_name) ==
-        _scene.float_variables.end()) {
-      throw(GrammarError(token.location,
-                         "unknown variable '" + token.value.str + "'"));
+    string name{token.value.str};
+    if (_scene.float_variables.find(name) == _scene.float_variables.end()) {
+      throw(GrammarError(token.location, "unknown variable '" + name + "'"));
+    }
+    if (variable_name)
+      *variable_name = name;
+    else if (find(animated_variables.begin(), animated_variables.end(),
+                  name) != animated_variables.end()) {
+      if (!fix_animated_variables)
+        throw(GrammarError(token.location,
+                           "the animated variable '" + name +
+                               "' can only be used in transformations"));
+      if (find(fixed_variables.begin(), fixed_variables.end(), name) ==
+          fixed_variables.end())
+        fixed_variables.push_back(name);
     }
-    return _scene.float_variables.at(variable_name);
+    return _scene.float_variables.at(name);
   } else {
     throw(GrammarError(token.location,
-                       "got '" + token.value.str + "' instead of a number"));
+                       "got '" + _token_text(token) + "' instead of a number"));
   }
 }
 
@@ -274,7 +405,7 @@ string InputStream::expect_string() {
   switch (token.type) {
   case TokenType::IDENTIFIER:
     throw(GrammarError(token.location,
-                       "got '" + token.value.str + "' instead of a string"));
+                       "got '" + _token_text(token) + "' instead of a string"));
     break;
   case TokenType::KEYWORD:
     throw(GrammarError(token.location, "got a keyword instead of a string."));
@@ -291,14 +422,14 @@ string InputStream::expect_string() {
                                                  token.value.symbol)));
     break;
   }
-  return token.value.str;
+  return string(token.value.str);
 }
 
 string InputStream::expect_identifier() {
   Token token = read_token();
   switch (token.type) {
   case TokenType::LITERAL_STRING:
-    throw(GrammarError(token.location, "got '" + token.value.str +
+    throw(GrammarError(token.location, "got '" + _token_text(token) +
                                            "' instead of a identifier"));
     break;
   case TokenType::KEYWORD:
@@ -318,16 +449,18 @@ string InputStream::expect_identifier() {
                                                  token.value.symbol)));
     break;
   }
-  return token.value.str;
+  return string(token.value.str);
 }
 
-Vec InputStream::_parse_vector(const Scene &_scene) {
+Vec InputStream::_parse_vector(const Scene &_scene, string *variable_names) {
   expect_symbol('[');
-  float x = expect_number(_scene);
+  float x = expect_number(_scene, variable_names);
   expect_symbol(',');
-  float y = expect_number(_scene);
+  float y =
+      expect_number(_scene, variable_names ? variable_names + 1 : nullptr);
   expect_symbol(',');
-  float z = expect_number(_scene);
+  float z =
+      expect_number(_scene, variable_names ? variable_names + 2 : nullptr);
   expect_symbol(']');
 
   return Vec{x, y, z};
@@ -363,8 +496,15 @@ shared_ptr<Pigment> InputStream::_parse_pigment(const Scene &_scene) {
     result = make_shared<CheckeredPigment>(_color1, _color2, num_of_steps);
   } else if (keyword == KeywordEnum::IMAGE) {
     string filename = expect_string();
-    HdrImage image{filename};
-    result = make_shared<ImagePigment>(image);
+    Timer t;
+    TextureOptions options;
+    options.map = map_textures;
+    options.tiled = tile_textures;
+    options.mipmaps = texture_filter != TextureFilter::nearest;
+    result = make_shared<ImagePigment>(textures->get(filename, options),
+                                       texture_filter);
+    if (stats_enabled())
+      thread_stats().texture_seconds += t.elapsed();
   } else {
     fmt::print("ERROR: {} is not a valid pigment type!", keyword);
     assert(false);
@@ -401,8 +541,9 @@ tuple<string, Material> InputStream::_parse_material(const Scene &_scene) {
   return tuple<string, Material>{name, Material{brdf, emitted_radiance}};
 }
 
-Transformation InputStream::_parse_transformation(const Scene &_scene) {
-  Transformation result;
+TransformationExpression
+InputStream::_parse_transformation(const Scene &_scene) {
+  TransformationExpression result;
   vector<KeywordEnum> transformation_keyword{
       KeywordEnum::IDENTITY,   KeywordEnum::TRANSLATION,
       KeywordEnum::ROTATION_X, KeywordEnum::ROTATION_Y,
@@ -410,40 +551,29 @@ Transformation InputStream::_parse_transformation(const Scene &_scene) {
   };
 
   while (true) {
-    KeywordEnum keyword = expect_keywords(transformation_keyword);
+    TransformationExpression::Factor factor;
+    factor.keyword = expect_keywords(transformation_keyword);
 
-    switch (keyword) {
+    switch (factor.keyword) {
     case KeywordEnum::IDENTITY:
       break; // Do nothing (this is a primitive form of optimization!)
 
     case KeywordEnum::TRANSLATION:
+    case KeywordEnum::SCALING: {
       expect_symbol('(');
-      result = result * translation(_parse_vector(_scene));
-      expect_symbol(')');
-      break;
-
-    case KeywordEnum::ROTATION_X:
-      expect_symbol('(');
-      result = result * rotation_x(expect_number(_scene));
-      expect_symbol(')');
-      break;
-
-    case KeywordEnum::ROTATION_Y:
-      expect_symbol('(');
-      result = result * rotation_y(expect_number(_scene));
+      Vec v = _parse_vector(_scene, factor.variables);
+      factor.values[0] = v.x;
+      factor.values[1] = v.y;
+      factor.values[2] = v.z;
       expect_symbol(')');
-      break;
-
-    case KeywordEnum::ROTATION_Z:
-      expect_symbol('(');
-      result = result * rotation_z(expect_number(_scene));
-      expect_symbol(')');
-      break;
+      result.factors.push_back(factor);
+    } break;
 
-    case KeywordEnum::SCALING:
+    default: // A rotation
       expect_symbol('(');
-      result = result * scaling(_parse_vector(_scene));
+      factor.values[0] = expect_number(_scene, &factor.variables[0]);
       expect_symbol(')');
+      result.factors.push_back(factor);
       break;
     }
 
@@ -458,7 +588,8 @@ Transformation InputStream::_parse_transformation(const Scene &_scene) {
   return result;
 }
 
-Sphere InputStream::_parse_sphere(const Scene &_scene) {
+Sphere InputStream::_parse_sphere(const Scene &_scene,
+                                  TransformationExpression &transformation) {
   expect_symbol('(');
   string material_name = expect_identifier();
 
@@ -468,13 +599,15 @@ Sphere InputStream::_parse_sphere(const Scene &_scene) {
     throw(GrammarError(location, "unknown material '" + material_name + "'"));
   }
   expect_symbol(',');
-  Transformation transformation = _parse_transformation(_scene);
+  transformation = _parse_transformation(_scene);
   expect_symbol(')');
 
-  return Sphere(transformation, _scene.materials.at(material_name));
+  return Sphere(transformation.evaluate(_scene.float_variables),
+                _scene.materials.at(material_name));
 }
 
-Plane InputStream::_parse_plane(const Scene &_scene) {
+Plane InputStream::_parse_plane(const Scene &_scene,
+                                TransformationExpression &transformation) {
   expect_symbol('(');
   string material_name = expect_identifier();
 
@@ -484,19 +617,24 @@ Plane InputStream::_parse_plane(const Scene &_scene) {
     throw(GrammarError(location, "unknown material '" + material_name + "'"));
   }
   expect_symbol(',');
-  Transformation transformation = _parse_transformation(_scene);
+  transformation = _parse_transformation(_scene);
   expect_symbol(')');
 
-  return Plane(transformation, _scene.materials.at(material_name));
+  return Plane(transformation.evaluate(_scene.float_variables),
+               _scene.materials.at(material_name));
 }
 
-shared_ptr<Camera> InputStream::_parse_camera(const Scene &_scene) {
+shared_ptr<Camera>
+InputStream::_parse_camera(const Scene &_scene,
+                           TransformationExpression &transformation_expr) {
   expect_symbol('(');
   vector<KeywordEnum> camera_keyword{KeywordEnum::PERSPECTIVE,
                                      KeywordEnum::ORTHOGONAL};
   KeywordEnum type_keyword = expect_keywords(camera_keyword);
   expect_symbol(',');
-  Transformation transformation = _parse_transformation(_scene);
+  transformation_expr = _parse_transformation(_scene);
+  Transformation transformation =
+      transformation_expr.evaluate(_scene.float_variables);
   expect_symbol(',');
   float aspect_ratio = expect_number(_scene);
   float distance = 0.f;
@@ -519,6 +657,7 @@ shared_ptr<Camera> InputStream::_parse_camera(const Scene &_scene) {
 }
 
 Scene InputStream::parse_scene(const map<string, float> &variables) {
+  fixed_variables.clear();
   Scene _scene;
   _scene.float_variables = variables;
   for (auto const &key : variables) {
@@ -557,16 +696,23 @@ Scene InputStream::parse_scene(const map<string, float> &variables) {
       }
     } break;
     case KeywordEnum::SPHERE:
-      _scene.world.add(make_shared<Sphere>(_parse_sphere(_scene)));
-      break;
-    case KeywordEnum::PLANE:
-      _scene.world.add(make_shared<Plane>(_parse_plane(_scene)));
-      break;
+    case KeywordEnum::PLANE: {
+      TransformationExpression transformation;
+      if (what.value.keyword == KeywordEnum::SPHERE)
+        _scene.world.add(
+            make_shared<Sphere>(_parse_sphere(_scene, transformation)));
+      else
+        _scene.world.add(
+            make_shared<Plane>(_parse_plane(_scene, transformation)));
+      if (transformation.depends_on(animated_variables))
+        _scene.animated_shapes.push_back(
+            {_scene.world.shapes.size() - 1, transformation});
+    } break;
     case KeywordEnum::CAMERA:
       if (_scene.camera) {
         throw GrammarError(what.location, "cannot define more than one camera");
       } else {
-        _scene.camera = _parse_camera(_scene);
+        _scene.camera = _parse_camera(_scene, _scene.camera_transformation);
       }
       break;
     case KeywordEnum::MATERIAL: {
@@ -575,5 +721,113 @@ Scene InputStream::parse_scene(const map<string, float> &variables) {
     } break;
     }
   }
+
+  _scene.fixed_variables = fixed_variables;
+  // All the shapes are known: build the acceleration structure once for all
+  _scene.world.compile();
   return _scene;
-}
\ No newline at end of file
+}
+Transformation
+TransformationExpression::evaluate(const map<string, float> &variables) const {
+  Transformation result;
+  for (const auto &factor : factors) {
+    float values[3];
+    for (int i{}; i < 3; i++) {
+      auto it = variables.find(factor.variables[i]);
+      values[i] = it == variables.end() ? factor.values[i] : it->second;
+    }
+
+    switch (factor.keyword) {
+    case KeywordEnum::TRANSLATION:
+      result = result * translation(Vec(values[0], values[1], values[2]));
+      break;
+    case KeywordEnum::SCALING:
+      result = result * scaling(Vec(values[0], values[1], values[2]));
+      break;
+    case KeywordEnum::ROTATION_X:
+      result = result * rotation_x(values[0]);
+      break;
+    case KeywordEnum::ROTATION_Y:
+      result = result * rotation_y(values[0]);
+      break;
+    case KeywordEnum::ROTATION_Z:
+      result = result * rotation_z(values[0]);
+      break;
+    default:
+      break;
+    }
+  }
+  return result;
+}
+
+bool TransformationExpression::depends_on(
+    const vector<string> &variables) const {
+  for (const auto &factor : factors) {
+    for (const auto &name : factor.variables) {
+      if (name != "" &&
+          find(variables.begin(), variables.end(), name) != variables.end())
+        return true;
+    }
+  }
+  return false;
+}
+
+map<string, float>
+Scene::_variables_at(const map<string, float> &values) const {
+  map<string, float> variables = float_variables;
+  for (const auto &value : values)
+    variables[value.first] = value.second;
+  return variables;
+}
+
+shared_ptr<Camera> Scene::camera_at(const map<string, float> &values) const {
+  shared_ptr<Camera> result;
+  if (auto perspective = dynamic_pointer_cast<PerspectiveCamera>(camera))
+    result = make_shared<PerspectiveCamera>(*perspective);
+  else
+    result = make_shared<OrthogonalCamera>(
+        *static_pointer_cast<OrthogonalCamera>(camera));
+  result->transformation =
+      camera_transformation.evaluate(_variables_at(values));
+  return result;
+}
+
+World Scene::world_at(const map<string, float> &values) const {
+  // Nothing moves: the trees and the compiled scene are copied as they are
+  if (animated_shapes.empty())
+    return world;
+
+  map<string, float> variables = _variables_at(values);
+  World result;
+  result.shapes = world.shapes;
+  for (const auto &animated : animated_shapes) {
+    shared_ptr<Shape> shape;
+    const Shape *original = world.shapes[animated.first].get();
+    if (auto sphere = dynamic_cast<const Sphere *>(original))
+      shape = make_shared<Sphere>(*sphere);
+    else
+      shape = make_shared<Plane>(*static_cast<const Plane *>(original));
+    shape->set_transformation(animated.second.evaluate(variables));
+    result.shapes[animated.first] = shape;
+  }
+  if (!world.has_bvh() || !world.has_compiled()) {
+    result.compile();
+    return result;
+  }
+
+  // The shapes keep their place in the trees of `world`, whose boxes are only
+  // moved around them
+  vector<AABB> shape_boxes(result.shapes.size()), sphere_boxes;
+  for (int i{}; i < result.shapes.size(); i++) {
+    Shape *shape = result.shapes[i].get();
+    if (shape->is_bounded())
+      shape_boxes[i] = shape->bounding_box();
+    if (dynamic_cast<Sphere *>(shape))
+      sphere_boxes.push_back(shape->bounding_box());
+  }
+  BVH shape_bvh = world.bvh, sphere_bvh = world.compiled.bvh;
+  shape_bvh.refit(shape_boxes);
+  sphere_bvh.refit(sphere_boxes);
+  result.compile(move(shape_bvh), move(sphere_bvh));
+  return result;
+}
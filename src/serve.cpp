@@ -0,0 +1,517 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "serve.h"
+#include "fmtlib.h"
+#include "imagetracer.h"
+#include "json.h"
+#include "scene_cache.h"
+#include "stats.h"
+#include <cerrno>
+#include <cmath>
+#include <csignal>
+#include <cstring>
+#include <limits>
+#include <set>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// The operator== template of geometry.h makes comparing times ambiguous
+static bool _same_time(filesystem::file_time_type a,
+                       filesystem::file_time_type b) {
+  return a.time_since_epoch().count() == b.time_since_epoch().count();
+}
+
+// Add to `files` the image read by `pigment`, if any
+static void _add_texture(const shared_ptr<Pigment> &pigment,
+                         set<string> &files) {
+  if (auto image = dynamic_cast<const ImagePigment *>(pigment.get())) {
+    if (image->texture.file_name != "")
+      files.insert(image->texture.file_name);
+  }
+}
+
+// Return the images read by the pigments of `scene`
+static set<string> _texture_files(const Scene &scene) {
+  set<string> files;
+  for (const auto &material : scene.materials) {
+    _add_texture(material.second.brdf->pigment, files);
+    _add_texture(material.second.emitted_radiance, files);
+  }
+  for (const auto &shape : scene.world.shapes) {
+    _add_texture(shape->material.brdf->pigment, files);
+    _add_texture(shape->material.emitted_radiance, files);
+  }
+  return files;
+}
+
+shared_ptr<Scene> SceneStore::_get(const string &key, const string &file_name,
+                                   filesystem::file_time_type time,
+                                   const function<Scene()> &load) {
+  promise<shared_ptr<Scene>> loaded;
+  shared_future<shared_ptr<Scene>> scene;
+  bool must_load = false;
+  unsigned long load_id;
+  {
+    lock_guard<mutex> lock(entries_mutex);
+    uses++;
+    auto it = entries.find(key);
+    bool is_current = it != entries.end() && _same_time(it->second.time, time);
+    if (is_current) {
+      for (const auto &texture : it->second.textures) {
+        error_code error;
+        if (!_same_time(filesystem::last_write_time(texture.first, error),
+                        texture.second))
+          is_current = false;
+      }
+    }
+    if (is_current) {
+      it->second.last_use = uses;
+      scene = it->second.scene;
+    } else {
+      // The other scenes read from an older version of the file are stale
+      for (auto other = entries.begin(); other != entries.end();) {
+        if (other->second.file_name == file_name &&
+            !_same_time(other->second.time, time))
+          other = entries.erase(other);
+        else
+          ++other;
+      }
+      // Jobs still rendering a dropped scene keep it alive until they finish
+      while (!entries.empty() && entries.size() >= max_scenes) {
+        auto oldest = entries.begin();
+        for (auto other = entries.begin(); other != entries.end(); ++other)
+          if (other->second.last_use < oldest->second.last_use)
+            oldest = other;
+        entries.erase(oldest);
+      }
+      scene = loaded.get_future().share();
+      entries[key] = Entry{file_name, time, scene, uses, uses, {}};
+      load_id = uses;
+      must_load = true;
+    }
+  }
+
+  if (must_load) {
+    try {
+      auto result = make_shared<Scene>(load());
+      vector<pair<string, filesystem::file_time_type>> texture_times;
+      for (const auto &texture : _texture_files(*result))
+        texture_times.push_back({texture, textures->file_time(texture)});
+      {
+        lock_guard<mutex> lock(entries_mutex);
+        auto it = entries.find(key);
+        if (it != entries.end() && it->second.load == load_id)
+          it->second.textures = texture_times;
+      }
+      loaded.set_value(result);
+    } catch (...) {
+      loaded.set_exception(current_exception());
+    }
+    // The new scene holds the textures it shares with the dropped ones
+    textures->prune();
+  }
+  return scene.get();
+}
+
+size_t SceneStore::size() {
+  lock_guard<mutex> lock(entries_mutex);
+  return entries.size();
+}
+
+ServedScene SceneStore::get(const string &file_name,
+                            const map<string, float> &vars) {
+  error_code error;
+  auto time = filesystem::last_write_time(file_name, error);
+  if (error)
+    throw runtime_error("unable to open " + file_name);
+
+  if (is_scene_cache(file_name)) {
+    shared_ptr<Scene> scene = _get(file_name, file_name, time, [&]() {
+      return read_scene_cache(file_name, *textures, texture_options(settings),
+                              parse_texture_filter(settings.texture_filter));
+    });
+    for (const auto &var : vars) {
+      auto it = scene->float_variables.find(var.first);
+      if (it == scene->float_variables.end() || it->second != var.second)
+        throw runtime_error(file_name + " was compiled with other values of "
+                            "the variables");
+    }
+    return {scene, false};
+  }
+
+  RenderSettings scene_settings = settings;
+  scene_settings.input_scene = file_name;
+  string key = file_name;
+  if (!vars.empty()) {
+    vector<string> names;
+    for (const auto &var : vars) {
+      names.push_back(var.first);
+      key += " " + var.first;
+    }
+    shared_ptr<Scene> scene = _get(key, file_name, time, [&]() {
+      return read_scene_file(scene_settings, vars, names, textures, false,
+                             true);
+    });
+    // The variables used outside the transformations are fixed in the scene,
+    // which can only be shared by the jobs giving them the same values
+    bool same_values = true;
+    for (const auto &name : scene->fixed_variables) {
+      if (scene->float_variables.at(name) != vars.at(name))
+        same_values = false;
+    }
+    if (same_values)
+      return {scene, true};
+    key = file_name;
+    for (const auto &var : vars)
+      key += fmt::format(" {}={}", var.first, var.second);
+  }
+  return {_get(key, file_name, time,
+               [&]() {
+                 return read_scene_file(scene_settings, vars, {}, textures,
+                                        false);
+               }),
+          false};
+}
+
+// Return the number `value`, throwing invalid_argument if it is not
+static double job_number(const JsonValue &value, const string &key) {
+  if (value.type != JsonType::number)
+    throw invalid_argument(fmt::format("\"{}\" must be a number", key));
+  return value.number;
+}
+
+// Return the integer `value`, throwing invalid_argument if it is not
+static int job_int(const JsonValue &value, const string &key) {
+  double number = job_number(value, key);
+  if (number != floor(number) || abs(number) > numeric_limits<int>::max())
+    throw invalid_argument(fmt::format("\"{}\" must be an integer", key));
+  return static_cast<int>(number);
+}
+
+// Return the string `value`, throwing invalid_argument if it is not
+static string job_string(const JsonValue &value, const string &key) {
+  if (value.type != JsonType::string)
+    throw invalid_argument(fmt::format("\"{}\" must be a string", key));
+  return value.str;
+}
+
+void parse_render_job(const string &line, RenderJob &job) {
+  JsonValue json = parse_json(line);
+  if (json.type != JsonType::object)
+    throw invalid_argument("a job must be a JSON object");
+  if (const JsonValue *id = json.find("id")) {
+    if (id->type == JsonType::string)
+      job.id = json_quote(id->str);
+    else
+      job.id = fmt::format("{}", job_number(*id, "id"));
+  }
+
+  RenderSettings &settings = job.settings;
+  for (const auto &member : json.object) {
+    const string &key = member.first;
+    const JsonValue &value = member.second;
+    if (key == "id")
+      continue;
+    else if (key == "scene")
+      settings.input_scene = job_string(value, key);
+    else if (key == "output")
+      settings.output_file = job_string(value, key);
+    else if (key == "width")
+      settings.width = job_int(value, key);
+    else if (key == "height")
+      settings.height = job_int(value, key);
+    else if (key == "algorithm")
+      settings.algorithm = job_string(value, key);
+    else if (key == "samples_per_pixel")
+      settings.samples_per_pixel = job_int(value, key);
+    else if (key == "num_of_rays")
+      settings.num_of_rays = job_int(value, key);
+    else if (key == "max_depth")
+      settings.max_depth = job_int(value, key);
+    else if (key == "init_state")
+      settings.init_state = job_int(value, key);
+    else if (key == "init_seq")
+      settings.init_seq = job_int(value, key);
+    else if (key == "max_error")
+      settings.max_error = job_number(value, key);
+    else if (key == "min_samples")
+      settings.min_samples = job_int(value, key);
+    else if (key == "max_samples")
+      settings.max_samples = job_int(value, key);
+    else if (key == "vars") {
+      if (value.type != JsonType::object)
+        throw invalid_argument("\"vars\" must be an object");
+      for (const auto &var : value.object)
+        job.vars[var.first] = job_number(var.second, var.first);
+    } else
+      throw invalid_argument(fmt::format("unknown option \"{}\"", key));
+  }
+
+  if (settings.input_scene == "")
+    throw invalid_argument("the job has no scene");
+  if (settings.output_file == "")
+    throw invalid_argument("the job has no output file");
+  if (settings.width <= 0 || settings.height <= 0)
+    throw invalid_argument("the size of the image must be positive");
+  if (settings.algorithm != "onoff" && settings.algorithm != "flat" &&
+      settings.algorithm != "pathtracing" && settings.algorithm != "iterative")
+    throw invalid_argument(
+        fmt::format("unknown renderer type \"{}\"", settings.algorithm));
+  string error = settings_error(settings);
+  if (error != "")
+    throw invalid_argument(error);
+}
+
+string run_render_job(RenderJob &job, SceneStore &scenes, ThreadPool &pool) {
+  const RenderSettings &settings = job.settings;
+  Timer t;
+  ServedScene served = scenes.get(settings.input_scene, job.vars);
+  Scene &scene = *served.scene;
+
+  // As with the frames of an animation, the world is only copied when some
+  // shapes move
+  bool moving_shapes = served.animated && !scene.animated_shapes.empty();
+  World frame_world;
+  if (moving_shapes)
+    frame_world = scene.world_at(job.vars);
+  World &world = moving_shapes ? frame_world : scene.world;
+  shared_ptr<Camera> camera =
+      served.animated ? scene.camera_at(job.vars) : scene.camera;
+  double load_seconds = t.elapsed();
+
+  t.reset();
+  ImageTracer tracer(HdrImage(settings.width, settings.height), camera,
+                     static_cast<int>(sqrt(settings.samples_per_pixel)),
+                     PCG(settings.init_state, settings.init_seq));
+  tracer.pool = &pool;
+  shared_ptr<Renderer> renderer = make_renderer(settings, world, false);
+  auto render_ray = [&](const Ray *rays, int n, Color *colors, PCG &pcg) {
+    renderer->render_packet(rays, n, colors, pcg);
+  };
+  if (settings.is_adaptive()) {
+    AccumulationBuffer buffer(settings.width, settings.height);
+    tracer.fire_adaptive(render_ray, buffer, settings.max_error,
+                         settings.min_samples, settings.max_samples, 0);
+  } else
+    tracer.fire_all_rays(render_ray, 0);
+  double render_seconds = t.elapsed();
+
+  string output_file = settings.output_file;
+  string ldr_extension = split_output_file(output_file);
+  save_image(tracer.image, output_file + ".pfm", output_file + ldr_extension);
+  return fmt::format("\"pfm\": {}, \"image\": {}, \"load_seconds\": {:.3f}, "
+                     "\"render_seconds\": {:.3f}",
+                     json_quote(output_file + ".pfm"),
+                     json_quote(output_file + ldr_extension), load_seconds,
+                     render_seconds);
+}
+
+ServeClient::~ServeClient() {
+  ::close(input);
+  if (output != input)
+    ::close(output);
+}
+
+void ServeClient::reply(const string &line) {
+  lock_guard<mutex> lock(output_mutex);
+  string text = line + "\n";
+  size_t written = 0;
+  while (written < text.size()) {
+    ssize_t n = write(output, text.data() + written, text.size() - written);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0)
+      return;
+    written += n;
+  }
+}
+
+void JobQueue::push(shared_ptr<ServeClient> client, string line) {
+  {
+    lock_guard<mutex> lock(jobs_mutex);
+    jobs.emplace_back(client, move(line));
+  }
+  job_available.notify_one();
+}
+
+bool JobQueue::pop(shared_ptr<ServeClient> &client, string &line) {
+  unique_lock<mutex> lock(jobs_mutex);
+  job_available.wait(lock, [&]() { return closed || !jobs.empty(); });
+  if (jobs.empty())
+    return false;
+  client = jobs.front().first;
+  line = move(jobs.front().second);
+  jobs.pop_front();
+  return true;
+}
+
+void JobQueue::close() {
+  {
+    lock_guard<mutex> lock(jobs_mutex);
+    closed = true;
+  }
+  job_available.notify_all();
+}
+
+void read_jobs(shared_ptr<ServeClient> client, JobQueue &queue) {
+  // Longer lines are surely not jobs: the client is dropped
+  const size_t max_line_length = 1 << 20;
+  string buffer;
+  char chunk[65536];
+  while (true) {
+    ssize_t n = read(client->input, chunk, sizeof(chunk));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    buffer.append(chunk, n);
+
+    size_t start = 0, end;
+    while ((end = buffer.find('\n', start)) != string::npos) {
+      string line = buffer.substr(start, end - start);
+      if (!line.empty() && line.back() == '\r')
+        line.pop_back();
+      if (line.find_first_not_of(" \t") != string::npos)
+        queue.push(client, move(line));
+      start = end + 1;
+    }
+    buffer.erase(0, start);
+    if (buffer.size() > max_line_length) {
+      client->reply(R"({"id": null, "status": "error", "error": "line too )"
+                    R"(long"})");
+      return;
+    }
+  }
+}
+
+void serve(RenderSettings settings, vector<string> &cli_vars,
+           const string &socket_path, int num_of_jobs, int max_scenes) {
+  if (settings.is_progressive()) {
+    fmt::print("ERROR: serve does not render progressively.\nExiting.\n");
+    exit(1);
+  }
+  if (settings.is_worker()) {
+    fmt::print("ERROR: only render can split an image among "
+               "workers.\nExiting.\n");
+    exit(1);
+  }
+  if (settings.uses_checkpoints()) {
+    fmt::print("ERROR: only render can write and resume from "
+               "checkpoints.\nExiting.\n");
+    exit(1);
+  }
+  if (num_of_jobs <= 0) {
+    fmt::print("ERROR: the number of jobs must be positive.\nExiting.\n");
+    exit(1);
+  }
+  if (max_scenes <= 0) {
+    fmt::print("ERROR: the number of scenes kept in memory must be "
+               "positive.\nExiting.\n");
+    exit(1);
+  }
+  parse_texture_filter(settings.texture_filter); // Exit if it is unknown
+  map<string, float> default_vars = build_vars_table(cli_vars);
+
+  SceneStore scenes(settings, max_scenes);
+  if (settings.input_scene != "") {
+    try {
+      scenes.get(settings.input_scene, default_vars);
+    } catch (exception &e) {
+      fmt::print("ERROR: {}\nExiting.\n", e.what());
+      exit(1);
+    }
+  }
+
+  // Replies must be written to a closed connection without killing the
+  // daemon
+  signal(SIGPIPE, SIG_IGN);
+
+  // The jobs share the threads rendering the tiles of their images
+  ThreadPool pool(settings.num_of_threads);
+  JobQueue queue;
+  auto worker = [&]() {
+    shared_ptr<ServeClient> client;
+    string line;
+    while (queue.pop(client, line)) {
+      RenderJob job;
+      job.settings = settings;
+      job.vars = default_vars;
+      string reply;
+      try {
+        parse_render_job(line, job);
+        reply = fmt::format(R"({{"id": {}, "status": "done", {}}})", job.id,
+                            run_render_job(job, scenes, pool));
+      } catch (exception &e) {
+        reply = fmt::format(R"({{"id": {}, "status": "error", "error": {}}})",
+                            job.id, json_quote(e.what()));
+      }
+      client->reply(reply);
+      client.reset();
+    }
+  };
+  vector<thread> workers;
+  for (int i{}; i < num_of_jobs; i++)
+    workers.emplace_back(worker);
+
+  if (socket_path == "") {
+    // The replies are the only output written to stdout: the messages of the
+    // renderer go to stderr
+    fflush(stdout);
+    int replies = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+    fmt::print("Waiting for jobs on the standard input\n");
+    read_jobs(make_shared<ServeClient>(dup(STDIN_FILENO), replies), queue);
+
+    queue.close();
+    for (auto &worker : workers)
+      worker.join();
+    return;
+  }
+
+  sockaddr_un address{};
+  address.sun_family = AF_UNIX;
+  if (socket_path.size() >= sizeof(address.sun_path)) {
+    fmt::print("ERROR: the path of the socket is too long.\nExiting.\n");
+    exit(1);
+  }
+  strcpy(address.sun_path, socket_path.c_str());
+  int server = socket(AF_UNIX, SOCK_STREAM, 0);
+  error_code error;
+  if (filesystem::is_socket(socket_path, error))
+    unlink(socket_path.c_str()); // Left by a daemon which has been killed
+  if (server < 0 ||
+      bind(server, reinterpret_cast<sockaddr *>(&address), sizeof(address)) <
+          0 ||
+      listen(server, 16) < 0) {
+    fmt::print("ERROR: unable to listen on {}: {}.\nExiting.\n", socket_path,
+               strerror(errno));
+    exit(1);
+  }
+  fmt::print("Waiting for jobs on {}\n", socket_path);
+  while (true) {
+    int connection = accept(server, nullptr, nullptr);
+    if (connection < 0)
+      continue;
+    thread(read_jobs, make_shared<ServeClient>(connection, connection),
+           ref(queue))
+        .detach();
+  }
+}
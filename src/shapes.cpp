@@ -19,52 +19,151 @@
 
 #include "shapes.h"
 
+// Smallest cosine between a ray and a surface used to stretch footprints:
+// at grazing angles the footprint would grow without limit
+static const float MIN_FOOTPRINT_COS = 0.05f;
+
+// Width of the footprint of `ray` at distance `t`, measured in the reference
+// frame of a shape where the direction of the ray is `object_dir`
+static inline float _object_footprint(Ray ray, Vec object_dir, float t) {
+  float scale = sqrt(object_dir.squared_norm() / ray.dir.squared_norm());
+  return (ray.footprint + t * ray.spread) * scale;
+}
+
+void Shape::packet_intersection(const RayPacket &packet, float *t) {
+  for (int i{}; i < RayPacket::max_size; i++) {
+    t[i] = numeric_limits<float>::infinity();
+    if (i < packet.size) {
+      HitRecord hit = ray_intersection(packet.rays[i]);
+      if (hit.hit)
+        t[i] = hit.t;
+    }
+  }
+}
+
 HitRecord Sphere::ray_intersection(Ray ray) {
-  Ray inv_ray = ray.transform(transformation.inverse());
-  Vec origin_vec = inv_ray.origin.to_vec();
-  bool hit = true;
+  // Move the ray into the reference frame of the unit sphere
+  Point origin;
+  Vec dir;
+  if (is_simple) {
+    origin = Point{(ray.origin.x - center.x) * inv_radius,
+                   (ray.origin.y - center.y) * inv_radius,
+                   (ray.origin.z - center.z) * inv_radius};
+    dir = ray.dir * inv_radius;
+  } else {
+    origin = world_to_object * ray.origin;
+    dir = world_to_object * ray.dir;
+  }
+  Vec origin_vec = origin.to_vec();
 
-  float a = inv_ray.dir.squared_norm();
-  float b = 2.0 * origin_vec.dot(inv_ray.dir);
-  float c = origin_vec.squared_norm() - 1.0;
+  float a = dir.x * dir.x + dir.y * dir.y + dir.z * dir.z;
+  float b = 2.f * origin_vec.dot(dir);
+  float c = origin_vec.dot(origin_vec) - 1.f;
 
-  float delta = b * b - 4.0 * a * c;
-  if (delta <= 0.0)
-    hit = false;
+  float delta = b * b - 4.f * a * c;
+  if (delta <= 0.f)
+    return HitRecord();
 
-  float tmin = (-b - sqrt(delta)) / (2.0 * a);
-  float tmax = (-b + sqrt(delta)) / (2.0 * a);
-  float first_hit_t = 0.f;
+  float sqrt_delta = sqrt(delta);
+  float tmin = (-b - sqrt_delta) / (2.f * a);
+  float tmax = (-b + sqrt_delta) / (2.f * a);
+  float first_hit_t;
 
-  if (tmin > inv_ray.tmin && tmin < inv_ray.tmax)
+  if (tmin > ray.tmin && tmin < ray.tmax)
     first_hit_t = tmin;
-  else if (tmax > inv_ray.tmin && tmax < inv_ray.tmax)
+  else if (tmax > ray.tmin && tmax < ray.tmax)
     first_hit_t = tmax;
   else
-    hit = false;
+    return HitRecord();
+
+  Point hit_point = origin + dir * first_hit_t;
+  Normal normal = sphere_normal(hit_point, ray.dir);
 
-  Point hit_point = inv_ray.at(first_hit_t);
+  Point world_point;
+  if (is_simple) {
+    world_point = center + hit_point.to_vec() * radius;
+    normal = inv_radius * normal;
+  } else {
+    world_point = object_to_world * hit_point;
+    normal = world_to_object.transpose_mul(normal);
+  }
 
-  return HitRecord(make_shared<Sphere>(*this), transformation * hit_point,
-                   transformation * sphere_normal(hit_point, ray.dir),
-                   sphere_point_to_uv(hit_point), first_hit_t, ray, hit);
+  HitRecord record(this, world_point, normal, sphere_point_to_uv(hit_point),
+                   first_hit_t, ray, true);
+  if (ray.footprint > 0.f || ray.spread > 0.f) {
+    // The footprint is stretched along the surface by the slope of the ray;
+    // a unit of length spans 1 / (2π sinθ) in u and 1 / π in v
+    float cos_theta = fabs(hit_point.to_vec().dot(dir)) / sqrt(a);
+    float sin_theta =
+        sqrt(hit_point.x * hit_point.x + hit_point.y * hit_point.y);
+    float width = _object_footprint(ray, dir, first_hit_t) /
+                  max(cos_theta, MIN_FOOTPRINT_COS);
+    record.footprint =
+        Vec2d(width / (2.f * float(M_PI) * max(sin_theta, 1e-3f)),
+              width / float(M_PI));
+  }
+  return record;
+}
+
+void Sphere::packet_intersection(const RayPacket &packet, float *t) {
+  if (is_simple)
+    packet_intersect_simple_sphere(center, inv_radius, packet, t);
+  else
+    packet_intersect_sphere(world_to_object, packet, t);
+}
+
+void Sphere::_update_simple_form() {
+  const float(&m)[4][4] = transformation.m;
+  is_simple = m[0][1] == 0.f && m[0][2] == 0.f && m[1][0] == 0.f &&
+              m[1][2] == 0.f && m[2][0] == 0.f && m[2][1] == 0.f &&
+              m[0][0] == m[1][1] && m[0][0] == m[2][2] && m[0][0] > 0.f;
+  center = Point{m[0][3], m[1][3], m[2][3]};
+  radius = m[0][0];
+  inv_radius = 1.f / radius;
+}
+
+AABB Sphere::bounding_box() {
+  AABB box;
+  for (int corner{}; corner < 8; corner++) {
+    Point p{(corner & 1) ? 1.f : -1.f, (corner & 2) ? 1.f : -1.f,
+            (corner & 4) ? 1.f : -1.f};
+    box.expand(transformation * p);
+  }
+  return box;
 }
 
 HitRecord Plane::ray_intersection(Ray ray) {
-  Ray inv_ray = ray.transform(transformation.inverse());
-  Vec origin_vec = inv_ray.origin.to_vec();
-  bool hit = true;
+  // Move the ray into the reference frame of the x-y plane
+  Point origin = world_to_object * ray.origin;
+  Vec dir = world_to_object * ray.dir;
 
-  if (are_close(inv_ray.dir.z, 0.0)) // if ray is parallel to the plane
-    hit = false;
+  if (are_close(dir.z, 0.0)) // if ray is parallel to the plane
+    return HitRecord();
 
-  float t = -origin_vec.z / inv_ray.dir.z;
+  float t = -origin.z / dir.z;
+  if (t <= ray.tmin || t >= ray.tmax)
+    return HitRecord();
 
-  if (t <= inv_ray.tmin || t >= inv_ray.tmax)
-    hit = false;
+  Point hit_point = origin + dir * t;
+  HitRecord record(this, object_to_world * hit_point,
+                   world_to_object.transpose_mul(
+                       plane_normal(hit_point, ray.dir)),
+                   plane_point_to_uv(hit_point), t, ray, true);
+  if (ray.footprint > 0.f || ray.spread > 0.f) {
+    // A unit of length on the plane spans a unit in u and v
+    float cos_theta = fabs(dir.z) / sqrt(dir.squared_norm());
+    float width =
+        _object_footprint(ray, dir, t) / max(cos_theta, MIN_FOOTPRINT_COS);
+    record.footprint = Vec2d(width, width);
+  }
+  return record;
+}
 
-  Point hit_point = inv_ray.at(t);
-  return HitRecord(make_shared<Plane>(*this), transformation * hit_point,
-                   transformation * plane_normal(hit_point, ray.dir),
-                   plane_point_to_uv(hit_point), t, ray, hit);
+void Plane::packet_intersection(const RayPacket &packet, float *t) {
+  packet_intersect_plane(world_to_object, packet, t);
 }
+
+AABB Plane::bounding_box() {
+  float inf = numeric_limits<float>::infinity();
+  return AABB{Point(-inf, -inf, -inf), Point(inf, inf, inf)};
+}
\ No newline at end of file
@@ -0,0 +1,174 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "simd.h"
+#include <cstdint>
+#include <cstring>
+
+static bool _cpu_has_avx2() {
+#ifdef HAS_AVX2_KERNELS
+  // Needed because this also runs during static initialization
+  __builtin_cpu_init();
+  return __builtin_cpu_supports("avx2");
+#else
+  return false;
+#endif
+}
+
+static bool use_avx2 = _cpu_has_avx2();
+
+bool simd_enabled() { return use_avx2; }
+
+void set_simd_enabled(bool enabled) { use_avx2 = enabled && _cpu_has_avx2(); }
+
+#ifdef HAS_AVX2_KERNELS
+AVX2_FUNCTION static size_t _byte_swap_32_avx2(const char *src, char *dst,
+                                               size_t count) {
+  const __m256i shuffle = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12, 3, 2, 1, 0, 7, 6,
+      5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  size_t i{};
+  for (; i + 8 <= count; i += 8) {
+    __m256i words =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i *>(src + 4 * i));
+    _mm256_storeu_si256(reinterpret_cast<__m256i *>(dst + 4 * i),
+                        _mm256_shuffle_epi8(words, shuffle));
+  }
+  return i;
+}
+#endif
+
+void byte_swap_32(const void *src, void *dst, size_t count) {
+  const char *from = static_cast<const char *>(src);
+  char *to = static_cast<char *>(dst);
+  size_t i{};
+#ifdef HAS_AVX2_KERNELS
+  if (use_avx2)
+    i = _byte_swap_32_avx2(from, to, count);
+#endif
+  for (; i < count; i++) {
+    uint32_t word;
+    memcpy(&word, from + 4 * i, 4);
+    word = __builtin_bswap32(word);
+    memcpy(to + 4 * i, &word, 4);
+  }
+}
+
+#ifdef HAS_AVX2_KERNELS
+AVX2_FUNCTION static size_t _scale_and_clamp_avx2(float *values, size_t count,
+                                                  float scale) {
+  const __m256 factor = _mm256_set1_ps(scale), one = _mm256_set1_ps(1.f);
+  size_t i{};
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_mul_ps(_mm256_loadu_ps(values + i), factor);
+    _mm256_storeu_ps(values + i, _mm256_div_ps(x, _mm256_add_ps(one, x)));
+  }
+  return i;
+}
+#endif
+
+void scale_and_clamp(float *values, size_t count, float scale) {
+  size_t i{};
+#ifdef HAS_AVX2_KERNELS
+  if (use_avx2)
+    i = _scale_and_clamp_avx2(values, count, scale);
+#endif
+  for (; i < count; i++) {
+    float x = values[i] * scale;
+    values[i] = x / (1 + x);
+  }
+}
+
+#ifdef HAS_AVX2_KERNELS
+// Natural logarithm of eight positive, finite and normal floats, using the
+// same reduction and polynomial as the Cephes library
+AVX2_FUNCTION static __m256 _log_avx2(__m256 x) {
+  const __m256 one = _mm256_set1_ps(1.f);
+  __m256i bits = _mm256_castps_si256(x);
+
+  // x = m * 2^e, with m in [sqrt(2) / 2, sqrt(2))
+  __m256 e = _mm256_cvtepi32_ps(_mm256_sub_epi32(
+      _mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+  __m256 m = _mm256_castsi256_ps(_mm256_or_si256(
+      _mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)),
+      _mm256_castps_si256(one)));
+  __m256 large = _mm256_cmp_ps(m, _mm256_set1_ps(1.41421356f), _CMP_GT_OQ);
+  m = _mm256_blendv_ps(m, _mm256_mul_ps(m, _mm256_set1_ps(0.5f)), large);
+  e = _mm256_add_ps(e, _mm256_and_ps(large, one));
+
+  __m256 t = _mm256_sub_ps(m, one), z = _mm256_mul_ps(t, t);
+  const float coefficients[] = {
+      7.0376836292E-2f,  -1.1514610310E-1f, 1.1676998740E-1f,
+      -1.2420140846E-1f, 1.4249322787E-1f,  -1.6668057665E-1f,
+      2.0000714765E-1f,  -2.4999993993E-1f, 3.3333331174E-1f};
+  __m256 p = _mm256_set1_ps(coefficients[0]);
+  for (int i{1}; i < 9; i++)
+    p = _mm256_add_ps(_mm256_mul_ps(p, t), _mm256_set1_ps(coefficients[i]));
+
+  __m256 y = _mm256_mul_ps(_mm256_mul_ps(p, t), z);
+  y = _mm256_add_ps(y, _mm256_mul_ps(e, _mm256_set1_ps(-2.12194440E-4f)));
+  y = _mm256_sub_ps(y, _mm256_mul_ps(z, _mm256_set1_ps(0.5f)));
+  return _mm256_add_ps(_mm256_add_ps(t, y),
+                       _mm256_mul_ps(e, _mm256_set1_ps(0.693359375f)));
+}
+
+AVX2_FUNCTION static double _sum_log10_avx2(const float *values,
+                                            size_t count) {
+  const __m256 min_normal = _mm256_set1_ps(numeric_limits<float>::min());
+  const __m256 infinity = _mm256_set1_ps(numeric_limits<float>::infinity());
+  const __m256 log10_e = _mm256_set1_ps(0.434294481903f);
+  __m256d low_sum = _mm256_setzero_pd(), high_sum = _mm256_setzero_pd();
+  double sum = 0.;
+  size_t i{};
+  for (; i + 8 <= count; i += 8) {
+    __m256 x = _mm256_loadu_ps(values + i);
+    // Zero, negative, infinite and denormal values are left to log10
+    __m256 valid = _mm256_and_ps(_mm256_cmp_ps(x, min_normal, _CMP_GE_OQ),
+                                 _mm256_cmp_ps(x, infinity, _CMP_LT_OQ));
+    if (_mm256_movemask_ps(valid) != 0xFF) {
+      for (size_t j{i}; j < i + 8; j++)
+        sum += log10(values[j]);
+      continue;
+    }
+
+    __m256 log10_x = _mm256_mul_ps(_log_avx2(x), log10_e);
+    low_sum = _mm256_add_pd(low_sum,
+                            _mm256_cvtps_pd(_mm256_castps256_ps128(log10_x)));
+    high_sum = _mm256_add_pd(
+        high_sum, _mm256_cvtps_pd(_mm256_extractf128_ps(log10_x, 1)));
+  }
+  for (; i < count; i++)
+    sum += log10(values[i]);
+
+  double lanes[4];
+  _mm256_storeu_pd(lanes, _mm256_add_pd(low_sum, high_sum));
+  return sum + lanes[0] + lanes[1] + lanes[2] + lanes[3];
+}
+#endif
+
+double sum_log10(const float *values, size_t count) {
+#ifdef HAS_AVX2_KERNELS
+  if (use_avx2)
+    return _sum_log10_avx2(values, count);
+#endif
+  double sum = 0.;
+  for (size_t i{}; i < count; i++)
+    sum += log10(values[i]);
+  return sum;
+}
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "stats.h"
+#include "fmtlib.h"
+#include <algorithm>
+#include <mutex>
+#include <sstream>
+
+bool _stats_enabled = false;
+
+void set_stats_enabled(bool enabled) { _stats_enabled = enabled; }
+
+// Statistics of the threads which have ended
+static mutex finished_mutex;
+static RenderStats finished_threads;
+
+namespace {
+// The statistics of a thread, which are handed over when it ends
+struct ThreadStats {
+  RenderStats stats;
+
+  ~ThreadStats() {
+    lock_guard<mutex> lock(finished_mutex);
+    finished_threads.merge(stats);
+  }
+};
+} // namespace
+
+RenderStats &thread_stats() {
+  thread_local ThreadStats local;
+  return local.stats;
+}
+
+RenderStats collect_stats() {
+  lock_guard<mutex> lock(finished_mutex);
+  RenderStats result = finished_threads;
+  result.merge(thread_stats());
+  return result;
+}
+
+void reset_stats() {
+  lock_guard<mutex> lock(finished_mutex);
+  finished_threads = RenderStats();
+  thread_stats() = RenderStats();
+}
+
+long RenderStats::rays() const {
+  long sum = 0;
+  for (long count : rays_per_depth)
+    sum += count;
+  return sum;
+}
+
+double RenderStats::average_path_length() const {
+  return camera_rays > 0 ? static_cast<double>(rays()) / camera_rays : 0.;
+}
+
+void RenderStats::merge(const RenderStats &other) {
+  camera_rays += other.camera_rays;
+  for (int i{}; i <= max_depth; i++)
+    rays_per_depth[i] += other.rays_per_depth[i];
+  intersection_tests += other.intersection_tests;
+  hits += other.hits;
+  shadow_rays += other.shadow_rays;
+  russian_roulette_terminations += other.russian_roulette_terminations;
+  textures += other.textures;
+  texture_bytes += other.texture_bytes;
+
+  parse_seconds += other.parse_seconds;
+  texture_seconds += other.texture_seconds;
+  tracing_seconds += other.tracing_seconds;
+  pfm_write_seconds += other.pfm_write_seconds;
+  tone_mapping_seconds += other.tone_mapping_seconds;
+  ldr_encode_seconds += other.ldr_encode_seconds;
+}
+
+// The depths which have been reached, i.e. the elements of `rays_per_depth`
+// to report
+static int _num_of_depths(const RenderStats &stats) {
+  int num_of_depths = RenderStats::max_depth + 1;
+  while (num_of_depths > 1 && stats.rays_per_depth[num_of_depths - 1] == 0)
+    num_of_depths--;
+  return num_of_depths;
+}
+
+void RenderStats::print() const {
+  fmt::print("Statistics:\n");
+  fmt::print("  rays traced: {} ({} camera, {} secondary, {} shadow)\n",
+             rays(), camera_rays, secondary_rays(), shadow_rays);
+  for (int depth{}; depth < _num_of_depths(*this); depth++)
+    fmt::print("    depth {}{}: {}\n", depth,
+               depth == max_depth ? " or more" : "", rays_per_depth[depth]);
+  fmt::print("  intersection tests: {} ({:.2f} per ray)\n", intersection_tests,
+             rays() > 0 ? static_cast<double>(intersection_tests) / rays()
+                        : 0.);
+  fmt::print("  hits: {} ({:.1f}% of the rays)\n", hits,
+             rays() > 0 ? 100. * hits / rays() : 0.);
+  fmt::print("  Russian roulette terminations: {}\n",
+             russian_roulette_terminations);
+  fmt::print("  average path length: {:.3f} rays\n", average_path_length());
+  fmt::print("  textures: {} ({:.1f} MB)\n", textures,
+             texture_bytes / (1024. * 1024.));
+  fmt::print("  time spent:\n");
+  fmt::print("    scene parsing: {:.3f} s (of which texture loading: "
+             "{:.3f} s)\n",
+             parse_seconds, texture_seconds);
+  fmt::print("    tracing: {:.3f} s\n", tracing_seconds);
+  fmt::print("    pfm writing: {:.3f} s (in the background)\n",
+             pfm_write_seconds);
+  fmt::print("    tone mapping: {:.3f} s\n", tone_mapping_seconds);
+  fmt::print("    ldr encoding: {:.3f} s\n", ldr_encode_seconds);
+}
+
+string RenderStats::to_json() const {
+  stringstream json;
+  json << "{\n  \"rays\": " << rays() << ",\n";
+  json << "  \"camera_rays\": " << camera_rays << ",\n";
+  json << "  \"secondary_rays\": " << secondary_rays() << ",\n";
+  json << "  \"shadow_rays\": " << shadow_rays << ",\n";
+  json << "  \"rays_per_depth\": [";
+  for (int depth{}; depth < _num_of_depths(*this); depth++)
+    json << (depth > 0 ? ", " : "") << rays_per_depth[depth];
+  json << "],\n";
+  json << "  \"intersection_tests\": " << intersection_tests << ",\n";
+  json << "  \"hits\": " << hits << ",\n";
+  json << "  \"russian_roulette_terminations\": "
+       << russian_roulette_terminations << ",\n";
+  json << fmt::format("  \"average_path_length\": {:.6f},\n",
+                      average_path_length());
+  json << "  \"textures\": " << textures << ",\n";
+  json << "  \"texture_bytes\": " << texture_bytes << ",\n";
+  json << fmt::format("  \"seconds\": {{\"parse\": {:.6f}, \"textures\": "
+                      "{:.6f}, \"tracing\": {:.6f}, \"pfm_write\": {:.6f}, "
+                      "\"tone_mapping\": {:.6f}, \"ldr_encode\": {:.6f}}}\n",
+                      parse_seconds, texture_seconds, tracing_seconds,
+                      pfm_write_seconds, tone_mapping_seconds,
+                      ldr_encode_seconds);
+  json << "}\n";
+  return json.str();
+}
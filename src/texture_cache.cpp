@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "texture_cache.h"
+
+// Check whether the pixels of `texture` are shared with some pigment
+static bool _is_used(const Texture &texture) {
+  return texture.image.use_count() > 1 || texture.mapped.use_count() > 1 ||
+         texture.mipmaps.use_count() > 1 || texture.tiled.use_count() > 1;
+}
+
+Texture TextureCache::get(const string &file_name,
+                          const TextureOptions &options) {
+  // Missing files keep their name, so that loading them reports the error
+  error_code error;
+  string key = filesystem::canonical(file_name, error).string();
+  if (error)
+    key = file_name;
+  auto time = filesystem::last_write_time(key, error);
+
+  lock_guard<mutex> lock(textures_mutex);
+  auto it = textures.find(key);
+  // The operator== template of geometry.h makes comparing times ambiguous
+  if (it != textures.end() && it->second.time.time_since_epoch().count() ==
+                                  time.time_since_epoch().count()) {
+    Texture &texture = it->second.texture;
+    if (options.mipmaps && !texture.mipmaps)
+      texture.build_mipmaps();
+    if (options.tiled)
+      texture.make_tiled();
+    return texture;
+  }
+
+  Texture texture;
+  texture.file_name = key;
+  auto file = make_shared<const MappedPfm>(file_name);
+  if (options.tiled)
+    texture.tiled = make_shared<const TiledImage>(*file);
+  else if (options.map && file->is_native())
+    texture.mapped = file;
+  else
+    texture.image = make_shared<const HdrImage>(*file);
+  if (options.mipmaps)
+    texture.build_mipmaps();
+  textures[key] = Entry{time, texture};
+  return texture;
+}
+
+filesystem::file_time_type TextureCache::file_time(const string &file_name) {
+  lock_guard<mutex> lock(textures_mutex);
+  auto it = textures.find(file_name);
+  return it == textures.end() ? filesystem::file_time_type::min()
+                              : it->second.time;
+}
+
+int TextureCache::num_of_textures() {
+  lock_guard<mutex> lock(textures_mutex);
+  return textures.size();
+}
+
+size_t TextureCache::memory_usage() {
+  lock_guard<mutex> lock(textures_mutex);
+  size_t bytes = 0;
+  for (const auto &entry : textures)
+    bytes += entry.second.texture.memory_usage();
+  return bytes;
+}
+
+void TextureCache::clear() {
+  lock_guard<mutex> lock(textures_mutex);
+  textures.clear();
+}
+
+void TextureCache::prune() {
+  lock_guard<mutex> lock(textures_mutex);
+  for (auto it = textures.begin(); it != textures.end();) {
+    if (_is_used(it->second.texture))
+      ++it;
+    else
+      it = textures.erase(it);
+  }
+}
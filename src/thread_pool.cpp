@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "thread_pool.h"
+#include <algorithm>
+
+ThreadPool::ThreadPool(int num_of_threads) {
+  if (num_of_threads <= 0)
+    num_of_threads = max(1u, thread::hardware_concurrency());
+  for (int i{}; i < num_of_threads; i++)
+    workers.emplace_back([this]() { _work(); });
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> lock(batches_mutex);
+    stopping = true;
+  }
+  work_available.notify_all();
+  for (auto &worker : workers)
+    worker.join();
+}
+
+void ThreadPool::run(int num_of_tasks, const function<void(int)> &task) {
+  if (num_of_tasks <= 0)
+    return;
+
+  auto batch = make_shared<Batch>();
+  batch->task = &task;
+  batch->num_of_tasks = num_of_tasks;
+
+  unique_lock<mutex> lock(batches_mutex);
+  batches.push_back(batch);
+  work_available.notify_all();
+
+  int index;
+  while (_take_task(batch, index))
+    _run_task(lock, *batch, index);
+  batch_done.wait(lock, [&]() { return batch->done == num_of_tasks; });
+}
+
+bool ThreadPool::_take_task(shared_ptr<Batch> &batch, int &index) {
+  if (batch) {
+    // The thread which submitted the batch only runs its own tasks
+    if (batch->next >= batch->num_of_tasks)
+      return false;
+    index = batch->next++;
+    if (batch->next == batch->num_of_tasks)
+      batches.erase(find(batches.begin(), batches.end(), batch));
+    return true;
+  }
+
+  if (batches.empty())
+    return false;
+  // Move the batch to the back of the queue, so that the next task is taken
+  // from another batch
+  batch = batches.front();
+  batches.pop_front();
+  index = batch->next++;
+  if (batch->next < batch->num_of_tasks)
+    batches.push_back(batch);
+  return true;
+}
+
+void ThreadPool::_run_task(unique_lock<mutex> &lock, Batch &batch,
+                           int index) {
+  lock.unlock();
+  (*batch.task)(index);
+  lock.lock();
+  if (++batch.done == batch.num_of_tasks)
+    batch_done.notify_all();
+}
+
+void ThreadPool::_work() {
+  unique_lock<mutex> lock(batches_mutex);
+  while (true) {
+    work_available.wait(lock, [&]() { return stopping || !batches.empty(); });
+    if (batches.empty())
+      return; // Stopping, and nothing is left to do
+
+    shared_ptr<Batch> batch;
+    int index;
+    if (_take_task(batch, index))
+      _run_task(lock, *batch, index);
+  }
+}
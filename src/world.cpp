@@ -19,9 +19,148 @@
 
 #include "world.h"
 #include "ray.h"
+#include "stats.h"
+
+void World::build_bvh() {
+  clear_bvh();
+
+  vector<AABB> boxes;
+  vector<int> bounded_shapes;
+  for (int i{}; i < shapes.size(); i++) {
+    if (shapes[i]->is_bounded()) {
+      boxes.push_back(shapes[i]->bounding_box());
+      bounded_shapes.push_back(i);
+    } else
+      unbounded_shapes.push_back(i);
+  }
+
+  bvh.build(boxes);
+  // The tree refers to the position of each box in `boxes`: map it back to
+  // the position of the shape in `shapes`
+  for (auto &index : bvh.indices)
+    index = bounded_shapes[index];
+
+  bvh_built = true;
+}
+
+void World::clear_bvh() {
+  bvh.clear();
+  unbounded_shapes.clear();
+  bvh_built = false;
+}
+
+void World::compile() {
+  build_bvh();
+  compiled.build(shapes);
+}
+
+void World::compile(BVH shape_bvh, BVH sphere_bvh) {
+  clear_bvh();
+  for (int i{}; i < shapes.size(); i++) {
+    if (!shapes[i]->is_bounded())
+      unbounded_shapes.push_back(i);
+  }
+  bvh = move(shape_bvh);
+  bvh_built = true;
+
+  compiled.build(shapes, &sphere_bvh);
+}
 
 HitRecord World::ray_intersection(Ray ray) {
-  HitRecord closest{shapes.at(0)};
+  if (!stats_enabled())
+    return _closest_intersection(ray);
+
+  RenderStats &stats = thread_stats();
+  stats.rays_per_depth[min(ray.depth, RenderStats::max_depth)]++;
+  HitRecord closest = _closest_intersection(ray);
+  stats.hits += closest.hit;
+  return closest;
+}
+
+HitRecord World::_closest_intersection(const Ray &ray) {
+  if (!use_bvh || !bvh_built)
+    return ray_intersection_brute_force(ray);
+  if (use_compiled && has_compiled())
+    return compiled.ray_intersection(ray);
+
+  HitRecord closest;
+  long num_of_tests = 0;
+  auto check_shape = [&](int i) {
+    num_of_tests++;
+    HitRecord intersection = shapes[i]->ray_intersection(ray);
+    if (intersection.hit && ((!closest.hit) || (intersection.t < closest.t)))
+      closest = intersection;
+    return closest.hit ? closest.t : ray.tmax;
+  };
+
+  for (int i : unbounded_shapes)
+    check_shape(i);
+  bvh.traverse(ray, check_shape);
+
+  if (stats_enabled())
+    thread_stats().intersection_tests += num_of_tests;
+  return closest;
+}
+
+void World::ray_intersection_packet(const Ray *rays, int n, HitRecord *hits) {
+  for (int first{}; first < n; first += RayPacket::max_size) {
+    RayPacket packet(rays + first, min(n - first, RayPacket::max_size));
+
+    // Only keep track of the closest shape of each ray here
+    float closest[RayPacket::max_size];
+    int closest_shape[RayPacket::max_size];
+    fill(closest, closest + RayPacket::max_size,
+         numeric_limits<float>::infinity());
+    fill(closest_shape, closest_shape + RayPacket::max_size, -1);
+
+    long num_of_tests = 0;
+    auto check_shape = [&](int i) {
+      num_of_tests += packet.size;
+      float t[RayPacket::max_size];
+      shapes[i]->packet_intersection(packet, t);
+      for (int lane{}; lane < packet.size; lane++) {
+        if (t[lane] < closest[lane]) {
+          closest[lane] = t[lane];
+          closest_shape[lane] = i;
+        }
+      }
+    };
+
+    if (!use_bvh || !bvh_built) {
+      for (int i{}; i < shapes.size(); i++)
+        check_shape(i);
+    } else {
+      for (int i : unbounded_shapes)
+        check_shape(i);
+      bvh.traverse_packet(packet, closest, check_shape);
+    }
+
+    // The full record is computed by the winning shape alone
+    for (int lane{}; lane < packet.size; lane++) {
+      int shape = closest_shape[lane];
+      if (shape < 0)
+        hits[first + lane] = HitRecord();
+      else
+        hits[first + lane] = shapes[shape]->ray_intersection(packet.rays[lane]);
+    }
+
+    if (stats_enabled()) {
+      RenderStats &stats = thread_stats();
+      stats.intersection_tests += num_of_tests;
+      for (int lane{}; lane < packet.size; lane++) {
+        int depth = min(packet.rays[lane].depth, RenderStats::max_depth);
+        stats.rays_per_depth[depth]++;
+        stats.hits += hits[first + lane].hit;
+      }
+    }
+  }
+}
+
+HitRecord World::ray_intersection_brute_force(Ray ray) {
+  if (stats_enabled())
+    thread_stats().intersection_tests += shapes.size();
+
+  HitRecord closest;
   for (int i{}; i < shapes.size(); i++) {
     HitRecord intersection = shapes[i]->ray_intersection(ray);
     if (!intersection.hit)
@@ -18,6 +18,7 @@
  */
 
 #include "HdrImage.h"
+#include "simd.h"
 #include <cassert>
 
 using namespace std;
@@ -76,6 +77,25 @@ void test_pfm_save(HdrImage img) { // SOLO little_endian
 
   ofstream outputFile("./my_le_img.pfm");
   img.write_pfm(outputFile, Endianness::little_endian);
+  outputFile.close();
+
+  // The same bytes, written in the background
+  img.write_pfm_async("./my_async_le_img.pfm", Endianness::little_endian)
+      .get();
+  ifstream async_file("./my_async_le_img.pfm", ios::binary);
+  stringstream async_buffer;
+  async_buffer << async_file.rdbuf();
+  assert(async_buffer.str() == buffer.str());
+
+  // Big endian output has the bytes of every float reversed
+  ostringstream be_buffer;
+  img.write_pfm(be_buffer, Endianness::big_endian);
+  assert(be_buffer.str().substr(0, 11) == "PF\n3 2\n1.0\n");
+  string le_pixels = buffer.str().substr(12);
+  string be_pixels = be_buffer.str().substr(11);
+  assert(be_pixels.size() == le_pixels.size());
+  for (int i{}; i < le_pixels.size(); i++)
+    assert(be_pixels[i] == le_pixels[i - i % 4 + 3 - i % 4]);
 }
 
 void test_pfm_parse_endianness() {
@@ -153,6 +173,128 @@ void test_pfm_read() {
   assert(img_be.get_pixel(2, 1) == (Color(7.0e2, 8.0e2, 9.0e2)));
 }
 
+void test_pfm_read_mapped() {
+  // The same references, read through the memory-mapped loader
+  for (string name : {"reference_le.pfm", "reference_be.pfm"}) {
+    MappedPfm file("../test/HdrImage_references/" + name);
+    HdrImage img("../test/HdrImage_references/" + name);
+    assert(file.is_native() == (name == "reference_le.pfm"));
+    assert(img.width == 3 && file.width == 3);
+    assert(img.height == 2 && file.height == 2);
+    for (int y{}; y < 2; y++) {
+      for (int x{}; x < 3; x++) {
+        float scale = pow(10, 1 + y);
+        Color expected((1 + 3 * x) * scale, (2 + 3 * x) * scale,
+                       (3 + 3 * x) * scale);
+        assert(img.get_pixel(x, y) == expected);
+        assert(file.get_pixel(x, y) == expected);
+      }
+    }
+  }
+
+  // Rows longer than a SIMD register, in both byte orders
+  HdrImage img(37, 5);
+  for (int i{}; i < img.pixels.size(); i++)
+    img.pixels[i] = Color(i, 0.5f * i, -1.f * i);
+  for (Endianness e : {Endianness::little_endian, Endianness::big_endian}) {
+    ofstream out("./mapped_test.pfm", ios::binary);
+    img.write_pfm(out, e);
+    out.close();
+    for (bool simd : {true, false}) {
+      set_simd_enabled(simd);
+      HdrImage mapped_img("./mapped_test.pfm");
+      ifstream in("./mapped_test.pfm", ios::binary);
+      HdrImage stream_img(in);
+      for (int i{}; i < img.pixels.size(); i++) {
+        assert(mapped_img.pixels[i] == img.pixels[i]);
+        assert(stream_img.pixels[i] == img.pixels[i]);
+      }
+    }
+  }
+  set_simd_enabled(true);
+
+  // Errors are the same as with streams
+  ofstream truncated("./truncated_test.pfm", ios::binary);
+  truncated << "PF\n37 5\n-1.0\n0000";
+  truncated.close();
+  bool caught = false;
+  try {
+    HdrImage bad("./truncated_test.pfm");
+  } catch (InvalidPfmFileFormat &err) {
+    caught = true;
+  }
+  assert(caught);
+
+  caught = false;
+  try {
+    HdrImage missing("./this_file_does_not_exist.pfm");
+  } catch (ios_base::failure &err) {
+    caught = true;
+  }
+  assert(caught);
+}
+
+void test_tiled_image() {
+  // Neither side is a multiple of the tiles
+  HdrImage img(13, 10);
+  for (int i{}; i < img.pixels.size(); i++)
+    img.pixels[i] = Color(i, 0.5f * i, -1.f * i);
+
+  for (int threads : {1, 3}) {
+    TiledImage tiled(img, threads);
+    assert(tiled.width == 13 && tiled.height == 10);
+    assert(tiled.tiles_per_row == 2);
+    assert(tiled.pixels.size() == 16 * 16);
+    for (int y{}; y < img.height; y++) {
+      for (int x{}; x < img.width; x++)
+        assert(tiled.get_pixel(x, y) == img.get_pixel(x, y));
+    }
+    // The pixels of a tile are contiguous
+    assert(tiled.pixel_offset(7, 7) == 63);
+    assert(tiled.pixel_offset(8, 0) == 64);
+    assert(tiled.pixel_offset(0, 8) == 128);
+
+    HdrImage copy = tiled.to_image();
+    for (int i{}; i < img.pixels.size(); i++)
+      assert(copy.pixels[i] == img.pixels[i]);
+  }
+
+  // Mapped files, in both byte orders
+  for (string name : {"reference_le.pfm", "reference_be.pfm"}) {
+    MappedPfm file("../test/HdrImage_references/" + name);
+    TiledImage tiled(file);
+    for (int y{}; y < 2; y++) {
+      for (int x{}; x < 3; x++)
+        assert(tiled.get_pixel(x, y) == file.get_pixel(x, y));
+    }
+  }
+}
+
+void test_gamma_lut() {
+  for (float gamma : {1.f, 1.8f, 2.2f, 0.5f}) {
+    GammaLUT to_ldr{gamma};
+    auto expected = [&](float x) {
+      return min(255, max(0, static_cast<int>(255 * pow(x, 1 / gamma))));
+    };
+
+    // Around every threshold, where an error would show first
+    for (int k{1}; k < 256; k++) {
+      float x = to_ldr.thresholds[k];
+      assert(to_ldr(x) == expected(x));
+      assert(to_ldr(nextafter(x, 0.f)) == expected(nextafter(x, 0.f)));
+    }
+    for (int i{}; i <= 100000; i++) {
+      float x = i / 100000.f;
+      assert(to_ldr(x) == expected(x));
+    }
+
+    // Out of range values are clamped
+    assert(to_ldr(-1.f) == 0);
+    assert(to_ldr(nanf("")) == 0);
+    assert(to_ldr(10.f) == 255);
+  }
+}
+
 void test_average_luminosity() {
   HdrImage img(2, 1);
   img.set_pixel(0, 0, Color(5.0, 10.0, 15.0));       // Luminosity : 10.0
@@ -195,6 +337,53 @@ void test_normalize_image(bool test_overload) {
   }
 }
 
+void test_tone_map() {
+  HdrImage img(101, 37);
+  for (int i{}; i < img.pixels.size(); i++)
+    img.pixels[i] = Color(0.01f * i, 0.5f + i % 7, 3.f * (i % 5));
+
+  // Same result as the separate passes, with or without AVX2
+  HdrImage expected{img};
+  expected.normalize_image(0.3, 2.0);
+  expected.clamp_image();
+  for (bool simd : {true, false}) {
+    set_simd_enabled(simd);
+    for (int threads : {1, 3}) {
+      HdrImage result{img};
+      result.tone_map(0.3, 2.0, threads);
+      for (int i{}; i < img.pixels.size(); i++) {
+        assert(result.pixels[i].r == expected.pixels[i].r);
+        assert(result.pixels[i].g == expected.pixels[i].g);
+        assert(result.pixels[i].b == expected.pixels[i].b);
+      }
+    }
+  }
+  set_simd_enabled(true);
+
+  // A luminosity of 0 is calculated from the image
+  HdrImage computed{img}, explicit_lum{img};
+  computed.tone_map(0.3);
+  explicit_lum.tone_map(0.3, img.average_luminosity());
+  assert(computed.pixels[100] == explicit_lum.pixels[100]);
+
+  // The sum of the logarithms does not lose precision on large images
+  HdrImage large(2000, 2000);
+  for (auto &pixel : large.pixels)
+    pixel = Color(3.f, 3.f, 3.f);
+  assert(are_close(large.average_luminosity(0.0, 1), 3.f, 1e-6));
+  assert(are_close(large.average_luminosity(0.0, 4), 3.f, 1e-6));
+
+  // The vectorized logarithms are as accurate as log10
+  HdrImage ramp(1000, 1);
+  for (int i{}; i < ramp.pixels.size(); i++)
+    ramp.pixels[i] = Color(1e-3f * (i + 1) * (i + 1), 0.f, 0.f);
+  set_simd_enabled(false);
+  float expected_lum = ramp.average_luminosity(1e-10, 1);
+  set_simd_enabled(true);
+  assert(are_close(ramp.average_luminosity(1e-10, 1) / expected_lum, 1.f,
+                   1e-6));
+}
+
 int main() {
 
   HdrImage img(7, 4);
@@ -214,11 +403,15 @@ int main() {
   test_pfm_parse_endianness();
   test_pfm_parse_img_size();
   test_pfm_read();
+  test_pfm_read_mapped();
+  test_tiled_image();
 
+  test_gamma_lut();
   test_average_luminosity();
   test_normalize_image(false);
   test_normalize_image(true);
   test_clamp_image();
+  test_tone_map();
 
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef ALLOC_COUNTER_H
+#define ALLOC_COUNTER_H
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/**
+ * @brief Number of heap allocations made so far by the program. Include this
+ * header in a single file of a test or benchmark: it replaces the global
+ * operator new and operator delete (all their forms go through malloc and
+ * free, so that every allocation is released by the matching function)
+ *
+ */
+static std::atomic<long> num_of_allocations{0};
+
+static void *_counted_malloc(std::size_t size) {
+  num_of_allocations++;
+  // malloc(0) may return a null pointer, which operator new must not
+  if (void *ptr = std::malloc(size ? size : 1))
+    return ptr;
+  throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size) { return _counted_malloc(size); }
+void *operator new[](std::size_t size) { return _counted_malloc(size); }
+
+void operator delete(void *ptr) noexcept { std::free(ptr); }
+void operator delete[](void *ptr) noexcept { std::free(ptr); }
+void operator delete(void *ptr, std::size_t) noexcept { std::free(ptr); }
+void operator delete[](void *ptr, std::size_t) noexcept { std::free(ptr); }
+
+#endif
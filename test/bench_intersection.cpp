@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "camera.h"
+#include "pcg.h"
+#include "shapes.h"
+#include "simd.h"
+#include "world.h"
+#include <chrono>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief The intersection test as it was done before shapes cached their
+ * affine matrices: the inverse transformation is copied for every ray, and
+ * points go through the full 4x4 product with the `w` divide
+ *
+ */
+HitRecord legacy_sphere_intersection(Sphere &sphere, Ray ray) {
+  Ray inv_ray = ray.transform(sphere.transformation.inverse());
+  Vec origin_vec = inv_ray.origin.to_vec();
+  bool hit = true;
+
+  float a = inv_ray.dir.squared_norm();
+  float b = 2.0 * origin_vec.dot(inv_ray.dir);
+  float c = origin_vec.squared_norm() - 1.0;
+
+  float delta = b * b - 4.0 * a * c;
+  if (delta <= 0.0)
+    hit = false;
+
+  float tmin = (-b - sqrt(delta)) / (2.0 * a);
+  float tmax = (-b + sqrt(delta)) / (2.0 * a);
+  float first_hit_t = 0.f;
+
+  if (tmin > inv_ray.tmin && tmin < inv_ray.tmax)
+    first_hit_t = tmin;
+  else if (tmax > inv_ray.tmin && tmax < inv_ray.tmax)
+    first_hit_t = tmax;
+  else
+    hit = false;
+
+  Point hit_point = inv_ray.at(first_hit_t);
+  Normal normal{hit_point.x, hit_point.y, hit_point.z};
+  return HitRecord(&sphere, sphere.transformation * hit_point,
+                   sphere.transformation * normal, Vec2d(), first_hit_t, ray,
+                   hit);
+}
+
+/**
+ * @brief Return the average time (in nanoseconds) spent by `func` on each ray
+ *
+ */
+template <typename Func>
+double time_per_test(const vector<Ray> &rays, int repetitions, Func func) {
+  int num_of_hits = 0;
+  auto start = chrono::high_resolution_clock::now();
+  for (int r{}; r < repetitions; r++) {
+    for (const auto &ray : rays)
+      num_of_hits += func(ray).hit;
+  }
+  auto stop = chrono::high_resolution_clock::now();
+
+  // Print the hits, otherwise the compiler could skip the whole loop
+  fmt::print("  ({} hits)", num_of_hits);
+  return chrono::duration<double, nano>(stop - start).count() /
+         (static_cast<double>(rays.size()) * repetitions);
+}
+
+int main() {
+  const int num_of_rays = 100000, repetitions = 50;
+
+  PCG pcg;
+  vector<Ray> rays;
+  for (int i{}; i < num_of_rays; i++) {
+    Point origin{-5.f, 4 * pcg.random_float() - 2, 4 * pcg.random_float() - 2};
+    Vec dir{1.f, 0.2f * pcg.random_float() - 0.1f,
+            0.2f * pcg.random_float() - 0.1f};
+    rays.push_back(Ray(origin, dir));
+  }
+
+  // A generic transformation and a translation with a uniform scaling
+  Sphere generic{translation(Vec(0.1, 0.2, 0.3)) * rotation_z(30) *
+                 scaling(Vec(1.5, 1.0, 1.2))};
+  Sphere simple{translation(Vec(0.1, 0.2, 0.3)) *
+                scaling(Vec(1.2, 1.2, 1.2))};
+
+  fmt::print("Sphere::ray_intersection, {} rays x {} repetitions\n",
+             num_of_rays, repetitions);
+
+  fmt::print("generic transformation, 4x4 matrices");
+  double legacy_generic = time_per_test(rays, repetitions, [&](const Ray &r) {
+    return legacy_sphere_intersection(generic, r);
+  });
+  fmt::print(": {:.2f} ns/test\n", legacy_generic);
+
+  fmt::print("generic transformation, cached 3x4 matrix");
+  double cached_generic = time_per_test(
+      rays, repetitions, [&](const Ray &r) { return generic.ray_intersection(r); });
+  fmt::print(": {:.2f} ns/test\n", cached_generic);
+
+  fmt::print("translation + uniform scaling, 4x4 matrices");
+  double legacy_simple = time_per_test(rays, repetitions, [&](const Ray &r) {
+    return legacy_sphere_intersection(simple, r);
+  });
+  fmt::print(": {:.2f} ns/test\n", legacy_simple);
+
+  fmt::print("translation + uniform scaling, center and radius");
+  double cached_simple = time_per_test(
+      rays, repetitions, [&](const Ray &r) { return simple.ray_intersection(r); });
+  fmt::print(": {:.2f} ns/test\n", cached_simple);
+
+  fmt::print("Speedup: {:.2f}x (generic), {:.2f}x (simple)\n",
+             legacy_generic / cached_generic, legacy_simple / cached_simple);
+
+  // Coherent camera rays against a world, one at a time and in packets
+  World world;
+  for (int i{}; i < 64; i++) {
+    Vec center{8 * pcg.random_float() - 4, 8 * pcg.random_float() - 4,
+               4 * pcg.random_float() - 2};
+    world.add(make_shared<Sphere>(
+        i % 2 ? translation(center) * scaling(Vec(0.5, 0.5, 0.5))
+              : translation(center) * rotation_z(30) *
+                    scaling(Vec(0.5, 0.3, 0.4))));
+  }
+  world.add(make_shared<Plane>(translation(Vec(0, 0, -3))));
+  world.build_bvh();
+
+  PerspectiveCamera camera(1.0, 1.0, translation(Vec(-8, 0, 0)));
+  const int side = 512;
+  vector<Ray> camera_rays;
+  for (int row{}; row < side; row++) {
+    for (int col{}; col < side; col++)
+      camera_rays.push_back(camera.fire_ray((col + 0.5f) / side,
+                                            (row + 0.5f) / side));
+  }
+
+  fmt::print("\nWorld with {} shapes, {} camera rays\n", world.shapes.size(),
+             camera_rays.size());
+  fmt::print("one ray at a time");
+  double scalar = time_per_test(camera_rays, 5, [&](const Ray &r) {
+    return world.ray_intersection(r);
+  });
+  fmt::print(": {:.2f} ns/ray\n", scalar);
+
+  vector<HitRecord> hits(camera_rays.size());
+  for (bool simd : {false, true}) {
+    set_simd_enabled(simd);
+    int num_of_hits = 0;
+    auto start = chrono::high_resolution_clock::now();
+    for (int r{}; r < 5; r++) {
+      world.ray_intersection_packet(camera_rays.data(), camera_rays.size(),
+                                    hits.data());
+      for (const auto &hit : hits)
+        num_of_hits += hit.hit;
+    }
+    auto stop = chrono::high_resolution_clock::now();
+    double packet = chrono::duration<double, nano>(stop - start).count() /
+                    (5. * camera_rays.size());
+    fmt::print("packets of {} rays, {}  ({} hits): {:.2f} ns/ray ({:.2f}x)\n",
+               RayPacket::max_size,
+               simd_enabled() ? "AVX2" : "scalar fallback", num_of_hits,
+               packet, scalar / packet);
+  }
+
+  // Incoherent rays, as the ones scattered by the path tracer
+  vector<Ray> scattered_rays;
+  for (int i{}; i < 200000; i++) {
+    Point origin{8 * pcg.random_float() - 4, 8 * pcg.random_float() - 4,
+                 4 * pcg.random_float() - 2};
+    Vec dir{2 * pcg.random_float() - 1, 2 * pcg.random_float() - 1,
+            2 * pcg.random_float() - 1};
+    scattered_rays.push_back(Ray(origin, dir));
+  }
+
+  fmt::print("\n{} incoherent rays\n", scattered_rays.size());
+  fmt::print("BVH over the shapes");
+  double bvh = time_per_test(scattered_rays, 5, [&](const Ray &r) {
+    return world.ray_intersection(r);
+  });
+  fmt::print(": {:.2f} ns/ray\n", bvh);
+
+  world.compile();
+  for (bool simd : {false, true}) {
+    set_simd_enabled(simd);
+    fmt::print("compiled scene, {}",
+               simd_enabled() ? "AVX2" : "scalar fallback");
+    double compiled = time_per_test(scattered_rays, 5, [&](const Ray &r) {
+      return world.ray_intersection(r);
+    });
+    fmt::print(": {:.2f} ns/ray ({:.2f}x)\n", compiled, bvh / compiled);
+  }
+  return 0;
+}
@@ -0,0 +1,281 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "HdrImage.h"
+#include "alloc_counter.h"
+#include "camera.h"
+#include "imagetracer.h"
+#include "materials.h"
+#include "pcg.h"
+#include "render.h"
+#include "scene_file.h"
+#include "shapes.h"
+#include "world.h"
+#include <chrono>
+#include <fstream>
+#include <sstream>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief The outcome of a benchmark
+ *
+ * @param name
+ * @param unit what a single operation is (a ray, an intersection, a frame...)
+ * @param operations number of operations timed
+ * @param seconds total time spent on them
+ * @param allocations heap allocations made while timing
+ */
+struct BenchmarkResult {
+  string name, unit;
+  long operations = 0;
+  double seconds = 0.;
+  long allocations = 0;
+};
+
+/**
+ * @brief Call `func`, which does `operations_per_call` operations, until at
+ * least `min_seconds` seconds have passed (and at least once)
+ *
+ * @return BenchmarkResult
+ */
+template <typename Func>
+BenchmarkResult run_benchmark(const string &name, const string &unit,
+                              long operations_per_call, Func func,
+                              double min_seconds = 0.5) {
+  BenchmarkResult result;
+  result.name = name;
+  result.unit = unit;
+
+  long allocations_before = num_of_allocations;
+  auto start = chrono::steady_clock::now();
+  do {
+    func();
+    result.operations += operations_per_call;
+    result.seconds = chrono::duration<double>(chrono::steady_clock::now() -
+                                              start)
+                         .count();
+  } while (result.seconds < min_seconds);
+  result.allocations = num_of_allocations - allocations_before;
+
+  fmt::print(stderr, "{:<40} {:>12.2f} ns/{}\n", name,
+             1e9 * result.seconds / result.operations, unit);
+  return result;
+}
+
+/**
+ * @brief Rays starting inside a cube of side 20 centered in the origin,
+ * going in random directions
+ *
+ */
+vector<Ray> random_rays(PCG &pcg, int n) {
+  vector<Ray> rays;
+  for (int i{}; i < n; i++) {
+    Point origin{20 * pcg.random_float() - 10, 20 * pcg.random_float() - 10,
+                 20 * pcg.random_float() - 10};
+    Vec dir{2 * pcg.random_float() - 1, 2 * pcg.random_float() - 1,
+            2 * pcg.random_float() - 1};
+    rays.push_back(Ray(origin, dir));
+  }
+  return rays;
+}
+
+/**
+ * @brief Write the results as a JSON document
+ *
+ */
+string to_json(const vector<BenchmarkResult> &results) {
+  stringstream json;
+  json << "{\n  \"benchmarks\": [\n";
+  for (int i{}; i < results.size(); i++) {
+    const BenchmarkResult &r = results[i];
+    double per_second = r.operations / r.seconds;
+    json << fmt::format(
+        "    {{\"name\": \"{}\", \"unit\": \"{}\", \"operations\": {}, "
+        "\"seconds\": {:.6f}, \"ns_per_op\": {:.3f}, "
+        "\"mops_per_second\": {:.6f}, \"allocations_per_op\": {:.6f}}}{}\n",
+        r.name, r.unit, r.operations, r.seconds, 1e9 / per_second,
+        per_second / 1e6, static_cast<double>(r.allocations) / r.operations,
+        i + 1 < results.size() ? "," : "");
+  }
+  json << "  ]\n}\n";
+  return json.str();
+}
+
+/*
+ * Usage: raytracer_bench [SCENE_FILE [OUTPUT_JSON]]
+ *
+ * The scene defaults to ../examples/demo.txt (i.e. the program is run from
+ * the build directory); the JSON document is printed on the standard output
+ * unless a file is given. Every benchmark uses fixed seeds, so that the work
+ * done is the same on every run.
+ */
+int main(int argc, char **argv) {
+  string scene_name = argc > 1 ? argv[1] : "../examples/demo.txt";
+  vector<BenchmarkResult> results;
+  PCG pcg;
+
+  // Camera rays
+  {
+    PerspectiveCamera camera(1.0, 16. / 9., translation(Vec(-1, 0, 1)));
+    const int side = 512;
+    float sum = 0.f;
+    results.push_back(
+        run_benchmark("camera_fire_ray", "ray", side * side, [&]() {
+          for (int row{}; row < side; row++) {
+            for (int col{}; col < side; col++)
+              sum += camera.fire_ray((col + 0.5f) / side, (row + 0.5f) / side)
+                         .dir.x;
+          }
+        }));
+    fmt::print(stderr, "  (checksum {})\n", sum);
+  }
+
+  // World::ray_intersection over growing numbers of spheres
+  vector<Ray> rays = random_rays(pcg, 100000);
+  for (int num_of_spheres : {16, 256, 4096}) {
+    World world;
+    float radius = 4.f / cbrt(num_of_spheres);
+    for (int i{}; i < num_of_spheres; i++) {
+      Vec center{20 * pcg.random_float() - 10, 20 * pcg.random_float() - 10,
+                 20 * pcg.random_float() - 10};
+      world.add(make_shared<Sphere>(translation(center) *
+                                    scaling(Vec(radius, radius, radius))));
+    }
+    world.add(make_shared<Plane>(translation(Vec(0, 0, -10))));
+    world.compile();
+
+    long hits = 0;
+    results.push_back(run_benchmark(
+        fmt::format("world_ray_intersection_{}_spheres", num_of_spheres),
+        "intersection", rays.size(), [&]() {
+          for (const auto &ray : rays)
+            hits += world.ray_intersection(ray).hit;
+        }));
+    fmt::print(stderr, "  (checksum {})\n", hits);
+  }
+
+  // BRDF sampling
+  {
+    DiffusiveBRDF diffuse;
+    SpecularBRDF specular;
+    const int n = 100000;
+    float sum = 0.f;
+    results.push_back(run_benchmark("diffuse_scatter_ray", "ray", n, [&]() {
+      for (int i{}; i < n; i++)
+        sum += diffuse.scatter_ray(pcg, -VEC_Z, Point(), VEC_Z.to_norm(), 1)
+                   .dir.z;
+    }));
+    results.push_back(run_benchmark("specular_scatter_ray", "ray", n, [&]() {
+      for (int i{}; i < n; i++)
+        sum += specular.scatter_ray(pcg, -VEC_Z, Point(), VEC_Z.to_norm(), 1)
+                   .dir.z;
+    }));
+    fmt::print(stderr, "  (checksum {})\n", sum);
+  }
+
+  // Random numbers
+  {
+    const int n = 1000000;
+    float sum = 0.f;
+    results.push_back(run_benchmark("pcg_random_float", "number", n, [&]() {
+      for (int i{}; i < n; i++)
+        sum += pcg.random_float();
+    }));
+    fmt::print(stderr, "  (checksum {})\n", sum);
+  }
+
+  // PFM files of a 1920x1080 image
+  {
+    HdrImage image(1920, 1080);
+    for (auto &pixel : image.pixels)
+      pixel = Color(pcg.random_float(), pcg.random_float(), pcg.random_float());
+    const string file_name = "raytracer_bench.pfm";
+    results.push_back(run_benchmark("pfm_write_1080p", "image", 1, [&]() {
+      ofstream stream(file_name, ios::binary);
+      image.write_pfm(stream, Endianness::little_endian);
+    }));
+    results.push_back(run_benchmark("pfm_read_1080p", "image", 1, [&]() {
+      HdrImage read_image(file_name);
+    }));
+    remove(file_name.c_str());
+  }
+
+  // A scene file with many shapes
+  {
+    const int n = 10000;
+    string scene_text = "float angle(30)\n"
+                        "material m(diffuse(uniform(<0.5, 0.5, 0.5>)), "
+                        "uniform(<0, 0, 0>))\n";
+    for (int i{}; i < n; i++)
+      scene_text += fmt::format(
+          "# Sphere {}\nsphere(m, translation([{:.4f}, {:.4f}, {:.4f}]) * "
+          "rotation_z(angle) * scaling([0.1, 0.1, 0.1]))\n",
+          i, pcg.random_float(), pcg.random_float(), pcg.random_float());
+    scene_text += "camera(perspective, translation([-4, 0, 1]), 1.0, 2.0)\n";
+
+    results.push_back(run_benchmark("scene_parse_10k_spheres", "shape", n,
+                                    [&]() {
+                                      stringstream sstr(scene_text);
+                                      InputStream stream(sstr);
+                                      stream.parse_scene({});
+                                    }));
+  }
+
+  // Full frames of the demo scene
+  ifstream scene_file(scene_name);
+  if (scene_file.fail()) {
+    fmt::print(stderr, "ERROR: unable to open {}, skipping the renders\n",
+               scene_name);
+  } else {
+    InputStream stream(scene_file, scene_name);
+    Scene scene = stream.parse_scene({});
+    const int width = 160, height = 90;
+
+    auto render_frame = [&](Renderer &renderer) {
+      ImageTracer tracer(HdrImage(width, height), scene.camera, 1, PCG());
+      tracer.fire_all_rays(
+          [&](const Ray *rays, int n, Color *colors, PCG &pcg) {
+            renderer.render_packet(rays, n, colors, pcg);
+          },
+          0);
+    };
+
+    FlatRenderer flat(scene.world);
+    results.push_back(run_benchmark("demo_frame_flat_160x90", "frame", 1,
+                                    [&]() { render_frame(flat); }));
+
+    PathTracer path_tracer(scene.world, BLACK, PCG(), 4, 3);
+    results.push_back(run_benchmark("demo_frame_pathtracing_160x90", "frame",
+                                    1, [&]() { render_frame(path_tracer); }));
+
+    IterativePathTracer iterative(scene.world, BLACK, PCG(), 3);
+    results.push_back(run_benchmark("demo_frame_iterative_160x90", "frame", 1,
+                                    [&]() { render_frame(iterative); }));
+  }
+
+  string json = to_json(results);
+  if (argc > 2) {
+    ofstream output(argv[2]);
+    output << json;
+  } else
+    fmt::print("{}", json);
+  return 0;
+}
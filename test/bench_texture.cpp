@@ -0,0 +1,230 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+#include "camera.h"
+#include "imagetracer.h"
+#include "materials.h"
+#include "pcg.h"
+#include "shapes.h"
+#include <chrono>
+#include <limits>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+/**
+ * @brief A hardware counter of the cache misses of this thread, read through
+ * perf_event_open. Counters may not be available (e.g., in containers or
+ * with a restrictive perf_event_paranoid): then `is_available` is false
+ *
+ */
+struct CacheMissCounter {
+  int fd = -1;
+
+  /**
+   * @brief Open the counter
+   *
+   * @param config one of the generic PERF_COUNT_HW_CACHE_* events, encoded
+   * as perf_event_open expects
+   */
+  CacheMissCounter(uint64_t config) {
+    perf_event_attr attr{};
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+  CacheMissCounter(const CacheMissCounter &) = delete;
+  ~CacheMissCounter() {
+    if (fd >= 0)
+      close(fd);
+  }
+
+  bool is_available() const { return fd >= 0; }
+
+  void start() {
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+
+  long stop() {
+    long long count = 0;
+    if (fd >= 0) {
+      ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+      if (read(fd, &count, sizeof(count)) != sizeof(count))
+        count = 0;
+    }
+    return count;
+  }
+};
+
+static const uint64_t L1D_READ_MISSES =
+    PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+static const uint64_t LLC_READ_MISSES =
+    PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+    (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+/**
+ * @brief The (u, v) coordinates seen by the camera rays of a `side` x `side`
+ * image looking at a unit sphere which almost fills it, as the tracer visits
+ * them: tile by tile, row by row inside each tile
+ *
+ */
+vector<Vec2d> camera_uvs(int side) {
+  Sphere planet{rotation_z(30)};
+  ImageTracer tracer(HdrImage(side, side),
+                     make_shared<PerspectiveCamera>(
+                         1.0, 1.0, translation(Vec(-2.5, 0, 0))));
+  const int tile = ImageTracer::tile_size;
+  vector<Vec2d> uvs;
+  for (int tile_row{}; tile_row < side; tile_row += tile) {
+    for (int tile_col{}; tile_col < side; tile_col += tile) {
+      for (int row{tile_row}; row < min(side, tile_row + tile); row++) {
+        for (int col{tile_col}; col < min(side, tile_col + tile); col++) {
+          HitRecord hit = planet.ray_intersection(tracer.fire_ray(col, row));
+          if (hit.hit)
+            uvs.push_back(hit.surface_point);
+        }
+      }
+    }
+  }
+  return uvs;
+}
+
+/**
+ * @brief The (u, v) coordinates of `n` random points on a unit sphere, as
+ * those hit by the rays scattered by other surfaces
+ *
+ */
+vector<Vec2d> scattered_uvs(int n) {
+  PCG pcg;
+  Sphere planet;
+  vector<Vec2d> uvs;
+  for (int i{}; i < n; i++) {
+    // A ray from the center hits the sphere where it points to
+    float z = 2 * pcg.random_float() - 1, phi = 2 * M_PI * pcg.random_float();
+    float r = sqrt(1 - z * z);
+    Ray ray(Point(), Vec(r * cos(phi), r * sin(phi), z));
+    uvs.push_back(planet.ray_intersection(ray).surface_point);
+  }
+  return uvs;
+}
+
+/**
+ * @brief Read the texture at every (u, v) point, and print the time and the
+ * cache misses per lookup of the fastest of `runs` runs (the others may be
+ * slowed down by other processes)
+ *
+ */
+void bench_lookups(const string &name, ImagePigment &pigment,
+                   const vector<Vec2d> &uvs, int runs) {
+  CacheMissCounter l1_misses(L1D_READ_MISSES), llc_misses(LLC_READ_MISSES);
+  Vec2d no_footprint(0., 0.);
+  Color sum;
+  double best_ns = numeric_limits<double>::infinity();
+  long best_l1 = 0, best_llc = 0;
+  for (int r{}; r < runs; r++) {
+    l1_misses.start();
+    llc_misses.start();
+    auto start = chrono::high_resolution_clock::now();
+    for (const auto &uv : uvs)
+      sum = sum + pigment.filtered(uv, no_footprint);
+    auto stop = chrono::high_resolution_clock::now();
+    long l1 = l1_misses.stop(), llc = llc_misses.stop();
+
+    double ns = chrono::duration<double, nano>(stop - start).count();
+    if (ns < best_ns) {
+      best_ns = ns;
+      best_l1 = l1;
+      best_llc = llc;
+    }
+  }
+
+  double lookups = uvs.size();
+  double ns = best_ns / lookups;
+  fmt::print("  {:<32} {:6.2f} ns/lookup  {:7.1f} M lookups/s", name, ns,
+             1e3 / ns);
+  if (l1_misses.is_available() && llc_misses.is_available())
+    fmt::print("  {:.3f} L1 / {:.4f} LLC misses per lookup",
+               best_l1 / lookups, best_llc / lookups);
+  // Print the sum, otherwise the compiler could skip the whole loop
+  fmt::print("  (sum {:.0f})\n", sum.r + sum.g + sum.b);
+}
+
+/**
+ * @brief Compare the row-major and the tiled layouts of `texture`
+ *
+ */
+void bench_texture(const string &name, const HdrImage &image) {
+  fmt::print("\n{} ({}x{}, {:.1f} MB)\n", name, image.width, image.height,
+             image.pixels.size() * sizeof(Color) / 1e6);
+
+  vector<Vec2d> camera = camera_uvs(1024);
+  vector<Vec2d> scattered = scattered_uvs(1 << 20);
+
+  for (auto filter : {TextureFilter::nearest, TextureFilter::bilinear}) {
+    string filter_name =
+        filter == TextureFilter::nearest ? "nearest" : "bilinear";
+    Texture rows{make_shared<const HdrImage>(image), nullptr};
+    Texture tiles = rows;
+    tiles.make_tiled();
+    ImagePigment row_pigment(rows, filter), tiled_pigment(tiles, filter);
+    const int runs = 7;
+
+    bench_lookups(filter_name + ", camera rays, rows", row_pigment, camera,
+                  runs);
+    bench_lookups(filter_name + ", camera rays, tiles", tiled_pigment, camera,
+                  runs);
+    bench_lookups(filter_name + ", scattered rays, rows", row_pigment,
+                  scattered, runs);
+    bench_lookups(filter_name + ", scattered rays, tiles", tiled_pigment,
+                  scattered, runs);
+  }
+}
+
+int main(int argc, char *argv[]) {
+  string texture_file =
+      argc > 1 ? argv[1] : "../examples/texture/jupiter.pfm";
+
+  CacheMissCounter counter(L1D_READ_MISSES);
+  fmt::print("Texture lookups, rows vs {}x{} tiles{}\n", TiledImage::tile_side,
+             TiledImage::tile_side,
+             counter.is_available()
+                 ? ""
+                 : " (cache miss counters are not available)");
+
+  bench_texture(texture_file, HdrImage(texture_file));
+
+  // A texture much larger than the caches
+  PCG pcg;
+  HdrImage large(8192, 4096);
+  for (auto &pixel : large.pixels)
+    pixel = Color(pcg.random_float(), pcg.random_float(), pcg.random_float());
+  bench_texture("random texture", large);
+  return 0;
+}
@@ -0,0 +1,90 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "HdrImage.h"
+#include "pcg.h"
+#include "simd.h"
+#include <chrono>
+
+using namespace std;
+
+/**
+ * @brief The tone mapping as it was done before HdrImage::tone_map: three
+ * scalar passes, with the logarithms summed in a float
+ *
+ */
+void legacy_tone_map(HdrImage &image, float factor) {
+  float cumsum = 0.f;
+  for (int i{}; i < image.pixels.size(); i++)
+    cumsum += log10(1e-10f + image.pixels[i].luminosity());
+  float luminosity = pow(10, cumsum / image.pixels.size());
+
+  for (int i{}; i < image.pixels.size(); i++)
+    image.pixels[i] = image.pixels[i] * (factor / luminosity);
+  image.clamp_image();
+}
+
+/**
+ * @brief Return the time (in milliseconds) spent by `func`
+ *
+ */
+template <typename Func> double milliseconds(Func func) {
+  auto start = chrono::high_resolution_clock::now();
+  func();
+  auto stop = chrono::high_resolution_clock::now();
+  return chrono::duration<double, milli>(stop - start).count();
+}
+
+int main() {
+  const int width = 4096, height = 4096;
+
+  PCG pcg;
+  HdrImage image(width, height);
+  for (auto &pixel : image.pixels)
+    pixel = Color(10 * pcg.random_float(), 10 * pcg.random_float(),
+                  10 * pcg.random_float());
+
+  fmt::print("Tone mapping of a {}x{} image\n", width, height);
+
+  HdrImage legacy{image};
+  double legacy_time = milliseconds([&]() { legacy_tone_map(legacy, 1.0); });
+  fmt::print("three scalar passes: {:.1f} ms\n", legacy_time);
+
+  for (bool simd : {false, true}) {
+    for (int threads : {1, 0}) {
+      set_simd_enabled(simd);
+      HdrImage fused{image};
+      double time = milliseconds([&]() { fused.tone_map(1.0, 0, threads); });
+      fmt::print("tone_map, {}, {}: {:.1f} ms ({:.2f}x)\n",
+                 simd_enabled() ? "AVX2" : "scalar",
+                 threads == 0 ? "one thread per core" : "1 thread", time,
+                 legacy_time / time);
+    }
+  }
+
+  // The float sum drifts from the exact average on such a large image
+  fmt::print("average luminosity: {} (double sum), {} (float sum)\n",
+             image.average_luminosity(), [&]() {
+               float cumsum = 0.f;
+               for (auto &pixel : image.pixels)
+                 cumsum += log10(1e-10f + pixel.luminosity());
+               return pow(10, cumsum / image.pixels.size());
+             }());
+  return 0;
+}
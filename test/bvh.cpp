@@ -0,0 +1,269 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "bvh.h"
+#include "pcg.h"
+#include "shapes.h"
+#include "simd.h"
+#include "stats.h"
+#include "world.h"
+#include <cassert>
+
+using namespace std;
+
+void test_aabb() {
+  AABB box;
+  assert(box.is_empty());
+
+  box.expand(Point(1.0, 2.0, 3.0));
+  box.expand(Point(-1.0, 0.0, 4.0));
+  assert(!box.is_empty());
+  assert(box.min == Point(-1.0, 0.0, 3.0));
+  assert(box.max == Point(1.0, 2.0, 4.0));
+  assert(box.centroid() == Point(0.0, 1.0, 3.5));
+
+  Ray ray1(Point(0.0, 1.0, 0.0), VEC_Z);
+  assert(box.intersect(ray1.origin, Vec(1.f / ray1.dir.x, 1.f / ray1.dir.y,
+                                        1.f / ray1.dir.z),
+                       ray1.tmin, ray1.tmax));
+  // The box is behind the origin of the ray
+  assert(!box.intersect(ray1.origin, Vec(1.f / ray1.dir.x, 1.f / ray1.dir.y,
+                                         -1.f / ray1.dir.z),
+                        ray1.tmin, ray1.tmax));
+  // The box is farther than tmax
+  assert(!box.intersect(ray1.origin, Vec(1.f / ray1.dir.x, 1.f / ray1.dir.y,
+                                         1.f / ray1.dir.z),
+                        ray1.tmin, 2.0));
+}
+
+void test_sphere_bounding_box() {
+  Sphere sphere{translation(Vec(1.0, 2.0, 3.0)) * scaling(Vec(2.0, 1.0, 0.5))};
+  AABB box = sphere.bounding_box();
+  assert(box.min == Point(-1.0, 1.0, 2.5));
+  assert(box.max == Point(3.0, 3.0, 3.5));
+
+  Plane plane;
+  assert(!plane.is_bounded());
+}
+
+void test_bvh_build() {
+  vector<AABB> boxes;
+  for (int i{}; i < 100; i++)
+    boxes.push_back(AABB(Point(i, 0, 0), Point(i + 0.5, 1, 1)));
+
+  BVH bvh;
+  bvh.build(boxes);
+
+  // Every primitive must appear exactly once in the leaves
+  vector<int> seen(boxes.size(), 0);
+  for (const auto &node : bvh.nodes) {
+    assert(node.count <= BVH::max_leaf_size);
+    for (int i{}; i < node.count; i++)
+      seen[bvh.indices[node.first + i]]++;
+  }
+  for (int count : seen)
+    assert(count == 1);
+
+  assert(bvh.nodes[0].bounds.min == Point(0, 0, 0));
+  assert(bvh.nodes[0].bounds.max == Point(99.5, 1, 1));
+}
+
+void test_bvh_matches_brute_force() {
+  PCG pcg;
+  World world;
+
+  for (int i{}; i < 500; i++) {
+    float radius = 0.1 + 0.4 * pcg.random_float();
+    Vec center{20 * pcg.random_float() - 10, 20 * pcg.random_float() - 10,
+               20 * pcg.random_float() - 10};
+    world.add(make_shared<Sphere>(translation(center) *
+                                  scaling(Vec(radius, radius, radius))));
+  }
+  world.add(make_shared<Plane>(translation(Vec(0, 0, -12))));
+  world.build_bvh();
+  assert(world.has_bvh());
+  assert(world.unbounded_shapes.size() == 1);
+
+  for (int i{}; i < 2000; i++) {
+    Point origin{30 * pcg.random_float() - 15, 30 * pcg.random_float() - 15,
+                 30 * pcg.random_float() - 15};
+    Vec dir{2 * pcg.random_float() - 1, 2 * pcg.random_float() - 1,
+            2 * pcg.random_float() - 1};
+    Ray ray(origin, dir);
+
+    HitRecord expected = world.ray_intersection_brute_force(ray);
+    HitRecord result = world.ray_intersection(ray);
+    assert(expected.hit == result.hit);
+    if (expected.hit) {
+      assert(are_close(expected.t, result.t));
+      assert(expected.world_point == result.world_point);
+    }
+  }
+
+  // Adding a shape invalidates the tree
+  world.add(make_shared<Sphere>());
+  assert(!world.has_bvh());
+  assert(world.ray_intersection(Ray(Point(0, 0, 5), -VEC_Z)).hit);
+}
+
+void test_packet_matches_scalar() {
+  PCG pcg;
+  World world;
+  for (int i{}; i < 200; i++) {
+    Vec center{20 * pcg.random_float() - 10, 20 * pcg.random_float() - 10,
+               20 * pcg.random_float() - 10};
+    float radius = 0.2 + 0.6 * pcg.random_float();
+    if (i % 2)
+      world.add(make_shared<Sphere>(translation(center) *
+                                    scaling(Vec(radius, radius, radius))));
+    else
+      world.add(make_shared<Sphere>(translation(center) * rotation_x(i) *
+                                    scaling(Vec(radius, 0.5, 0.7))));
+  }
+  world.add(make_shared<Plane>(translation(Vec(0, 0, -12)) * rotation_y(20)));
+
+  vector<Ray> rays;
+  for (int i{}; i < 1003; i++) {
+    Point origin{30 * pcg.random_float() - 15, 30 * pcg.random_float() - 15,
+                 30 * pcg.random_float() - 15};
+    Vec dir{2 * pcg.random_float() - 1, 2 * pcg.random_float() - 1,
+            2 * pcg.random_float() - 1};
+    rays.push_back(Ray(origin, dir));
+  }
+  // Rays parallel to the axes produce infinite inverse directions
+  rays.push_back(Ray(Point(0, 0, 0), VEC_X));
+  rays.push_back(Ray(Point(0, 0, 20), -VEC_Z));
+
+  vector<HitRecord> hits(rays.size());
+  for (bool simd : {true, false}) {
+    set_simd_enabled(simd);
+    for (bool bvh : {false, true}) {
+      if (bvh)
+        world.build_bvh();
+      world.ray_intersection_packet(rays.data(), rays.size(), hits.data());
+      for (int i{}; i < rays.size(); i++) {
+        HitRecord expected = world.ray_intersection(rays[i]);
+        assert(expected.hit == hits[i].hit);
+        if (expected.hit) {
+          assert(expected.shape == hits[i].shape);
+          assert(expected.t == hits[i].t);
+        }
+      }
+    }
+    world.clear_bvh();
+  }
+  set_simd_enabled(true);
+}
+
+void test_compiled_scene_matches_brute_force() {
+  PCG pcg;
+  World world;
+  for (int i{}; i < 300; i++) {
+    Vec center{20 * pcg.random_float() - 10, 20 * pcg.random_float() - 10,
+               20 * pcg.random_float() - 10};
+    float radius = 0.2 + 0.6 * pcg.random_float();
+    if (i % 3)
+      world.add(make_shared<Sphere>(translation(center) *
+                                    scaling(Vec(radius, radius, radius))));
+    else
+      world.add(make_shared<Sphere>(translation(center) * rotation_z(i) *
+                                    scaling(Vec(radius, 0.5, 0.7))));
+  }
+  for (int i{}; i < 9; i++)
+    world.add(make_shared<Plane>(translation(Vec(0, 0, -12 - i)) *
+                                 rotation_y(i)));
+  world.compile();
+  assert(world.has_bvh());
+  assert(world.has_compiled());
+  assert(world.compiled.num_of_planes == 9);
+  assert(world.compiled.other_shapes.empty());
+
+  for (bool simd : {true, false}) {
+    set_simd_enabled(simd);
+    for (int i{}; i < 2000; i++) {
+      Point origin{30 * pcg.random_float() - 15, 30 * pcg.random_float() - 15,
+                   30 * pcg.random_float() - 15};
+      Vec dir{2 * pcg.random_float() - 1, 2 * pcg.random_float() - 1,
+              2 * pcg.random_float() - 1};
+      Ray ray(origin, dir);
+
+      HitRecord expected = world.ray_intersection_brute_force(ray);
+      HitRecord result = world.ray_intersection(ray);
+      assert(expected.hit == result.hit);
+      if (expected.hit) {
+        assert(expected.shape == result.shape);
+        assert(expected.t == result.t);
+      }
+    }
+  }
+  set_simd_enabled(true);
+
+  // Without the BVH every shape is checked, even if the scene is compiled
+  Ray ray(Point(-15, 0, 0), VEC_X);
+  HitRecord expected = world.ray_intersection(ray);
+  world.use_bvh = false;
+  reset_stats();
+  set_stats_enabled(true);
+  HitRecord result = world.ray_intersection(ray);
+  set_stats_enabled(false);
+  assert(collect_stats().intersection_tests == world.shapes.size());
+  assert(expected.hit == result.hit && expected.t == result.t);
+  world.use_bvh = true;
+
+  // Adding a shape invalidates the compiled scene
+  world.add(make_shared<Sphere>());
+  assert(!world.has_compiled());
+}
+
+void test_bvh_refit() {
+  PCG pcg;
+  vector<AABB> boxes;
+  for (int i{}; i < 100; i++) {
+    Point corner{20 * pcg.random_float() - 10, 20 * pcg.random_float() - 10,
+                 20 * pcg.random_float() - 10};
+    boxes.push_back(AABB(corner, corner + Vec(1, 1, 1)));
+  }
+  BVH bvh;
+  bvh.build(boxes);
+  vector<BVHNode> nodes = bvh.nodes;
+
+  // Move the boxes: the tree keeps its structure, but its bounds follow them
+  for (auto &box : boxes)
+    box = AABB(box.min + Vec(5, 0, 0), box.max + Vec(5, 0, 2));
+  bvh.refit(boxes);
+  assert(bvh.nodes.size() == nodes.size());
+  for (int i{}; i < bvh.nodes.size(); i++) {
+    const BVHNode &node = bvh.nodes[i];
+    assert(node.first == nodes[i].first && node.count == nodes[i].count);
+    assert(node.bounds.min == nodes[i].bounds.min + Vec(5, 0, 0));
+    assert(node.bounds.max == nodes[i].bounds.max + Vec(5, 0, 2));
+  }
+}
+
+int main() {
+  test_aabb();
+  test_sphere_bounding_box();
+  test_bvh_build();
+  test_bvh_refit();
+  test_bvh_matches_brute_force();
+  test_packet_matches_scalar();
+  test_compiled_scene_matches_brute_force();
+
+  return 0;
+}
@@ -17,8 +17,11 @@
  * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
  */
 
+#include "checkpoint.h"
 #include "imagetracer.h"
 #include <cassert>
+#include <cstdio>
+#include <limits>
 
 using namespace std;
 
@@ -37,6 +40,57 @@ void test_orientation(ImageTracer tracer) {
   assert(Point(0.0, -2.0, -1.0) == bottom_right_ray.at(1.0));
 }
 
+void test_ray_footprint(ImageTracer tracer) {
+  // Pixels are one unit wide at the distance of the screen
+  Ray ray = tracer.fire_ray(1, 1);
+  assert(are_close(ray.footprint, 0.f));
+  assert(are_close(ray.spread, 1.f));
+
+  // With stratified sampling, rays are as wide as a sample
+  ImageTracer stratified(tracer.image, tracer.camera, 4);
+  assert(are_close(stratified.fire_ray(1, 1).spread, 0.25f));
+}
+
+void test_pixel_streams() {
+  HdrImage img(2 * ImageTracer::tile_size + 5, 7);
+  shared_ptr<Camera> camera =
+      make_shared<PerspectiveCamera>(1.0, 2.0, Transformation());
+  auto func = [](const Ray &ray, PCG &pcg) -> Color {
+    float first = pcg.random_float();
+    return Color(first, pcg.random_float(), 0.0);
+  };
+
+  // Every pixel can be computed alone from its own generator
+  ImageTracer tracer(img, camera, 0, PCG(1, 2));
+  tracer.fire_all_rays(func, 3);
+  for (int row{}; row < img.height; row++) {
+    for (int col{}; col < img.width; col++) {
+      PCG pcg = tracer.pixel_pcg(col, row);
+      assert(tracer.image.get_pixel(col, row).r == pcg.random_float());
+      assert(tracer.image.get_pixel(col, row).g == pcg.random_float());
+    }
+  }
+
+  // Whatever the number of threads
+  ImageTracer serial(img, camera, 0, PCG(1, 2));
+  serial.fire_all_rays(func, 1);
+  for (int i{}; i < img.pixels.size(); i++)
+    assert(serial.image.pixels[i].r == tracer.image.pixels[i].r);
+
+  // Passes use the next round of the generator of each pixel
+  AccumulationBuffer buffer(img.width, img.height);
+  tracer.fire_pass(func, buffer, 2);
+  tracer.fire_pass(func, buffer, 2);
+  PCG round0 = tracer.pixel_pcg(4, 5, 0), round1 = tracer.pixel_pcg(4, 5, 1);
+  float sum = round0.random_float() + round1.random_float();
+  assert(are_close(buffer.sums[buffer.width * 5 + 4].r, sum));
+
+  // Another seed gives another image
+  ImageTracer other(img, camera, 0, PCG(1, 3));
+  other.fire_all_rays(func, 3);
+  assert(other.image.get_pixel(0, 0).r != tracer.image.get_pixel(0, 0).r);
+}
+
 void test_image_coverage(ImageTracer tracer) {
   tracer.fire_all_rays([](Ray ray) -> Color { return Color(1.0, 2.0, 3.0); });
   for (int row{}; row < tracer.image.height; row++) {
@@ -45,6 +99,308 @@ void test_image_coverage(ImageTracer tracer) {
     }
   }
 }
+void test_parallel_rendering() {
+  // The image spans several tiles, and its size is not a multiple of them
+  HdrImage img(2 * ImageTracer::tile_size + 5, ImageTracer::tile_size + 3);
+  shared_ptr<Camera> camera =
+      make_shared<PerspectiveCamera>(1.0, 2.0, Transformation());
+
+  auto func = [](const Ray &ray, PCG &pcg) -> Color {
+    return Color(pcg.random_float(), ray.dir.y, ray.dir.z);
+  };
+
+  ImageTracer single_thread(img, camera, 2);
+  single_thread.fire_all_rays(func, 1);
+
+  for (int num_of_threads : {2, 3, 8}) {
+    ImageTracer tracer(img, camera, 2);
+    tracer.fire_all_rays(func, num_of_threads);
+    for (int i{}; i < img.pixels.size(); i++) {
+      // Results must be bit-identical, whatever the number of threads
+      assert(tracer.image.pixels[i].r == single_thread.image.pixels[i].r);
+      assert(tracer.image.pixels[i].g == single_thread.image.pixels[i].g);
+      assert(tracer.image.pixels[i].b == single_thread.image.pixels[i].b);
+    }
+  }
+
+  // Every pixel must have been rendered
+  ImageTracer tracer(img, camera);
+  tracer.fire_all_rays(
+      [](const Ray &ray, PCG &pcg) -> Color { return Color(1.0, 2.0, 3.0); },
+      4);
+  for (int row{}; row < tracer.image.height; row++) {
+    for (int col{}; col < tracer.image.width; col++) {
+      assert(tracer.image.get_pixel(col, row) == (Color(1.0, 2.0, 3.0)));
+    }
+  }
+}
+
+void test_progressive_rendering() {
+  HdrImage img(ImageTracer::tile_size + 3, 5);
+  shared_ptr<Camera> camera =
+      make_shared<PerspectiveCamera>(1.0, 2.0, Transformation());
+
+  AccumulationBuffer buffer(img.width, img.height);
+  assert(buffer.min_count() == 0);
+  assert(buffer.get_mean(0, 0) == Color());
+
+  // Two passes with 4 samples each: the mean of a constant is the constant
+  ImageTracer tracer(img, camera, 2);
+  auto constant = [](const Ray &ray, PCG &pcg) -> Color {
+    return Color(1.0, 2.0, 3.0);
+  };
+  tracer.fire_pass(constant, buffer, 2);
+  tracer.fire_pass(constant, buffer, 2);
+  assert(buffer.min_count() == 8);
+  for (int row{}; row < img.height; row++) {
+    for (int col{}; col < img.width; col++) {
+      assert(buffer.get_count(col, row) == 8);
+      assert(tracer.image.get_pixel(col, row) == Color(1.0, 2.0, 3.0));
+    }
+  }
+  HdrImage mean = buffer.to_image();
+  assert(mean.get_pixel(3, 4) == Color(1.0, 2.0, 3.0));
+
+  // Passes take new samples, but do not depend on the number of threads
+  auto func = [](const Ray &ray, PCG &pcg) -> Color {
+    return Color(pcg.random_float(), ray.dir.y, ray.dir.z);
+  };
+  ImageTracer single_thread(img, camera, 2);
+  AccumulationBuffer single_buffer(img.width, img.height);
+  single_thread.fire_pass(func, single_buffer, 1);
+  Color first_pass = single_buffer.get_mean(0, 0);
+  single_thread.fire_pass(func, single_buffer, 1);
+  assert(!(single_buffer.get_mean(0, 0) == first_pass));
+
+  ImageTracer multi_thread(img, camera, 2);
+  AccumulationBuffer multi_buffer(img.width, img.height);
+  multi_thread.fire_pass(func, multi_buffer, 4);
+  multi_thread.fire_pass(func, multi_buffer, 4);
+  for (int i{}; i < img.pixels.size(); i++) {
+    assert(multi_buffer.sums[i].r == single_buffer.sums[i].r);
+    assert(multi_thread.image.pixels[i].r == single_thread.image.pixels[i].r);
+  }
+
+  buffer.clear();
+  assert(buffer.min_count() == 0);
+}
+
+void test_adaptive_sampling() {
+  AccumulationBuffer buffer(2, 1);
+  buffer.add_sample(0, 0, Color(1.0, 1.0, 1.0));
+  assert(buffer.get_relative_error(0, 0) == numeric_limits<float>::infinity());
+  buffer.add_sample(0, 0, Color(3.0, 3.0, 3.0));
+  assert(are_close(buffer.get_variance(0, 0), 2.0));
+  assert(are_close(buffer.get_relative_error(0, 0), 0.5));
+
+  // Samples of different colors with the same luminosity are not noisy:
+  // the variance comes from the luminosity of each sample, not of their sum
+  buffer.clear();
+  for (int i{}; i < 4; i++)
+    buffer.add_sample(1, 0,
+                      i % 2 ? Color(1.0, 0.0, 0.0) : Color(0.0, 1.0, 0.0));
+  assert(are_close(buffer.get_mean_luminosity(1, 0), 0.5));
+  assert(buffer.get_variance(1, 0) == 0.f);
+  assert(buffer.get_relative_error(1, 0) == 0.f);
+  buffer.add_sample(0, 0, Color(2.0, 0.0, 0.0));
+  buffer.add_sample(0, 0, Color(0.0, 1.0, 0.0));
+  assert(are_close(buffer.get_mean_luminosity(0, 0), 0.75));
+  assert(are_close(buffer.get_variance(0, 0), 0.125));
+
+  // Uniform pixels converge immediately, noisy ones take all the samples
+  HdrImage img(ImageTracer::tile_size + 3, 6);
+  shared_ptr<Camera> camera =
+      make_shared<PerspectiveCamera>(1.0, 2.0, Transformation());
+  auto func = [](const Ray &ray, PCG &pcg) -> Color {
+    if (ray.dir.y > 0)
+      return Color(0.5, 0.5, 0.5);
+    float noise = pcg.random_float();
+    return Color(noise, noise, noise);
+  };
+
+  ImageTracer tracer(img, camera, 2);
+  AccumulationBuffer samples(img.width, img.height);
+  tracer.fire_adaptive(func, samples, 0.05, 8, 64, 2);
+  assert(samples.get_count(0, 0) == 8);
+  assert(tracer.image.get_pixel(0, 0) == Color(0.5, 0.5, 0.5));
+  assert(samples.get_count(img.width - 1, 0) == 64);
+  assert(samples.min_count() == 8);
+
+  // The result does not depend on the number of threads
+  ImageTracer single_thread(img, camera, 2);
+  AccumulationBuffer single_samples(img.width, img.height);
+  single_thread.fire_adaptive(func, single_samples, 0.05, 8, 64, 1);
+  for (int i{}; i < img.pixels.size(); i++) {
+    assert(samples.counts[i] == single_samples.counts[i]);
+    assert(tracer.image.pixels[i].r == single_thread.image.pixels[i].r);
+  }
+
+  // The heatmap goes from blue (fewest samples) to red (most samples)
+  HdrImage heatmap = samples.count_heatmap();
+  assert(heatmap.get_pixel(0, 0) == Color(0.0, 0.0, 1.0));
+  assert(heatmap.get_pixel(img.width - 1, 0) == Color(1.0, 0.0, 0.0));
+}
+
+void test_shared_pool() {
+  HdrImage img(3 * ImageTracer::tile_size + 7, ImageTracer::tile_size + 1);
+  shared_ptr<Camera> camera =
+      make_shared<PerspectiveCamera>(1.0, 2.0, Transformation());
+  auto func = [](const Ray &ray, PCG &pcg) -> Color {
+    return Color(pcg.random_float(), ray.dir.y, ray.dir.z);
+  };
+
+  ImageTracer expected(img, camera, 2);
+  expected.fire_all_rays(func, 1);
+
+  // Several tracers render at the same time on the threads of the pool
+  ThreadPool pool(3);
+  assert(pool.size() == 3);
+  vector<ImageTracer> tracers(4, ImageTracer(img, camera, 2));
+  vector<thread> jobs;
+  for (auto &tracer : tracers) {
+    tracer.pool = &pool;
+    jobs.emplace_back([&]() { tracer.fire_all_rays(func, 1); });
+  }
+  for (auto &job : jobs)
+    job.join();
+
+  for (const auto &tracer : tracers) {
+    for (int i{}; i < img.pixels.size(); i++) {
+      assert(tracer.image.pixels[i].r == expected.image.pixels[i].r);
+      assert(tracer.image.pixels[i].g == expected.image.pixels[i].g);
+      assert(tracer.image.pixels[i].b == expected.image.pixels[i].b);
+    }
+  }
+
+  // An empty batch returns at once
+  pool.run(0, [](int) { assert(false); });
+}
+
+void test_tile_files() {
+  HdrImage img(2 * ImageTracer::tile_size + 5, ImageTracer::tile_size + 3);
+  shared_ptr<Camera> camera =
+      make_shared<PerspectiveCamera>(1.0, 2.0, Transformation());
+  auto func = [](const Ray &ray, PCG &pcg) -> Color {
+    return Color(pcg.random_float(), ray.dir.y, ray.dir.z);
+  };
+
+  ImageTracer whole(img, camera, 2);
+  AccumulationBuffer expected(img.width, img.height);
+  whole.fire_pass(func, expected, 2);
+  assert(whole.num_of_tiles() == 6);
+
+  // Two workers render disjoint tiles, leaving the other pixels untouched
+  vector<vector<int>> tiles = {{0, 2, 4}, {5, 3, 1}};
+  vector<string> files = {"tiles_test0.acc", "tiles_test1.acc"};
+  for (int i{}; i < 2; i++) {
+    ImageTracer worker(img, camera, 2);
+    worker.tiles = tiles[i];
+    AccumulationBuffer buffer(img.width, img.height);
+    worker.fire_pass(func, buffer, 3);
+    TileBounds other(tiles[1 - i][0], ImageTracer::tile_size, img.width,
+                     img.height);
+    assert(buffer.get_count(other.first_col, other.first_row) == 0);
+    buffer.write_tiles(files[i], tiles[i], ImageTracer::tile_size, "frame");
+  }
+
+  // The order of the files does not matter
+  for (auto names : {files, vector<string>{files[1], files[0]}}) {
+    string frame;
+    AccumulationBuffer merged = merge_tile_files(names, &frame);
+    assert(frame == "frame");
+    for (int i{}; i < expected.counts.size(); i++) {
+      assert(merged.counts[i] == expected.counts[i]);
+      assert(merged.sums[i].r == expected.sums[i].r);
+      assert(merged.sums[i].g == expected.sums[i].g);
+      assert(merged.sums[i].b == expected.sums[i].b);
+      assert(merged.sums_lum[i] == expected.sums_lum[i]);
+      assert(merged.sums_sq[i] == expected.sums_sq[i]);
+    }
+  }
+
+  // Missing tiles, tiles rendered twice and different frames are rejected
+  AccumulationBuffer buffer(img.width, img.height);
+  buffer.write_tiles("tiles_test2.acc", {1}, ImageTracer::tile_size, "frame");
+  buffer.write_tiles("tiles_test3.acc", {}, ImageTracer::tile_size, "other");
+  for (auto names : {vector<string>{files[0]},
+                     vector<string>{files[0], files[1], "tiles_test2.acc"},
+                     vector<string>{files[0], files[1], "tiles_test3.acc"},
+                     vector<string>{}}) {
+    bool failed = false;
+    try {
+      merge_tile_files(names);
+    } catch (InvalidAccumulationFile &) {
+      failed = true;
+    }
+    assert(failed);
+  }
+
+  for (const string &name : {"tiles_test0.acc", "tiles_test1.acc",
+                             "tiles_test2.acc", "tiles_test3.acc"})
+    remove(name.c_str());
+}
+
+void test_checkpoint() {
+  HdrImage img(2 * ImageTracer::tile_size + 5, ImageTracer::tile_size + 3);
+  shared_ptr<Camera> camera =
+      make_shared<PerspectiveCamera>(1.0, 2.0, Transformation());
+  auto func = [](const Ray &ray, PCG &pcg) -> Color {
+    return Color(pcg.random_float(), ray.dir.y, ray.dir.z);
+  };
+
+  ImageTracer whole(img, camera, 2);
+  AccumulationBuffer expected(img.width, img.height);
+  for (int pass{}; pass < 3; pass++)
+    whole.fire_pass(func, expected, 2);
+
+  // The background thread keeps writing checkpoints while the tiles are
+  // rendered; the last one is written after the second pass was rendered
+  // on half of the tiles
+  ImageTracer tracer(img, camera, 2);
+  AccumulationBuffer buffer(img.width, img.height);
+  {
+    Checkpointer checkpointer(buffer, ImageTracer::tile_size,
+                              "checkpoint_test", "frame", 1e-4);
+    tracer.tile_mutexes = &checkpointer.tile_mutexes;
+    tracer.fire_pass(func, buffer, 3);
+    tracer.tiles = {1, 3, 5};
+    tracer.fire_pass(func, buffer, 3);
+    checkpointer.stop();
+    checkpointer.write();
+  }
+
+  // Resuming renders the missing tiles of the second pass, then the third
+  AccumulationBuffer resumed =
+      read_checkpoint("checkpoint_test", img.width, img.height, "frame");
+  assert(resumed.counts == buffer.counts);
+  ImageTracer resumed_tracer(img, camera, 2);
+  resumed_tracer.tiles = {0, 2, 4};
+  resumed_tracer.fire_pass(func, resumed, 2);
+  resumed_tracer.tiles.clear();
+  resumed_tracer.fire_pass(func, resumed, 2);
+  for (int i{}; i < expected.counts.size(); i++) {
+    assert(resumed.counts[i] == expected.counts[i]);
+    assert(resumed.sums[i].r == expected.sums[i].r);
+    assert(resumed.sums_lum[i] == expected.sums_lum[i]);
+    assert(resumed.sums_sq[i] == expected.sums_sq[i]);
+  }
+
+  // A checkpoint of another image or frame is rejected
+  for (auto frame : {"frame", "other"}) {
+    bool failed = false;
+    try {
+      read_checkpoint("checkpoint_test", img.width,
+                      frame == string("frame") ? img.height + 1 : img.height,
+                      frame);
+    } catch (InvalidAccumulationFile &) {
+      failed = true;
+    }
+    assert(failed);
+  }
+
+  remove("checkpoint_test");
+}
+
 int main() {
 
   HdrImage img(4, 2);
@@ -55,6 +411,14 @@ int main() {
   test_uv_sub_mapping(tracer);
   test_image_coverage(tracer);
   test_orientation(tracer);
+  test_ray_footprint(tracer);
+  test_parallel_rendering();
+  test_pixel_streams();
+  test_progressive_rendering();
+  test_adaptive_sampling();
+  test_shared_pool();
+  test_tile_files();
+  test_checkpoint();
 
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,83 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "json.h"
+#include <cassert>
+
+using namespace std;
+
+void test_parse() {
+  JsonValue value = parse_json(
+      R"( {"scene": "demo.txt", "width": 640, "gamma": -1.5e1,
+           "vars": {"angle": 30.5}, "tags": [true, false, null, []],
+           "empty": {}} )");
+  assert(value.type == JsonType::object);
+  assert(value.object.size() == 6);
+  assert(value.find("scene")->type == JsonType::string);
+  assert(value.find("scene")->str == "demo.txt");
+  assert(value.find("width")->number == 640.);
+  assert(value.find("gamma")->number == -15.);
+  assert(value.find("vars")->find("angle")->number == 30.5);
+  assert(value.find("missing") == nullptr);
+  assert(value.find("width")->find("anything") == nullptr);
+
+  const auto &tags = value.find("tags")->array;
+  assert(tags.size() == 4);
+  assert(tags[0].type == JsonType::boolean && tags[0].boolean);
+  assert(tags[1].type == JsonType::boolean && !tags[1].boolean);
+  assert(tags[2].type == JsonType::null);
+  assert(tags[3].type == JsonType::array && tags[3].array.empty());
+  assert(value.find("empty")->object.empty());
+}
+
+void test_strings() {
+  assert(parse_json(R"("a\"b\\c\/d\n\t")").str == "a\"b\\c/d\n\t");
+  assert(parse_json(R"("\u00e8")").str == "\xc3\xa8");
+  assert(parse_json(R"("\ud83d\ude00")").str == "\xf0\x9f\x98\x80");
+
+  string text = "quote \" backslash \\ newline \n bell \x07";
+  assert(json_quote(text) ==
+         R"("quote \" backslash \\ newline \n bell \u0007")");
+  assert(parse_json(json_quote(text)).str == text);
+}
+
+void test_errors() {
+  vector<string> invalid = {
+      "", "{", "{\"a\" 1}", "{\"a\": 1,}", "[1 2]", "tru", "01x", "-", "1.",
+      "\"abc", "\"\\x\"", "\"\\u12\"", "{1: 2}", "[] []",
+      // Too many nested values
+      string(100, '[') + string(100, ']')};
+  for (const string &text : invalid) {
+    bool failed = false;
+    try {
+      parse_json(text);
+    } catch (JsonError &) {
+      failed = true;
+    }
+    assert(failed);
+  }
+}
+
+int main() {
+  test_parse();
+  test_strings();
+  test_errors();
+
+  return 0;
+}
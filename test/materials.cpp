@@ -55,6 +55,68 @@ void test_image_pigment() {
   assert(pigment(Vec2d(1.0, 0.0)) == (Color(2.0, 3.0, 1.0)));
   assert(pigment(Vec2d(0.0, 1.0)) == (Color(2.0, 1.0, 3.0)));
   assert(pigment(Vec2d(1.0, 1.0)) == (Color(3.0, 2.0, 1.0)));
+
+  // The same texture, stored in tiles
+  pigment.texture.make_tiled();
+  assert(pigment.texture.tiled && !pigment.texture.image);
+  assert(pigment(Vec2d(0.0, 0.0)) == (Color(1.0, 2.0, 3.0)));
+  assert(pigment(Vec2d(1.0, 0.0)) == (Color(2.0, 3.0, 1.0)));
+  assert(pigment(Vec2d(0.0, 1.0)) == (Color(2.0, 1.0, 3.0)));
+  assert(pigment(Vec2d(1.0, 1.0)) == (Color(3.0, 2.0, 1.0)));
+}
+
+void test_mipmaps() {
+  HdrImage image(4, 2);
+  for (int y{}; y < image.height; y++) {
+    for (int x{}; x < image.width; x++)
+      image.set_pixel(x, y, Color(x, y, 1.0));
+  }
+
+  Texture texture{make_shared<const HdrImage>(image), nullptr};
+  texture.build_mipmaps(2);
+  assert(texture.num_of_levels() == 3);
+
+  const HdrImage *level1 = texture.level_image(1);
+  assert(level1->width == 2 && level1->height == 1);
+  assert(level1->get_pixel(0, 0) == (Color(0.5, 0.5, 1.0)));
+  assert(level1->get_pixel(1, 0) == (Color(2.5, 0.5, 1.0)));
+
+  const HdrImage *level2 = texture.level_image(2);
+  assert(level2->width == 1 && level2->height == 1);
+  assert(level2->get_pixel(0, 0) == (Color(1.5, 0.5, 1.0)));
+
+  assert(texture.memory_usage() == (8 + 2 + 1) * sizeof(Color));
+}
+
+void test_filtered_image_pigment() {
+  HdrImage image = HdrImage(2, 2);
+  image.set_pixel(0, 0, Color(1.0, 2.0, 3.0));
+  image.set_pixel(1, 0, Color(2.0, 3.0, 1.0));
+  image.set_pixel(0, 1, Color(2.0, 1.0, 3.0));
+  image.set_pixel(1, 1, Color(3.0, 2.0, 1.0));
+
+  // The default filter ignores the footprint
+  ImagePigment nearest(image);
+  Vec2d none(0., 0.), whole(1., 1.);
+  assert(nearest.filtered(Vec2d(0.1, 0.1), whole) == (Color(1.0, 2.0, 3.0)));
+
+  Texture texture{make_shared<const HdrImage>(image), nullptr};
+  texture.build_mipmaps();
+  ImagePigment bilinear(texture, TextureFilter::bilinear);
+  assert(bilinear.filtered(Vec2d(0.25, 0.25), none) == (Color(1.0, 2.0, 3.0)));
+  assert(bilinear.filtered(Vec2d(0.5, 0.25), none) == (Color(1.5, 2.5, 2.0)));
+  assert(bilinear.filtered(Vec2d(0.5, 0.5), none) == (Color(2.0, 2.0, 2.0)));
+  // u wraps around, v is clamped
+  assert(bilinear.filtered(Vec2d(0.0, 0.0), none) == (Color(1.5, 2.5, 2.0)));
+  // A footprint as large as the texture sees its average
+  assert(bilinear.filtered(Vec2d(0.1, 0.9), whole) == (Color(2.0, 2.0, 2.0)));
+
+  // Halfway between the levels 0 and 1
+  ImagePigment trilinear(texture, TextureFilter::trilinear);
+  float half_level = sqrt(2.) / 2.;
+  assert(trilinear.filtered(Vec2d(0.25, 0.25),
+                            Vec2d(half_level, half_level)) ==
+         (Color(1.5, 2.0, 2.5)));
 }
 
 /**
@@ -90,6 +152,8 @@ int main() {
   test_uniform_pigment();
   test_checkered_pigment();
   test_image_pigment();
+  test_mipmaps();
+  test_filtered_image_pigment();
   test_scatter_ray();
   return 0;
 }
\ No newline at end of file
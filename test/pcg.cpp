@@ -19,6 +19,10 @@
 
 #include "pcg.h"
 #include <cassert>
+#include <cmath>
+#include <vector>
+
+using namespace std;
 
 void test_random() {
   PCG pcg;
@@ -32,8 +36,65 @@ void test_random() {
     assert(expected[i] == pcg.random());
 }
 
+void test_advance() {
+  PCG pcg, skipped;
+  for (int i{}; i < 1000; i++)
+    pcg.random();
+  skipped.advance(1000);
+  assert(skipped.state == pcg.state);
+  assert(skipped.random() == pcg.random());
+
+  skipped.advance(0);
+  assert(skipped.state == pcg.state);
+}
+
+void test_streams() {
+  // Streams are reproducible
+  PCG first = PCG::stream(42, 54, 1000, 3);
+  PCG again = PCG::stream(42, 54, 1000, 3);
+  for (int i{}; i < 10; i++)
+    assert(first.random() == again.random());
+
+  // Samples of a pixel are consecutive chunks of the same sequence
+  PCG sample0 = PCG::stream(42, 54, 1000, 0);
+  PCG sample1 = PCG::stream(42, 54, 1000, 1);
+  assert(sample0.inc == sample1.inc);
+  sample0.advance(PCG::sample_stride);
+  assert(sample0.state == sample1.state);
+
+  // Neighbouring pixels get different sequences, and the numbers they draw
+  // are not correlated
+  const int num_of_pixels = 10000;
+  vector<double> x(num_of_pixels), y(num_of_pixels);
+  for (int pixel{}; pixel < num_of_pixels; pixel++) {
+    PCG a = PCG::stream(42, 54, pixel), b = PCG::stream(42, 54, pixel + 1);
+    assert(a.inc != b.inc);
+    x[pixel] = a.random_float();
+    y[pixel] = b.random_float();
+  }
+  double mean_x = 0., mean_y = 0.;
+  for (int i{}; i < num_of_pixels; i++) {
+    mean_x += x[i] / num_of_pixels;
+    mean_y += y[i] / num_of_pixels;
+  }
+  double cov = 0., var_x = 0., var_y = 0.;
+  for (int i{}; i < num_of_pixels; i++) {
+    cov += (x[i] - mean_x) * (y[i] - mean_y);
+    var_x += (x[i] - mean_x) * (x[i] - mean_x);
+    var_y += (y[i] - mean_y) * (y[i] - mean_y);
+  }
+  assert(fabs(mean_x - 0.5) < 0.02);
+  assert(fabs(cov / sqrt(var_x * var_y)) < 0.05);
+
+  // The seed of the image changes every stream
+  assert(PCG::stream(42, 54, 7).random() != PCG::stream(43, 54, 7).random());
+  assert(PCG::stream(42, 54, 7).random() != PCG::stream(42, 55, 7).random());
+}
+
 int main() {
   test_random();
+  test_advance();
+  test_streams();
 
   return 0;
 }
\ No newline at end of file
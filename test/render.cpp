@@ -19,8 +19,11 @@
 
 #include "render.h"
 #include "HdrImage.h"
+#include "alloc_counter.h"
 #include "camera.h"
 #include "imagetracer.h"
+#include "simd.h"
+#include "stats.h"
 #include <cassert>
 
 using namespace std;
@@ -106,10 +109,201 @@ void test_pathTracer() {
   }
 }
 
+void test_iterative_pathTracer() {
+  PCG pcg;
+
+  // Furnace test: the expected radiance is known analytically
+  for (int i{}; i < 5; i++) {
+    World world;
+    float emitted_radiance = pcg.random_float();
+    float reflectance = pcg.random_float() * 0.9;
+    Material enclosure_material{
+        make_shared<DiffusiveBRDF>(
+            make_shared<UniformPigment>(WHITE * reflectance)),
+        make_shared<UniformPigment>(WHITE * emitted_radiance)};
+
+    Sphere sphere(Transformation(), enclosure_material);
+    world.add(make_shared<Sphere>(sphere));
+
+    IterativePathTracer path_tracer(world, BLACK, pcg, 100, 101);
+
+    Ray ray(Point(0, 0, 0), Vec(1, 0, 0));
+    Color color = path_tracer(ray);
+
+    float expected = emitted_radiance / (1.0 - reflectance);
+
+    assert(are_close(expected, color.r, 1e-3));
+    assert(are_close(expected, color.g, 1e-3));
+    assert(are_close(expected, color.b, 1e-3));
+  }
+
+  // With one ray per surface point, the recursive estimator follows the same
+  // path, drawing the same random numbers
+  World world;
+  world.add(make_shared<Plane>(
+      Transformation(),
+      Material(make_shared<DiffusiveBRDF>(make_shared<CheckeredPigment>(
+                   Color(0.3, 0.5, 0.1), Color(0.1, 0.2, 0.5))),
+               make_shared<UniformPigment>(Color(0.1, 0.1, 0.1)))));
+  world.add(make_shared<Sphere>(
+      translation(Vec(0, 0, 1)),
+      Material(make_shared<SpecularBRDF>(
+          make_shared<UniformPigment>(Color(0.6, 0.2, 0.3))))));
+  world.add(make_shared<Sphere>(
+      scaling(Vec(20, 20, 20)),
+      Material(make_shared<DiffusiveBRDF>(make_shared<UniformPigment>(BLACK)),
+               make_shared<UniformPigment>(Color(1.0, 0.9, 0.5)))));
+
+  PathTracer recursive(world, BLACK, PCG(), 1, 5, 2);
+  IterativePathTracer iterative(world, BLACK, PCG(), 5, 2);
+  for (int i{}; i < 100; i++) {
+    Ray ray(Point(-3, 0, 1), Vec(1, pcg.random_float() - 0.5,
+                                 pcg.random_float() - 0.5));
+    Color expected = recursive(ray);
+    Color color = iterative(ray);
+    assert(are_close(expected.r, color.r, 1e-4));
+    assert(are_close(expected.g, color.g, 1e-4));
+    assert(are_close(expected.b, color.b, 1e-4));
+  }
+}
+
+void test_no_allocations_while_rendering() {
+  Material material{
+      make_shared<DiffusiveBRDF>(make_shared<UniformPigment>(WHITE * 0.5)),
+      make_shared<UniformPigment>(WHITE * 0.1)};
+  World world;
+  world.add(make_shared<Sphere>(scaling(Vec(10, 10, 10)), material));
+  world.add(make_shared<Plane>(translation(Vec(0, 0, -1)), material));
+  world.add(make_shared<Sphere>(translation(Vec(2, 0, 0)), material));
+  world.build_bvh();
+
+  PathTracer renderer(world, BLACK, PCG(), 2, 3, 2);
+  ImageTracer tracer(HdrImage(8, 8), make_shared<PerspectiveCamera>(), 2);
+  function<Color(const Ray &)> func = [&](const Ray &ray) {
+    return renderer(ray);
+  };
+
+  Ray rays[12];
+  Color colors[12];
+  for (int i{}; i < 12; i++)
+    rays[i] = tracer.fire_ray(i % 8, i / 8);
+  PCG pcg;
+
+  // Intersections, scattering and shading must not touch the heap
+  long allocations_before = num_of_allocations;
+  tracer.fire_all_rays(func);
+  assert(num_of_allocations == allocations_before);
+
+  // Neither must packets
+  renderer.render_packet(rays, 12, colors, pcg);
+  assert(num_of_allocations == allocations_before);
+}
+
+void test_packet_rendering() {
+  PCG pcg;
+  World world;
+  for (int i{}; i < 30; i++) {
+    Material material{make_shared<DiffusiveBRDF>(make_shared<UniformPigment>(
+                          Color(pcg.random_float(), pcg.random_float(),
+                                pcg.random_float()))),
+                      make_shared<UniformPigment>(WHITE * 0.2)};
+    Vec center{6 * pcg.random_float() - 3, 6 * pcg.random_float() - 3,
+               3 * pcg.random_float()};
+    // Half of the spheres use the generic intersection
+    Transformation transformation =
+        i % 2 ? translation(center) * scaling(Vec(0.4, 0.4, 0.4))
+              : translation(center) * rotation_z(10 * i) *
+                    scaling(Vec(0.5, 0.3, 0.4));
+    world.add(make_shared<Sphere>(transformation, material));
+  }
+  world.add(make_shared<Plane>(
+      translation(Vec(0, 0, -1)),
+      Material(make_shared<DiffusiveBRDF>(make_shared<CheckeredPigment>(
+          Color(0.3, 0.5, 0.1), Color(0.1, 0.2, 0.5))))));
+  world.build_bvh();
+
+  shared_ptr<Camera> camera = make_shared<PerspectiveCamera>(
+      1.0, 1.0, translation(Vec(-6, 0, 1)));
+  IterativePathTracer renderer(world, Color(0.1, 0.1, 0.2), PCG(), 3, 2);
+
+  // The reference image is traced one ray at a time
+  ImageTracer scalar(HdrImage(24, 24), camera, 3);
+  scalar.fire_all_rays(
+      [&](const Ray &ray, PCG &pcg) { return renderer(ray, pcg); }, 1);
+
+  // Packets must give exactly the same image, with or without AVX2
+  for (bool simd : {true, false}) {
+    set_simd_enabled(simd);
+    ImageTracer packets(HdrImage(24, 24), camera, 3);
+    packets.fire_all_rays(
+        [&](const Ray *rays, int n, Color *colors, PCG &pcg) {
+          renderer.render_packet(rays, n, colors, pcg);
+        },
+        2);
+    for (int i{}; i < scalar.image.pixels.size(); i++) {
+      assert(packets.image.pixels[i].r == scalar.image.pixels[i].r);
+      assert(packets.image.pixels[i].g == scalar.image.pixels[i].g);
+      assert(packets.image.pixels[i].b == scalar.image.pixels[i].b);
+    }
+  }
+  set_simd_enabled(true);
+}
+
+void test_render_stats() {
+  // Every ray hits the enclosure, and is tested against both shapes
+  Material material{
+      make_shared<DiffusiveBRDF>(make_shared<UniformPigment>(WHITE * 0.5)),
+      make_shared<UniformPigment>(WHITE * 0.1)};
+  World world;
+  world.add(make_shared<Sphere>(scaling(Vec(10, 10, 10)), material));
+  world.add(make_shared<Plane>(translation(Vec(0, 0, -1)), material));
+
+  IterativePathTracer renderer(world, BLACK, PCG(), 5, 2);
+  auto render_ray = [&](const Ray *rays, int n, Color *colors, PCG &pcg) {
+    renderer.render_packet(rays, n, colors, pcg);
+  };
+
+  // Nothing is counted unless asked
+  reset_stats();
+  ImageTracer tracer(HdrImage(16, 16), make_shared<PerspectiveCamera>(), 2);
+  tracer.fire_all_rays(render_ray, 2);
+  assert(collect_stats().rays() == 0);
+
+  // The counters of the worker threads are merged with the ones of the
+  // calling thread
+  set_stats_enabled(true);
+  tracer.fire_all_rays(render_ray, 2);
+  set_stats_enabled(false);
+  RenderStats stats = collect_stats();
+  assert(stats.camera_rays == 16 * 16 * 4);
+  assert(stats.rays_per_depth[1] == stats.camera_rays);
+  assert(stats.hits == stats.rays());
+  assert(stats.intersection_tests == 2 * stats.rays());
+  assert(stats.shadow_rays == 0);
+  assert(stats.russian_roulette_terminations > 0);
+  for (int depth{2}; depth <= RenderStats::max_depth; depth++)
+    assert(stats.rays_per_depth[depth] <= stats.rays_per_depth[depth - 1]);
+  assert(stats.rays_per_depth[6] == 0); // max_depth of the renderer is 5
+  assert(stats.average_path_length() > 1. &&
+         stats.average_path_length() <= 5.);
+
+  RenderStats twice = stats;
+  twice.merge(stats);
+  assert(twice.rays() == 2 * stats.rays());
+  assert(twice.to_json().find("\"camera_rays\": 2048") != string::npos);
+
+  reset_stats();
+  assert(collect_stats().rays() == 0);
+}
+
 int main() {
   test_OnOff_render();
   test_flat_render();
   test_pathTracer();
+  test_iterative_pathTracer();
+  test_no_allocations_while_rendering();
+  test_packet_rendering();
+  test_render_stats();
 
   return 0;
 }
\ No newline at end of file
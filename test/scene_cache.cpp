@@ -0,0 +1,193 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "pcg.h"
+#include "scene_cache.h"
+#include <cassert>
+#include <cstring>
+#include <sstream>
+
+using namespace std;
+
+const string SCENE_TEXT =
+    "float angle(10)\n"
+    "float size(0.5)\n"
+    "material sky(diffuse(uniform(<0, 0, 0>)), uniform(<0.7, 0.5, 1>))\n"
+    "material ground(diffuse(checkered(<0.3, 0.5, 0.1>, <0.1, 0.2, 0.5>, "
+    "4)), uniform(<0, 0, 0>))\n"
+    "material mirror(specular(uniform(<0.5, 0.5, 0.5>)), "
+    "image(\"../test/HdrImage_references/reference_le.pfm\"))\n"
+    "material unused(diffuse(uniform(<1, 1, 1>)), uniform(<0, 0, 0>))\n"
+    "plane(sky, translation([0, 0, 100]) * rotation_y(angle))\n"
+    "plane(ground, identity)\n"
+    "sphere(mirror, translation([0, 0, 1]) * scaling([size, size, size]))\n"
+    "sphere(ground, translation([1, 2, 3]) * rotation_z(angle) * "
+    "scaling([1, 0.5, 2]))\n"
+    "sphere(mirror, translation([-2, 1, 0.5]))\n"
+    "camera(perspective, rotation_z(30) * translation([-4, 0, 1]), 1.5, "
+    "2.0)\n";
+
+const string CACHE_FILE = "scene_cache_test.bin";
+
+Scene parse(const string &text, const map<string, float> &variables) {
+  stringstream sstr(text);
+  InputStream stream(sstr);
+  return stream.parse_scene(variables);
+}
+
+bool same_matrices(const Transformation &a, const Transformation &b) {
+  return memcmp(a.m, b.m, sizeof(a.m)) == 0 &&
+         memcmp(a.invm, b.invm, sizeof(a.invm)) == 0;
+}
+
+void test_round_trip() {
+  map<string, float> variables{{"size", 0.25}};
+  Scene scene = parse(SCENE_TEXT, variables);
+  write_scene_cache(scene, CACHE_FILE);
+  assert(is_scene_cache(CACHE_FILE));
+  assert(scene_cache_variables(CACHE_FILE) == variables);
+
+  TextureCache textures;
+  Scene cached = read_scene_cache(CACHE_FILE, textures);
+  assert(textures.num_of_textures() == 1);
+
+  // Variables
+  assert(cached.float_variables == scene.float_variables);
+  assert(cached.overridden_variables == scene.overridden_variables);
+
+  // Camera
+  auto camera = dynamic_pointer_cast<PerspectiveCamera>(cached.camera);
+  assert(camera);
+  assert(camera->screen_distance == 2.f);
+  assert(camera->aspect_ratio == 1.5f);
+  assert(same_matrices(camera->transformation, scene.camera->transformation));
+
+  // Shapes, with the same matrices and materials
+  assert(cached.world.shapes.size() == scene.world.shapes.size());
+  for (int i{}; i < scene.world.shapes.size(); i++) {
+    const Shape &expected = *scene.world.shapes[i];
+    const Shape &result = *cached.world.shapes[i];
+    assert(typeid(expected) == typeid(result));
+    assert(same_matrices(expected.transformation, result.transformation));
+    assert(typeid(*expected.material.brdf) == typeid(*result.material.brdf));
+    assert(typeid(*expected.material.emitted_radiance) ==
+           typeid(*result.material.emitted_radiance));
+  }
+  // Shapes sharing a material still share it
+  assert(cached.world.shapes[2]->material.brdf.get() ==
+         cached.world.shapes[4]->material.brdf.get());
+  assert(cached.world.shapes[1]->material.brdf.get() ==
+         cached.world.shapes[3]->material.brdf.get());
+  assert(cached.world.shapes[0]->material.brdf.get() !=
+         cached.world.shapes[1]->material.brdf.get());
+
+  // Materials, including the unused one
+  assert(cached.materials.size() == 4);
+  auto &ground = static_cast<CheckeredPigment &>(
+      *cached.materials.at("ground").brdf->pigment);
+  assert(ground.color1 == Color(0.3, 0.5, 0.1));
+  assert(ground.color2 == Color(0.1, 0.2, 0.5));
+  assert(ground.num_of_steps == 4);
+  auto &sky = static_cast<UniformPigment &>(
+      *cached.materials.at("sky").emitted_radiance);
+  assert(sky.color == Color(0.7, 0.5, 1));
+  auto &mirror = static_cast<ImagePigment &>(
+      *cached.materials.at("mirror").emitted_radiance);
+  assert(mirror.texture.width() == 3 && mirror.texture.height() == 2);
+  assert(dynamic_cast<SpecularBRDF *>(
+      cached.materials.at("mirror").brdf.get()));
+
+  // The trees are read, not built again, and give the same intersections
+  assert(cached.world.has_bvh() && cached.world.has_compiled());
+  assert(cached.world.bvh.nodes.size() == scene.world.bvh.nodes.size());
+  assert(cached.world.compiled.bvh.indices ==
+         scene.world.compiled.bvh.indices);
+  PCG pcg;
+  for (int i{}; i < 1000; i++) {
+    Point origin{10 * pcg.random_float() - 5, 10 * pcg.random_float() - 5,
+                 10 * pcg.random_float() - 5};
+    Vec dir{2 * pcg.random_float() - 1, 2 * pcg.random_float() - 1,
+            2 * pcg.random_float() - 1};
+    HitRecord expected = scene.world.ray_intersection(Ray(origin, dir));
+    HitRecord result = cached.world.ray_intersection(Ray(origin, dir));
+    assert(expected.hit == result.hit);
+    if (expected.hit)
+      assert(expected.t == result.t);
+  }
+
+  remove(CACHE_FILE.c_str());
+}
+
+void test_invalid_files() {
+  auto check_invalid = [](const string &bytes) {
+    {
+      ofstream file(CACHE_FILE, ios::binary);
+      file << bytes;
+    }
+    TextureCache textures;
+    try {
+      read_scene_cache(CACHE_FILE, textures);
+      assert(false);
+    } catch (InvalidSceneCache &e) {
+      fmt::print("{}\n", e.what());
+    }
+  };
+
+  TextureCache textures;
+  try {
+    read_scene_cache(CACHE_FILE, textures);
+    assert(false);
+  } catch (ios_base::failure &) {
+  }
+
+  // A scene file
+  check_invalid(SCENE_TEXT);
+  assert(!is_scene_cache(CACHE_FILE));
+
+  write_scene_cache(parse(SCENE_TEXT, {}), CACHE_FILE);
+  string bytes;
+  {
+    ifstream file(CACHE_FILE, ios::binary);
+    bytes.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+  }
+
+  // Truncated file
+  check_invalid(bytes.substr(0, bytes.size() - 4));
+  check_invalid(bytes.substr(0, 20));
+
+  // Another version
+  string other_version = bytes;
+  other_version[8]++;
+  check_invalid(other_version);
+  assert(is_scene_cache(CACHE_FILE));
+
+  // The last index of the tree over the spheres refers to no sphere
+  string bad_index = bytes;
+  int index = 1000;
+  memcpy(&bad_index[bad_index.size() - 4], &index, 4);
+  check_invalid(bad_index);
+
+  remove(CACHE_FILE.c_str());
+}
+
+int main() {
+  test_round_trip();
+  test_invalid_files();
+  return 0;
+}
@@ -104,6 +104,86 @@ void test_lexer() {
   assert(stream.read_token().type == TokenType::STOP);
 }
 
+void test_lexer_keywords() {
+  vector<pair<string, KeywordEnum>> keywords{
+      {"new", KeywordEnum::NEW},
+      {"material", KeywordEnum::MATERIAL},
+      {"plane", KeywordEnum::PLANE},
+      {"sphere", KeywordEnum::SPHERE},
+      {"diffuse", KeywordEnum::DIFFUSE},
+      {"specular", KeywordEnum::SPECULAR},
+      {"uniform", KeywordEnum::UNIFORM},
+      {"checkered", KeywordEnum::CHECKERED},
+      {"image", KeywordEnum::IMAGE},
+      {"identity", KeywordEnum::IDENTITY},
+      {"translation", KeywordEnum::TRANSLATION},
+      {"rotation_x", KeywordEnum::ROTATION_X},
+      {"rotation_y", KeywordEnum::ROTATION_Y},
+      {"rotation_z", KeywordEnum::ROTATION_Z},
+      {"scaling", KeywordEnum::SCALING},
+      {"camera", KeywordEnum::CAMERA},
+      {"orthogonal", KeywordEnum::ORTHOGONAL},
+      {"perspective", KeywordEnum::PERSPECTIVE},
+      {"float", KeywordEnum::FLOAT},
+  };
+  for (const auto &keyword : keywords) {
+    stringstream sstr(keyword.first);
+    InputStream stream(sstr);
+    Token token = stream.read_token();
+    assert(token.type == TokenType::KEYWORD);
+    assert(token.value.keyword == keyword.second);
+  }
+
+  // Words as long as a keyword, and beginning and ending like it
+  stringstream sstr("rotation_w nww Plane plane_ perspectiv spere _new");
+  InputStream stream(sstr);
+  for (string word : {"rotation_w", "nww", "Plane", "plane_", "perspectiv",
+                      "spere", "_new"}) {
+    Token token = stream.read_token();
+    assert(token.type == TokenType::IDENTIFIER);
+    assert(token.value.str == word);
+  }
+}
+
+void test_lexer_mapped_file() {
+  const string file_name = "scene_file_test.txt";
+  {
+    ofstream file(file_name);
+    file << "# A comment\nfloat\tangle(-1.5e2)\n\tsphere(\"a b\", @)";
+  }
+
+  // The file is either mapped or copied, with the same tokens
+  for (bool map_file : {true, false}) {
+    InputStream stream(file_name, 4, map_file);
+    assert(stream.read_token().value.keyword == KeywordEnum::FLOAT);
+    Token token = stream.read_token();
+    assert(token.value.str == "angle");
+    assert(token.location.line_num == 2);
+    assert(token.location.col_num == 11);
+    assert(stream.read_token().value.symbol == '(');
+    assert(stream.read_token().value.number == -150.f);
+    assert(stream.read_token().value.symbol == ')');
+    assert(stream.read_token().value.keyword == KeywordEnum::SPHERE);
+    assert(stream.read_token().value.symbol == '(');
+    assert(stream.read_token().value.str == "a b");
+    assert(stream.read_token().value.symbol == ',');
+    try {
+      stream.read_token();
+      assert(false);
+    } catch (GrammarError &e) {
+      assert(string(e.what()) ==
+             "scene_file_test.txt:3:20:got invalid character");
+    }
+  }
+  remove(file_name.c_str());
+
+  try {
+    InputStream stream(file_name);
+    assert(false);
+  } catch (ios_base::failure &) {
+  }
+}
+
 void test_parser() {
   stringstream sstr(
       "\nfloat clock(150)\n\nmaterial "
@@ -178,11 +258,140 @@ void test_parser_double_camera() {
   }
 }
 
+void test_parser_animation() {
+  string scene_text =
+      "material sky(diffuse(uniform(<0, 0, 0>)), uniform(<0.7, 0.5, 1>))\n"
+      "float angle(10)\n"
+      "sphere(sky, translation([0, 0, 1]))\n"
+      "sphere(sky, rotation_z(angle) * translation([angle, 0, 1]))\n"
+      "camera(perspective, rotation_z(angle) * translation([-4, 0, 1]), 1.0, "
+      "2.0)\n";
+  stringstream sstr(scene_text);
+  InputStream stream(sstr);
+  stream.animated_variables = {"angle"};
+  map<string, float> vars{{"angle", 30}};
+  Scene scene = stream.parse_scene(vars);
+
+  // Only the second sphere depends on the animated variable
+  assert(scene.animated_shapes.size() == 1);
+  assert(scene.animated_shapes[0].first == 1);
+
+  map<string, float> values{{"angle", 45}};
+  shared_ptr<Camera> camera = scene.camera_at(values);
+  assert(camera->transformation.is_close(rotation_z(45) *
+                                         translation(Vec(-4, 0, 1))));
+  assert(are_close(static_cast<PerspectiveCamera &>(*camera).screen_distance,
+                   2.0));
+  // The camera of the scene is not changed
+  assert(scene.camera->transformation.is_close(rotation_z(30) *
+                                               translation(Vec(-4, 0, 1))));
+
+  World world = scene.world_at(values);
+  assert(world.has_compiled());
+  assert(world.shapes[0].get() == scene.world.shapes[0].get());
+  assert(world.shapes[1].get() != scene.world.shapes[1].get());
+  assert(world.shapes[1]->transformation.is_close(
+      rotation_z(45) * translation(Vec(45, 0, 1))));
+  assert(scene.world.shapes[1]->transformation.is_close(
+      rotation_z(30) * translation(Vec(30, 0, 1))));
+  // Materials (and their textures) are shared
+  assert(world.shapes[1]->material.brdf.get() ==
+         scene.world.shapes[1]->material.brdf.get());
+
+  // The trees are refitted around the moved sphere, not built again
+  assert(world.bvh.nodes.size() == scene.world.bvh.nodes.size());
+  assert(world.bvh.indices == scene.world.bvh.indices);
+  PCG pcg;
+  for (int i{}; i < 1000; i++) {
+    Point origin{20 * pcg.random_float() - 10, 20 * pcg.random_float() - 10,
+                 20 * pcg.random_float() - 10};
+    Vec dir{2 * pcg.random_float() - 1, 2 * pcg.random_float() - 1,
+            2 * pcg.random_float() - 1};
+    Ray ray(origin, dir);
+    HitRecord expected = world.ray_intersection_brute_force(ray);
+    HitRecord result = world.ray_intersection(ray);
+    assert(expected.hit == result.hit);
+    if (expected.hit)
+      assert(expected.shape == result.shape && expected.t == result.t);
+  }
+
+  // Scenes without moving shapes share their trees with every frame
+  stringstream still_sstr("material sky(diffuse(uniform(<0, 0, 0>)), "
+                          "uniform(<0.7, 0.5, 1>))\n"
+                          "float angle(10)\n"
+                          "sphere(sky, translation([0, 0, 1]))\n"
+                          "camera(perspective, rotation_z(angle), 1.0, 2.0)\n");
+  InputStream still_stream(still_sstr);
+  still_stream.animated_variables = {"angle"};
+  Scene still_scene = still_stream.parse_scene(vars);
+  assert(still_scene.animated_shapes.empty());
+  World still_world = still_scene.world_at(values);
+  assert(still_world.has_compiled());
+  assert(still_world.shapes[0].get() == still_scene.world.shapes[0].get());
+
+  // Animated variables can only be used in transformations
+  stringstream color_sstr("float angle(10)\n"
+                          "material sky(diffuse(uniform(<angle, 0, 0>)), "
+                          "uniform(<0.7, 0.5, 1>))\n");
+  InputStream color_stream(color_sstr);
+  color_stream.animated_variables = {"angle"};
+  try {
+    color_stream.parse_scene(vars);
+    assert(false);
+  } catch (GrammarError &e) {
+    fmt::print("{}\n", e.what());
+  }
+
+  // Unless their values are fixed in the scene
+  color_sstr.clear();
+  color_sstr.seekg(0);
+  InputStream fixed_stream(color_sstr);
+  fixed_stream.animated_variables = {"angle"};
+  fixed_stream.fix_animated_variables = true;
+  Scene fixed_scene = fixed_stream.parse_scene(vars);
+  assert(fixed_scene.fixed_variables == vector<string>{"angle"});
+  assert(scene.fixed_variables.empty());
+}
+
+void test_parser_texture_cache() {
+  // The same file, written in three different ways
+  stringstream sstr(
+      "material a(diffuse(image(\"../test/HdrImage_references/"
+      "reference_le.pfm\")),\n"
+      "  image(\"../test/HdrImage_references/reference_le.pfm\"))\n"
+      "material b(diffuse(image(\"../test/../test/HdrImage_references/"
+      "reference_le.pfm\")), uniform(<0, 0, 0>))\n"
+      "material c(diffuse(image(\"../test/HdrImage_references/"
+      "reference_be.pfm\")), uniform(<0, 0, 0>))\n");
+  InputStream stream(sstr);
+  map<string, float> vars;
+  Scene scene = stream.parse_scene(vars);
+
+  assert(stream.textures->num_of_textures() == 2);
+  assert(stream.textures->memory_usage() == 2 * 3 * 2 * sizeof(Color));
+
+  auto texture = [&](const string &material, bool emitted) {
+    const Material &m = scene.materials.at(material);
+    return static_cast<ImagePigment &>(emitted ? *m.emitted_radiance
+                                               : *m.brdf->pigment)
+        .texture.image.get();
+  };
+  assert(texture("a", false) == texture("a", true));
+  assert(texture("a", false) == texture("b", false));
+  assert(texture("a", false) != texture("c", false));
+  assert(texture("a", false)->get_pixel(0, 0) ==
+         texture("c", false)->get_pixel(0, 0));
+}
+
 int main() {
   test_input_file();
   test_lexer();
+  test_lexer_keywords();
+  test_lexer_mapped_file();
   test_parser();
   test_parser_undefined_material();
   test_parser_double_camera();
+  test_parser_animation();
+  test_parser_texture_cache();
   return 0;
 }
\ No newline at end of file
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2021 Simone Pirota, Federico Pellegatta
+ *
+ * This file is part of raytracer.
+ *
+ * raytracer is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * raytracer is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with raytracer.  If not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include "json.h"
+#include "serve.h"
+#include <cassert>
+#include <fstream>
+#include <sstream>
+
+using namespace std;
+
+// The defaults of the jobs, as given on the command line of the daemon
+RenderJob default_job() {
+  RenderJob job;
+  job.settings.input_scene = "scene.txt";
+  job.settings.output_file = "image.png";
+  job.settings.width = 64;
+  job.settings.height = 32;
+  job.settings.algorithm = "flat";
+  job.settings.samples_per_pixel = 1;
+  job.vars = {{"angle", 10}, {"clock", 1}};
+  return job;
+}
+
+void test_parse_render_job() {
+  // The options of the job override the defaults, the others are kept
+  RenderJob job = default_job();
+  parse_render_job(R"({"id": "first", "output": "other.png", "width": 128, )"
+                   R"("samples_per_pixel": 4, "vars": {"angle": 30}})",
+                   job);
+  assert(job.id == "\"first\"");
+  assert(job.settings.output_file == "other.png");
+  assert(job.settings.width == 128);
+  assert(job.settings.height == 32);
+  assert(job.settings.samples_per_pixel == 4);
+  assert(job.settings.input_scene == "scene.txt");
+  assert(job.settings.algorithm == "flat");
+  assert(job.vars.at("angle") == 30.f);
+  assert(job.vars.at("clock") == 1.f);
+
+  job = default_job();
+  parse_render_job("{}", job);
+  assert(job.id == "null");
+  assert(job.settings.output_file == "image.png");
+
+  job = default_job();
+  parse_render_job(R"({"id": 7, "max_error": 0.05})", job);
+  assert(job.id == "7");
+  assert(job.settings.is_adaptive());
+
+  // The identifier is known even when the rest of the job is not valid
+  job = default_job();
+  try {
+    parse_render_job(R"({"id": 3, "width": -1})", job);
+    assert(false);
+  } catch (invalid_argument &) {
+    assert(job.id == "3");
+  }
+
+  for (string line :
+       {R"([1, 2])", R"({"colour": "red"})", R"({"width": "wide"})",
+        R"({"width": 1.5})", R"({"scene": 1})", R"({"scene": ""})",
+        R"({"output": ""})", R"({"height": 0})", R"({"algorithm": "magic"})",
+        R"({"samples_per_pixel": 3})", R"({"vars": [1]})",
+        R"({"vars": {"angle": "a"}})",
+        R"({"max_error": 0.1, "min_samples": 8, "max_samples": 4})"}) {
+    job = default_job();
+    bool failed = false;
+    try {
+      parse_render_job(line, job);
+    } catch (invalid_argument &) {
+      failed = true;
+    }
+    assert(failed);
+  }
+
+  job = default_job();
+  try {
+    parse_render_job(R"({"width": )", job);
+    assert(false);
+  } catch (JsonError &) {
+  }
+}
+
+// Write `text` to `file_name`, giving it a modification time after the
+// previous one even on filesystems with a coarse resolution
+void write_file(const string &file_name, const string &text) {
+  error_code error;
+  auto previous = filesystem::last_write_time(file_name, error);
+  {
+    ofstream file(file_name);
+    file << text;
+  }
+  if (!error)
+    filesystem::last_write_time(file_name, previous + chrono::seconds(2));
+}
+
+void test_scene_store() {
+  const string file_name = "serve_test_scene.txt";
+  const string scene_text =
+      "material sky(diffuse(uniform(<0, 0, 0>)), uniform(<0.7, 0.5, 1>))\n"
+      "float angle(10)\n"
+      "float red(1)\n"
+      "sphere(sky, translation([0, 0, 1]))\n"
+      "sphere(sky, rotation_z(angle) * translation([0, 0, 1]))\n"
+      "camera(perspective, translation([-4, 0, 1]), 1.0, 2.0)\n";
+  write_file(file_name, scene_text);
+
+  RenderSettings settings;
+  settings.texture_filter = "nearest";
+  SceneStore scenes(settings);
+
+  // The scene is loaded once
+  ServedScene first = scenes.get(file_name, {});
+  ServedScene second = scenes.get(file_name, {});
+  assert(!first.animated);
+  assert(first.scene.get() == second.scene.get());
+  assert(first.scene->world.shapes.size() == 2);
+
+  // Variables used in transformations are animated: all their values share
+  // the same scene
+  ServedScene angle30 = scenes.get(file_name, {{"angle", 30}});
+  ServedScene angle45 = scenes.get(file_name, {{"angle", 45}});
+  assert(angle30.animated);
+  assert(angle30.scene.get() == angle45.scene.get());
+  assert(angle30.scene.get() != first.scene.get());
+  assert(angle30.scene->animated_shapes.size() == 1);
+
+  // A changed file is read again
+  write_file(file_name, scene_text + "sphere(sky, translation([0, 0, 3]))\n");
+  ServedScene reloaded = scenes.get(file_name, {});
+  assert(reloaded.scene.get() != first.scene.get());
+  assert(reloaded.scene->world.shapes.size() == 3);
+  assert(scenes.get(file_name, {}).scene.get() == reloaded.scene.get());
+
+  // Errors are thrown to every job, until the file is fixed
+  write_file(file_name, "sphere(missing_material, identity)\n");
+  for (int i{}; i < 2; i++) {
+    try {
+      scenes.get(file_name, {});
+      assert(false);
+    } catch (GrammarError &) {
+    }
+  }
+  write_file(file_name, scene_text);
+  assert(scenes.get(file_name, {}).scene->world.shapes.size() == 2);
+
+  remove(file_name.c_str());
+  try {
+    scenes.get(file_name, {});
+    assert(false);
+  } catch (runtime_error &) {
+  }
+}
+
+void test_scene_store_eviction() {
+  const string file_name = "serve_test_eviction.txt";
+  const string scene_text =
+      "float red(1)\n"
+      "material sky(diffuse(uniform(<red, 0, 0>)), uniform(<0.7, 0.5, 1>))\n"
+      "sphere(sky, translation([0, 0, 1]))\n";
+  write_file(file_name, scene_text);
+
+  RenderSettings settings;
+  settings.texture_filter = "nearest";
+  SceneStore scenes(settings, 2);
+
+  // A variable used in a material is fixed in the scene, which is only shared
+  // by the jobs giving it the same value
+  ServedScene red1 = scenes.get(file_name, {{"red", 1}});
+  assert(red1.animated);
+  assert(red1.scene->fixed_variables == vector<string>{"red"});
+  ServedScene red2 = scenes.get(file_name, {{"red", 2}});
+  assert(!red2.animated);
+  assert(red1.scene.get() != red2.scene.get());
+  assert(scenes.size() == 2);
+
+  // The least recently used scene is dropped
+  assert(scenes.get(file_name, {{"red", 1}}).scene.get() == red1.scene.get());
+  ServedScene red3 = scenes.get(file_name, {{"red", 3}});
+  assert(scenes.size() == 2);
+  assert(scenes.get(file_name, {{"red", 3}}).scene.get() == red3.scene.get());
+  assert(scenes.get(file_name, {{"red", 1}}).scene.get() == red1.scene.get());
+  assert(scenes.get(file_name, {{"red", 2}}).scene.get() != red2.scene.get());
+  assert(scenes.size() == 2);
+
+  // Reading a changed file drops the scenes of the older version
+  SceneStore large_store(settings, 8);
+  for (int i{1}; i <= 3; i++)
+    large_store.get(file_name, {{"red", float(i)}});
+  assert(large_store.size() == 3);
+  write_file(file_name, scene_text);
+  large_store.get(file_name, {});
+  assert(large_store.size() == 1);
+
+  // A file which is not valid is only parsed once
+  write_file(file_name, "sphere(missing_material, identity)\n");
+  for (int i{}; i < 2; i++) {
+    try {
+      large_store.get(file_name, {{"red", 1}});
+      assert(false);
+    } catch (GrammarError &) {
+    }
+  }
+  assert(large_store.size() == 1);
+
+  remove(file_name.c_str());
+}
+
+// Write a 1x1 PFM image with the color `color` to `file_name`
+void write_texture(const string &file_name, Color color) {
+  HdrImage image(1, 1);
+  image.set_pixel(0, 0, color);
+  stringstream sstr;
+  image.write_pfm(sstr, Endianness::little_endian);
+  write_file(file_name, sstr.str());
+}
+
+void test_scene_store_textures() {
+  const string texture_name = "serve_test_texture.pfm";
+  const string file_name = "serve_test_textured.txt";
+  const string other_file_name = "serve_test_plain.txt";
+  write_texture(texture_name, Color(1, 2, 3));
+  write_file(file_name, "material sky(diffuse(image(\"" + texture_name +
+                            "\")), uniform(<0, 0, 0>))\n"
+                            "sphere(sky, identity)\n");
+  write_file(other_file_name,
+             "material sky(diffuse(uniform(<0, 0, 0>)), uniform(<0, 0, 0>))\n"
+             "sphere(sky, identity)\n");
+
+  RenderSettings settings;
+  settings.texture_filter = "nearest";
+  SceneStore scenes(settings, 1);
+  ServedScene first = scenes.get(file_name, {});
+  assert(scenes.textures->num_of_textures() == 1);
+  assert(scenes.get(file_name, {}).scene.get() == first.scene.get());
+
+  // A changed texture is read again, together with the scene
+  write_texture(texture_name, Color(4, 5, 6));
+  ServedScene second = scenes.get(file_name, {});
+  assert(second.scene.get() != first.scene.get());
+  auto &pigment = dynamic_cast<ImagePigment &>(
+      *second.scene->world.shapes[0]->material.brdf->pigment);
+  assert(pigment.texture.get_pixel(0, 0) == Color(4, 5, 6));
+  assert(scenes.textures->num_of_textures() == 1);
+
+  // The textures are dropped with the last scene using them
+  first = second = ServedScene();
+  scenes.get(other_file_name, {});
+  assert(scenes.size() == 1);
+  assert(scenes.textures->num_of_textures() == 0);
+
+  remove(texture_name.c_str());
+  remove(file_name.c_str());
+  remove(other_file_name.c_str());
+}
+
+int main() {
+  test_parse_render_job();
+  test_scene_store();
+  test_scene_store_eviction();
+  test_scene_store_textures();
+  return 0;
+}
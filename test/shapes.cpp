@@ -29,14 +29,14 @@ void test_sphere_hit() {
 
   HitRecord intersection1 = sphere.ray_intersection(ray1);
   assert(intersection1.hit);
-  assert(HitRecord(make_shared<Sphere>(sphere), Point(0., 0., 1.),
+  assert(HitRecord(&sphere, Point(0., 0., 1.),
                    Normal(0., 0., 1.), Vec2d(0., 0.), 1.0, ray1, false)
              .is_close(intersection1));
 
   Ray ray2 = Ray(Point(3, 0, 0), -VEC_X);
   HitRecord intersection2 = sphere.ray_intersection(ray2);
   assert(intersection2.hit);
-  assert(HitRecord(make_shared<Sphere>(sphere), Point(1.0, 0.0, 0.0),
+  assert(HitRecord(&sphere, Point(1.0, 0.0, 0.0),
                    Normal(1.0, 0.0, 0.0), Vec2d(0.0, 0.5), 2.0, ray2, false)
              .is_close(intersection2));
 
@@ -49,7 +49,7 @@ void test_sphere_inner_hit() {
   Ray ray(Point(0, 0, 0), VEC_X);
   HitRecord intersection = sphere.ray_intersection(ray);
   assert(intersection.hit);
-  assert(HitRecord(make_shared<Sphere>(sphere), Point(1.0, 0.0, 0.0),
+  assert(HitRecord(&sphere, Point(1.0, 0.0, 0.0),
                    Normal(-1.0, 0.0, 0.0), Vec2d(0.0, 0.5), 1.0, ray, false)
              .is_close(intersection));
 }
@@ -60,14 +60,14 @@ void test_sphere_transformation() {
   Ray ray1{Point(10, 0, 2), -VEC_Z};
   HitRecord intersection1 = sphere.ray_intersection(ray1);
   assert(intersection1.hit);
-  assert(HitRecord(make_shared<Sphere>(sphere), Point(10.0, 0.0, 1.0),
+  assert(HitRecord(&sphere, Point(10.0, 0.0, 1.0),
                    Normal(0.0, 0.0, 1.0), Vec2d(0.0, 0.0), 1.0, ray1, false)
              .is_close(intersection1));
 
   Ray ray2{Point(13, 0, 0), -VEC_X};
   HitRecord intersection2 = sphere.ray_intersection(ray2);
   assert(intersection2.hit);
-  assert(HitRecord(make_shared<Sphere>(sphere), Point(11.0, 0.0, 0.0),
+  assert(HitRecord(&sphere, Point(11.0, 0.0, 0.0),
                    Normal(1.0, 0.0, 0.0), Vec2d(0.0, 0.5), 2.0, ray2, false)
              .is_close(intersection2));
 
@@ -135,7 +135,7 @@ void test_plane_hit() {
 
   HitRecord intersection1 = plane.ray_intersection(ray1);
   assert(intersection1.hit);
-  assert(HitRecord(make_shared<Plane>(plane), Point(0., 0., 0.),
+  assert(HitRecord(&plane, Point(0., 0., 0.),
                    Normal(0., 0., 1.), Vec2d(0., 0.), 2.0, ray1, true)
              .is_close(intersection1));
 
@@ -144,12 +144,41 @@ void test_plane_hit() {
   assert(!intersection2.hit);
 }
 
+void test_footprint() {
+  Ray ray(Point(0., 0., 2.), -VEC_Z);
+  Plane plane(translation(Vec(0., 0., 1.)));
+  // Rays with no footprint leave it unknown
+  assert(plane.ray_intersection(ray).footprint.is_close(Vec2d(0., 0.)));
+
+  ray.footprint = 0.1;
+  ray.spread = 0.05;
+  assert(plane.ray_intersection(ray).footprint.is_close(Vec2d(0.15, 0.15)));
+
+  // Oblique rays cover a longer strip of the surface
+  Ray oblique(Point(0., 0., 2.), Vec(1., 0., -1.));
+  oblique.footprint = 0.1;
+  oblique.spread = 0.05;
+  float oblique_width = 0.15 * sqrt(2.);
+  assert(plane.ray_intersection(oblique).footprint.is_close(
+      Vec2d(oblique_width, oblique_width)));
+
+  // On the equator of a unit sphere, a unit of length spans 1/2π in u and
+  // 1/π in v
+  Sphere sphere(scaling(Vec(2., 2., 2.)));
+  Ray equator(Point(4., 0., 0.), -VEC_X);
+  equator.footprint = 0.1;
+  equator.spread = 0.05;
+  // t = 2, and the sphere has radius 2
+  assert(sphere.ray_intersection(equator).footprint.is_close(
+      Vec2d(0.1 / (2. * M_PI), 0.1 / M_PI)));
+}
+
 void test_plane_transformation() {
   Plane plane1(rotation_x(90));
   Ray ray1(Point(0., 2., 0.), -VEC_Y);
   HitRecord intersection1{plane1.ray_intersection(ray1)};
   assert(intersection1.hit);
-  assert(HitRecord(make_shared<Plane>(plane1), Point(0., 0., 0.),
+  assert(HitRecord(&plane1, Point(0., 0., 0.),
                    Normal(0., 1., 0.), Vec2d(0., 0.), 2.0, ray1, true)
              .is_close(intersection1));
 
@@ -162,7 +191,7 @@ void test_plane_transformation() {
 
   HitRecord intersection3 = plane2.ray_intersection(ray3);
   assert(intersection3.hit);
-  assert(HitRecord(make_shared<Plane>(plane2), Point(0., 0., 1.),
+  assert(HitRecord(&plane2, Point(0., 0., 1.),
                    Normal(0., 0., 1.), Vec2d(0., 0.), 1.0, ray3, true)
              .is_close(intersection3));
 }
@@ -201,6 +230,7 @@ int main() {
   // Plane tests
   test_plane_hit();
   test_plane_transformation();
+  test_footprint();
 
   // World tests
   test_ray_intersection();